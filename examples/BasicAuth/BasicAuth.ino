@@ -0,0 +1,88 @@
+#include <WiFi.h>
+#include <EspHttpServer.h>
+#include <mbedtls/pkcs5.h>
+
+EspHttpServer::Server server;
+
+#if __has_include("arduino_secrets.h")
+#include "arduino_secrets.h"
+#else
+#define WIFI_SSID "YourSSID"     // Enter your Wi-Fi SSID here / Wi-FiのSSIDを入力
+#define WIFI_PASS "YourPassword" // Enter your Wi-Fi password here / Wi-Fiのパスワードを入力
+#endif
+
+// en: Demo credentials. Store a PBKDF2 hash instead of the password itself.
+// ja: デモ用の資格情報。パスワードそのものではなく PBKDF2 ハッシュを保持します。
+static const char *kUser = "admin";
+static const uint8_t kSalt[16] = {0x45, 0x73, 0x70, 0x48, 0x74, 0x74, 0x70, 0x53, 0x65, 0x72, 0x76, 0x65, 0x72, 0x44, 0x65, 0x6d};
+static uint8_t g_passwordHash[32];
+constexpr uint32_t kIterations = 10000;
+
+void setup()
+{
+  Serial.begin(115200);
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(WIFI_SSID, WIFI_PASS);
+  while (WiFi.status() != WL_CONNECTED)
+  {
+    delay(200);
+  }
+
+  // en: Derive the demo hash once at boot ("password"). Real devices would load it from NVS.
+  // ja: デモ用に起動時に "password" のハッシュを作成。実機では NVS などから読み込みます。
+  mbedtls_pkcs5_pbkdf2_hmac_ext(MBEDTLS_MD_SHA256,
+                                reinterpret_cast<const unsigned char *>("password"), 8,
+                                kSalt, sizeof(kSalt),
+                                kIterations, sizeof(g_passwordHash), g_passwordHash);
+
+  EspHttpServer::AuthConfig auth;
+  auth.realm = "EspHttpServer demo";
+  auth.allowBasic = true;
+  auth.allowBearer = true;
+  auth.cacheTtlMs = 60 * 1000;
+  auth.verify = [](const EspHttpServer::AuthCredentials &cred)
+  {
+    if (cred.scheme == EspHttpServer::AuthCredentials::Bearer)
+    {
+      static const char kToken[] = "demo-token-0123456789";
+      return cred.secretLen == sizeof(kToken) - 1 &&
+             EspHttpServer::constantTimeEquals(cred.secret, kToken, cred.secretLen);
+    }
+    const size_t userLen = strlen(kUser);
+    const bool userOk = cred.userLen == userLen && EspHttpServer::constantTimeEquals(cred.user, kUser, userLen);
+    // en: The slow KDF runs only on cache misses (once per credential per TTL).
+    // ja: 重い KDF はキャッシュミス時のみ（資格情報ごと TTL に 1 回）実行されます。
+    const bool passOk = EspHttpServer::verifyPbkdf2Sha256(cred.secret, cred.secretLen,
+                                                         kSalt, sizeof(kSalt),
+                                                         kIterations,
+                                                         g_passwordHash, sizeof(g_passwordHash));
+    return userOk && passOk;
+  };
+  server.requireAuth("/api", auth);
+
+  server.on("/", HTTP_GET, [](EspHttpServer::Request &req, EspHttpServer::Response &res)
+            { (void)req;
+              res.sendText(200, "text/plain", "Public page. Try /api/status with admin/password."); });
+
+  server.on("/api/status", HTTP_GET, [](EspHttpServer::Request &req, EspHttpServer::Response &res)
+            {
+              String body = "{\"user\":\"";
+              body += req.authUser();
+              body += "\",\"uptime\":";
+              body += String(millis());
+              body += "}";
+              res.sendText(200, "application/json", body); });
+
+  if (!server.begin())
+  {
+    Serial.println("Failed to start server");
+    return;
+  }
+
+  Serial.printf("Auth demo: http://%s/api/status\n", WiFi.localIP().toString().c_str());
+}
+
+void loop()
+{
+  delay(1);
+}
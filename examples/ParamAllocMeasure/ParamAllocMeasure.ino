@@ -0,0 +1,67 @@
+#include <EspHttpServer.h>
+#include <esp_heap_caps.h>
+
+#include <utility>
+#include <vector>
+
+// en: Counts heap blocks held by parsed key/value pairs stored as String pairs (the layout before SmallString)
+//     and as EspHttpServer::ParamList. No Wi-Fi needed; open the Serial Monitor at 115200 baud.
+// ja: 解析済みのキー／値ペアを String ペア（SmallString 導入前の形式）と EspHttpServer::ParamList で保持したときの
+//     ヒープブロック数を比較します。Wi-Fi 不要。シリアルモニタを 115200 baud で開いてください。
+
+struct Sample
+{
+  const char *label;
+  const char *pairs[6][2];
+};
+
+static const Sample kSamples[] = {
+    {"short (<= 11 bytes)", {{"id", "42"}, {"lang", "ja"}, {"page", "3"}, {"sort", "asc"}, {"q", "esp32"}, {"limit", "20"}}},
+    {"medium (12-23 bytes)", {{"redirect_uri", "/settings/network"}, {"session_token", "a1b2c3d4e5f6a7b8"}, {"device_name", "living-room-sensor"}, {"utm_campaign", "spring_release"}, {"client_version", "1.0.1-beta.3"}, {"timezone_name", "Asia/Tokyo"}}},
+    {"long (> 23 bytes)", {{"callback_url_for_oauth", "https://example.com/oauth/callback"}, {"x", "0123456789abcdef0123456789abcdef"}, {"access_token_hint", "eyJhbGciOiJIUzI1NiJ9.payload"}, {"y", "a-very-long-query-value-here"}, {"z", "yet-another-long-query-value"}, {"w", "and-one-more-long-query-value"}}},
+};
+
+static size_t allocatedBlocks()
+{
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+  return info.allocated_blocks;
+}
+
+template <typename List>
+static size_t blocksHeldBy(const Sample &sample)
+{
+  // en: Reserve first so only the per-string allocations are counted, not the vector itself.
+  // ja: 先に reserve しておき、ベクタ自体ではなく文字列ごとの確保だけを数えます。
+  List list;
+  list.reserve(6);
+  const size_t before = allocatedBlocks();
+  for (const auto &pair : sample.pairs)
+  {
+    list.emplace_back(pair[0], pair[1]);
+  }
+  const size_t after = allocatedBlocks();
+  return after - before;
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  delay(1000);
+
+  Serial.println("Heap blocks held by 6 parsed key/value pairs (vector storage excluded)");
+  for (const Sample &sample : kSamples)
+  {
+    const size_t stringBlocks = blocksHeldBy<std::vector<std::pair<String, String>>>(sample);
+    const size_t smallBlocks = blocksHeldBy<EspHttpServer::ParamList>(sample);
+    Serial.printf("  %-22s String pairs: %2u  ParamList: %2u\n", sample.label,
+                  static_cast<unsigned>(stringBlocks), static_cast<unsigned>(smallBlocks));
+  }
+}
+
+void loop()
+{
+  // en: Measurement runs once in setup().
+  // ja: 計測は setup() で 1 回だけ実行します。
+  delay(1000);
+}
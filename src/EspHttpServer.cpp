@@ -1,12 +1,25 @@
 #include "EspHttpServer.h"
+#include "esphttpserver_urldecode.h"
 
 #include <esp_log.h>
 #include <esp_system.h>
+#include <esp_random.h>
+#include <esp_rom_crc.h>
+#include <esp_idf_version.h>
+#include <esp_heap_caps.h>
+#include <cerrno>
+#include <cstdlib>
 #include <cstring>
 #include <algorithm>
 #include <cctype>
 #include <lwip/sockets.h>
 #include <lwip/ip4_addr.h>
+#include <mbedtls/base64.h>
+#include <mbedtls/md.h>
+#include <mbedtls/pkcs5.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 #include <memory>
 #include <new>
 
@@ -30,6 +43,8 @@ namespace EspHttpServer
             const char *type;
         };
 
+        // en: Entry order is the MIME id used by EmbeddedAsset::mimeId; only append (tools/embed_assets.py mirrors it).
+        // ja: 並び順が EmbeddedAsset::mimeId になるため末尾追加のみ可（tools/embed_assets.py と同期）。
         const MimeEntry kMimeTable[] = {
             {".avif", "image/avif"},
             {".css", "text/css"},
@@ -109,6 +124,17 @@ namespace EspHttpServer
             return String("application/octet-stream");
         }
 
+        constexpr uint8_t kEmbeddedGzip = 1;
+
+        const char *mimeTypeForId(uint8_t id)
+        {
+            if (id < sizeof(kMimeTable) / sizeof(kMimeTable[0]))
+            {
+                return kMimeTable[id].type;
+            }
+            return "application/octet-stream";
+        }
+
         String htmlEscape(const String &input)
         {
             String out;
@@ -146,73 +172,11 @@ namespace EspHttpServer
             return mime.equalsIgnoreCase("text/html");
         }
 
-        bool streamFileToClient(httpd_req_t *raw, fs::FS *fs, const String &path)
-        {
-            if (!fs)
-            {
-                return false;
-            }
-            File file = fs->open(path, "r");
-            if (!file)
-            {
-                ESP_LOGE(TAG, "Failed to open %s", path.c_str());
-                return false;
-            }
-            constexpr size_t kChunkSize = 1024;
-            std::unique_ptr<uint8_t[]> buffer(new (std::nothrow) uint8_t[kChunkSize]);
-            if (!buffer)
-            {
-                ESP_LOGE(TAG, "Failed to allocate stream buffer");
-                file.close();
-                return false;
-            }
-            while (file.available())
-            {
-                const size_t readLen = file.read(buffer.get(), kChunkSize);
-                if (readLen == 0)
-                {
-                    break;
-                }
-                if (httpd_resp_send_chunk(raw, reinterpret_cast<const char *>(buffer.get()), readLen) != ESP_OK)
-                {
-                    file.close();
-                    return false;
-                }
-            }
-            file.close();
-            httpd_resp_send_chunk(raw, nullptr, 0);
-            return true;
-        }
-
-        bool streamMemoryToClient(httpd_req_t *raw, const uint8_t *data, size_t size)
-        {
-            if (!raw)
-            {
-                return false;
-            }
-            if (!data && size > 0)
-            {
-                return false;
-            }
-            if (size == 0)
-            {
-                httpd_resp_send_chunk(raw, nullptr, 0);
-                return true;
-            }
-            const size_t chunkSize = 1024;
-            size_t offset = 0;
-            while (offset < size)
-            {
-                const size_t len = std::min(chunkSize, size - offset);
-                if (httpd_resp_send_chunk(raw, reinterpret_cast<const char *>(data + offset), len) != ESP_OK)
-                {
-                    return false;
-                }
-                offset += len;
-            }
-            httpd_resp_send_chunk(raw, nullptr, 0);
-            return true;
-        }
+        constexpr size_t kStreamChunkSize = 1024;
+        // en: Sends faster than this with a full chunk grow the size; slower ones shrink it (a blocking send means a full socket buffer).
+        // ja: 満杯のチャンクがこれより速く送れたら拡大、遅ければ縮小（送信のブロックはソケットバッファ満杯を意味する）。
+        constexpr int64_t kFastSendUs = 4000;
+        constexpr int64_t kSlowSendUs = 40000;
 
         String ensureLeadingSlash(const String &path)
         {
@@ -247,6 +211,24 @@ namespace EspHttpServer
             return true;
         }
 
+        String normalizeUriPrefix(const String &uriPrefix)
+        {
+            String prefix = uriPrefix;
+            if (prefix.isEmpty())
+            {
+                prefix = "/";
+            }
+            if (!prefix.startsWith("/"))
+            {
+                prefix = "/" + prefix;
+            }
+            while (prefix.length() > 1 && prefix.endsWith("/"))
+            {
+                prefix.remove(prefix.length() - 1);
+            }
+            return prefix;
+        }
+
         String joinFsPath(const String &base, const String &rel)
         {
             String result = base;
@@ -267,844 +249,1309 @@ namespace EspHttpServer
             return result;
         }
 
-        bool containsControlChars(const String &text)
+        String buildFullPath(const String &base, const String &entryName)
         {
-            for (size_t i = 0; i < text.length(); ++i)
+            if (entryName.isEmpty())
             {
-                const unsigned char c = static_cast<unsigned char>(text.charAt(i));
-                if (c < 0x20 || c == 0x7f)
-                {
-                    return true;
-                }
+                return base;
             }
-            return false;
-        }
-
-        void trimSpaces(String &text)
-        {
-            while (text.length() > 0 && isspace(static_cast<unsigned char>(text.charAt(0))))
+            if (entryName.startsWith("/"))
+            {
+                return entryName;
+            }
+            if (base == "/")
             {
-                text.remove(0, 1);
+                return String("/") + entryName;
             }
-            while (text.length() > 0 && isspace(static_cast<unsigned char>(text.charAt(text.length() - 1))))
+            String combined = base;
+            if (!combined.endsWith("/"))
             {
-                text.remove(text.length() - 1, 1);
+                combined += "/";
             }
+            combined += entryName;
+            return combined;
         }
 
-        bool parseUrlEncodedInternal(const String &input, std::vector<std::pair<String, String>> &out)
+        using FsVisitor = std::function<void(const String &relPath, size_t size)>;
+
+        // en: Recursively visits regular files below dirPath, reporting paths relative to root.
+        // ja: dirPath 以下の通常ファイルを再帰的に巡回し、root からの相対パスを通知する。
+        void walkFsTree(fs::FS &fs, const String &root, const String &dirPath, int depth, const FsVisitor &visit)
         {
-            auto decode = [](const String &in, String &decoded) -> bool
+            constexpr int kMaxDepth = 8;
+            File dir = fs.open(dirPath);
+            if (!dir || !dir.isDirectory())
             {
-                decoded.clear();
-                decoded.reserve(in.length());
-                auto hexToInt = [](char c) -> int
+                if (dir)
                 {
-                    if (c >= '0' && c <= '9')
-                        return c - '0';
-                    if (c >= 'a' && c <= 'f')
-                        return c - 'a' + 10;
-                    if (c >= 'A' && c <= 'F')
-                        return c - 'A' + 10;
-                    return -1;
-                };
-                for (size_t i = 0; i < in.length(); ++i)
+                    dir.close();
+                }
+                return;
+            }
+            while (true)
+            {
+                File item = dir.openNextFile();
+                if (!item)
                 {
-                    char c = in.charAt(i);
-                    if (c == '+')
-                    {
-                        decoded += ' ';
-                        continue;
-                    }
-                    if (c == '%' && i + 2 < in.length())
+                    break;
+                }
+                const char *rawName = item.name();
+                const String fullPath = buildFullPath(dirPath, rawName ? String(rawName) : String());
+                const bool isDir = item.isDirectory();
+                const size_t size = isDir ? 0 : item.size();
+                item.close();
+                if (isDir)
+                {
+                    if (depth < kMaxDepth)
                     {
-                        int hi = hexToInt(in.charAt(i + 1));
-                        int lo = hexToInt(in.charAt(i + 2));
-                        if (hi >= 0 && lo >= 0)
-                        {
-                            decoded += static_cast<char>((hi << 4) | lo);
-                            i += 2;
-                            continue;
-                        }
-                        return false;
+                        walkFsTree(fs, root, fullPath, depth + 1, visit);
                     }
-                    decoded += c;
+                    continue;
                 }
-                return true;
-            };
+                String rel = fullPath;
+                if (root != "/" && rel.startsWith(root))
+                {
+                    rel = rel.substring(root.length());
+                }
+                visit(ensureLeadingSlash(rel), size);
+            }
+            dir.close();
+        }
 
-            size_t start = 0;
-            while (start <= input.length())
+        int parseQValue(const char *p)
+        {
+            int whole = 0;
+            if (*p >= '0' && *p <= '9')
+            {
+                whole = *p - '0';
+                ++p;
+            }
+            int frac = 0;
+            int scale = 100;
+            if (*p == '.')
             {
-                int amp = input.indexOf('&', start);
-                if (amp < 0)
+                ++p;
+                while (*p >= '0' && *p <= '9')
                 {
-                    amp = input.length();
+                    frac += (*p - '0') * scale;
+                    scale /= 10;
+                    ++p;
                 }
-                String token = input.substring(start, amp);
-                int eq = token.indexOf('=');
-                String rawKey;
-                String rawVal;
-                if (eq >= 0)
+            }
+            const int q = whole * 1000 + frac;
+            return q > 1000 ? 1000 : q;
+        }
+
+        using WeightedTokenVisitor = std::function<bool(const char *token, size_t len, int quality)>;
+
+        // en: Walks a comma-separated header such as Accept / Accept-Language, reporting each token
+        //     with its q-value (0-1000). Stops when the visitor returns false.
+        // ja: Accept / Accept-Language などのカンマ区切りヘッダーを走査し、各トークンと q 値（0-1000）を通知する。
+        //     visitor が false を返すと終了。
+        void forEachWeightedToken(const char *header, const WeightedTokenVisitor &visit)
+        {
+            const char *p = header ? header : "";
+            while (*p)
+            {
+                while (*p == ' ' || *p == ',')
                 {
-                    rawKey = token.substring(0, eq);
-                    rawVal = token.substring(eq + 1);
+                    ++p;
                 }
-                else
+                const char *start = p;
+                while (*p && *p != ',' && *p != ';' && *p != ' ')
                 {
-                    rawKey = token;
-                    rawVal = String();
+                    ++p;
                 }
-                String keyDecoded;
-                String valDecoded;
-                if (!rawKey.isEmpty() && decode(rawKey, keyDecoded) && decode(rawVal, valDecoded) && !containsControlChars(keyDecoded) && !containsControlChars(valDecoded))
+                const size_t len = static_cast<size_t>(p - start);
+                int quality = 1000;
+                while (*p && *p != ',')
                 {
-                    out.push_back({keyDecoded, valDecoded});
+                    if (*p == ';')
+                    {
+                        ++p;
+                        while (*p == ' ')
+                        {
+                            ++p;
+                        }
+                        if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=')
+                        {
+                            quality = parseQValue(p + 2);
+                        }
+                        continue;
+                    }
+                    ++p;
                 }
-                start = static_cast<size_t>(amp) + 1;
-                if (amp == static_cast<int>(input.length()))
+                if (len > 0 && !visit(start, len, quality))
                 {
-                    break;
+                    return;
                 }
             }
-            return true;
         }
 
-    } // namespace
+        // en: q-value the Accept header assigns to an exact media type, or -1 when it is not listed.
+        //     Wildcards are ignored on purpose so `*/*` clients keep the original format.
+        // ja: Accept ヘッダーで完全一致するメディアタイプの q 値。未記載なら -1。
+        //     `*/*` のみのクライアントには元形式を返すため、ワイルドカードは無視する。
+        int mediaTypeQuality(const String &accept, const char *type)
+        {
+            const size_t typeLen = strlen(type);
+            int result = -1;
+            forEachWeightedToken(accept.c_str(), [&](const char *token, size_t len, int quality)
+                                 {
+                                     if (len == typeLen && strncasecmp(token, type, len) == 0)
+                                     {
+                                         result = quality;
+                                         return false;
+                                     }
+                                     return true; });
+            return result;
+        }
 
-    class StaticInputStream
-    {
-    public:
-        StaticInputStream(fs::FS *fs, const String &path)
-            : _fs(fs), _useFs(true)
+        // en: Whether Accept admits a media type through an exact, `major/*` or `*/*` range with q > 0.
+        //     Parameters on the type (`; charset=...`) are ignored; an empty header accepts everything.
+        // ja: Accept が完全一致・`major/*`・`*/*` のいずれか（q > 0）でメディアタイプを許すか。
+        //     タイプ側のパラメータ（`; charset=...`）は無視し、ヘッダーが空なら常に許可。
+        bool acceptsMediaType(const String &accept, const char *type)
         {
-            if (_fs)
+            if (accept.isEmpty())
+            {
+                return true;
+            }
+            const char *semi = strchr(type, ';');
+            size_t typeLen = semi ? static_cast<size_t>(semi - type) : strlen(type);
+            while (typeLen > 0 && type[typeLen - 1] == ' ')
             {
-                _file = _fs->open(path, "r");
+                --typeLen;
             }
+            const char *slash = static_cast<const char *>(memchr(type, '/', typeLen));
+            const size_t majorLen = slash ? static_cast<size_t>(slash - type) : typeLen;
+            bool accepted = false;
+            forEachWeightedToken(accept.c_str(), [&](const char *token, size_t len, int quality)
+                                 {
+                                     const bool any = (len == 3 && memcmp(token, "*/*", 3) == 0);
+                                     const bool exact = (len == typeLen && strncasecmp(token, type, len) == 0);
+                                     const bool major = (len == majorLen + 2 && strncasecmp(token, type, majorLen) == 0 &&
+                                                         token[majorLen] == '/' && token[majorLen + 1] == '*');
+                                     if ((any || exact || major) && quality > 0)
+                                     {
+                                         accepted = true;
+                                         return false;
+                                     }
+                                     return true; });
+            return accepted;
         }
 
-        StaticInputStream(const uint8_t *data, size_t size)
-            : _fs(nullptr), _useFs(false), _data(data), _size(size)
+        // en: Best q-value Accept-Language gives a language tag: exact range or a range with the tag as its
+        //     primary subtag (en-US -> en); `*` only counts when neither names the tag, so "fr;q=0, *" still
+        //     excludes fr. Returns -1 when nothing matches and 0 when the tag is explicitly not acceptable.
+        // ja: Accept-Language が言語タグに与える最大の q 値。完全一致と主タグ一致（en-US -> en）を優先し、
+        //     `*` はどちらも無いときだけ使う（"fr;q=0, *" でも fr は除外）。一致が無ければ -1、明示的に
+        //     拒否されていれば 0。
+        int languageQuality(const String &acceptLanguage, const String &lang)
         {
+            const size_t langLen = lang.length();
+            int named = -1;
+            int wildcard = -1;
+            forEachWeightedToken(acceptLanguage.c_str(), [&](const char *token, size_t len, int quality)
+                                 {
+                                     const bool exact = (len == langLen && strncasecmp(token, lang.c_str(), len) == 0);
+                                     const bool primary = (len > langLen && token[langLen] == '-' && strncasecmp(token, lang.c_str(), langLen) == 0);
+                                     if (exact || primary)
+                                     {
+                                         named = std::max(named, quality);
+                                     }
+                                     else if (len == 1 && token[0] == '*')
+                                     {
+                                         wildcard = std::max(wildcard, quality);
+                                     }
+                                     return true; });
+            return named >= 0 ? named : wildcard;
         }
 
-        ~StaticInputStream()
+        // en: Inserts ".<tag>" before the extension: /app.js -> /app.<tag>.js.
+        // ja: 拡張子の前に ".<tag>" を挿入する（/app.js -> /app.<tag>.js）。
+        String insertPathTag(const String &path, const String &tag)
         {
-            if (_file)
+            const int slash = path.lastIndexOf('/');
+            const int dot = path.lastIndexOf('.');
+            if (dot <= slash)
             {
-                _file.close();
+                return path + "." + tag;
             }
+            return path.substring(0, dot) + "." + tag + path.substring(dot);
         }
 
-        bool valid() const
+        constexpr uint32_t kFnvOffset = 2166136261u;
+        constexpr uint32_t kFnvPrime = 16777619u;
+
+        uint32_t fnv1a(uint32_t hash, const uint8_t *data, size_t len)
         {
-            if (_useFs)
+            for (size_t i = 0; i < len; ++i)
             {
-                return static_cast<bool>(_file);
+                hash ^= data[i];
+                hash *= kFnvPrime;
             }
-            return (_data != nullptr) || (_size == 0);
+            return hash;
         }
 
-        bool readChar(char &out)
+        bool hashFsFile(fs::FS &fs, const String &path, uint32_t &out)
         {
-            if (_useFs)
+            File file = fs.open(path, "r");
+            if (!file)
             {
-                if (!_file)
-                {
-                    return false;
-                }
-                if (_bufPos >= _bufLen)
+                return false;
+            }
+            uint8_t buffer[256];
+            uint32_t hash = kFnvOffset;
+            while (true)
+            {
+                const size_t readLen = file.read(buffer, sizeof(buffer));
+                if (readLen == 0)
                 {
-                    _bufLen = _file.read(_buffer, sizeof(_buffer));
-                    _bufPos = 0;
-                    if (_bufLen == 0)
-                    {
-                        return false;
-                    }
+                    break;
                 }
-                out = static_cast<char>(_buffer[_bufPos++]);
-                return true;
+                hash = fnv1a(hash, buffer, readLen);
             }
+            file.close();
+            out = hash;
+            return true;
+        }
 
-            if (_pos >= _size)
+        String formatHash(uint32_t hash)
+        {
+            char buf[9];
+            snprintf(buf, sizeof(buf), "%08x", static_cast<unsigned>(hash));
+            return String(buf);
+        }
+
+        // en: Binary search over the (pathHash, path) ordered embedded table.
+        // ja: (pathHash, path) 順の埋め込みテーブルを二分探索する。
+        int findEmbeddedAsset(const EmbeddedAsset *assets, size_t count, const String &path)
+        {
+            if (!assets || count == 0)
             {
-                return false;
+                return -1;
             }
-            if (_data)
+            const uint32_t hash = fnv1a(kFnvOffset, reinterpret_cast<const uint8_t *>(path.c_str()), path.length());
+            size_t lo = 0;
+            size_t hi = count;
+            while (lo < hi)
             {
-                out = static_cast<char>(_data[_pos]);
+                const size_t mid = lo + (hi - lo) / 2;
+                if (assets[mid].pathHash < hash)
+                {
+                    lo = mid + 1;
+                }
+                else
+                {
+                    hi = mid;
+                }
             }
-            else
+            for (size_t i = lo; i < count && assets[i].pathHash == hash; ++i)
             {
-                out = 0;
+                if (assets[i].path && path == assets[i].path)
+                {
+                    return static_cast<int>(i);
+                }
             }
-            ++_pos;
-            return true;
+            return -1;
         }
 
-    private:
-        fs::FS *_fs = nullptr;
-        bool _useFs = false;
-        File _file;
-        const uint8_t *_data = nullptr;
-        size_t _size = 0;
-        size_t _pos = 0;
-        uint8_t _buffer[256];
-        size_t _bufLen = 0;
-        size_t _bufPos = 0;
-    };
-
-    // -------- Request --------
-
-    String Request::uri() const
-    {
-        return _raw ? String(_raw->uri) : String();
-    }
-
-    String Request::method() const
-    {
-        if (!_raw)
-            return {};
-        switch (_raw->method)
+        bool needsStaticIndex(const StaticOptions &options)
         {
-        case HTTP_GET:
-            return String("GET");
-        case HTTP_POST:
-            return String("POST");
-        case HTTP_PUT:
-            return String("PUT");
-        case HTTP_DELETE:
-            return String("DELETE");
-        default:
-            return String("UNKNOWN");
+            return options.negotiateImageFormats || !options.languages.empty() || options.fingerprintAssets ||
+                   options.derivePreload || !options.preload.empty();
         }
-    }
 
-    String Request::pathParam(const String &key) const
-    {
-        for (const auto &entry : _pathParams)
+        constexpr size_t kMaxDerivedPreloads = 8;
+        constexpr size_t kPreloadScanBytes = 8192;
+
+        // en: Preload destination ("as") for a URL by extension, or nullptr when the type is not preloadable.
+        // ja: 拡張子から決めるプリロード種別（as）。対象外の型なら nullptr。
+        const char *preloadDestination(const String &url, bool &crossOrigin)
         {
-            if (entry.first == key)
+            String path = url;
+            const int cut = path.indexOf('?') >= 0 ? path.indexOf('?') : path.indexOf('#');
+            if (cut >= 0)
+            {
+                path.remove(cut);
+            }
+            path.toLowerCase();
+            crossOrigin = false;
+            if (path.endsWith(".css"))
+            {
+                return "style";
+            }
+            if (path.endsWith(".js") || path.endsWith(".mjs"))
+            {
+                return "script";
+            }
+            if (path.endsWith(".woff2") || path.endsWith(".woff") || path.endsWith(".ttf") || path.endsWith(".otf"))
+            {
+                crossOrigin = true;
+                return "font";
+            }
+            if (path.endsWith(".json"))
+            {
+                crossOrigin = true;
+                return "fetch";
+            }
+            static const char *const kImages[] = {".png", ".jpg", ".jpeg", ".gif", ".webp", ".avif", ".svg", ".ico"};
+            for (const char *extension : kImages)
             {
-                return entry.second;
+                if (path.endsWith(extension))
+                {
+                    return "image";
+                }
             }
+            return nullptr;
         }
-        return String();
-    }
 
-    bool Request::hasPathParam(const String &key) const
-    {
-        for (const auto &entry : _pathParams)
+        // en: A URL copied into a Link header must not end the header line, close the <...> reference, or split
+        //     the value: control characters, spaces, '<', '>' and ',' disqualify it.
+        // ja: Link ヘッダーへ写す URL は、ヘッダー行の終端・<...> の閉じ・値の分割を起こしてはならない。
+        //     制御文字・空白・'<'・'>'・',' を含むものは使わない。
+        bool isSafeLinkUrl(const String &url)
         {
-            if (entry.first == key)
+            if (url.isEmpty())
             {
-                return true;
+                return false;
+            }
+            for (size_t i = 0; i < url.length(); ++i)
+            {
+                const unsigned char c = static_cast<unsigned char>(url[i]);
+                if (c <= 0x20 || c == 0x7f || c == '<' || c == '>' || c == ',')
+                {
+                    return false;
+                }
             }
+            return true;
         }
-        return false;
-    }
-
-    bool Request::decodeComponent(const String &input, String &output)
-    {
-        output.clear();
-        output.reserve(input.length());
-        auto hexToInt = [](char c) -> int
-        {
-            if (c >= '0' && c <= '9')
-                return c - '0';
-            if (c >= 'a' && c <= 'f')
-                return c - 'a' + 10;
-            if (c >= 'A' && c <= 'F')
-                return c - 'A' + 10;
-            return -1;
-        };
 
-        for (size_t i = 0; i < input.length(); ++i)
+        bool isLinkToken(const String &value)
         {
-            char c = input.charAt(i);
-            if (c == '+')
+            if (value.isEmpty())
             {
-                output += ' ';
-                continue;
+                return false;
             }
-            if (c == '%' && i + 2 < input.length())
+            for (size_t i = 0; i < value.length(); ++i)
             {
-                int hi = hexToInt(input.charAt(i + 1));
-                int lo = hexToInt(input.charAt(i + 2));
-                if (hi >= 0 && lo >= 0)
+                const char c = value[i];
+                if (!isalnum(static_cast<unsigned char>(c)) && c != '-')
                 {
-                    output += static_cast<char>((hi << 4) | lo);
-                    i += 2;
-                    continue;
+                    return false;
                 }
-                return false;
             }
-            output += c;
+            return true;
         }
-        return true;
-    }
 
-    bool Request::ensureQueryParsed() const
-    {
-        if (_queryParsed)
+        void appendPreloadLink(String &header, const String &url, const char *rel, const char *as, bool crossOrigin)
         {
-            return true;
+            if (!header.isEmpty())
+            {
+                header += ", ";
+            }
+            header += "<" + url + ">; rel=" + rel;
+            if (as)
+            {
+                header += "; as=";
+                header += as;
+            }
+            if (crossOrigin)
+            {
+                header += "; crossorigin";
+            }
         }
-        _queryParsed = true;
-        const String fullUri = uri();
-        int qPos = fullUri.indexOf('?');
-        if (qPos < 0 || qPos + 1 >= fullUri.length())
+
+        // en: Link header for the stylesheets, scripts and explicit preloads an HTML page references before </head>.
+        //     URLs are kept as written: the browser resolves Link URLs against the page URL, like the markup.
+        // ja: HTML が </head> より前で参照するスタイルシート・スクリプト・明示的な preload から Link ヘッダーを作る。
+        //     URL は記述のまま（ブラウザは Link の URL もマークアップと同じくページ URL 基準で解決する）。
+        String derivePreloadHeader(const char *html, size_t len)
         {
-            return true;
+            String header;
+            size_t count = 0;
+            const char *p = html;
+            const char *end = html + len;
+            auto skipSpace = [&]()
+            {
+                while (p < end && (isspace(static_cast<unsigned char>(*p)) || *p == '/'))
+                {
+                    ++p;
+                }
+            };
+            auto tagIs = [&](const char *name) -> bool
+            {
+                const size_t n = strlen(name);
+                return static_cast<size_t>(end - p) > n && strncasecmp(p, name, n) == 0 &&
+                       (isspace(static_cast<unsigned char>(p[n])) || p[n] == '>' || p[n] == '/');
+            };
+            while (p < end && count < kMaxDerivedPreloads)
+            {
+                const char *lt = static_cast<const char *>(memchr(p, '<', end - p));
+                if (!lt)
+                {
+                    break;
+                }
+                p = lt + 1;
+                if (tagIs("/head"))
+                {
+                    break;
+                }
+                const bool isLink = tagIs("link");
+                const bool isScript = !isLink && tagIs("script");
+                if (!isLink && !isScript)
+                {
+                    continue;
+                }
+                p += isLink ? 4 : 6;
+                String rel;
+                String url;
+                String type;
+                String as;
+                bool crossOrigin = false;
+                while (true)
+                {
+                    skipSpace();
+                    if (p >= end || *p == '>')
+                    {
+                        break;
+                    }
+                    const char *nameStart = p;
+                    while (p < end && !isspace(static_cast<unsigned char>(*p)) && *p != '=' && *p != '>' && *p != '/')
+                    {
+                        ++p;
+                    }
+                    String name(nameStart, p - nameStart);
+                    name.toLowerCase();
+                    String value;
+                    if (p < end && *p == '=')
+                    {
+                        ++p;
+                        const char quote = (p < end && (*p == '"' || *p == '\'')) ? *p++ : 0;
+                        const char *valueStart = p;
+                        while (p < end && (quote ? *p != quote : (!isspace(static_cast<unsigned char>(*p)) && *p != '>')))
+                        {
+                            ++p;
+                        }
+                        value = String(valueStart, p - valueStart);
+                        if (quote && p < end)
+                        {
+                            ++p;
+                        }
+                    }
+                    if (name == "rel")
+                    {
+                        value.toLowerCase();
+                        rel = value;
+                    }
+                    else if ((isLink && name == "href") || (isScript && name == "src"))
+                    {
+                        url = value;
+                    }
+                    else if (name == "type")
+                    {
+                        value.toLowerCase();
+                        type = value;
+                    }
+                    else if (name == "as")
+                    {
+                        as = value;
+                    }
+                    else if (name == "crossorigin")
+                    {
+                        crossOrigin = true;
+                    }
+                }
+                url.trim();
+                if (!isSafeLinkUrl(url) || url.startsWith("data:") || url.indexOf("{{") >= 0)
+                {
+                    continue;
+                }
+                if (isScript)
+                {
+                    const bool module = (type == "module");
+                    appendPreloadLink(header, url, module ? "modulepreload" : "preload", module ? nullptr : "script", crossOrigin);
+                }
+                else if (rel.indexOf("stylesheet") >= 0)
+                {
+                    appendPreloadLink(header, url, "preload", "style", crossOrigin);
+                }
+                else if (rel.indexOf("modulepreload") >= 0)
+                {
+                    appendPreloadLink(header, url, "modulepreload", nullptr, crossOrigin);
+                }
+                else if (rel.indexOf("preload") >= 0 && isLinkToken(as))
+                {
+                    appendPreloadLink(header, url, "preload", as.c_str(), crossOrigin);
+                }
+                else
+                {
+                    continue;
+                }
+                ++count;
+            }
+            return header;
         }
-        String queryStr = fullUri.substring(qPos + 1);
-        parseUrlEncodedInternal(queryStr, _queryParams);
-        return true;
-    }
 
-    bool Request::ensureFormParsed() const
-    {
-        if (_formParsed)
+        // en: Splits /app.<8 hex>.js into /app.js and the hash; false when the name carries no fingerprint.
+        // ja: /app.<16進8桁>.js を /app.js とハッシュに分解。フィンガープリントが無ければ false。
+        bool stripFingerprint(const String &path, String &logical, uint32_t &hash)
         {
-            return !_formOverflow;
+            const int slash = path.lastIndexOf('/');
+            const int extDot = path.lastIndexOf('.');
+            if (extDot <= slash + 9)
+            {
+                return false;
+            }
+            const int tagDot = extDot - 9;
+            if (path.charAt(tagDot) != '.')
+            {
+                return false;
+            }
+            uint32_t value = 0;
+            for (int i = tagDot + 1; i < extDot; ++i)
+            {
+                const char c = path.charAt(i);
+                int nibble = -1;
+                if (c >= '0' && c <= '9')
+                    nibble = c - '0';
+                else if (c >= 'a' && c <= 'f')
+                    nibble = c - 'a' + 10;
+                if (nibble < 0)
+                {
+                    return false;
+                }
+                value = (value << 4) | static_cast<uint32_t>(nibble);
+            }
+            logical = path.substring(0, tagDot) + path.substring(extDot);
+            hash = value;
+            return true;
         }
-        _formParsed = true;
-        _formOverflow = false;
-        if (!_raw)
+
+        bool isNegotiableImage(const String &path)
         {
-            return true;
+            String lower = path;
+            lower.toLowerCase();
+            return lower.endsWith(".png") || lower.endsWith(".jpg") || lower.endsWith(".jpeg") || lower.endsWith(".gif");
         }
 
-        size_t contentLength = _raw->content_len;
-        if (contentLength == 0)
+        String replaceExtension(const String &path, const char *ext)
         {
-            return true;
+            const int slash = path.lastIndexOf('/');
+            const int dot = path.lastIndexOf('.');
+            if (dot <= slash)
+            {
+                return path + ext;
+            }
+            return path.substring(0, dot) + ext;
         }
 
-        char ctypeBuf[64] = {0};
-        String contentType;
-        size_t ctypeLen = httpd_req_get_hdr_value_len(_raw, "Content-Type");
-        if (ctypeLen > 0 && ctypeLen < sizeof(ctypeBuf))
+        bool containsControlChars(const String &text)
         {
-            if (httpd_req_get_hdr_value_str(_raw, "Content-Type", ctypeBuf, sizeof(ctypeBuf)) == ESP_OK)
+            for (size_t i = 0; i < text.length(); ++i)
             {
-                contentType = String(ctypeBuf);
+                const unsigned char c = static_cast<unsigned char>(text.charAt(i));
+                if (c < 0x20 || c == 0x7f)
+                {
+                    return true;
+                }
             }
+            return false;
         }
-        if (!isUrlEncodedContentType(contentType))
+
+        using detail::findUrlSpecial;
+        using detail::hexValue;
+        using detail::urlDecodeSpan;
+
+        bool urlDecodeString(const String &input, String &output, bool plusAsSpace)
         {
+            const size_t length = input.length();
+            if (findUrlSpecial(input.c_str(), length, plusAsSpace) == length)
+            {
+                output = input;
+                return true;
+            }
+            output = input;
+            size_t decodedLength = 0;
+            if (!urlDecodeSpan(output.c_str(), length, output.begin(), decodedLength, plusAsSpace))
+            {
+                output.clear();
+                return false;
+            }
+            output.remove(decodedLength);
             return true;
         }
 
-        if (contentLength > _maxFormSize)
+        using detail::needsUrlDecoding;
+
+        // en: Same pair rules as parseUrlEncodedInternal, but hands out views instead of building Strings.
+        // ja: parseUrlEncodedInternal と同じ規則でペアを分割し、String を作らずビューを渡す。
+        template <typename Fn>
+        void walkUrlEncodedViews(const char *data, size_t length, char *scratch, Fn &&fn)
         {
-            _formOverflow = true;
-            httpd_resp_send_err(_raw, HTTPD_400_BAD_REQUEST, "Form too large");
-            return false;
+            detail::walkUrlEncodedViews<ParamView>(data, length, scratch, std::forward<Fn>(fn));
         }
 
-        std::unique_ptr<char[]> body(new (std::nothrow) char[contentLength + 1]);
-        if (!body)
+        // en: Refills a String kept across a forEach loop; its buffer is reused once it is large enough.
+        // ja: forEach のループ中に使い回す String へ代入する。十分な容量があればバッファを再利用する。
+        void assignSmall(String &out, const SmallString &in)
         {
-            _formOverflow = true;
-            return false;
+            out = "";
+            out.concat(in.c_str(), in.length());
         }
-        size_t received = 0;
-        while (received < contentLength)
+
+        bool parseUrlEncodedInternal(const String &input, ParamList &out)
         {
-            const size_t toRead = std::min(static_cast<size_t>(1024), contentLength - received);
-            int ret = httpd_req_recv(_raw, body.get() + received, toRead);
-            if (ret <= 0)
+            const char *data = input.c_str();
+            const size_t length = input.length();
+            std::unique_ptr<char[]> scratch;
+            if (needsUrlDecoding(data, length))
             {
-                _formOverflow = true;
-                return false;
+                scratch.reset(new (std::nothrow) char[length]);
+                if (!scratch)
+                {
+                    return false;
+                }
             }
-            received += static_cast<size_t>(ret);
+            auto collect = [&](const ParamView &key, const ParamView &value) -> bool
+            {
+                out.emplace_back(SmallString(key.data, key.length), SmallString(value.data, value.length));
+                return true;
+            };
+            walkUrlEncodedViews(data, length, scratch.get(), collect);
+            return true;
         }
-        body[contentLength] = '\0';
-        String formText(body.get());
-        parseUrlEncodedInternal(formText, _formParams);
-        return true;
-    }
 
-    bool Request::isUrlEncodedContentType(const String &contentType)
-    {
-        if (contentType.isEmpty())
+        bool viewEqualsIgnoreCase(const ParamView &view, const char *text)
         {
-            return false;
+            const size_t length = strlen(text);
+            return view.length == length && strncasecmp(view.data, text, length) == 0;
         }
-        String lower = contentType;
-        lower.toLowerCase();
-        return lower.startsWith("application/x-www-form-urlencoded");
-    }
 
-    bool Request::extractBoundary(const String &contentType, String &boundaryOut)
+    } // namespace
+
+    bool ParamView::equals(const char *text) const
     {
-        boundaryOut.clear();
-        if (contentType.isEmpty())
-        {
-            return false;
-        }
-        String lower = contentType;
-        lower.toLowerCase();
-        int pos = lower.indexOf("boundary=");
-        if (pos < 0)
+        if (!text)
         {
             return false;
         }
-        String rest = contentType.substring(pos + 9);
-        rest.trim();
-        if (rest.startsWith("\""))
+        const size_t textLength = strlen(text);
+        return textLength == length && (length == 0 || memcmp(data, text, length) == 0);
+    }
+
+    SmallString::SmallString(const char *text)
+    {
+        if (text)
         {
-            int endQuote = rest.indexOf('"', 1);
-            if (endQuote > 1)
-            {
-                boundaryOut = rest.substring(1, endQuote);
-            }
+            assign(text, strlen(text));
         }
-        else
+    }
+
+    SmallString::SmallString(const char *text, size_t length)
+    {
+        assign(text, length);
+    }
+
+    SmallString::SmallString(const String &text)
+    {
+        assign(text.c_str(), text.length());
+    }
+
+    SmallString::SmallString(const SmallString &other)
+    {
+        assign(other.c_str(), other._length);
+    }
+
+    SmallString::SmallString(SmallString &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    SmallString &SmallString::operator=(const SmallString &other)
+    {
+        if (this != &other)
         {
-            int semi = rest.indexOf(';');
-            if (semi >= 0)
-            {
-                boundaryOut = rest.substring(0, semi);
-            }
-            else
-            {
-                boundaryOut = rest;
-            }
+            assign(other.c_str(), other._length);
         }
-        boundaryOut.trim();
-        return !boundaryOut.isEmpty();
+        return *this;
     }
 
-    bool Request::ensureMultipartParsed() const
+    SmallString &SmallString::operator=(SmallString &&other) noexcept
     {
-        if (_multipartParsed)
+        if (this == &other)
         {
-            return !_multipartOverflow;
+            return *this;
         }
-        _multipartParsed = true;
-        _multipartOverflow = false;
-        if (!_raw)
+        release();
+        if (other._heap)
         {
-            return true;
+            _heap = other._heap;
+            other._heap = nullptr;
         }
-
-        size_t contentLength = _raw->content_len;
-        if (contentLength == 0)
+        else
         {
-            return true;
+            memcpy(_inline, other._inline, other._length + 1);
         }
+        _length = other._length;
+        other._length = 0;
+        other._inline[0] = '\0';
+        return *this;
+    }
 
-        char ctypeBuf[128] = {0};
-        String contentType;
-        size_t ctypeLen = httpd_req_get_hdr_value_len(_raw, "Content-Type");
-        if (ctypeLen > 0 && ctypeLen < sizeof(ctypeBuf))
+    SmallString::~SmallString()
+    {
+        release();
+    }
+
+    // en: On allocation failure the string is left empty, which callers already treat as "absent".
+    // ja: 確保に失敗した場合は空のままにする（呼び出し側は「存在しない」として扱う）。
+    void SmallString::assign(const char *text, size_t length)
+    {
+        release();
+        char *target = _inline;
+        if (length > kInlineCapacity)
         {
-            if (httpd_req_get_hdr_value_str(_raw, "Content-Type", ctypeBuf, sizeof(ctypeBuf)) == ESP_OK)
+            target = new (std::nothrow) char[length + 1];
+            if (!target)
             {
-                contentType = String(ctypeBuf);
+                ESP_LOGE(TAG, "SmallString alloc failed (%u bytes)", static_cast<unsigned>(length));
+                return;
             }
+            _heap = target;
         }
-        String boundary;
-        if (!extractBoundary(contentType, boundary) || boundary.isEmpty())
+        if (length > 0)
         {
-            return true;
+            memcpy(target, text, length);
         }
+        target[length] = '\0';
+        _length = length;
+    }
 
-        if (contentLength > _maxFormSize)
+    void SmallString::release()
+    {
+        delete[] _heap;
+        _heap = nullptr;
+        _length = 0;
+        _inline[0] = '\0';
+    }
+
+    bool SmallString::equals(const char *text, size_t length) const
+    {
+        return _length == length && (length == 0 || memcmp(c_str(), text, length) == 0);
+    }
+
+    String SmallString::toString() const
+    {
+        String out;
+        if (_length > 0)
         {
-            _multipartOverflow = true;
-            httpd_resp_send_err(_raw, HTTPD_400_BAD_REQUEST, "Multipart too large");
-            return false;
+            out.concat(c_str(), _length);
         }
+        return out;
+    }
 
-        std::unique_ptr<char[]> body(new (std::nothrow) char[contentLength + 1]);
-        if (!body)
+    String ParamView::toString() const
+    {
+        String out;
+        if (length > 0)
         {
-            _multipartOverflow = true;
-            return false;
+            out.concat(data, length);
         }
-        size_t received = 0;
-        while (received < contentLength)
+        return out;
+    }
+
+    class StaticInputStream
+    {
+    public:
+        // en: Borrows an already open handle; the owner closes (or returns) it.
+        // ja: オープン済みハンドルを借用する。クローズ（返却）は所有者が行う。
+        explicit StaticInputStream(File file)
+            : _useFs(true), _file(file)
         {
-            const size_t toRead = std::min(static_cast<size_t>(1024), contentLength - received);
-            int ret = httpd_req_recv(_raw, body.get() + received, toRead);
-            if (ret <= 0)
-            {
-                _multipartOverflow = true;
-                return false;
-            }
-            received += static_cast<size_t>(ret);
         }
-        body[contentLength] = '\0';
-        String payload(body.get());
 
-        const String boundaryToken = "--" + boundary;
-        size_t pos = 0;
-        while (true)
+        StaticInputStream(const uint8_t *data, size_t size)
+            : _useFs(false), _data(data), _size(size)
         {
-            int start = payload.indexOf(boundaryToken, pos);
-            if (start < 0)
-            {
-                break;
-            }
-            start += boundaryToken.length();
-            if (payload.startsWith("--", start))
-            {
-                break; // closing boundary
-            }
-            if (payload.startsWith("\r\n", start))
-            {
-                start += 2;
-            }
-            int headerEnd = payload.indexOf("\r\n\r\n", start);
-            if (headerEnd < 0)
-            {
-                break;
-            }
-            String headerBlock = payload.substring(start, headerEnd);
-            int nextBoundary = payload.indexOf("\r\n" + boundaryToken, headerEnd + 4);
-            if (nextBoundary < 0)
+        }
+
+        bool valid() const
+        {
+            if (_useFs)
             {
-                break;
+                return static_cast<bool>(_file);
             }
-            String contentData = payload.substring(headerEnd + 4, nextBoundary);
-
-            MultipartField field;
-            field.info.size = contentData.length();
+            return (_data != nullptr) || (_size == 0);
+        }
 
-            int dispPos = headerBlock.indexOf("Content-Disposition:");
-            if (dispPos >= 0)
+        bool readChar(char &out)
+        {
+            if (_useFs)
             {
-                String disp = headerBlock.substring(dispPos);
-                int namePos = disp.indexOf("name=");
-                if (namePos >= 0)
+                if (!_file)
                 {
-                    int firstQuote = disp.indexOf('"', namePos);
-                    int secondQuote = disp.indexOf('"', firstQuote + 1);
-                    if (firstQuote >= 0 && secondQuote > firstQuote)
-                    {
-                        field.info.name = disp.substring(firstQuote + 1, secondQuote);
-                    }
+                    return false;
                 }
-                int filePos = disp.indexOf("filename=");
-                if (filePos >= 0)
+                if (_bufPos >= _bufLen)
                 {
-                    int fq = disp.indexOf('"', filePos);
-                    int sq = disp.indexOf('"', fq + 1);
-                    if (fq >= 0 && sq > fq)
+                    _bufLen = _file.read(_buffer, sizeof(_buffer));
+                    _bufPos = 0;
+                    if (_bufLen == 0)
                     {
-                        field.info.filename = disp.substring(fq + 1, sq);
+                        return false;
                     }
                 }
+                out = static_cast<char>(_buffer[_bufPos++]);
+                return true;
             }
 
-            int ctypePos = headerBlock.indexOf("Content-Type:");
-            if (ctypePos >= 0)
+            if (_pos >= _size)
             {
-                int lineEnd = headerBlock.indexOf("\r\n", ctypePos);
-                String ctLine = (lineEnd > ctypePos) ? headerBlock.substring(ctypePos + 13, lineEnd) : headerBlock.substring(ctypePos + 13);
-                ctLine.trim();
-                field.info.contentType = ctLine;
+                return false;
+            }
+            if (_data)
+            {
+                out = static_cast<char>(_data[_pos]);
+            }
+            else
+            {
+                out = 0;
             }
+            ++_pos;
+            return true;
+        }
 
-            field.data = contentData;
-            _multipartFields.push_back(field);
-            pos = static_cast<size_t>(nextBoundary + 2); // skip leading CRLF before boundary
+    private:
+        bool _useFs = false;
+        File _file;
+        const uint8_t *_data = nullptr;
+        size_t _size = 0;
+        size_t _pos = 0;
+        uint8_t _buffer[256];
+        size_t _bufLen = 0;
+        size_t _bufPos = 0;
+    };
+
+    // -------- Request --------
+
+    String Request::uri() const
+    {
+        if (_subRequest)
+        {
+            return _subUri;
         }
-        return true;
+        return _raw ? String(_raw->uri) : String();
     }
 
-    bool Request::parseUrlEncoded(const String &text, std::vector<std::pair<String, String>> &out) const
+    String Request::method() const
     {
-        return parseUrlEncodedInternal(text, out);
+        if (_subRequest)
+            return String("GET");
+        if (!_raw)
+            return {};
+        switch (_raw->method)
+        {
+        case HTTP_GET:
+            return String("GET");
+        case HTTP_POST:
+            return String("POST");
+        case HTTP_PUT:
+            return String("PUT");
+        case HTTP_DELETE:
+            return String("DELETE");
+        default:
+            return String("UNKNOWN");
+        }
     }
 
-    bool Request::hasQueryParam(const String &name) const
+    bool Request::hasHeader(const char *name) const
     {
-        if (name.isEmpty())
+        if (!_raw || !name)
         {
             return false;
         }
-        ensureQueryParsed();
-        for (auto it = _queryParams.rbegin(); it != _queryParams.rend(); ++it)
-        {
-            if (it->first == name)
-            {
-                return true;
-            }
-        }
-        return false;
+        return httpd_req_get_hdr_value_len(_raw, name) > 0;
     }
 
-    String Request::queryParam(const String &name) const
+    String Request::header(const char *name) const
     {
-        if (name.isEmpty())
+        if (!_raw || !name)
         {
             return String();
         }
-        ensureQueryParsed();
-        for (auto it = _queryParams.rbegin(); it != _queryParams.rend(); ++it)
+        const size_t len = httpd_req_get_hdr_value_len(_raw, name);
+        if (len == 0)
         {
-            if (it->first == name)
+            return String();
+        }
+        ClassBuffer<char> buffer = Server::allocateBuffer<char>(_server, AllocClass::RequestArena, len + 1);
+        if (!buffer)
+        {
+            ESP_LOGE(TAG, "header buffer alloc failed");
+            return String();
+        }
+        if (httpd_req_get_hdr_value_str(_raw, name, buffer.get(), len + 1) != ESP_OK)
+        {
+            return String();
+        }
+        return String(buffer.get());
+    }
+
+    String Request::pathParam(const String &key) const
+    {
+        for (const auto &entry : _pathParams)
+        {
+            if (entry.first == key)
             {
-                return it->second;
+                return entry.second.toString();
             }
         }
         return String();
     }
 
-    void Request::forEachQueryParam(std::function<bool(const String &name, const String &value)> cb) const
+    bool Request::hasPathParam(const String &key) const
     {
-        if (!cb)
-        {
-            return;
-        }
-        ensureQueryParsed();
-        for (const auto &kv : _queryParams)
+        for (const auto &entry : _pathParams)
         {
-            if (!cb(kv.first, kv.second))
+            if (entry.first == key)
             {
-                break;
+                return true;
             }
         }
+        return false;
     }
 
-    bool Request::hasMultipartField(const String &name) const
+    bool Request::decodeComponent(const String &input, String &output)
     {
-        if (name.isEmpty())
-        {
-            return false;
-        }
-        if (!ensureMultipartParsed())
+        return urlDecodeString(input, output, true);
+    }
+
+    bool Request::ensureQueryParsed() const
+    {
+        if (_queryParsed)
         {
-            return false;
+            return true;
         }
-        for (auto it = _multipartFields.rbegin(); it != _multipartFields.rend(); ++it)
+        _queryParsed = true;
+        const String fullUri = uri();
+        int qPos = fullUri.indexOf('?');
+        if (qPos < 0 || qPos + 1 >= fullUri.length())
         {
-            if (it->info.name == name)
-            {
-                return true;
-            }
+            return true;
         }
-        return false;
+        String queryStr = fullUri.substring(qPos + 1);
+        parseUrlEncodedInternal(queryStr, _queryParams);
+        return true;
     }
 
-    String Request::multipartField(const String &name) const
+    bool Request::ensureFormParsed() const
     {
-        if (name.isEmpty())
+        if (_formParsed)
         {
-            return String();
+            return !_formOverflow;
         }
-        if (!ensureMultipartParsed())
+        _formParsed = true;
+        if (!ensureFormBody())
         {
-            return String();
+            return false;
         }
-        for (auto it = _multipartFields.rbegin(); it != _multipartFields.rend(); ++it)
+        if (_formBody)
         {
-            if (it->info.name == name)
-            {
-                return it->data;
-            }
+            String formText(_formBody.get());
+            parseUrlEncodedInternal(formText, _formParams);
         }
-        return String();
+        return true;
     }
 
-    void Request::onMultipart(MultipartFieldHandler handler) const
+    // en: Reads an urlencoded body once and keeps it, so the String and view accessors share one buffer.
+    // ja: urlencoded ボディを一度だけ読み保持する。String 版とビュー版のアクセサで同じバッファを共有する。
+    bool Request::ensureFormBody() const
     {
-        if (!handler)
+        if (_formBodyRead)
         {
-            return;
+            return !_formOverflow;
         }
-        if (!ensureMultipartParsed())
+        _formBodyRead = true;
+        _formOverflow = false;
+        if (!_raw || _subRequest)
         {
-            return;
+            return true;
         }
-        for (const auto &field : _multipartFields)
+
+        size_t contentLength = _raw->content_len;
+        if (contentLength == 0)
         {
-            struct MemoryStream : public Stream
+            return true;
+        }
+
+        char ctypeBuf[64] = {0};
+        String contentType;
+        size_t ctypeLen = httpd_req_get_hdr_value_len(_raw, "Content-Type");
+        if (ctypeLen > 0 && ctypeLen < sizeof(ctypeBuf))
+        {
+            if (httpd_req_get_hdr_value_str(_raw, "Content-Type", ctypeBuf, sizeof(ctypeBuf)) == ESP_OK)
             {
-                const String &data;
-                size_t pos = 0;
-                explicit MemoryStream(const String &d) : data(d) {}
-                int available() override { return static_cast<int>(data.length() - pos); }
-                int read() override
-                {
-                    if (pos >= data.length())
-                        return -1;
-                    return static_cast<unsigned char>(data.charAt(pos++));
-                }
-                int peek() override
-                {
-                    if (pos >= data.length())
-                        return -1;
-                    return static_cast<unsigned char>(data.charAt(pos));
-                }
-                size_t readBytes(char *buffer, size_t len) override
-                {
-                    size_t remain = data.length() - pos;
-                    size_t toCopy = std::min(remain, len);
-                    memcpy(buffer, data.c_str() + pos, toCopy);
-                    pos += toCopy;
-                    return toCopy;
-                }
-                void flush() override {}
-                size_t write(uint8_t) override { return 0; }
-            } stream(field.data);
-
-            if (!handler(field.info, stream))
-            {
-                break;
+                contentType = String(ctypeBuf);
             }
         }
-    }
+        if (!isUrlEncodedContentType(contentType))
+        {
+            return true;
+        }
 
-    bool Request::hasFormParam(const String &name) const
-    {
-        if (name.isEmpty())
+        if (contentLength > _maxFormSize)
         {
+            _formOverflow = true;
+            httpd_resp_send_err(_raw, HTTPD_400_BAD_REQUEST, "Form too large");
             return false;
         }
-        if (!ensureFormParsed())
+
+        ClassBuffer<char> body = Server::allocateBuffer<char>(_server, AllocClass::RequestArena, contentLength + 1);
+        if (!body)
         {
+            _formOverflow = true;
             return false;
         }
-        for (auto it = _formParams.rbegin(); it != _formParams.rend(); ++it)
+        TransferProgress progress;
+        size_t received = 0;
+        while (received < contentLength)
         {
-            if (it->first == name)
+            const size_t toRead = std::min(static_cast<size_t>(1024), contentLength - received);
+            int ret = receiveBody(body.get() + received, toRead, progress);
+            if (ret <= 0)
             {
-                return true;
+                _formOverflow = true;
+                return false;
             }
+            received += static_cast<size_t>(ret);
         }
-        return false;
+        body[contentLength] = '\0';
+        _formBody = std::move(body);
+        _formBodyLength = contentLength;
+        return true;
     }
 
-    String Request::formParam(const String &name) const
+    int Request::receiveBody(char *buffer, size_t len, TransferProgress &progress) const
     {
-        if (name.isEmpty())
+        if (_subRequest)
         {
-            return String();
+            return 0;
         }
-        if (!ensureFormParsed())
+        if (_server)
         {
-            return String();
+            return _server->receiveChunk(_raw, buffer, len, progress);
         }
-        for (auto it = _formParams.rbegin(); it != _formParams.rend(); ++it)
+        return httpd_req_recv(_raw, buffer, len);
+    }
+
+    bool Request::isUrlEncodedContentType(const String &contentType)
+    {
+        if (contentType.isEmpty())
         {
-            if (it->first == name)
-            {
-                return it->second;
-            }
+            return false;
         }
-        return String();
+        String lower = contentType;
+        lower.toLowerCase();
+        return lower.startsWith("application/x-www-form-urlencoded");
     }
 
-    void Request::forEachFormParam(std::function<bool(const String &name, const String &value)> cb) const
+    bool Request::extractBoundary(const String &contentType, String &boundaryOut)
     {
-        if (!cb)
+        boundaryOut.clear();
+        if (contentType.isEmpty())
         {
-            return;
+            return false;
         }
-        if (!ensureFormParsed())
+        String lower = contentType;
+        lower.toLowerCase();
+        int pos = lower.indexOf("boundary=");
+        if (pos < 0)
         {
-            return;
+            return false;
         }
-        for (const auto &kv : _formParams)
+        String rest = contentType.substring(pos + 9);
+        rest.trim();
+        if (rest.startsWith("\""))
         {
-            if (!cb(kv.first, kv.second))
+            int endQuote = rest.indexOf('"', 1);
+            if (endQuote > 1)
             {
-                break;
+                boundaryOut = rest.substring(1, endQuote);
             }
         }
+        else
+        {
+            int semi = rest.indexOf(';');
+            if (semi >= 0)
+            {
+                boundaryOut = rest.substring(0, semi);
+            }
+            else
+            {
+                boundaryOut = rest;
+            }
+        }
+        boundaryOut.trim();
+        return !boundaryOut.isEmpty();
     }
 
-    void Request::setMaxFormSize(size_t bytes)
-    {
-        _maxFormSize = bytes;
-    }
-
-    bool Request::ensureCookiesParsed() const
+    bool Request::ensureMultipartParsed() const
     {
-        if (_cookiesParsed)
+        if (_multipartParsed)
+        {
+            return !_multipartOverflow;
+        }
+        _multipartParsed = true;
+        _multipartOverflow = false;
+        if (!_raw || _subRequest)
         {
             return true;
         }
-        _cookiesParsed = true;
-        if (!_raw)
+
+        size_t contentLength = _raw->content_len;
+        if (contentLength == 0)
         {
-            return false;
+            return true;
         }
 
-        size_t len = httpd_req_get_hdr_value_len(_raw, "Cookie");
-        if (len == 0)
+        char ctypeBuf[128] = {0};
+        String contentType;
+        size_t ctypeLen = httpd_req_get_hdr_value_len(_raw, "Content-Type");
+        if (ctypeLen > 0 && ctypeLen < sizeof(ctypeBuf))
+        {
+            if (httpd_req_get_hdr_value_str(_raw, "Content-Type", ctypeBuf, sizeof(ctypeBuf)) == ESP_OK)
+            {
+                contentType = String(ctypeBuf);
+            }
+        }
+        String boundary;
+        if (!extractBoundary(contentType, boundary) || boundary.isEmpty())
         {
             return true;
         }
-        std::unique_ptr<char[]> buffer(new (std::nothrow) char[len + 1]);
-        if (!buffer)
+
+        if (contentLength > _maxFormSize)
         {
-            ESP_LOGE(TAG, "cookie buffer alloc failed");
+            _multipartOverflow = true;
+            httpd_resp_send_err(_raw, HTTPD_400_BAD_REQUEST, "Multipart too large");
             return false;
         }
-        if (httpd_req_get_hdr_value_str(_raw, "Cookie", buffer.get(), len + 1) != ESP_OK)
+
+        ClassBuffer<char> body = Server::allocateBuffer<char>(_server, AllocClass::RequestArena, contentLength + 1);
+        if (!body)
         {
-            ESP_LOGW(TAG, "failed to read Cookie header");
+            _multipartOverflow = true;
             return false;
         }
+        TransferProgress progress;
+        size_t received = 0;
+        while (received < contentLength)
+        {
+            const size_t toRead = std::min(static_cast<size_t>(1024), contentLength - received);
+            int ret = receiveBody(body.get() + received, toRead, progress);
+            if (ret <= 0)
+            {
+                _multipartOverflow = true;
+                return false;
+            }
+            received += static_cast<size_t>(ret);
+        }
+        body[contentLength] = '\0';
+        String payload(body.get());
 
-        auto processToken = [&](const String &token)
+        const String boundaryToken = "--" + boundary;
+        size_t pos = 0;
+        while (true)
         {
-            String working = token;
-            trimSpaces(working);
-            if (working.isEmpty())
+            int start = payload.indexOf(boundaryToken, pos);
+            if (start < 0)
             {
-                return;
+                break;
             }
-            int eq = working.indexOf('=');
-            if (eq < 0)
+            start += boundaryToken.length();
+            if (payload.startsWith("--", start))
             {
-                return;
+                break; // closing boundary
             }
-            String name = working.substring(0, eq);
-            String value = working.substring(eq + 1);
-            trimSpaces(name);
-            trimSpaces(value);
-            if (name.isEmpty() || containsControlChars(name) || containsControlChars(value))
+            if (payload.startsWith("\r\n", start))
             {
-                return;
+                start += 2;
             }
-            _cookies.push_back({name, value});
-        };
+            int headerEnd = payload.indexOf("\r\n\r\n", start);
+            if (headerEnd < 0)
+            {
+                break;
+            }
+            String headerBlock = payload.substring(start, headerEnd);
+            int nextBoundary = payload.indexOf("\r\n" + boundaryToken, headerEnd + 4);
+            if (nextBoundary < 0)
+            {
+                break;
+            }
+            String contentData = payload.substring(headerEnd + 4, nextBoundary);
 
-        String token;
-        for (size_t i = 0; i < len; ++i)
-        {
-            const char c = buffer[i];
-            if (c == ';')
+            MultipartField field;
+            field.info.size = contentData.length();
+
+            int dispPos = headerBlock.indexOf("Content-Disposition:");
+            if (dispPos >= 0)
             {
-                processToken(token);
-                token.clear();
-                continue;
+                String disp = headerBlock.substring(dispPos);
+                int namePos = disp.indexOf("name=");
+                if (namePos >= 0)
+                {
+                    int firstQuote = disp.indexOf('"', namePos);
+                    int secondQuote = disp.indexOf('"', firstQuote + 1);
+                    if (firstQuote >= 0 && secondQuote > firstQuote)
+                    {
+                        field.info.name = disp.substring(firstQuote + 1, secondQuote);
+                    }
+                }
+                int filePos = disp.indexOf("filename=");
+                if (filePos >= 0)
+                {
+                    int fq = disp.indexOf('"', filePos);
+                    int sq = disp.indexOf('"', fq + 1);
+                    if (fq >= 0 && sq > fq)
+                    {
+                        field.info.filename = disp.substring(fq + 1, sq);
+                    }
+                }
+            }
+
+            int ctypePos = headerBlock.indexOf("Content-Type:");
+            if (ctypePos >= 0)
+            {
+                int lineEnd = headerBlock.indexOf("\r\n", ctypePos);
+                String ctLine = (lineEnd > ctypePos) ? headerBlock.substring(ctypePos + 13, lineEnd) : headerBlock.substring(ctypePos + 13);
+                ctLine.trim();
+                field.info.contentType = ctLine;
             }
-            token += c;
+
+            field.data = contentData;
+            _multipartFields.push_back(field);
+            pos = static_cast<size_t>(nextBoundary + 2); // skip leading CRLF before boundary
         }
-        processToken(token);
         return true;
     }
 
-    bool Request::hasCookie(const String &name) const
+    bool Request::parseUrlEncoded(const String &text, ParamList &out) const
+    {
+        return parseUrlEncodedInternal(text, out);
+    }
+
+    bool Request::hasQueryParam(const String &name) const
     {
         if (name.isEmpty())
         {
             return false;
         }
-        ensureCookiesParsed();
-        for (const auto &kv : _cookies)
+        ensureQueryParsed();
+        for (auto it = _queryParams.rbegin(); it != _queryParams.rend(); ++it)
         {
-            if (kv.first == name)
+            if (it->first == name)
             {
                 return true;
             }
@@ -1112,1787 +1559,7396 @@ namespace EspHttpServer
         return false;
     }
 
-    String Request::cookie(const String &name) const
+    String Request::queryParam(const String &name) const
     {
         if (name.isEmpty())
         {
             return String();
         }
-        ensureCookiesParsed();
-        for (const auto &kv : _cookies)
+        ensureQueryParsed();
+        for (auto it = _queryParams.rbegin(); it != _queryParams.rend(); ++it)
         {
-            if (kv.first == name)
+            if (it->first == name)
             {
-                return kv.second;
+                return it->second.toString();
             }
         }
         return String();
     }
 
-    void Request::forEachCookie(std::function<bool(const String &name, const String &value)> cb) const
+    void Request::forEachQueryParam(std::function<bool(const String &name, const String &value)> cb) const
     {
         if (!cb)
         {
             return;
         }
-        ensureCookiesParsed();
-        for (const auto &kv : _cookies)
+        ensureQueryParsed();
+        String name;
+        String value;
+        for (const auto &kv : _queryParams)
         {
-            if (!cb(kv.first, kv.second))
+            assignSmall(name, kv.first);
+            assignSmall(value, kv.second);
+            if (!cb(name, value))
             {
                 break;
             }
         }
     }
 
-    void Request::setPathInfo(const String &path, const std::vector<std::pair<String, String>> &params)
+    bool Request::hasMultipartField(const String &name) const
     {
-        _normalizedPath = path;
-        _pathParams = params;
+        if (name.isEmpty())
+        {
+            return false;
+        }
+        if (!ensureMultipartParsed())
+        {
+            return false;
+        }
+        for (auto it = _multipartFields.rbegin(); it != _multipartFields.rend(); ++it)
+        {
+            if (it->info.name == name)
+            {
+                return true;
+            }
+        }
+        return false;
     }
 
-    void Request::clearPathInfo()
+    String Request::multipartField(const String &name) const
     {
-        _normalizedPath = "/";
-        _pathParams.clear();
+        if (name.isEmpty())
+        {
+            return String();
+        }
+        if (!ensureMultipartParsed())
+        {
+            return String();
+        }
+        for (auto it = _multipartFields.rbegin(); it != _multipartFields.rend(); ++it)
+        {
+            if (it->info.name == name)
+            {
+                return it->data;
+            }
+        }
+        return String();
     }
 
-    // -------- Response --------
-
-    Response::Response(httpd_req_t *raw) { attachRequest(raw); }
-
-    void Response::attachRequest(httpd_req_t *raw)
+    void Request::onMultipart(MultipartFieldHandler handler) const
     {
-        _raw = raw;
-        _chunked = false;
-        _lastStatusCode = 0;
-        _requestContext = nullptr;
-        _responseCommitted = false;
-        _setCookieBuffers.clear();
-    }
+        if (!handler)
+        {
+            return;
+        }
+        if (!ensureMultipartParsed())
+        {
+            return;
+        }
+        for (const auto &field : _multipartFields)
+        {
+            struct MemoryStream : public Stream
+            {
+                const String &data;
+                size_t pos = 0;
+                explicit MemoryStream(const String &d) : data(d) {}
+                int available() override { return static_cast<int>(data.length() - pos); }
+                int read() override
+                {
+                    if (pos >= data.length())
+                        return -1;
+                    return static_cast<unsigned char>(data.charAt(pos++));
+                }
+                int peek() override
+                {
+                    if (pos >= data.length())
+                        return -1;
+                    return static_cast<unsigned char>(data.charAt(pos));
+                }
+                size_t readBytes(char *buffer, size_t len) override
+                {
+                    size_t remain = data.length() - pos;
+                    size_t toCopy = std::min(remain, len);
+                    memcpy(buffer, data.c_str() + pos, toCopy);
+                    pos += toCopy;
+                    return toCopy;
+                }
+                void flush() override {}
+                size_t write(uint8_t) override { return 0; }
+            } stream(field.data);
 
-    void Response::setTemplateHandler(TemplateHandler handler)
-    {
-        _templateHandler = std::move(handler);
+            if (!handler(field.info, stream))
+            {
+                break;
+            }
+        }
     }
 
-    void Response::clearTemplateHandler()
+    bool Request::hasFormParam(const String &name) const
     {
-        _templateHandler = nullptr;
+        if (name.isEmpty())
+        {
+            return false;
+        }
+        if (!ensureFormParsed())
+        {
+            return false;
+        }
+        for (auto it = _formParams.rbegin(); it != _formParams.rend(); ++it)
+        {
+            if (it->first == name)
+            {
+                return true;
+            }
+        }
+        return false;
     }
 
-    void Response::setHeadInjection(const char *snippet)
+    String Request::formParam(const String &name) const
     {
-        _headInjectionPtr = snippet;
-        _headInjectionIsRawPtr = true;
-        _headInjection.clear();
+        if (name.isEmpty())
+        {
+            return String();
+        }
+        if (!ensureFormParsed())
+        {
+            return String();
+        }
+        for (auto it = _formParams.rbegin(); it != _formParams.rend(); ++it)
+        {
+            if (it->first == name)
+            {
+                return it->second.toString();
+            }
+        }
+        return String();
     }
 
-    void Response::setHeadInjection(const String &snippet)
+    void Request::forEachFormParam(std::function<bool(const String &name, const String &value)> cb) const
     {
-        _headInjection = snippet;
-        _headInjectionPtr = _headInjection.c_str();
-        _headInjectionIsRawPtr = false;
+        if (!cb)
+        {
+            return;
+        }
+        if (!ensureFormParsed())
+        {
+            return;
+        }
+        String name;
+        String value;
+        for (const auto &kv : _formParams)
+        {
+            assignSmall(name, kv.first);
+            assignSmall(value, kv.second);
+            if (!cb(name, value))
+            {
+                break;
+            }
+        }
     }
 
-    void Response::clearHeadInjection()
+    void Request::setMaxFormSize(size_t bytes)
     {
-        _headInjectionPtr = nullptr;
-        _headInjection.clear();
-        _headInjectionIsRawPtr = false;
+        _maxFormSize = bytes;
     }
 
-    void Response::setErrorRenderer(ErrorRenderer handler)
+    bool Request::paramSource(bool form, const char *&data, size_t &length) const
     {
-        _errorRenderer = std::move(handler);
+        if (form)
+        {
+            if (!ensureFormBody() || !_formBody)
+            {
+                return false;
+            }
+            data = _formBody.get();
+            length = _formBodyLength;
+            return true;
+        }
+        if (!_raw && !_subRequest)
+        {
+            return false;
+        }
+        const char *query = strchr(_subRequest ? _subUri.c_str() : _raw->uri, '?');
+        if (!query || query[1] == '\0')
+        {
+            return false;
+        }
+        data = query + 1;
+        length = strlen(data);
+        return true;
     }
 
-    void Response::clearErrorRenderer()
+    template <typename Fn>
+    bool Request::visitParam(bool form, const char *name, Fn &&fn) const
     {
-        _errorRenderer = nullptr;
+        const char *data = nullptr;
+        size_t length = 0;
+        if (!name || !paramSource(form, data, length))
+        {
+            return false;
+        }
+        ClassBuffer<char> scratch;
+        if (needsUrlDecoding(data, length))
+        {
+            scratch = Server::allocateBuffer<char>(_server, AllocClass::RequestArena, length);
+            if (!scratch)
+            {
+                return false;
+            }
+        }
+        ParamView found;
+        bool hit = false;
+        auto match = [&](const ParamView &key, const ParamView &value) -> bool
+        {
+            if (key.equals(name))
+            {
+                found = value;
+                hit = true;
+            }
+            return true;
+        };
+        walkUrlEncodedViews(data, length, scratch.get(), match);
+        if (hit)
+        {
+            fn(found);
+        }
+        return hit;
     }
 
-    void Response::send(int code, const char *type, const uint8_t *data, size_t len)
+    template <typename Fn>
+    void Request::forEachView(bool form, Fn &&cb) const
     {
-        if (!_raw)
+        const char *data = nullptr;
+        size_t length = 0;
+        if (!paramSource(form, data, length))
+        {
             return;
-        _lastStatusCode = code;
-        const String typeStr = type ? String(type) : String();
-        const bool htmlEligible = isHtmlMime(typeStr);
-        const bool needsProcessing = htmlEligible && (_templateHandler || (_headInjectionPtr && _headInjectionPtr[0]));
-
-        httpd_resp_set_type(_raw, type);
-        httpd_resp_set_status(_raw, statusString(code));
-        markCommitted();
-
-        if (needsProcessing)
+        }
+        ClassBuffer<char> scratch;
+        if (needsUrlDecoding(data, length))
         {
-            StaticInputStream stream(data, len);
-            if (!streamHtmlFromSource(stream))
+            scratch = Server::allocateBuffer<char>(_server, AllocClass::RequestArena, length);
+            if (!scratch)
             {
-                ESP_LOGE(TAG, "[RESP] %d html processing failed", code);
-                sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
                 return;
             }
-            ESP_LOGI(TAG, "[RESP][TPL] %d %s processed", code, type ? type : "-", len);
-            return;
         }
-
-        httpd_resp_send(_raw, reinterpret_cast<const char *>(data), len);
-        ESP_LOGI(TAG, "[RESP] %d %s %zu bytes", code, type ? type : "-", len);
-    }
-
-    void Response::send(int code, const char *type, const String &body)
-    {
-        send(code, type, reinterpret_cast<const uint8_t *>(body.c_str()), body.length());
+        walkUrlEncodedViews(data, length, scratch.get(), std::forward<Fn>(cb));
     }
 
-    void Response::sendText(int code, const char *type, const char *text)
-    {
-        send(code, type, reinterpret_cast<const uint8_t *>(text), strlen(text));
-    }
-
-    void Response::sendText(int code, const char *type, const String &text)
+    long Request::paramInt(bool form, const char *name, long defaultValue, ParamError *error) const
     {
-        send(code, type, reinterpret_cast<const uint8_t *>(text.c_str()), text.length());
+        ParamError status = ParamError::Missing;
+        long result = defaultValue;
+        auto parse = [&](const ParamView &value)
+        {
+            char buffer[24];
+            if (value.length == 0 || value.length >= sizeof(buffer))
+            {
+                status = value.length == 0 ? ParamError::Invalid : ParamError::OutOfRange;
+                return;
+            }
+            memcpy(buffer, value.data, value.length);
+            buffer[value.length] = '\0';
+            char *end = nullptr;
+            errno = 0;
+            const long parsed = strtol(buffer, &end, 10);
+            if (*end != '\0')
+            {
+                status = ParamError::Invalid;
+            }
+            else if (errno == ERANGE)
+            {
+                status = ParamError::OutOfRange;
+            }
+            else
+            {
+                status = ParamError::None;
+                result = parsed;
+            }
+        };
+        visitParam(form, name, parse);
+        if (error)
+        {
+            *error = status;
+        }
+        return result;
     }
 
-    void Response::beginChunked(int code, const char *type)
+    float Request::paramFloat(bool form, const char *name, float defaultValue, ParamError *error) const
     {
-        if (!_raw)
-            return;
-        _chunked = true;
-        _lastStatusCode = code;
-        httpd_resp_set_type(_raw, type);
-        httpd_resp_set_status(_raw, statusString(code));
-        ESP_LOGI(TAG, "[RESP] %d %s (chunked)", code, type ? type : "-");
-        markCommitted();
+        ParamError status = ParamError::Missing;
+        float result = defaultValue;
+        auto parse = [&](const ParamView &value)
+        {
+            char buffer[32];
+            if (value.length == 0 || value.length >= sizeof(buffer))
+            {
+                status = ParamError::Invalid;
+                return;
+            }
+            memcpy(buffer, value.data, value.length);
+            buffer[value.length] = '\0';
+            char *end = nullptr;
+            errno = 0;
+            const float parsed = strtof(buffer, &end);
+            if (*end != '\0')
+            {
+                status = ParamError::Invalid;
+            }
+            else if (errno == ERANGE)
+            {
+                status = ParamError::OutOfRange;
+            }
+            else
+            {
+                status = ParamError::None;
+                result = parsed;
+            }
+        };
+        visitParam(form, name, parse);
+        if (error)
+        {
+            *error = status;
+        }
+        return result;
     }
 
-    void Response::sendChunk(const uint8_t *data, size_t len)
+    // en: A bare key ("?debug") counts as true.
+    // ja: 値なしのキー（"?debug"）は true とみなす。
+    bool Request::paramBool(bool form, const char *name, bool defaultValue, ParamError *error) const
     {
-        if (!_raw || !_chunked)
-            return;
-        httpd_resp_send_chunk(_raw, reinterpret_cast<const char *>(data), len);
+        static const char *const kTrue[] = {"", "1", "true", "yes", "on"};
+        static const char *const kFalse[] = {"0", "false", "no", "off"};
+        ParamError status = ParamError::Missing;
+        bool result = defaultValue;
+        auto parse = [&](const ParamView &value)
+        {
+            status = ParamError::Invalid;
+            for (const char *word : kTrue)
+            {
+                if (viewEqualsIgnoreCase(value, word))
+                {
+                    status = ParamError::None;
+                    result = true;
+                    return;
+                }
+            }
+            for (const char *word : kFalse)
+            {
+                if (viewEqualsIgnoreCase(value, word))
+                {
+                    status = ParamError::None;
+                    result = false;
+                    return;
+                }
+            }
+        };
+        visitParam(form, name, parse);
+        if (error)
+        {
+            *error = status;
+        }
+        return result;
     }
 
-    void Response::sendChunk(const char *text)
+    int Request::paramEnum(bool form, const char *name, std::initializer_list<const char *> choices, int defaultValue, ParamError *error) const
     {
-        sendChunk(reinterpret_cast<const uint8_t *>(text), strlen(text));
+        ParamError status = ParamError::Missing;
+        int result = defaultValue;
+        auto parse = [&](const ParamView &value)
+        {
+            status = ParamError::Invalid;
+            int index = 0;
+            for (const char *choice : choices)
+            {
+                if (value.equals(choice))
+                {
+                    status = ParamError::None;
+                    result = index;
+                    return;
+                }
+                ++index;
+            }
+        };
+        visitParam(form, name, parse);
+        if (error)
+        {
+            *error = status;
+        }
+        return result;
     }
 
-    void Response::sendChunk(const String &text)
+    long Request::queryInt(const char *name, long defaultValue, ParamError *error) const
     {
-        sendChunk(reinterpret_cast<const uint8_t *>(text.c_str()), text.length());
+        return paramInt(false, name, defaultValue, error);
     }
 
-    void Response::endChunked()
+    float Request::queryFloat(const char *name, float defaultValue, ParamError *error) const
     {
-        if (!_raw || !_chunked)
-            return;
-        httpd_resp_send_chunk(_raw, nullptr, 0);
-        _chunked = false;
-        ESP_LOGI(TAG, "[RESP] chunked end (%d)", _lastStatusCode);
+        return paramFloat(false, name, defaultValue, error);
     }
 
-    void Response::sendStatic()
+    bool Request::queryBool(const char *name, bool defaultValue, ParamError *error) const
     {
-        if (!_raw)
-            return;
+        return paramBool(false, name, defaultValue, error);
+    }
 
-        if (_staticSource == StaticSourceType::None)
+    int Request::queryEnum(const char *name, std::initializer_list<const char *> choices, int defaultValue, ParamError *error) const
+    {
+        return paramEnum(false, name, choices, defaultValue, error);
+    }
+
+    long Request::formInt(const char *name, long defaultValue, ParamError *error) const
+    {
+        return paramInt(true, name, defaultValue, error);
+    }
+
+    float Request::formFloat(const char *name, float defaultValue, ParamError *error) const
+    {
+        return paramFloat(true, name, defaultValue, error);
+    }
+
+    bool Request::formBool(const char *name, bool defaultValue, ParamError *error) const
+    {
+        return paramBool(true, name, defaultValue, error);
+    }
+
+    int Request::formEnum(const char *name, std::initializer_list<const char *> choices, int defaultValue, ParamError *error) const
+    {
+        return paramEnum(true, name, choices, defaultValue, error);
+    }
+
+    void Request::forEachQueryView(ParamViewCallback cb) const
+    {
+        if (cb)
         {
-            ESP_LOGE(TAG, "Static source missing");
-            sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
-            return;
+            forEachView(false, cb);
         }
+    }
 
-        if (!_staticInfo.exists)
+    void Request::forEachFormView(ParamViewCallback cb) const
+    {
+        if (cb)
         {
-            String missingPath = _staticInfo.logicalPath;
-            if (missingPath.isEmpty())
-            {
-                missingPath = _staticInfo.relPath;
-            }
-            ESP_LOGI(TAG, "[RESP] 404 static %s", missingPath.c_str());
-            sendError(HTTPD_404_NOT_FOUND);
-            return;
+            forEachView(true, cb);
         }
+    }
 
-        String logicalPath = _staticInfo.logicalPath;
-        if (logicalPath.isEmpty())
+    bool Request::ensureCookiesParsed() const
+    {
+        if (_cookiesParsed)
         {
-            logicalPath = _staticInfo.relPath;
+            return true;
+        }
+        _cookiesParsed = true;
+        if (!_raw)
+        {
+            return false;
         }
-        const String mime = determineMimeType(logicalPath);
-        httpd_resp_set_type(_raw, mime.c_str());
-        httpd_resp_set_status(_raw, HTTPD_200);
-        constexpr int kStaticStatusCode = 200;
-        _lastStatusCode = kStaticStatusCode;
-        markCommitted();
 
-        const char *sourceLabel = "NONE";
-        const char *originPath = "-";
-        if (_staticSource == StaticSourceType::FileSystem)
+        size_t len = httpd_req_get_hdr_value_len(_raw, "Cookie");
+        if (len == 0)
         {
-            sourceLabel = "FS";
-            originPath = _staticInfo.fsPath.c_str();
+            return true;
         }
-        else if (_staticSource == StaticSourceType::Memory)
+        ClassBuffer<char> buffer = Server::allocateBuffer<char>(_server, AllocClass::RequestArena, len + 1);
+        if (!buffer)
         {
-            sourceLabel = "MEM";
+            ESP_LOGE(TAG, "cookie buffer alloc failed");
+            return false;
         }
-        ESP_LOGI(TAG,
-                 "[RESP][STATIC][%s] %d %s (%s) origin=%s",
-                 sourceLabel,
-                 kStaticStatusCode,
-                 logicalPath.c_str(),
-                 _staticInfo.isGzipped ? "gzip" : "plain",
-                 originPath);
-
-        const bool htmlEligible = !_staticInfo.isGzipped && isHtmlMime(mime);
-        if (_staticInfo.isGzipped)
+        if (httpd_req_get_hdr_value_str(_raw, "Cookie", buffer.get(), len + 1) != ESP_OK)
         {
-            httpd_resp_set_hdr(_raw, "Content-Encoding", "gzip");
+            ESP_LOGW(TAG, "failed to read Cookie header");
+            return false;
         }
 
-        const bool needsProcessing = htmlEligible && (_templateHandler || (_headInjectionPtr && _headInjectionPtr[0]));
-        if (!needsProcessing)
+        auto collect = [&](const ParamView &name, const ParamView &value) -> bool
         {
-            bool ok = false;
-            if (_staticSource == StaticSourceType::FileSystem)
-            {
-                ok = streamFileToClient(_raw, _staticFs, _staticInfo.fsPath);
-            }
-            else
-            {
-                ok = streamMemoryToClient(_raw, _memData, _memSize);
-            }
-            if (!ok)
+            _cookies.emplace_back(SmallString(name.data, name.length), SmallString(value.data, value.length));
+            return true;
+        };
+        detail::walkCookieViews<ParamView>(buffer.get(), strnlen(buffer.get(), len), collect);
+        return true;
+    }
+
+    bool Request::hasCookie(const String &name) const
+    {
+        if (name.isEmpty())
+        {
+            return false;
+        }
+        ensureCookiesParsed();
+        for (const auto &kv : _cookies)
+        {
+            if (kv.first == name)
             {
-                ESP_LOGE(TAG, "[RESP] 500 static stream failed (%s)", logicalPath.c_str());
-                sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+                return true;
             }
-            return;
         }
+        return false;
+    }
 
-        bool ok = false;
-        if (_staticSource == StaticSourceType::FileSystem)
-        {
-            StaticInputStream stream(_staticFs, _staticInfo.fsPath);
-            ok = streamHtmlFromSource(stream);
-        }
-        else
+    String Request::cookie(const String &name) const
+    {
+        if (name.isEmpty())
         {
-            StaticInputStream stream(_memData, _memSize);
-            ok = streamHtmlFromSource(stream);
+            return String();
         }
-        if (!ok)
+        ensureCookiesParsed();
+        for (const auto &kv : _cookies)
         {
-            ESP_LOGE(TAG, "[RESP] 500 static html stream failed (%s)", logicalPath.c_str());
-            sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+            if (kv.first == name)
+            {
+                return kv.second.toString();
+            }
         }
+        return String();
     }
 
-    void Response::sendFile(fs::FS &fs, const String &fsPath)
+    void Request::forEachCookie(std::function<bool(const String &name, const String &value)> cb) const
     {
-        StaticInfo info;
-        info.uri = fsPath;
-        info.relPath = fsPath;
-        info.fsPath = fsPath;
-        info.exists = fs.exists(fsPath);
-        info.isDir = false;
-        info.isGzipped = fsPath.endsWith(".gz");
-        info.logicalPath = info.isGzipped ? fsPath.substring(0, fsPath.length() - 3) : fsPath;
-        setStaticFileSystem(&fs);
-        setStaticInfo(info);
-        sendStatic();
+        if (!cb)
+        {
+            return;
+        }
+        ensureCookiesParsed();
+        String name;
+        String value;
+        for (const auto &kv : _cookies)
+        {
+            assignSmall(name, kv.first);
+            assignSmall(value, kv.second);
+            if (!cb(name, value))
+            {
+                break;
+            }
+        }
     }
 
-    void Response::sendError(int status)
+    void Request::forEachCookieView(ParamViewCallback cb) const
     {
-        if (!_raw)
-            return;
-        _chunked = false;
-        _lastStatusCode = status;
-        httpd_resp_set_status(_raw, statusString(status));
-        ESP_LOGI(TAG, "[RESP][ERR] %d", status);
-        markCommitted();
-        if (_errorRenderer && _requestContext)
+        if (!cb)
         {
-            _errorRenderer(status, *_requestContext, *this);
             return;
         }
-        const char *message = defaultErrorMessage(status);
-        httpd_resp_set_type(_raw, "text/plain");
-        httpd_resp_send(_raw, message, strlen(message));
+        ensureCookiesParsed();
+        for (const auto &kv : _cookies)
+        {
+            if (!cb(ParamView{kv.first.c_str(), kv.first.length()}, ParamView{kv.second.c_str(), kv.second.length()}))
+            {
+                break;
+            }
+        }
     }
 
-    bool Response::committed() const
+    void Request::setPathInfo(const String &path, const ParamList &params)
     {
-        return _responseCommitted;
+        _normalizedPath = path;
+        _pathParams = params;
     }
 
-    void Response::redirect(const char *location, int status)
+    void Request::clearPathInfo()
     {
-        if (!_raw)
-            return;
-        _lastStatusCode = status;
-        const char *statusStr = statusString(status);
-        httpd_resp_set_status(_raw, statusStr);
-        httpd_resp_set_hdr(_raw, "Location", location);
-        httpd_resp_send(_raw, nullptr, 0);
-        ESP_LOGI(TAG, "[RESP] %d redirect -> %s", status, location);
-        markCommitted();
+        _normalizedPath = "/";
+        _pathParams.clear();
     }
 
-    void Response::setStaticInfo(const StaticInfo &info)
+    // -------- Response --------
+
+    namespace
     {
-        _staticInfo = info;
+        // en: Slot marker for a caller-owned File passed to sendFile(File&); it is never closed by the response.
+        // ja: sendFile(File&) で渡された呼び出し側所有の File を示すスロット値。レスポンス側では閉じない。
+        constexpr int kBorrowedFileSlot = -2;
+        // en: Larger renderer output is not memoized (it is sent normally each time).
+        // ja: これより大きいレンダラー出力は保持せず、毎回通常どおり送る。
+        constexpr size_t kMaxMemoizedErrorBody = 4096;
+    } // namespace
+
+    Response::Response(httpd_req_t *raw) { attachRequest(raw); }
+    Response::~Response() { releasePendingStaticFile(); }
+
+    void Response::attachRequest(httpd_req_t *raw)
+    {
+        _raw = raw;
+        _chunked = false;
+        _lastStatusCode = 0;
+        _requestContext = nullptr;
+        _responseCommitted = false;
+        _setCookieBuffers.clear();
+        _headerBuffers.clear();
     }
 
-    void Response::setCookie(const Cookie &cookie)
+    void Response::setTemplateHandler(TemplateHandler handler)
     {
-        if (!_raw)
-        {
-            return;
-        }
-        if (_responseCommitted)
-        {
-            ESP_LOGW(TAG, "Set-Cookie after commit ignored");
+        _templateHandler = std::move(handler);
+    }
+
+    void Response::clearTemplateHandler()
+    {
+        _templateHandler = nullptr;
+    }
+
+    void Response::setHeadInjection(const char *snippet)
+    {
+        _headInjectionPtr = snippet;
+        _headInjectionIsRawPtr = true;
+        _headInjection.clear();
+    }
+
+    void Response::setHeadInjection(const String &snippet)
+    {
+        _headInjection = snippet;
+        _headInjectionPtr = _headInjection.c_str();
+        _headInjectionIsRawPtr = false;
+    }
+
+    void Response::clearHeadInjection()
+    {
+        _headInjectionPtr = nullptr;
+        _headInjection.clear();
+        _headInjectionIsRawPtr = false;
+    }
+
+    void Response::setErrorRenderer(ErrorRenderer handler)
+    {
+        // en: Memoized output belongs to the previous renderer. sendError() works on copies, so a send in flight
+        //     keeps its renderer and memoized body alive.
+        // ja: 保持済みの出力は以前のレンダラーのもの。sendError() はコピーを使うため、送信中のレンダラーと
+        //     保持済みボディは送信が終わるまで有効。
+        xSemaphoreTake(errorPageLock(), portMAX_DELAY);
+        _errorRenderer = std::move(handler);
+        _errorPages.erase(std::remove_if(_errorPages.begin(), _errorPages.end(),
+                                         [](const ErrorPage &page)
+                                         { return page.owned != nullptr; }),
+                          _errorPages.end());
+        xSemaphoreGive(errorPageLock());
+    }
+
+    void Response::clearErrorRenderer()
+    {
+        setErrorRenderer(nullptr);
+    }
+
+    void Response::setErrorPage(int status, const char *contentType, const uint8_t *data, size_t length)
+    {
+        if (!contentType || (!data && length > 0))
+        {
+            ESP_LOGW(TAG, "[RESP][ERR] invalid error page for %d", status);
             return;
         }
-        if (cookie.name.isEmpty() || containsControlChars(cookie.name) || containsControlChars(cookie.value))
+        xSemaphoreTake(errorPageLock(), portMAX_DELAY);
+        auto it = std::find_if(_errorPages.begin(), _errorPages.end(), [&](const ErrorPage &page)
+                               { return page.status == status && strcasecmp(page.contentType, contentType) == 0; });
+        if (it == _errorPages.end())
         {
-            ESP_LOGW(TAG, "invalid cookie skipped");
-            return;
+            _errorPages.emplace_back();
+            it = _errorPages.end() - 1;
         }
+        it->status = status;
+        it->contentType = contentType;
+        it->data = data;
+        it->length = length;
+        it->owned.reset();
+        xSemaphoreGive(errorPageLock());
+    }
 
-        Cookie::SameSite sameSite = cookie.sameSite;
-        bool secure = cookie.secure;
-        if (sameSite == Cookie::SameSite::None && !secure)
+    void Response::memoizeErrorPages(std::initializer_list<int> statuses)
+    {
+        xSemaphoreTake(errorPageLock(), portMAX_DELAY);
+        for (int status : statuses)
         {
-            secure = true;
+            if (std::find(_memoizedErrorStatuses.begin(), _memoizedErrorStatuses.end(), status) == _memoizedErrorStatuses.end())
+            {
+                _memoizedErrorStatuses.push_back(status);
+            }
         }
+        xSemaphoreGive(errorPageLock());
+    }
 
-        String header;
-        header.reserve(cookie.name.length() + cookie.value.length() + 64);
-        header += cookie.name;
-        header += "=";
-        header += cookie.value;
+    void Response::clearErrorPages()
+    {
+        xSemaphoreTake(errorPageLock(), portMAX_DELAY);
+        _errorPages.clear();
+        _memoizedErrorStatuses.clear();
+        xSemaphoreGive(errorPageLock());
+    }
 
-        if (!cookie.path.isEmpty())
-        {
-            header += "; Path=";
-            header += cookie.path;
+    SemaphoreHandle_t Response::errorPageLock()
+    {
+        static SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+        return lock;
+    }
+
+    bool Response::sendErrorPage(int status)
+    {
+        const String accept = _requestContext ? _requestContext->header("Accept") : String();
+        const char *type = nullptr;
+        const uint8_t *data = nullptr;
+        size_t length = 0;
+        const char *headers = nullptr;
+        size_t headerCount = 0;
+        std::shared_ptr<uint8_t[]> hold;
+        bool found = false;
+        // en: Registered pages come first, then memoized ones. A memoized body can be dropped by setErrorRenderer()
+        //     or clearErrorPages() once the lock is released, so keep a reference to it for the duration of the send.
+        // ja: 登録ページを優先し、次に保持済みの出力。保持済みボディはロック解放後に setErrorRenderer() や
+        //     clearErrorPages() で破棄され得るため、送信が終わるまで参照を保持する。
+        xSemaphoreTake(errorPageLock(), portMAX_DELAY);
+        for (int pass = 0; pass < 2 && !found; ++pass)
+        {
+            for (const ErrorPage &page : _errorPages)
+            {
+                if (page.status != status || (page.owned != nullptr) != (pass == 1) || !acceptsMediaType(accept, page.contentType))
+                {
+                    continue;
+                }
+                type = page.contentType;
+                data = page.data;
+                length = page.length;
+                headers = page.headers;
+                headerCount = page.headerCount;
+                hold = page.owned;
+                found = true;
+                break;
+            }
         }
-        if (!cookie.domain.isEmpty())
+        xSemaphoreGive(errorPageLock());
+        if (!found)
         {
-            header += "; Domain=";
-            header += cookie.domain;
+            return false;
         }
-        if (cookie.maxAge >= 0)
+        writeHead(status, type);
+        // en: Replay the headers the renderer set. httpd_resp_send() copies them out before returning, and `hold`
+        //     keeps the memoized strings alive until then, so they are passed without another copy.
+        // ja: レンダラーが設定したヘッダを再送する。httpd_resp_send() は戻る前にヘッダを書き出し、それまで `hold` が
+        //     保持済みの文字列を生かしておくため、コピーせずにそのまま渡す。
+        for (size_t i = 0; i < headerCount && !_capture; ++i)
         {
-            header += "; Max-Age=";
-            header += String(cookie.maxAge);
+            const char *value = headers + strlen(headers) + 1;
+            httpd_resp_set_hdr(_raw, headers, value);
+            headers = value + strlen(value) + 1;
         }
-        if (secure)
+        writeBody(data, length);
+        ESP_LOGI(TAG, "[RESP][ERR] %d %s %zu bytes (preformatted)", status, type, length);
+        return true;
+    }
+
+    void Response::storeErrorPage(int status, const char *type, const uint8_t *data, size_t length)
+    {
+        if (!type || length > kMaxMemoizedErrorBody)
         {
-            header += "; Secure";
+            return;
         }
-        if (cookie.httpOnly)
+        // en: Headers the renderer set (everything from _memoHeaderStart on) are stored with the body; headers the
+        //     route set before sendError() belong to that request and are left out.
+        // ja: レンダラーが設定したヘッダ（_memoHeaderStart 以降）はボディと一緒に保持する。sendError() の前に
+        //     ルートが設定したヘッダはそのリクエスト固有のものなので含めない。
+        const size_t typeLen = strlen(type);
+        size_t headersLen = 0;
+        for (size_t i = _memoHeaderStart; i < _headerBuffers.size(); ++i)
         {
-            header += "; HttpOnly";
+            const char *name = _headerBuffers[i].get();
+            const size_t nameLen = strlen(name) + 1;
+            headersLen += nameLen + strlen(name + nameLen) + 1;
         }
-        header += "; SameSite=";
-        switch (sameSite)
+        uint8_t *buffer = new (std::nothrow) uint8_t[typeLen + 1 + headersLen + length];
+        if (!buffer)
         {
-        case Cookie::SameSite::None:
-            header += "None";
-            break;
-        case Cookie::SameSite::Strict:
-            header += "Strict";
-            break;
-        case Cookie::SameSite::Lax:
-        default:
-            header += "Lax";
-            break;
+            return;
         }
+        std::shared_ptr<uint8_t[]> owned(buffer);
+        memcpy(owned.get(), type, typeLen + 1);
+        size_t offset = typeLen + 1;
+        for (size_t i = _memoHeaderStart; i < _headerBuffers.size(); ++i)
+        {
+            const char *name = _headerBuffers[i].get();
+            const size_t nameLen = strlen(name) + 1;
+            const size_t pairLen = nameLen + strlen(name + nameLen) + 1;
+            memcpy(owned.get() + offset, name, pairLen);
+            offset += pairLen;
+        }
+        if (length > 0)
+        {
+            memcpy(owned.get() + offset, data, length);
+        }
+        xSemaphoreTake(errorPageLock(), portMAX_DELAY);
+        const bool exists = std::any_of(_errorPages.begin(), _errorPages.end(), [&](const ErrorPage &page)
+                                        { return page.status == status && strcasecmp(page.contentType, type) == 0; });
+        if (!exists)
+        {
+            ErrorPage page;
+            page.status = status;
+            page.contentType = reinterpret_cast<const char *>(owned.get());
+            page.headers = reinterpret_cast<const char *>(owned.get() + typeLen + 1);
+            page.headerCount = _headerBuffers.size() - _memoHeaderStart;
+            page.data = owned.get() + offset;
+            page.length = length;
+            page.owned = std::move(owned);
+            _errorPages.push_back(std::move(page));
+            ESP_LOGD(TAG, "[RESP][ERR] memoized %d %s %zu bytes, %u headers", status, type, length,
+                     static_cast<unsigned>(_errorPages.back().headerCount));
+        }
+        xSemaphoreGive(errorPageLock());
+    }
 
-        size_t len = header.length();
-        std::unique_ptr<char[]> buf(new (std::nothrow) char[len + 1]);
-        if (!buf)
+    void Response::send(int code, const char *type, const uint8_t *data, size_t len)
+    {
+        if (!_raw)
+            return;
+        _lastStatusCode = code;
+        const String typeStr = type ? String(type) : String();
+        const bool htmlEligible = isHtmlMime(typeStr);
+        const bool needsProcessing = htmlEligible && (_templateHandler || assetRewriteActive() || (_headInjectionPtr && _headInjectionPtr[0]));
+
+        writeHead(code, type);
+        markCommitted();
+
+        if (needsProcessing)
         {
-            ESP_LOGE(TAG, "cookie header alloc failed");
+            StaticInputStream stream(data, len);
+            if (!streamHtmlFromSource(stream))
+            {
+                ESP_LOGE(TAG, "[RESP] %d html processing failed", code);
+                sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+                return;
+            }
+            ESP_LOGI(TAG, "[RESP][TPL] %d %s processed", code, type ? type : "-", len);
             return;
         }
-        memcpy(buf.get(), header.c_str(), len + 1);
-        httpd_resp_set_hdr(_raw, "Set-Cookie", buf.get());
-        _setCookieBuffers.push_back(std::move(buf));
+
+        writeBody(data, len);
+        ESP_LOGI(TAG, "[RESP] %d %s %zu bytes", code, type ? type : "-", len);
+        if (_memoizeStatus == code)
+        {
+            storeErrorPage(code, type, data, len);
+        }
+        _memoizeStatus = 0;
     }
 
-    void Response::clearCookie(const String &name, const String &path)
+    void Response::send(int code, const char *type, const String &body)
     {
-        Cookie c;
-        c.name = name;
-        c.value = "";
-        c.path = path;
-        c.maxAge = 0;
-        setCookie(c);
+        send(code, type, reinterpret_cast<const uint8_t *>(body.c_str()), body.length());
     }
 
-    void Response::setStaticFileSystem(fs::FS *fs)
+    void Response::sendText(int code, const char *type, const char *text)
     {
-        _staticSource = fs ? StaticSourceType::FileSystem : StaticSourceType::None;
-        _staticFs = fs;
-        _memData = nullptr;
-        _memSize = 0;
+        send(code, type, reinterpret_cast<const uint8_t *>(text), strlen(text));
     }
 
-    void Response::setStaticMemorySource(const uint8_t *data, size_t size)
+    void Response::sendText(int code, const char *type, const String &text)
     {
-        if (data || size == 0)
-        {
-            _staticSource = StaticSourceType::Memory;
-            _memData = data;
-            _memSize = size;
-        }
-        else
-        {
-            clearStaticSource();
-        }
-        _staticFs = nullptr;
+        send(code, type, reinterpret_cast<const uint8_t *>(text.c_str()), text.length());
     }
 
-    void Response::clearStaticSource()
+    void Response::beginChunked(int code, const char *type)
     {
-        _staticSource = StaticSourceType::None;
-        _staticFs = nullptr;
-        _memData = nullptr;
-        _memSize = 0;
+        if (!_raw)
+            return;
+        _chunked = true;
+        _lastStatusCode = code;
+        writeHead(code, type);
+        ESP_LOGI(TAG, "[RESP] %d %s (chunked)", code, type ? type : "-");
+        markCommitted();
     }
 
-    const char *Response::statusString(int code)
+    void Response::sendChunk(const uint8_t *data, size_t len)
     {
-        snprintf(_statusBuffer, sizeof(_statusBuffer), "%d", code);
-        return _statusBuffer;
+        if (!_raw || !_chunked)
+            return;
+        writeBodyChunk(data, len);
     }
 
-    void Response::setRequestContext(Request *req)
+    void Response::sendChunk(const char *text)
     {
-        _requestContext = req;
+        sendChunk(reinterpret_cast<const uint8_t *>(text), strlen(text));
     }
 
-    void Response::markCommitted()
+    void Response::sendChunk(const String &text)
     {
-        _responseCommitted = true;
+        sendChunk(reinterpret_cast<const uint8_t *>(text.c_str()), text.length());
     }
 
-    const char *Response::defaultErrorMessage(int status)
+    void Response::endChunked()
     {
-        switch (status)
+        if (!_raw || !_chunked)
+            return;
+        endBody();
+        _chunked = false;
+        ESP_LOGI(TAG, "[RESP] chunked end (%d)", _lastStatusCode);
+    }
+
+    void Response::sendStream(int code, const char *type, ChunkSource source, size_t sizeHint)
+    {
+        if (!_raw || !source)
+            return;
+        _chunked = false;
+        _lastStatusCode = code;
+        writeHead(code, type ? type : "application/octet-stream");
+        ESP_LOGI(TAG, "[RESP] %d %s (stream)", code, type ? type : "-");
+        markCommitted();
+        if (!streamBody(std::move(source), sizeHint, nullptr, true))
         {
-        case 400:
-            return "Bad Request";
-        case 401:
-            return "Unauthorized";
-        case 403:
-            return "Forbidden";
-        case 404:
-            return "Not Found";
-        case 405:
-            return "Method Not Allowed";
-        case 500:
-            return "Internal Server Error";
-        case 503:
-            return "Service Unavailable";
-        default:
-            return "Error";
+            ESP_LOGE(TAG, "[RESP] stream aborted (%d)", code);
         }
     }
 
-    ErrorRenderer Response::_errorRenderer;
-
-    bool Response::streamHtmlFromSource(StaticInputStream &stream)
+    // en: Single body path for static and generated responses: blocking loop, or a cooperative hand-off when enabled.
+    // ja: 静的・生成レスポンス共通のボディ送信経路。ブロッキングのループ、または有効時は協調送信へ引き継ぐ。
+    bool Response::streamBody(ChunkSource source, size_t sizeHint, std::function<void()> onDone, bool allowCooperative)
     {
-        if (!_raw || !stream.valid())
+        if (allowCooperative && !_capture && _server && _server->startCooperativeStream(_raw, _trafficClass, source, onDone, sizeHint))
         {
-            return false;
+            return true;
         }
 
-        constexpr size_t kChunkLimit = 512;
-        String chunk;
-        chunk.reserve(kChunkLimit);
-
-        const bool templateActive = static_cast<bool>(_templateHandler);
-        const char *headSnippet = (_headInjectionPtr && _headInjectionPtr[0]) ? _headInjectionPtr : nullptr;
-        bool snippetInserted = (headSnippet == nullptr);
-        constexpr char kHeadToken[] = "<head";
-        constexpr int kHeadTokenLen = sizeof(kHeadToken) - 1;
-        int headMatchIdx = 0;
-        bool awaitingHeadBoundary = false;
-        bool waitingHeadClose = false;
-
-        auto flushChunk = [&]() -> bool
+        size_t capacity = bodyChunkSize();
+        ClassBuffer<uint8_t> buffer = Server::allocateBuffer<uint8_t>(_server, AllocClass::IoBuffer, capacity);
+        bool ok = static_cast<bool>(buffer);
+        if (!ok)
         {
-            if (chunk.isEmpty())
+            ESP_LOGE(TAG, "Failed to allocate stream buffer");
+        }
+        while (ok)
+        {
+            if (_server)
             {
-                return true;
+                _server->fitChunkBuffer(buffer, capacity, _sendProgress.chunkSize);
             }
-            if (httpd_resp_send_chunk(_raw, chunk.c_str(), chunk.length()) != ESP_OK)
+            const size_t len = source(buffer.get(), bodyChunkSize());
+            if (len == 0)
             {
-                return false;
+                endBody();
+                break;
             }
-            chunk.clear();
-            return true;
-        };
-
-        auto appendRawChar = [&](char c) -> bool
+            ok = writeBodyChunk(buffer.get(), len) == ESP_OK;
+        }
+        if (onDone)
         {
-            chunk += c;
-            if (chunk.length() >= kChunkLimit)
-            {
-                return flushChunk();
-            }
-            return true;
-        };
+            onDone();
+        }
+        return ok;
+    }
 
-        auto appendRawString = [&](const char *text) -> bool
+    esp_err_t Response::writeBodyChunk(const uint8_t *data, size_t len)
+    {
+        if (_capture)
         {
-            if (!text)
+            return writeBody(data, len);
+        }
+        if (_server)
+        {
+            bodyChunkSize();
+            return _server->sendBodyChunk(_raw, _trafficClass, data, len, _sendProgress);
+        }
+        return httpd_resp_send_chunk(_raw, reinterpret_cast<const char *>(data), len);
+    }
+
+    void Response::writeHead(int code, const char *type)
+    {
+        if (_capture)
+        {
+            _capture->status = code;
+            if (type)
             {
-                return true;
+                _capture->contentType = type;
             }
-            while (*text)
+            return;
+        }
+        if (type)
+        {
+            httpd_resp_set_type(_raw, type);
+        }
+        httpd_resp_set_status(_raw, statusString(code));
+    }
+
+    // en: Whole-body send; in capture mode the bytes are appended up to the capture's capacity.
+    // ja: ボディ一括送信。キャプチャ中は容量まで追記する。
+    esp_err_t Response::writeBody(const uint8_t *data, size_t len)
+    {
+        if (!_capture)
+        {
+            return httpd_resp_send(_raw, reinterpret_cast<const char *>(data), len);
+        }
+        const size_t room = _capture->capacity - _capture->length;
+        const size_t take = std::min(room, len);
+        if (take > 0)
+        {
+            memcpy(_capture->data + _capture->length, data, take);
+            _capture->length += take;
+        }
+        if (take < len)
+        {
+            _capture->truncated = true;
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t Response::endBody()
+    {
+        return _capture ? ESP_OK : httpd_resp_send_chunk(_raw, nullptr, 0);
+    }
+
+    size_t Response::bodyChunkSize()
+    {
+        if (_sendProgress.chunkSize == 0)
+        {
+            _sendProgress.chunkSize = _server ? _server->initialChunkSize() : kStreamChunkSize;
+        }
+        return _sendProgress.chunkSize;
+    }
+
+    void Response::sendEarlyHints(const String &logicalPath)
+    {
+        if (_earlyHints.isEmpty())
+        {
+            return;
+        }
+        String hints = "HTTP/1.1 103 Early Hints\r\nLink: ";
+        hints += _earlyHints;
+        hints += "\r\n\r\n";
+        _earlyHints = String();
+        if (httpd_send(_raw, hints.c_str(), hints.length()) < 0)
+        {
+            ESP_LOGW(TAG, "[RESP] failed to send 103 Early Hints");
+            return;
+        }
+        ESP_LOGD(TAG, "[RESP] 103 %s", logicalPath.c_str());
+    }
+
+    void Response::sendStatic()
+    {
+        if (!_raw)
+            return;
+
+        if (_staticSource == StaticSourceType::None)
+        {
+            ESP_LOGE(TAG, "Static source missing");
+            sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        if (!_staticInfo.exists)
+        {
+            String missingPath = _staticInfo.logicalPath;
+            if (missingPath.isEmpty())
             {
-                if (!appendRawChar(*text++))
-                {
-                    return false;
-                }
+                missingPath = _staticInfo.relPath;
             }
-            return true;
-        };
+            ESP_LOGI(TAG, "[RESP] 404 static %s", missingPath.c_str());
+            sendError(HTTPD_404_NOT_FOUND);
+            return;
+        }
 
-        auto emitChar = [&](char c) -> bool
+        String logicalPath = _staticInfo.logicalPath;
+        if (logicalPath.isEmpty())
         {
-            if (!snippetInserted)
+            logicalPath = _staticInfo.relPath;
+        }
+        if (!_staticInfo.etag.isEmpty())
+        {
+            setHeader("ETag", _staticInfo.etag);
+            const String ifNoneMatch = _requestContext ? _requestContext->header("If-None-Match") : String();
+            if (!ifNoneMatch.isEmpty() && (ifNoneMatch == "*" || ifNoneMatch.indexOf(_staticInfo.etag) >= 0))
             {
-                const char lower = static_cast<char>(tolower(static_cast<unsigned char>(c)));
-                if (!awaitingHeadBoundary && !waitingHeadClose)
-                {
-                    if (lower == kHeadToken[headMatchIdx])
-                    {
-                        headMatchIdx++;
-                        if (headMatchIdx == kHeadTokenLen)
-                        {
-                            awaitingHeadBoundary = true;
-                            headMatchIdx = 0;
-                        }
-                    }
-                    else
-                    {
-                        if (lower == kHeadToken[0])
-                        {
-                            headMatchIdx = 1;
-                        }
-                        else
-                        {
-                            headMatchIdx = 0;
-                        }
-                    }
-                }
-                else if (awaitingHeadBoundary)
+                _lastStatusCode = 304;
+                if (_capture)
                 {
-                    if (c == '>' || c == '/' || isspace(static_cast<unsigned char>(c)))
-                    {
-                        awaitingHeadBoundary = false;
-                        if (c == '>')
-                        {
-                            if (!appendRawChar(c))
-                            {
-                                return false;
-                            }
-                            if (headSnippet && headSnippet[0])
-                            {
-                                if (!appendRawString(headSnippet))
-                                {
-                                    return false;
-                                }
-                            }
-                            snippetInserted = true;
-                            return true;
-                        }
-                        waitingHeadClose = true;
-                    }
-                    else
-                    {
-                        awaitingHeadBoundary = false;
-                    }
+                    writeHead(304, nullptr);
                 }
-                else if (waitingHeadClose && c == '>')
+                else
                 {
-                    waitingHeadClose = false;
-                    if (!appendRawChar(c))
-                    {
-                        return false;
-                    }
-                    if (headSnippet && headSnippet[0])
-                    {
-                        if (!appendRawString(headSnippet))
-                        {
-                            return false;
-                        }
-                    }
-                    snippetInserted = true;
-                    return true;
+                    httpd_resp_set_status(_raw, "304 Not Modified");
+                    httpd_resp_send(_raw, nullptr, 0);
                 }
+                markCommitted();
+                ESP_LOGI(TAG, "[RESP][STATIC] 304 %s", logicalPath.c_str());
+                return;
             }
-            return appendRawChar(c);
-        };
+        }
 
-        auto emitString = [&](const String &text) -> bool
+        const String mime = _staticMimeType ? String(_staticMimeType) : determineMimeType(logicalPath);
+        constexpr int kStaticStatusCode = 200;
+        if (_capture)
         {
-            for (size_t i = 0; i < text.length(); ++i)
+            writeHead(kStaticStatusCode, mime.c_str());
+        }
+        else
+        {
+            sendEarlyHints(logicalPath);
+            httpd_resp_set_type(_raw, mime.c_str());
+            httpd_resp_set_status(_raw, HTTPD_200);
+        }
+        _lastStatusCode = kStaticStatusCode;
+        markCommitted();
+
+        const char *sourceLabel = "NONE";
+        const char *originPath = "-";
+        if (_staticSource == StaticSourceType::FileSystem)
+        {
+            sourceLabel = "FS";
+            originPath = _staticInfo.fsPath.c_str();
+        }
+        else if (_staticSource == StaticSourceType::Memory)
+        {
+            sourceLabel = "MEM";
+        }
+        ESP_LOGI(TAG,
+                 "[RESP][STATIC][%s] %d %s (%s) origin=%s",
+                 sourceLabel,
+                 kStaticStatusCode,
+                 logicalPath.c_str(),
+                 _staticInfo.isGzipped ? "gzip" : "plain",
+                 originPath);
+
+        const bool htmlEligible = !_staticInfo.isGzipped && isHtmlMime(mime);
+        if (_staticInfo.isGzipped)
+        {
+            if (_capture)
             {
-                if (!emitChar(text.charAt(i)))
-                {
-                    return false;
-                }
+                _capture->gzip = true;
             }
-            return true;
-        };
+            else
+            {
+                httpd_resp_set_hdr(_raw, "Content-Encoding", "gzip");
+            }
+        }
 
-        auto emitRepeat = [&](char c, int count) -> bool
+        const bool needsProcessing = htmlEligible && (_templateHandler || assetRewriteActive() || (_headInjectionPtr && _headInjectionPtr[0]));
+        if (!needsProcessing)
         {
-            for (int i = 0; i < count; ++i)
+            bool ok = false;
+            if (_staticSource == StaticSourceType::FileSystem)
             {
-                if (!emitChar(c))
+                int slot = -1;
+                File file = openStaticFile(slot);
+                if (!file)
                 {
-                    return false;
+                    ESP_LOGE(TAG, "Failed to open %s", _staticInfo.fsPath.c_str());
+                }
+                else
+                {
+                    // en: The closures own the handle, so they stay valid if the body continues after this Response is gone.
+                    // ja: ハンドルはクロージャが保持するため、Response 破棄後にボディ送信が続いても有効。
+                    const bool borrowed = (slot == kBorrowedFileSlot);
+                    Server *server = _server;
+                    ok = streamBody([file](uint8_t *buffer, size_t capacity) mutable
+                                    { return file.read(buffer, capacity); },
+                                    file.size(),
+                                    [server, file, slot]() mutable
+                                    {
+                                        if (slot == kBorrowedFileSlot)
+                                        {
+                                            return;
+                                        }
+                                        if (server)
+                                        {
+                                            server->releaseFile(file, slot);
+                                        }
+                                        else if (file)
+                                        {
+                                            file.close();
+                                        }
+                                    },
+                                    !borrowed);
                 }
             }
-            return true;
-        };
+            else if (_memData || _memSize == 0)
+            {
+                const uint8_t *data = _memData;
+                const size_t size = _memSize;
+                size_t offset = 0;
+                ok = streamBody([data, size, offset](uint8_t *buffer, size_t capacity) mutable
+                                {
+                                    const size_t len = std::min(capacity, size - offset);
+                                    memcpy(buffer, data + offset, len);
+                                    offset += len;
+                                    return len; },
+                                size, nullptr, true);
+            }
+            if (!ok)
+            {
+                ESP_LOGE(TAG, "[RESP] 500 static stream failed (%s)", logicalPath.c_str());
+                sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+            }
+            return;
+        }
 
-        enum class TemplateState
+        bool ok = false;
+        if (_staticSource == StaticSourceType::FileSystem)
         {
-            Normal,
-            OpenBrace,
-            Placeholder
-        };
+            int slot = -1;
+            File file = openStaticFile(slot);
+            {
+                StaticInputStream stream(file);
+                ok = streamHtmlFromSource(stream);
+            }
+            closeStaticFile(file, slot);
+        }
+        else
+        {
+            StaticInputStream stream(_memData, _memSize);
+            ok = streamHtmlFromSource(stream);
+        }
+        if (!ok)
+        {
+            ESP_LOGE(TAG, "[RESP] 500 static html stream failed (%s)", logicalPath.c_str());
+            sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+        }
+    }
 
-        TemplateState state = TemplateState::Normal;
-        int braceCount = 0;
-        bool waitingThird = false;
-        bool triple = false;
-        int closingCount = 0;
-        String placeholderRaw;
+    // en: Opens the path once: existence, size and directory-ness come from that handle, which is then streamed.
+    // ja: パスを 1 回だけ開き、存在・サイズ・ディレクトリ判定をそのハンドルから得て、そのまま送信に使う。
+    void Response::sendFile(fs::FS &fs, const String &fsPath)
+    {
+        StaticInfo info;
+        info.uri = fsPath;
+        info.relPath = fsPath;
+        info.fsPath = fsPath;
+        info.isGzipped = fsPath.endsWith(".gz");
+        info.logicalPath = info.isGzipped ? fsPath.substring(0, fsPath.length() - 3) : fsPath;
 
-        char ch;
-        while (stream.readChar(ch))
+        int slot = -1;
+        File file = _server ? _server->acquireFile(&fs, fsPath, slot) : fs.open(fsPath, "r");
+        if (file)
         {
-            bool reprocess = true;
-            while (reprocess)
-            {
-                reprocess = false;
-                switch (state)
-                {
-                case TemplateState::Normal:
-                    if (templateActive && ch == '{')
-                    {
-                        state = TemplateState::OpenBrace;
-                        braceCount = 1;
-                    }
-                    else
+            info.isDir = file.isDirectory();
+            info.exists = !info.isDir;
+            info.size = info.isDir ? 0 : file.size();
+        }
+
+        setStaticFileSystem(&fs);
+        setStaticInfo(info);
+        if (info.exists)
+        {
+            setPendingStaticFile(file, slot);
+        }
+        else
+        {
+            closeStaticFile(file, slot);
+        }
+        sendStatic();
+        releasePendingStaticFile();
+    }
+
+    // en: Streams a handle the caller already holds from the start; the caller keeps ownership and closes it.
+    // ja: 呼び出し側が保持するハンドルを先頭から送信する。所有権は呼び出し側に残り、クローズも呼び出し側が行う。
+    void Response::sendFile(File &file)
+    {
+        StaticInfo info;
+        const String fsPath = file ? String(file.path()) : String();
+        info.uri = fsPath;
+        info.relPath = fsPath;
+        info.fsPath = fsPath;
+        info.isGzipped = fsPath.endsWith(".gz");
+        info.logicalPath = info.isGzipped ? fsPath.substring(0, fsPath.length() - 3) : fsPath;
+        info.isDir = file && file.isDirectory();
+        info.exists = file && !info.isDir;
+        info.size = info.exists ? file.size() : 0;
+
+        clearStaticSource();
+        _staticSource = StaticSourceType::FileSystem;
+        setStaticInfo(info);
+        if (info.exists)
+        {
+            setPendingStaticFile(file, kBorrowedFileSlot);
+        }
+        sendStatic();
+        releasePendingStaticFile();
+    }
+
+    void Response::sendFragment(const String &block)
+    {
+        if (!_raw)
+            return;
+
+        if (_staticSource == StaticSourceType::None || !_staticInfo.exists)
+        {
+            sendError(HTTPD_404_NOT_FOUND);
+            return;
+        }
+        // en: Blocks are located in the template text, so a gzip source falls back to its plain sibling (FS only).
+        // ja: ブロックはテンプレート本文から探すため、gzip のソースは平文の兄弟ファイルに切り替える（FS のみ）。
+        if (_staticInfo.isGzipped)
+        {
+            if (_staticSource != StaticSourceType::FileSystem || !_staticInfo.fsPath.endsWith(".gz"))
+            {
+                ESP_LOGE(TAG, "[RESP][FRAG] %s: gzip-only source", _staticInfo.logicalPath.c_str());
+                sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+                return;
+            }
+            _staticInfo.fsPath.remove(_staticInfo.fsPath.length() - 3);
+            _staticInfo.isGzipped = false;
+        }
+
+        _chunked = false;
+        bool found = false;
+        bool ok = false;
+        if (_staticSource == StaticSourceType::FileSystem)
+        {
+            int slot = -1;
+            File file = openStaticFile(slot);
+            {
+                StaticInputStream stream(file);
+                ok = streamHtmlFromSource(stream, &block, &found);
+            }
+            closeStaticFile(file, slot);
+        }
+        else
+        {
+            StaticInputStream stream(_memData, _memSize);
+            ok = streamHtmlFromSource(stream, &block, &found);
+        }
+        if (!found)
+        {
+            ESP_LOGI(TAG, "[RESP][FRAG] 404 %s#%s", _staticInfo.logicalPath.c_str(), block.c_str());
+            sendError(HTTPD_404_NOT_FOUND);
+            return;
+        }
+        if (!ok)
+        {
+            ESP_LOGE(TAG, "[RESP][FRAG] %s#%s stream failed", _staticInfo.logicalPath.c_str(), block.c_str());
+            return;
+        }
+        ESP_LOGI(TAG, "[RESP][FRAG] 200 %s#%s", _staticInfo.logicalPath.c_str(), block.c_str());
+    }
+
+    void Response::sendFragment(fs::FS &fs, const String &fsPath, const String &block)
+    {
+        StaticInfo info;
+        info.uri = fsPath;
+        info.relPath = fsPath;
+        info.fsPath = fsPath;
+        info.logicalPath = fsPath;
+
+        int slot = -1;
+        File file = _server ? _server->acquireFile(&fs, fsPath, slot) : fs.open(fsPath, "r");
+        info.isDir = file && file.isDirectory();
+        info.exists = file && !info.isDir;
+        info.size = info.exists ? file.size() : 0;
+
+        setStaticFileSystem(&fs);
+        setStaticInfo(info);
+        if (info.exists)
+        {
+            setPendingStaticFile(file, slot);
+        }
+        else
+        {
+            closeStaticFile(file, slot);
+        }
+        sendFragment(block);
+        releasePendingStaticFile();
+    }
+
+    void Response::sendFragment(const uint8_t *data, size_t len, const String &block)
+    {
+        StaticInfo info;
+        info.exists = (data || len == 0);
+        info.size = len;
+        setStaticMemorySource(data, len);
+        setStaticInfo(info);
+        sendFragment(block);
+    }
+
+    namespace
+    {
+        // en: Fixed-buffer writer for listings and batch results: escapes straight into one kCapacity buffer (allocated by
+        //     the caller as AllocClass::IoBuffer, off the httpd task stack) and flushes it as a chunk.
+        // ja: 一覧・バッチ結果用の固定バッファライタ。呼び出し側が AllocClass::IoBuffer で確保した kCapacity の
+        //     バッファ（httpd タスクのスタック外）へ直接エスケープし、満杯になればチャンク送信する。
+        class ListingWriter
+        {
+        public:
+            static constexpr size_t kCapacity = 512;
+
+            ListingWriter(Response &res, char *buffer) : _res(res), _buffer(buffer) {}
+
+            void put(char c)
+            {
+                if (_len == kCapacity)
+                {
+                    flush();
+                }
+                _buffer[_len++] = c;
+            }
+
+            void raw(const char *text)
+            {
+                while (text && *text)
+                {
+                    put(*text++);
+                }
+            }
+
+            void number(uint64_t value)
+            {
+                char digits[24];
+                snprintf(digits, sizeof(digits), "%llu", static_cast<unsigned long long>(value));
+                raw(digits);
+            }
+
+            void json(const char *text)
+            {
+                json(text, text ? strlen(text) : 0);
+            }
+
+            void json(const char *text, size_t len)
+            {
+                for (size_t i = 0; i < len; ++i)
+                {
+                    const unsigned char c = static_cast<unsigned char>(text[i]);
+                    if (c == '"' || c == '\\')
                     {
-                        if (!emitChar(ch))
-                        {
-                            return false;
-                        }
+                        put('\\');
+                        put(static_cast<char>(c));
                     }
-                    break;
-                case TemplateState::OpenBrace:
-                    if (templateActive && ch == '{')
+                    else if (c < 0x20)
                     {
-                        braceCount++;
-                        if (braceCount == 2)
-                        {
-                            state = TemplateState::Placeholder;
-                            placeholderRaw.clear();
-                            waitingThird = true;
-                            triple = false;
-                            closingCount = 0;
-                        }
+                        char escaped[8];
+                        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                        raw(escaped);
                     }
                     else
                     {
-                        if (!emitRepeat('{', braceCount))
-                        {
-                            return false;
-                        }
-                        braceCount = 0;
-                        state = TemplateState::Normal;
-                        reprocess = true;
+                        put(static_cast<char>(c));
                     }
-                    break;
-                case TemplateState::Placeholder:
-                    if (waitingThird)
+                }
+            }
+
+            void html(const char *text)
+            {
+                for (const char *p = text; p && *p; ++p)
+                {
+                    switch (*p)
                     {
-                        if (ch == '{')
-                        {
-                            triple = true;
-                            waitingThird = false;
-                            continue;
-                        }
-                        waitingThird = false;
-                        reprocess = true;
-                        continue;
+                    case '&':
+                        raw("&amp;");
+                        break;
+                    case '<':
+                        raw("&lt;");
+                        break;
+                    case '>':
+                        raw("&gt;");
+                        break;
+                    case '"':
+                        raw("&quot;");
+                        break;
+                    case '\'':
+                        raw("&#39;");
+                        break;
+                    default:
+                        put(*p);
+                        break;
                     }
-                    if (ch == '}')
+                }
+            }
+
+            void url(const char *text)
+            {
+                static const char kHex[] = "0123456789ABCDEF";
+                for (const char *p = text; p && *p; ++p)
+                {
+                    const unsigned char c = static_cast<unsigned char>(*p);
+                    if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' || c == '/')
                     {
-                        closingCount++;
-                        const int needed = triple ? 3 : 2;
-                        if (closingCount == needed)
-                        {
-                            String key = placeholderRaw;
-                            key.trim();
-                            bool handled = false;
-                            String replacement;
-                            if (_templateHandler && !key.isEmpty())
-                            {
-                                StringBuilderPrint printer(replacement);
-                                handled = _templateHandler(key, printer);
-                            }
-                            if (handled)
-                            {
-                                if (!triple)
-                                {
-                                    replacement = htmlEscape(replacement);
-                                }
-                                if (!emitString(replacement))
-                                {
-                                    return false;
-                                }
-                            }
-                            else
-                            {
-                                if (!emitRepeat('{', needed))
-                                {
-                                    return false;
-                                }
-                                if (!emitString(placeholderRaw))
-                                {
-                                    return false;
-                                }
-                                if (!emitRepeat('}', needed))
-                                {
-                                    return false;
-                                }
-                            }
-                            placeholderRaw.clear();
-                            closingCount = 0;
-                            triple = false;
-                            state = TemplateState::Normal;
-                            braceCount = 0;
-                        }
-                        continue;
+                        put(static_cast<char>(c));
                     }
-                    if (closingCount > 0)
+                    else
                     {
-                        for (int i = 0; i < closingCount; ++i)
-                        {
-                            placeholderRaw += '}';
-                        }
-                        closingCount = 0;
+                        put('%');
+                        put(kHex[c >> 4]);
+                        put(kHex[c & 0x0F]);
                     }
-                    placeholderRaw += ch;
-                    break;
+                }
+            }
+
+            void flush()
+            {
+                if (_len > 0)
+                {
+                    _res.sendChunk(reinterpret_cast<const uint8_t *>(_buffer), _len);
+                    _len = 0;
+                }
+            }
+
+        private:
+            Response &_res;
+            char *_buffer;
+            size_t _len = 0;
+        };
+
+        struct ListingRow
+        {
+            char name[256];
+            uint32_t size;
+            bool isDir;
+        };
+
+        const char *baseName(const char *path)
+        {
+            if (!path)
+            {
+                return "";
+            }
+            const char *slash = strrchr(path, '/');
+            return slash ? slash + 1 : path;
+        }
+
+        void writeListingRow(ListingWriter &out, const DirectoryListingOptions &options, bool first, const char *name, bool isDir, uint32_t size)
+        {
+            if (options.format == DirectoryListingOptions::Format::Json)
+            {
+                out.raw(first ? "{\"name\":\"" : ",{\"name\":\"");
+                out.json(name);
+                out.raw(isDir ? "\",\"dir\":true,\"size\":" : "\",\"dir\":false,\"size\":");
+                out.number(size);
+                out.put('}');
+                return;
+            }
+            out.raw("<li><a href=\"");
+            out.html(options.entryLinkPrefix.c_str());
+            out.url(name);
+            if (isDir)
+            {
+                out.put('/');
+            }
+            out.raw("\">");
+            out.html(name);
+            if (isDir)
+            {
+                out.raw("/</a></li>\n");
+                return;
+            }
+            out.raw("</a> ");
+            out.number(size);
+            out.raw("</li>\n");
+        }
+    } // namespace
+
+    // en: Streams one page of a directory in constant memory: entries are read with openNextFile() and escaped
+    //     straight into a fixed chunk buffer. Only sortByName keeps the page (at most kMaxSortWindow rows) in memory.
+    // ja: ディレクトリの 1 ページを定数メモリで送信する。openNextFile() で読んだエントリを固定チャンクバッファへ
+    //     直接エスケープする。ページを保持するのは sortByName 指定時のみ（最大 kMaxSortWindow 行）。
+    void Response::sendDirectoryListing(fs::FS &fs, const String &dirPath, const DirectoryListingOptions &options)
+    {
+        if (!_raw)
+            return;
+
+        const String openPath = dirPath.isEmpty() ? String("/") : dirPath;
+        File dir = fs.open(openPath);
+        if (!dir || !dir.isDirectory())
+        {
+            if (dir)
+            {
+                dir.close();
+            }
+            sendError(HTTPD_404_NOT_FOUND);
+            return;
+        }
+
+        const size_t maxLimit = DirectoryListingOptions::kMaxLimit;
+        const size_t maxSortWindow = DirectoryListingOptions::kMaxSortWindow;
+        size_t limit = options.limit == 0 ? 1 : std::min(options.limit, maxLimit);
+        ClassBuffer<char> writerBuffer = Server::allocateBuffer<char>(_server, AllocClass::IoBuffer, ListingWriter::kCapacity);
+        if (!writerBuffer)
+        {
+            dir.close();
+            ESP_LOGE(TAG, "[RESP] 500 listing buffer alloc failed");
+            sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+            return;
+        }
+        ClassBuffer<ListingRow> rows;
+        if (options.sortByName)
+        {
+            limit = std::min(limit, maxSortWindow);
+            rows = Server::allocateBuffer<ListingRow>(_server, AllocClass::IoBuffer, limit);
+            if (!rows)
+            {
+                dir.close();
+                ESP_LOGE(TAG, "[RESP] 500 listing window alloc failed");
+                sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+                return;
+            }
+        }
+
+        // en: The cursor is "<offset>:<name>": the last entry of the previous page and its position in directory
+        //     order. Resuming right after that name means entries added or removed before it do not shift the page;
+        //     when the entry itself is gone, the page resumes at its old position. Skipped entries are not opened.
+        // ja: カーソルは "<offset>:<name>"（前ページ最後のエントリ名と、そのディレクトリ順での位置）。その名前の直後から
+        //     再開するため、手前でエントリが増減してもページがずれない。そのエントリ自体が消えた場合は元の位置から再開する。
+        //     読み飛ばすエントリは open しない。
+        char *anchor = nullptr;
+        const size_t offset = strtoul(options.cursor.c_str(), &anchor, 10);
+        if (!anchor || *anchor != ':' || !anchor[1])
+        {
+            anchor = nullptr;
+        }
+        size_t skipped = 0;
+        bool anchored = false;
+        while (anchor && !anchored)
+        {
+            bool isDir = false;
+            const String entry = dir.getNextFileName(&isDir);
+            if (entry.isEmpty())
+            {
+                break;
+            }
+            ++skipped;
+            anchored = strcmp(baseName(entry.c_str()), anchor + 1) == 0;
+        }
+        size_t resumeAt = offset;
+        if (anchor && !anchored)
+        {
+            dir.rewindDirectory();
+            skipped = 0;
+            resumeAt = offset > 0 ? offset - 1 : 0;
+        }
+        while (!anchored && skipped < resumeAt)
+        {
+            bool isDir = false;
+            if (dir.getNextFileName(&isDir).isEmpty())
+            {
+                break;
+            }
+            ++skipped;
+        }
+
+        const bool json = options.format == DirectoryListingOptions::Format::Json;
+        beginChunked(200, json ? "application/json" : "text/html");
+        ListingWriter out(*this, writerBuffer.get());
+        if (json)
+        {
+            out.raw("{\"path\":\"");
+            out.json(openPath.c_str());
+            out.raw("\",\"entries\":[");
+        }
+        else
+        {
+            out.raw("<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>Index of ");
+            out.html(openPath.c_str());
+            out.raw("</title></head><body>\n<h1>Index of ");
+            out.html(openPath.c_str());
+            out.raw("</h1>\n<ul>\n");
+        }
+
+        size_t count = 0;
+        char last[sizeof(ListingRow::name)] = {0}; // last entry in directory order, for the next cursor
+        while (count < limit)
+        {
+            File item = dir.openNextFile();
+            if (!item)
+            {
+                break;
+            }
+            const char *name = baseName(item.name());
+            strncpy(last, name, sizeof(last) - 1);
+            const bool isDir = item.isDirectory();
+            const uint32_t size = isDir ? 0 : static_cast<uint32_t>(item.size());
+            if (rows)
+            {
+                ListingRow &row = rows[count];
+                strncpy(row.name, name, sizeof(row.name) - 1);
+                row.name[sizeof(row.name) - 1] = '\0';
+                row.size = size;
+                row.isDir = isDir;
+            }
+            else
+            {
+                writeListingRow(out, options, count == 0, name, isDir, size);
+            }
+            item.close();
+            ++count;
+        }
+
+        if (rows)
+        {
+            std::sort(rows.get(), rows.get() + count, [](const ListingRow &a, const ListingRow &b)
+                      { return strcmp(a.name, b.name) < 0; });
+            for (size_t i = 0; i < count; ++i)
+            {
+                writeListingRow(out, options, i == 0, rows[i].name, rows[i].isDir, rows[i].size);
+            }
+        }
+
+        bool isDir = false;
+        const bool more = count == limit && !dir.getNextFileName(&isDir).isEmpty();
+        dir.close();
+        const uint64_t next = static_cast<uint64_t>(skipped) + count;
+
+        if (json)
+        {
+            out.raw("],\"next\":");
+            if (more)
+            {
+                out.put('"');
+                out.number(next);
+                out.put(':');
+                out.json(last);
+                out.put('"');
+            }
+            else
+            {
+                out.raw("null");
+            }
+            out.put('}');
+        }
+        else
+        {
+            out.raw("</ul>\n");
+            if (more)
+            {
+                out.raw("<p><a href=\"");
+                out.html(options.pageLinkPrefix.c_str());
+                out.number(next);
+                out.raw("%3A");
+                out.url(last);
+                out.raw("\">Next page</a></p>\n");
+            }
+            out.raw("</body></html>\n");
+        }
+        out.flush();
+        endChunked();
+    }
+
+    void Response::sendError(int status)
+    {
+        if (!_raw)
+            return;
+        _chunked = false;
+        _lastStatusCode = status;
+        writeHead(status, nullptr);
+        ESP_LOGI(TAG, "[RESP][ERR] %d", status);
+        // en: Snapshot the shared error settings so another task may replace them while this one renders.
+        // ja: 共有のエラー設定をスナップショットし、描画中に他タスクが差し替えても影響を受けないようにする。
+        ErrorRenderer renderer;
+        xSemaphoreTake(errorPageLock(), portMAX_DELAY);
+        const bool hasPages = !_errorPages.empty();
+        const bool memoize = std::find(_memoizedErrorStatuses.begin(), _memoizedErrorStatuses.end(), status) != _memoizedErrorStatuses.end();
+        if (_requestContext)
+        {
+            renderer = _errorRenderer;
+        }
+        xSemaphoreGive(errorPageLock());
+        // en: The response is committed only after the page is written, so the renderer's setHeader()/setCookie()
+        //     calls still apply.
+        // ja: ページを書き終えてからコミット扱いにするため、レンダラー内の setHeader()/setCookie() も反映される。
+        if (hasPages && sendErrorPage(status))
+        {
+            markCommitted();
+            return;
+        }
+        if (renderer)
+        {
+            _memoizeStatus = memoize ? status : 0;
+            _memoHeaderStart = _headerBuffers.size();
+            renderer(status, *_requestContext, *this);
+            _memoizeStatus = 0;
+            markCommitted();
+            return;
+        }
+        const char *message = defaultErrorMessage(status);
+        writeHead(status, "text/plain");
+        writeBody(reinterpret_cast<const uint8_t *>(message), strlen(message));
+        markCommitted();
+    }
+
+    bool Response::committed() const
+    {
+        return _responseCommitted;
+    }
+
+    void Response::redirect(const char *location, int status)
+    {
+        if (!_raw)
+            return;
+        _lastStatusCode = status;
+        writeHead(status, nullptr);
+        if (!_capture)
+        {
+            httpd_resp_set_hdr(_raw, "Location", location);
+        }
+        writeBody(nullptr, 0);
+        ESP_LOGI(TAG, "[RESP] %d redirect -> %s", status, location);
+        markCommitted();
+    }
+
+    void Response::setStaticInfo(const StaticInfo &info)
+    {
+        _staticInfo = info;
+    }
+
+    void Response::setCookie(const Cookie &cookie)
+    {
+        // en: Captured sub-responses carry only status, type and body.
+        // ja: キャプチャしたサブレスポンスはステータス・タイプ・ボディのみを保持する。
+        if (!_raw || _capture)
+        {
+            return;
+        }
+        if (_responseCommitted)
+        {
+            ESP_LOGW(TAG, "Set-Cookie after commit ignored");
+            return;
+        }
+        if (cookie.name.isEmpty() || containsControlChars(cookie.name) || containsControlChars(cookie.value))
+        {
+            ESP_LOGW(TAG, "invalid cookie skipped");
+            return;
+        }
+        // en: Cookies are per client, so an error page that sets one is never memoized.
+        // ja: Cookie はクライアントごとのものなので、Cookie を設定したエラーページは保持しない。
+        _memoizeStatus = 0;
+
+        Cookie::SameSite sameSite = cookie.sameSite;
+        bool secure = cookie.secure;
+        if (sameSite == Cookie::SameSite::None && !secure)
+        {
+            secure = true;
+        }
+
+        String header;
+        header.reserve(cookie.name.length() + cookie.value.length() + 64);
+        header += cookie.name;
+        header += "=";
+        header += cookie.value;
+
+        if (!cookie.path.isEmpty())
+        {
+            header += "; Path=";
+            header += cookie.path;
+        }
+        if (!cookie.domain.isEmpty())
+        {
+            header += "; Domain=";
+            header += cookie.domain;
+        }
+        if (cookie.maxAge >= 0)
+        {
+            header += "; Max-Age=";
+            header += String(cookie.maxAge);
+        }
+        if (secure)
+        {
+            header += "; Secure";
+        }
+        if (cookie.httpOnly)
+        {
+            header += "; HttpOnly";
+        }
+        header += "; SameSite=";
+        switch (sameSite)
+        {
+        case Cookie::SameSite::None:
+            header += "None";
+            break;
+        case Cookie::SameSite::Strict:
+            header += "Strict";
+            break;
+        case Cookie::SameSite::Lax:
+        default:
+            header += "Lax";
+            break;
+        }
+
+        size_t len = header.length();
+        ClassBuffer<char> buf = Server::allocateBuffer<char>(_server, AllocClass::RequestArena, len + 1);
+        if (!buf)
+        {
+            ESP_LOGE(TAG, "cookie header alloc failed");
+            return;
+        }
+        memcpy(buf.get(), header.c_str(), len + 1);
+        httpd_resp_set_hdr(_raw, "Set-Cookie", buf.get());
+        _setCookieBuffers.push_back(std::move(buf));
+    }
+
+    void Response::clearCookie(const String &name, const String &path)
+    {
+        Cookie c;
+        c.name = name;
+        c.value = "";
+        c.path = path;
+        c.maxAge = 0;
+        setCookie(c);
+    }
+
+    void Response::setHeader(const char *name, const char *value)
+    {
+        if (!_raw || !name || !value || _capture)
+        {
+            return;
+        }
+        if (_responseCommitted)
+        {
+            ESP_LOGW(TAG, "header %s after commit ignored", name);
+            return;
+        }
+        if (containsControlChars(String(value)))
+        {
+            ESP_LOGW(TAG, "invalid header %s skipped", name);
+            return;
+        }
+        // en: esp_http_server keeps the pointers until the response is sent, so copy both strings.
+        // ja: esp_http_server は送信まで文字列ポインタを保持するため、名前と値をコピーしておく。
+        const size_t nameLen = strlen(name);
+        const size_t valueLen = strlen(value);
+        ClassBuffer<char> buf = Server::allocateBuffer<char>(_server, AllocClass::RequestArena, nameLen + valueLen + 2);
+        if (!buf)
+        {
+            ESP_LOGE(TAG, "header alloc failed");
+            return;
+        }
+        memcpy(buf.get(), name, nameLen + 1);
+        memcpy(buf.get() + nameLen + 1, value, valueLen + 1);
+        httpd_resp_set_hdr(_raw, buf.get(), buf.get() + nameLen + 1);
+        _headerBuffers.push_back(std::move(buf));
+    }
+
+    void Response::setHeader(const char *name, const String &value)
+    {
+        setHeader(name, value.c_str());
+    }
+
+    void Response::setStaticFileSystem(fs::FS *fs)
+    {
+        _staticSource = fs ? StaticSourceType::FileSystem : StaticSourceType::None;
+        _staticFs = fs;
+        _memData = nullptr;
+        _memSize = 0;
+        _staticMimeType = nullptr;
+    }
+
+    void Response::setStaticMemorySource(const uint8_t *data, size_t size)
+    {
+        _staticMimeType = nullptr;
+        if (data || size == 0)
+        {
+            _staticSource = StaticSourceType::Memory;
+            _memData = data;
+            _memSize = size;
+        }
+        else
+        {
+            clearStaticSource();
+        }
+        _staticFs = nullptr;
+    }
+
+    void Response::setStaticMimeType(const char *mime)
+    {
+        _staticMimeType = mime;
+    }
+
+    File Response::openStaticFile(int &slot)
+    {
+        slot = -1;
+        if (_pendingFile && _pendingPath == _staticInfo.fsPath)
+        {
+            File file = _pendingFile;
+            slot = _pendingSlot;
+            _pendingFile = File();
+            _pendingSlot = -1;
+            _pendingPath = String();
+            if (slot == kBorrowedFileSlot)
+            {
+                file.seek(0);
+            }
+            return file;
+        }
+        releasePendingStaticFile();
+        if (!_staticFs)
+        {
+            return File();
+        }
+        if (_server)
+        {
+            return _server->acquireFile(_staticFs, _staticInfo.fsPath, slot);
+        }
+        return _staticFs->open(_staticInfo.fsPath, "r");
+    }
+
+    void Response::closeStaticFile(File &file, int slot)
+    {
+        if (slot == kBorrowedFileSlot)
+        {
+            return;
+        }
+        if (_server)
+        {
+            _server->releaseFile(file, slot);
+        }
+        else if (file)
+        {
+            file.close();
+        }
+    }
+
+    void Response::setPendingStaticFile(File file, int slot)
+    {
+        releasePendingStaticFile();
+        _pendingPath = file ? _staticInfo.fsPath : String();
+        _pendingFile = file;
+        _pendingSlot = slot;
+    }
+
+    void Response::releasePendingStaticFile()
+    {
+        if (_pendingFile || _pendingSlot >= 0)
+        {
+            closeStaticFile(_pendingFile, _pendingSlot);
+        }
+        _pendingFile = File();
+        _pendingSlot = -1;
+        _pendingPath = String();
+    }
+
+    void Response::clearStaticSource()
+    {
+        _staticSource = StaticSourceType::None;
+        _staticFs = nullptr;
+        _memData = nullptr;
+        _memSize = 0;
+        _staticMimeType = nullptr;
+    }
+
+    const char *Response::statusString(int code)
+    {
+        snprintf(_statusBuffer, sizeof(_statusBuffer), "%d", code);
+        return _statusBuffer;
+    }
+
+    void Response::setRequestContext(Request *req)
+    {
+        _requestContext = req;
+    }
+
+    void Response::setServerContext(Server *server)
+    {
+        _server = server;
+    }
+
+    bool Response::assetRewriteActive() const
+    {
+        return _server && _server->_fingerprintHandlerCount > 0;
+    }
+
+    void Response::markCommitted()
+    {
+        _responseCommitted = true;
+    }
+
+    const char *Response::defaultErrorMessage(int status)
+    {
+        switch (status)
+        {
+        case 400:
+            return "Bad Request";
+        case 401:
+            return "Unauthorized";
+        case 403:
+            return "Forbidden";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        case 409:
+            return "Conflict";
+        case 412:
+            return "Precondition Failed";
+        case 413:
+            return "Payload Too Large";
+        case 415:
+            return "Unsupported Media Type";
+        case 429:
+            return "Too Many Requests";
+        case 460:
+            return "Checksum Mismatch";
+        case 500:
+            return "Internal Server Error";
+        case 503:
+            return "Service Unavailable";
+        default:
+            return "Error";
+        }
+    }
+
+    ErrorRenderer Response::_errorRenderer;
+    std::vector<Response::ErrorPage> Response::_errorPages;
+    std::vector<int> Response::_memoizedErrorStatuses;
+
+    bool Response::streamHtmlFromSource(StaticInputStream &stream, const String *block, bool *blockFound)
+    {
+        if (!_raw || !stream.valid())
+        {
+            return false;
+        }
+
+        String chunk;
+        chunk.reserve(bodyChunkSize());
+
+        // en: {{$block name}} / {{/block}} markers are dropped from full pages. With block set, only that block's body
+        //     is emitted: everything before it is scanned for markers without evaluating placeholders, and reading
+        //     stops at its closing marker.
+        // ja: {{$block name}} / {{/block}} マーカーはページ全体の描画では取り除く。block 指定時はそのブロック本体のみを出力し、
+        //     それより前はプレースホルダーを評価せずにマーカーだけを探し、閉じマーカーで読み込みを終える。
+        bool emitting = (block == nullptr);
+        bool fragmentDone = false;
+        int blockDepth = 0;
+        int targetDepth = -1;
+
+        const bool templateActive = static_cast<bool>(_templateHandler) || assetRewriteActive() || block;
+        const char *headSnippet = (!block && _headInjectionPtr && _headInjectionPtr[0]) ? _headInjectionPtr : nullptr;
+        bool snippetInserted = (headSnippet == nullptr);
+        constexpr char kHeadToken[] = "<head";
+        constexpr int kHeadTokenLen = sizeof(kHeadToken) - 1;
+        int headMatchIdx = 0;
+        bool awaitingHeadBoundary = false;
+        bool waitingHeadClose = false;
+
+        auto flushChunk = [&]() -> bool
+        {
+            if (chunk.isEmpty())
+            {
+                return true;
+            }
+            if (writeBodyChunk(reinterpret_cast<const uint8_t *>(chunk.c_str()), chunk.length()) != ESP_OK)
+            {
+                return false;
+            }
+            chunk.clear();
+            return true;
+        };
+
+        auto appendRawChar = [&](char c) -> bool
+        {
+            chunk += c;
+            if (chunk.length() >= _sendProgress.chunkSize)
+            {
+                return flushChunk();
+            }
+            return true;
+        };
+
+        auto appendRawString = [&](const char *text) -> bool
+        {
+            if (!text)
+            {
+                return true;
+            }
+            while (*text)
+            {
+                if (!appendRawChar(*text++))
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        auto emitChar = [&](char c) -> bool
+        {
+            if (!emitting)
+            {
+                return true;
+            }
+            if (!snippetInserted)
+            {
+                const char lower = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+                if (!awaitingHeadBoundary && !waitingHeadClose)
+                {
+                    if (lower == kHeadToken[headMatchIdx])
+                    {
+                        headMatchIdx++;
+                        if (headMatchIdx == kHeadTokenLen)
+                        {
+                            awaitingHeadBoundary = true;
+                            headMatchIdx = 0;
+                        }
+                    }
+                    else
+                    {
+                        if (lower == kHeadToken[0])
+                        {
+                            headMatchIdx = 1;
+                        }
+                        else
+                        {
+                            headMatchIdx = 0;
+                        }
+                    }
+                }
+                else if (awaitingHeadBoundary)
+                {
+                    if (c == '>' || c == '/' || isspace(static_cast<unsigned char>(c)))
+                    {
+                        awaitingHeadBoundary = false;
+                        if (c == '>')
+                        {
+                            if (!appendRawChar(c))
+                            {
+                                return false;
+                            }
+                            if (headSnippet && headSnippet[0])
+                            {
+                                if (!appendRawString(headSnippet))
+                                {
+                                    return false;
+                                }
+                            }
+                            snippetInserted = true;
+                            return true;
+                        }
+                        waitingHeadClose = true;
+                    }
+                    else
+                    {
+                        awaitingHeadBoundary = false;
+                    }
+                }
+                else if (waitingHeadClose && c == '>')
+                {
+                    waitingHeadClose = false;
+                    if (!appendRawChar(c))
+                    {
+                        return false;
+                    }
+                    if (headSnippet && headSnippet[0])
+                    {
+                        if (!appendRawString(headSnippet))
+                        {
+                            return false;
+                        }
+                    }
+                    snippetInserted = true;
+                    return true;
+                }
+            }
+            return appendRawChar(c);
+        };
+
+        auto emitString = [&](const String &text) -> bool
+        {
+            for (size_t i = 0; i < text.length(); ++i)
+            {
+                if (!emitChar(text.charAt(i)))
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        auto emitRepeat = [&](char c, int count) -> bool
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                if (!emitChar(c))
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        enum class TemplateState
+        {
+            Normal,
+            OpenBrace,
+            Placeholder
+        };
+
+        TemplateState state = TemplateState::Normal;
+        int braceCount = 0;
+        bool waitingThird = false;
+        bool triple = false;
+        int closingCount = 0;
+        String placeholderRaw;
+
+        char ch;
+        while (!fragmentDone && stream.readChar(ch))
+        {
+            bool reprocess = true;
+            while (reprocess)
+            {
+                reprocess = false;
+                switch (state)
+                {
+                case TemplateState::Normal:
+                    if (templateActive && ch == '{')
+                    {
+                        state = TemplateState::OpenBrace;
+                        braceCount = 1;
+                    }
+                    else
+                    {
+                        if (!emitChar(ch))
+                        {
+                            return false;
+                        }
+                    }
+                    break;
+                case TemplateState::OpenBrace:
+                    if (templateActive && ch == '{')
+                    {
+                        braceCount++;
+                        if (braceCount == 2)
+                        {
+                            state = TemplateState::Placeholder;
+                            placeholderRaw.clear();
+                            waitingThird = true;
+                            triple = false;
+                            closingCount = 0;
+                        }
+                    }
+                    else
+                    {
+                        if (!emitRepeat('{', braceCount))
+                        {
+                            return false;
+                        }
+                        braceCount = 0;
+                        state = TemplateState::Normal;
+                        reprocess = true;
+                    }
+                    break;
+                case TemplateState::Placeholder:
+                    if (waitingThird)
+                    {
+                        if (ch == '{')
+                        {
+                            triple = true;
+                            waitingThird = false;
+                            continue;
+                        }
+                        waitingThird = false;
+                        reprocess = true;
+                        continue;
+                    }
+                    if (ch == '}')
+                    {
+                        closingCount++;
+                        const int needed = triple ? 3 : 2;
+                        if (closingCount == needed)
+                        {
+                            String key = placeholderRaw;
+                            key.trim();
+                            bool handled = false;
+                            bool silent = false; // block markers, and placeholders outside the requested block
+                            String replacement;
+                            if (key.startsWith("$block ") || key == "/block")
+                            {
+                                silent = true;
+                                if (key[0] == '$')
+                                {
+                                    String name = key.substring(7);
+                                    name.trim();
+                                    ++blockDepth;
+                                    if (block && !emitting && name == *block)
+                                    {
+                                        emitting = true;
+                                        targetDepth = blockDepth;
+                                        // en: The fragment's 200 head goes out only once its block exists, so a missing
+                                        //     block still answers a clean 404 through sendError() and the ErrorRenderer.
+                                        // ja: フラグメントの 200 ヘッダーはブロックが見つかってから送る。見つからなければ
+                                        //     sendError() と ErrorRenderer でそのまま 404 を返せる。
+                                        _lastStatusCode = 200;
+                                        writeHead(200, "text/html");
+                                        markCommitted();
+                                    }
+                                }
+                                else if (blockDepth > 0)
+                                {
+                                    fragmentDone = (block && emitting && blockDepth == targetDepth);
+                                    --blockDepth;
+                                }
+                            }
+                            else if (!emitting)
+                            {
+                                silent = true;
+                            }
+                            else if (key.startsWith("asset:") && assetRewriteActive())
+                            {
+                                // en: {{asset:/path}} expands to the fingerprinted URL, or the plain path when unknown.
+                                // ja: {{asset:/path}} はフィンガープリント付き URL に展開。未登録なら元のパス。
+                                String assetUrl = key.substring(6);
+                                assetUrl.trim();
+                                if (!_server->resolveAssetUrl(assetUrl, replacement))
+                                {
+                                    replacement = assetUrl;
+                                }
+                                handled = true;
+                            }
+                            else if (_templateHandler && !key.isEmpty())
+                            {
+                                StringBuilderPrint printer(replacement);
+                                handled = _templateHandler(key, printer);
+                            }
+                            if (handled)
+                            {
+                                if (!triple)
+                                {
+                                    replacement = htmlEscape(replacement);
+                                }
+                                if (!emitString(replacement))
+                                {
+                                    return false;
+                                }
+                            }
+                            else if (!silent)
+                            {
+                                if (!emitRepeat('{', needed))
+                                {
+                                    return false;
+                                }
+                                if (!emitString(placeholderRaw))
+                                {
+                                    return false;
+                                }
+                                if (!emitRepeat('}', needed))
+                                {
+                                    return false;
+                                }
+                            }
+                            placeholderRaw.clear();
+                            closingCount = 0;
+                            triple = false;
+                            state = TemplateState::Normal;
+                            braceCount = 0;
+                        }
+                        continue;
+                    }
+                    if (closingCount > 0)
+                    {
+                        for (int i = 0; i < closingCount; ++i)
+                        {
+                            placeholderRaw += '}';
+                        }
+                        closingCount = 0;
+                    }
+                    placeholderRaw += ch;
+                    break;
+                }
+            }
+        }
+
+        if (state == TemplateState::OpenBrace && braceCount > 0)
+        {
+            if (!emitRepeat('{', braceCount))
+            {
+                return false;
+            }
+        }
+        else if (state == TemplateState::Placeholder)
+        {
+            const int needed = triple ? 3 : 2;
+            if (!emitRepeat('{', needed))
+            {
+                return false;
+            }
+            if (!emitString(placeholderRaw))
+            {
+                return false;
+            }
+            if (closingCount > 0)
+            {
+                if (!emitRepeat('}', closingCount))
+                {
+                    return false;
+                }
+            }
+        }
+
+        if (blockFound)
+        {
+            *blockFound = (targetDepth >= 0);
+        }
+        if (block && targetDepth < 0)
+        {
+            return false;
+        }
+        if (!flushChunk())
+        {
+            return false;
+        }
+        return endBody() == ESP_OK;
+    }
+
+    namespace
+    {
+        String defaultSessionId(size_t idBytes)
+        {
+            const size_t bytes = idBytes > 0 ? idBytes : 16;
+            String out;
+            out.reserve(bytes * 2);
+            static const char kHex[] = "0123456789abcdef";
+            for (size_t i = 0; i < bytes; ++i)
+            {
+                uint8_t b = static_cast<uint8_t>(esp_random() & 0xFF);
+                out += kHex[(b >> 4) & 0x0F];
+                out += kHex[b & 0x0F];
+            }
+            return out;
+        }
+
+        bool defaultValidateSessionId(const String &id, size_t idBytes)
+        {
+            if (id.isEmpty())
+            {
+                return false;
+            }
+            size_t minLen = idBytes ? (idBytes * 2) / 3 : 8;
+            if (minLen < 8)
+            {
+                minLen = 8;
+            }
+            if (id.length() < minLen)
+            {
+                return false;
+            }
+            for (size_t i = 0; i < id.length(); ++i)
+            {
+                const unsigned char c = static_cast<unsigned char>(id.charAt(i));
+                if (!(isalnum(c) || c == '-' || c == '_' || c == '.'))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        Cookie buildSessionCookie(const SessionConfig &cfg, const String &value)
+        {
+            Cookie c;
+            c.name = cfg.cookieName.isEmpty() ? String("sid") : cfg.cookieName;
+            c.value = value;
+            c.path = cfg.path.isEmpty() ? String("/") : cfg.path;
+            c.maxAge = cfg.maxAgeSeconds;
+            c.secure = cfg.secure;
+            c.httpOnly = cfg.httpOnly;
+            c.sameSite = cfg.sameSite;
+            return c;
+        }
+    } // namespace
+
+    SessionInfo beginSession(Request &req, Response &res, const SessionConfig &cfg)
+    {
+        SessionInfo info;
+
+        const String cookieName = cfg.cookieName.isEmpty() ? String("sid") : cfg.cookieName;
+        const String existing = req.cookie(cookieName);
+
+        bool valid = false;
+        if (!existing.isEmpty())
+        {
+            if (cfg.validate)
+            {
+                valid = cfg.validate(existing);
+            }
+            else
+            {
+                valid = defaultValidateSessionId(existing, cfg.idBytes);
+            }
+        }
+
+        if (valid)
+        {
+            info.id = existing;
+            info.isNew = false;
+        }
+        else
+        {
+            info.id = cfg.generate ? cfg.generate() : defaultSessionId(cfg.idBytes);
+            if (info.id.isEmpty())
+            {
+                info.id = defaultSessionId(cfg.idBytes);
+            }
+            info.isNew = true;
+        }
+        info.rotated = false;
+
+        if (!info.id.isEmpty() && (info.isNew || cfg.maxAgeSeconds >= 0))
+        {
+            Cookie c = buildSessionCookie(cfg, info.id);
+            res.setCookie(c);
+        }
+
+        return info;
+    }
+
+    SessionInfo rotateSession(SessionInfo &cur, Response &res, const SessionConfig &cfg)
+    {
+        SessionInfo updated = cur;
+        const String oldId = cur.id;
+        updated.id = cfg.generate ? cfg.generate() : defaultSessionId(cfg.idBytes);
+        if (updated.id.isEmpty())
+        {
+            updated.id = defaultSessionId(cfg.idBytes);
+        }
+        updated.rotated = true;
+        updated.isNew = false;
+
+        if (!updated.id.isEmpty())
+        {
+            Cookie c = buildSessionCookie(cfg, updated.id);
+            res.setCookie(c);
+        }
+
+        if (cfg.onRotate && !oldId.isEmpty() && !updated.id.isEmpty())
+        {
+            cfg.onRotate(oldId, updated.id);
+        }
+
+        cur = updated;
+        return updated;
+    }
+
+    void touchSessionCookie(SessionInfo &cur, Response &res, const SessionConfig &cfg)
+    {
+        if (cur.id.isEmpty() || cfg.maxAgeSeconds < 0)
+        {
+            return;
+        }
+        Cookie c = buildSessionCookie(cfg, cur.id);
+        res.setCookie(c);
+    }
+
+    // -------- Auth --------
+
+    namespace
+    {
+        constexpr size_t kAuthHeaderMax = 256;
+        constexpr size_t kAuthDecodedMax = 192;
+        constexpr size_t kAuthDigestLen = 32;
+
+        // en: Per-boot HMAC key so cached digests are useless outside this process.
+        // ja: 起動ごとに生成する HMAC 鍵。キャッシュ上のダイジェストを外部で再利用できないようにする。
+        const uint8_t *authCacheKey()
+        {
+            static uint8_t key[kAuthDigestLen];
+            static bool ready = false;
+            if (!ready)
+            {
+                esp_fill_random(key, sizeof(key));
+                ready = true;
+            }
+            return key;
+        }
+
+        bool computeCredentialDigest(const AuthCredentials &cred, uint8_t *out)
+        {
+            const mbedtls_md_info_t *md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+            if (!md)
+            {
+                return false;
+            }
+            const uint8_t header[3] = {
+                static_cast<uint8_t>(cred.scheme),
+                static_cast<uint8_t>((cred.userLen >> 8) & 0xFF),
+                static_cast<uint8_t>(cred.userLen & 0xFF),
+            };
+            mbedtls_md_context_t ctx;
+            mbedtls_md_init(&ctx);
+            bool ok = mbedtls_md_setup(&ctx, md, 1) == 0 &&
+                      mbedtls_md_hmac_starts(&ctx, authCacheKey(), kAuthDigestLen) == 0 &&
+                      mbedtls_md_hmac_update(&ctx, header, sizeof(header)) == 0;
+            if (ok && cred.userLen > 0)
+            {
+                ok = mbedtls_md_hmac_update(&ctx, reinterpret_cast<const uint8_t *>(cred.user), cred.userLen) == 0;
+            }
+            if (ok && cred.secretLen > 0)
+            {
+                ok = mbedtls_md_hmac_update(&ctx, reinterpret_cast<const uint8_t *>(cred.secret), cred.secretLen) == 0;
+            }
+            ok = ok && mbedtls_md_hmac_finish(&ctx, out) == 0;
+            mbedtls_md_free(&ctx);
+            return ok;
+        }
+
+        // en: Splits "Basic <b64>" / "Bearer <token>" in place; Basic payloads decode into `decoded`.
+        // ja: "Basic <b64>" / "Bearer <token>" をその場で分解し、Basic は `decoded` にデコードする。
+        bool parseAuthorization(char *header, size_t len, char *decoded, size_t decodedCap, AuthCredentials &out)
+        {
+            size_t pos = 0;
+            while (pos < len && header[pos] == ' ')
+            {
+                ++pos;
+            }
+            const size_t schemeStart = pos;
+            while (pos < len && header[pos] != ' ')
+            {
+                ++pos;
+            }
+            const size_t schemeLen = pos - schemeStart;
+            while (pos < len && header[pos] == ' ')
+            {
+                ++pos;
+            }
+            size_t end = len;
+            while (end > pos && header[end - 1] == ' ')
+            {
+                --end;
+            }
+            if (end == pos)
+            {
+                return false;
+            }
+            const char *value = header + pos;
+            const size_t valueLen = end - pos;
+
+            if (schemeLen == 5 && strncasecmp(header + schemeStart, "Basic", 5) == 0)
+            {
+                size_t decodedLen = 0;
+                if (mbedtls_base64_decode(reinterpret_cast<unsigned char *>(decoded), decodedCap - 1, &decodedLen,
+                                          reinterpret_cast<const unsigned char *>(value), valueLen) != 0)
+                {
+                    return false;
+                }
+                decoded[decodedLen] = '\0';
+                const char *colon = static_cast<const char *>(memchr(decoded, ':', decodedLen));
+                if (!colon)
+                {
+                    return false;
+                }
+                out.scheme = AuthCredentials::Basic;
+                out.user = decoded;
+                out.userLen = static_cast<size_t>(colon - decoded);
+                out.secret = colon + 1;
+                out.secretLen = decodedLen - out.userLen - 1;
+                return true;
+            }
+            if (schemeLen == 6 && strncasecmp(header + schemeStart, "Bearer", 6) == 0)
+            {
+                out.scheme = AuthCredentials::Bearer;
+                out.user = nullptr;
+                out.userLen = 0;
+                out.secret = value;
+                out.secretLen = valueLen;
+                return true;
+            }
+            return false;
+        }
+
+        bool authDeadlinePending(uint32_t deadline, uint32_t now)
+        {
+            return static_cast<int32_t>(deadline - now) > 0;
+        }
+    } // namespace
+
+    bool constantTimeEquals(const void *a, const void *b, size_t len)
+    {
+        if (!a || !b)
+        {
+            return false;
+        }
+        const uint8_t *pa = static_cast<const uint8_t *>(a);
+        const uint8_t *pb = static_cast<const uint8_t *>(b);
+        uint8_t diff = 0;
+        for (size_t i = 0; i < len; ++i)
+        {
+            diff |= static_cast<uint8_t>(pa[i] ^ pb[i]);
+        }
+        return diff == 0;
+    }
+
+    bool verifyPbkdf2Sha256(const char *password,
+                            size_t passwordLen,
+                            const uint8_t *salt,
+                            size_t saltLen,
+                            uint32_t iterations,
+                            const uint8_t *expected,
+                            size_t expectedLen)
+    {
+        if (!password || !salt || !expected || expectedLen == 0 || expectedLen > kAuthDigestLen || iterations == 0)
+        {
+            return false;
+        }
+        uint8_t derived[kAuthDigestLen];
+        const int ret = mbedtls_pkcs5_pbkdf2_hmac_ext(MBEDTLS_MD_SHA256,
+                                                      reinterpret_cast<const unsigned char *>(password), passwordLen,
+                                                      salt, saltLen,
+                                                      iterations,
+                                                      static_cast<uint32_t>(expectedLen),
+                                                      derived);
+        const bool ok = (ret == 0) && constantTimeEquals(derived, expected, expectedLen);
+        memset(derived, 0, sizeof(derived));
+        return ok;
+    }
+
+    // -------- Server --------
+
+    // en: Long-lived tables prefer PSRAM so internal DRAM stays free for Wi-Fi and DMA; boards without PSRAM fall back.
+    // ja: 長寿命のテーブルは PSRAM を優先し、内部 DRAM を Wi-Fi や DMA 用に残す。PSRAM が無いボードでは内部 RAM を使う。
+    Server::Server()
+    {
+        _alloc[static_cast<size_t>(AllocClass::Cache)].policy.placement = MemoryPlacement::PreferPsram;
+        _alloc[static_cast<size_t>(AllocClass::RouteTable)].policy.placement = MemoryPlacement::PreferPsram;
+        _alloc[static_cast<size_t>(AllocClass::Session)].policy.placement = MemoryPlacement::PreferPsram;
+    }
+    Server::~Server()
+    {
+        end();
+        if (_uploadGcTimer)
+        {
+            esp_timer_delete(_uploadGcTimer);
+        }
+        if (_shapeTimer)
+        {
+            esp_timer_delete(_shapeTimer);
+        }
+        if (_scanMutex)
+        {
+            vSemaphoreDelete(_scanMutex);
+        }
+    }
+
+    bool Server::begin(const httpd_config_t &cfg)
+    {
+        return begin(cfg, _options);
+    }
+
+    bool Server::begin(const httpd_config_t &cfg, const ServerOptions &options)
+    {
+        if (_handle)
+            return true;
+        _options = options;
+        _streamsStopping = false;
+        httpd_config_t localCfg = cfg;
+        localCfg.uri_match_fn = httpd_uri_match_wildcard;
+        esp_err_t err = httpd_start(&_handle, &localCfg);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "httpd_start failed: %s", esp_err_to_name(err));
+            return false;
+        }
+        for (auto &hook : _methodHooks)
+        {
+            registerMethodHook(hook.get());
+        }
+        if (_uploadGcTimer && _uploadGcPeriodUs > 0)
+        {
+            esp_timer_start_periodic(_uploadGcTimer, _uploadGcPeriodUs);
+        }
+        startBackgroundScan();
+        return true;
+    }
+
+    void Server::end()
+    {
+        _streamsStopping = true;
+        if (_shapeTimer)
+        {
+            esp_timer_stop(_shapeTimer);
+        }
+        if (_uploadGcTimer)
+        {
+            esp_timer_stop(_uploadGcTimer);
+        }
+        while (_shapeTimerBusy.load() || _uploadGcBusy.load())
+        {
+            vTaskDelay(1);
+        }
+        if (_handle)
+        {
+            // en: Streams are ended on the httpd task, where their async request copies can still be completed; queued
+            //     work is dropped by httpd_stop(), so wait until every queued turn has run and released its job.
+            // ja: ストリームは非同期リクエストのコピーを完了できる httpd タスク上で終了する。キュー済みの作業は
+            //     httpd_stop() で破棄されるため、全ターンが実行されジョブを解放するまで待つ。
+            if (_streamJobsLive.load() > 0 && httpd_queue_work(_handle, &Server::shutdownStreamJobs, this) == ESP_OK)
+            {
+                const uint32_t startedAt = millis();
+                while (_streamJobsLive.load() > 0 && millis() - startedAt < 2000)
+                {
+                    vTaskDelay(pdMS_TO_TICKS(10));
+                }
+            }
+            httpd_stop(_handle);
+            _handle = nullptr;
+        }
+        // en: Only reached when the httpd task never ran the shutdown (e.g. end() called from a handler): the sessions
+        //     are gone, so the jobs are freed without completing their request copies.
+        // ja: httpd タスクが終了処理を実行できなかった場合のみ（ハンドラ内から end() を呼んだ等）。セッションは既に
+        //     無いため、リクエストのコピーを完了せずにジョブだけを解放する。
+        if (!_streamJobs.empty())
+        {
+            ESP_LOGW(TAG, "[RESP] %u streams dropped without completion", static_cast<unsigned>(_streamJobs.size()));
+        }
+        for (StreamJob *job : _streamJobs)
+        {
+            _traffic[static_cast<size_t>(job->trafficClass)].stats.activeStreams--;
+            if (job->onDone)
+            {
+                job->onDone();
+            }
+            delete job;
+            _streamJobsLive--;
+        }
+        _streamJobs.clear();
+        _scanAbort = true;
+        while (_scanTaskRunning.load())
+        {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+        dropOpenFiles();
+    }
+
+    void Server::setTrafficClass(const String &uriPrefix, TrafficClass cls)
+    {
+        const String prefix = normalizeUriPrefix(uriPrefix);
+        for (auto &rule : _trafficRules)
+        {
+            if (rule.first == prefix)
+            {
+                rule.second = cls;
+                return;
+            }
+        }
+        _trafficRules.emplace_back(prefix, cls);
+    }
+
+    void Server::configureTrafficClass(TrafficClass cls, const TrafficClassConfig &config)
+    {
+        TrafficClassState &state = _traffic[static_cast<size_t>(cls)];
+        state.config = config;
+        if (state.config.bytesPerSecond > 0 && state.config.burstBytes == 0)
+        {
+            state.config.burstBytes = std::max<uint32_t>(state.config.bytesPerSecond / 4, kStreamChunkSize);
+        }
+        state.tokens = state.config.burstBytes;
+        state.lastRefillUs = esp_timer_get_time();
+    }
+
+    void *HeapCapsAllocator::allocate(size_t size, MemoryPlacement placement, bool *fellBack)
+    {
+        constexpr uint32_t kInternalCaps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+        constexpr uint32_t kPsramCaps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+        switch (placement)
+        {
+        case MemoryPlacement::Internal:
+            return heap_caps_malloc(size, kInternalCaps);
+        case MemoryPlacement::PsramOnly:
+            return heap_caps_malloc(size, kPsramCaps);
+        case MemoryPlacement::PreferPsram:
+        {
+            void *ptr = heap_caps_malloc(size, kPsramCaps);
+            if (!ptr)
+            {
+                ptr = heap_caps_malloc(size, kInternalCaps);
+                if (ptr && fellBack)
+                {
+                    *fellBack = true;
+                }
+            }
+            return ptr;
+        }
+        case MemoryPlacement::Default:
+        default:
+            return heap_caps_malloc(size, MALLOC_CAP_8BIT);
+        }
+    }
+
+    void HeapCapsAllocator::deallocate(void *ptr)
+    {
+        heap_caps_free(ptr);
+    }
+
+    namespace
+    {
+        HeapCapsAllocator &defaultAllocator()
+        {
+            static HeapCapsAllocator allocator;
+            return allocator;
+        }
+    } // namespace
+
+    void ClassBufferDeleter::operator()(void *ptr) const
+    {
+        if (!ptr)
+        {
+            return;
+        }
+        if (server)
+        {
+            server->releaseFor(cls, ptr, size);
+        }
+        else
+        {
+            defaultAllocator().deallocate(ptr);
+        }
+    }
+
+    void *Server::allocateRaw(Server *server, AllocClass cls, size_t size)
+    {
+        if (server)
+        {
+            return server->allocateFor(cls, size, true);
+        }
+        return defaultAllocator().allocate(size, MemoryPlacement::Default, nullptr);
+    }
+
+    void Server::bindAllocators(HandlerEntry &entry)
+    {
+        entry.index.entries = ClassVector<StaticIndexEntry>(allocatorFor<StaticIndexEntry>(AllocClass::Cache));
+        entry.index.fingerprints = ClassVector<FingerprintEntry>(allocatorFor<FingerprintEntry>(AllocClass::Cache));
+        entry.index.preloads = ClassVector<PreloadEntry>(allocatorFor<PreloadEntry>(AllocClass::Cache));
+        entry.negativeCache.slots = ClassVector<NegativeCache::Slot>(allocatorFor<NegativeCache::Slot>(AllocClass::Cache));
+    }
+
+    void Server::bindAllocators(StaticIndex &index)
+    {
+        index.entries = ClassVector<StaticIndexEntry>(allocatorFor<StaticIndexEntry>(AllocClass::Cache));
+        index.fingerprints = ClassVector<FingerprintEntry>(allocatorFor<FingerprintEntry>(AllocClass::Cache));
+        index.preloads = ClassVector<PreloadEntry>(allocatorFor<PreloadEntry>(AllocClass::Cache));
+    }
+
+    void Server::setAllocator(Allocator *allocator)
+    {
+        _allocator = allocator;
+    }
+
+    void Server::setAllocPolicy(AllocClass cls, const AllocPolicy &policy)
+    {
+        _alloc[static_cast<size_t>(cls)].policy = policy;
+    }
+
+    AllocStats Server::allocStats(AllocClass cls) const
+    {
+        const AllocState &state = _alloc[static_cast<size_t>(cls)];
+        AllocStats stats;
+        stats.bytesInUse = state.bytesInUse.load();
+        stats.peakBytes = state.peakBytes.load();
+        stats.allocations = state.allocations.load();
+        stats.failures = state.failures.load();
+        stats.overBudget = state.overBudget.load();
+        stats.placementFallbacks = state.placementFallbacks.load();
+        return stats;
+    }
+
+    // en: Buffers (enforceBudget) are refused past the budget and callers take their existing nullptr paths;
+    //     container storage cannot fail gracefully, so it is only counted as over budget, and a placement the
+    //     heap cannot honour (PsramOnly without PSRAM) is retried with the default one. Called from the httpd
+    //     and scan tasks, hence the atomics.
+    // ja: バッファ（enforceBudget）は予算超過で拒否し、呼び出し側は既存の nullptr 経路を通る。コンテナの領域は
+    //     失敗を扱えないため予算超過として数えるだけにし、満たせない配置（PSRAM 無しの PsramOnly）は既定の配置で
+    //     再試行する。httpd タスクと走査タスクから呼ばれるためアトミックを使う。
+    void *Server::allocateFor(AllocClass cls, size_t size, bool enforceBudget)
+    {
+        AllocState &state = _alloc[static_cast<size_t>(cls)];
+        const size_t budget = state.policy.budget;
+        if (budget > 0 && state.bytesInUse.load() + size > budget)
+        {
+            state.overBudget++;
+            if (enforceBudget)
+            {
+                state.failures++;
+                ESP_LOGW(TAG, "[MEM] class %u over budget (%u bytes requested)", static_cast<unsigned>(cls), static_cast<unsigned>(size));
+                return nullptr;
+            }
+        }
+        Allocator &allocator = _allocator ? *_allocator : defaultAllocator();
+        bool fellBack = false;
+        void *ptr = allocator.allocate(size, state.policy.placement, &fellBack);
+        if (!ptr && !enforceBudget && state.policy.placement != MemoryPlacement::Default)
+        {
+            state.failures++;
+            ptr = allocator.allocate(size, MemoryPlacement::Default, nullptr);
+            fellBack = true;
+        }
+        if (!ptr)
+        {
+            state.failures++;
+            return nullptr;
+        }
+        if (fellBack)
+        {
+            state.placementFallbacks++;
+        }
+        state.allocations++;
+        const size_t inUse = state.bytesInUse.fetch_add(size) + size;
+        size_t peak = state.peakBytes.load();
+        while (inUse > peak && !state.peakBytes.compare_exchange_weak(peak, inUse))
+        {
+        }
+        return ptr;
+    }
+
+    void Server::releaseFor(AllocClass cls, void *ptr, size_t size)
+    {
+        if (!ptr)
+        {
+            return;
+        }
+        Allocator &allocator = _allocator ? *_allocator : defaultAllocator();
+        allocator.deallocate(ptr);
+        _alloc[static_cast<size_t>(cls)].bytesInUse.fetch_sub(size);
+    }
+
+    TrafficClassStats Server::trafficStats(TrafficClass cls) const
+    {
+        return _traffic[static_cast<size_t>(cls)].stats;
+    }
+
+    // en: Same matching as requireAuth()/serveStatic(): whole path segments only, so "/api" covers "/api/x" but
+    //     not "/apix".
+    // ja: requireAuth()/serveStatic() と同じく、パスセグメント単位で一致させる。"/api" は "/api/x" に一致するが
+    //     "/apix" には一致しない。
+    TrafficClass Server::trafficClassFor(const String &path) const
+    {
+        TrafficClass cls = TrafficClass::Normal;
+        size_t bestLen = 0;
+        String rel;
+        for (const auto &rule : _trafficRules)
+        {
+            const size_t len = rule.first.length();
+            if (len >= bestLen && extractRelativePath(path, rule.first, rel))
+            {
+                cls = rule.second;
+                bestLen = len;
+            }
+        }
+        return cls;
+    }
+
+    // en: Deficit token bucket: the chunk is always charged, and the returned wait (µs) is how long until the
+    //     bucket is back above zero. Body sends only run on the httpd task, so no locking is needed.
+    // ja: 負債方式のトークンバケット。チャンク分を常に差し引き、残高が 0 以上に戻るまでの待ち時間 (µs) を返す。
+    //     ボディ送信は httpd タスク上でのみ行われるためロック不要。
+    int64_t Server::reserveTraffic(TrafficClass cls, size_t len)
+    {
+        TrafficClassState &state = _traffic[static_cast<size_t>(cls)];
+        const uint32_t rate = state.config.bytesPerSecond;
+        if (rate == 0)
+        {
+            return 0;
+        }
+        const int64_t now = esp_timer_get_time();
+        state.tokens += (now - state.lastRefillUs) * rate / 1000000;
+        state.lastRefillUs = now;
+        if (state.tokens > static_cast<int64_t>(state.config.burstBytes))
+        {
+            state.tokens = state.config.burstBytes;
+        }
+        state.tokens -= static_cast<int64_t>(len);
+        if (state.tokens >= 0)
+        {
+            return 0;
+        }
+        const int64_t waitUs = (-state.tokens * 1000000 + rate - 1) / rate;
+        state.stats.throttledChunks++;
+        state.stats.throttleWaitUs += waitUs;
+        return waitUs;
+    }
+
+    void Server::noteChunkSent(TrafficClass cls, size_t len)
+    {
+        TrafficClassStats &stats = _traffic[static_cast<size_t>(cls)].stats;
+        stats.bytesSent += len;
+        stats.chunksSent++;
+    }
+
+    // en: Blocking path: a throttled chunk sleeps the httpd task, so other sockets only get ahead in cooperative mode.
+    // ja: ブロッキング経路。制限中のチャンクは httpd タスクを休止させるため、他ソケットが先行できるのは協調モードのみ。
+    esp_err_t Server::sendBodyChunk(httpd_req_t *req, TrafficClass cls, const uint8_t *data, size_t len, TransferProgress &progress)
+    {
+        const int64_t waitUs = reserveTraffic(cls, len);
+        if (waitUs > 0)
+        {
+            vTaskDelay(pdMS_TO_TICKS((waitUs + 999) / 1000) + 1);
+        }
+        return transmitChunk(req, cls, data, len, progress);
+    }
+
+    size_t Server::initialChunkSize() const
+    {
+        const size_t lower = std::max<size_t>(_options.minChunkSize, 1);
+        return std::min(std::max(kStreamChunkSize, lower), std::max(lower, _options.maxChunkSize));
+    }
+
+    // en: Stream buffers start at the first chunk size and are replaced only when transmitChunk() has grown the chunk
+    //     past them, so short or slow streams never hold maxChunkSize. Call only while the buffer holds no pending
+    //     data. If the larger buffer cannot be allocated, the stream keeps its buffer and chunkSize is capped to it.
+    // ja: ストリームバッファは最初のチャンクサイズで確保し、transmitChunk() がチャンクをそれより大きくした時だけ
+    //     置き換える。短い・遅いストリームが maxChunkSize 分を抱えることはない。未送信データが無い時にのみ呼ぶ。
+    //     大きいバッファを確保できなければ現在のバッファを使い続け、chunkSize をその大きさに抑える。
+    void Server::fitChunkBuffer(ClassBuffer<uint8_t> &buffer, size_t &capacity, size_t &chunkSize)
+    {
+        if (chunkSize <= capacity)
+        {
+            return;
+        }
+        ClassBuffer<uint8_t> larger = allocateBuffer<uint8_t>(this, AllocClass::IoBuffer, chunkSize);
+        if (!larger)
+        {
+            ESP_LOGD(TAG, "[RESP] chunk buffer stays at %u bytes", static_cast<unsigned>(capacity));
+            chunkSize = capacity;
+            return;
+        }
+        buffer = std::move(larger);
+        capacity = chunkSize;
+    }
+
+    // en: Times the send and adapts chunkSize for the next chunk of the same response: a full chunk that went out
+    //     quickly doubles it, a send that blocked on the socket halves it, always within the ServerOptions bounds.
+    // ja: 送信時間を計測し、同じレスポンスの次のチャンクサイズを調整する。満杯のチャンクが速く送れたら 2 倍、
+    //     ソケットでブロックしたら半分にする。常に ServerOptions の範囲内。
+    esp_err_t Server::transmitChunk(httpd_req_t *req, TrafficClass cls, const uint8_t *data, size_t len, TransferProgress &progress)
+    {
+        const int64_t started = esp_timer_get_time();
+        if (progress.startedUs == 0)
+        {
+            progress.startedUs = started;
+        }
+        const esp_err_t err = httpd_resp_send_chunk(req, reinterpret_cast<const char *>(data), len);
+        const int64_t elapsed = esp_timer_get_time() - started;
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        noteChunkSent(cls, len);
+        progress.bytes += len;
+        progress.activeUs += elapsed;
+        if (!transferWithinLimits(req, progress, false))
+        {
+            return ESP_FAIL;
+        }
+
+        size_t &chunkSize = progress.chunkSize;
+        const size_t lower = std::max<size_t>(_options.minChunkSize, 1);
+        const size_t upper = std::max(lower, _options.maxChunkSize);
+        _chunkStats.chunks++;
+        _chunkStats.bytes += len;
+        _chunkStats.sendUsTotal += elapsed;
+        if (len >= chunkSize && elapsed < kFastSendUs && chunkSize < upper)
+        {
+            chunkSize = std::min(chunkSize * 2, upper);
+            _chunkStats.grows++;
+        }
+        else if (elapsed > kSlowSendUs && chunkSize > lower)
+        {
+            chunkSize = std::max(chunkSize / 2, lower);
+            _chunkStats.shrinks++;
+        }
+        if (_chunkStats.smallestChosen == 0 || chunkSize < _chunkStats.smallestChosen)
+        {
+            _chunkStats.smallestChosen = chunkSize;
+        }
+        _chunkStats.largestChosen = std::max(_chunkStats.largestChosen, chunkSize);
+        return ESP_OK;
+    }
+
+    int Server::receiveChunk(httpd_req_t *req, char *buffer, size_t len, TransferProgress &progress)
+    {
+        if (progress.startedUs == 0)
+        {
+            progress.startedUs = esp_timer_get_time();
+        }
+        const int64_t started = esp_timer_get_time();
+        const int ret = httpd_req_recv(req, buffer, len);
+        progress.activeUs += esp_timer_get_time() - started;
+        if (ret > 0)
+        {
+            progress.bytes += static_cast<size_t>(ret);
+            if (!transferWithinLimits(req, progress, true))
+            {
+                return HTTPD_SOCK_ERR_FAIL;
+            }
+        }
+        return ret;
+    }
+
+    // en: Checked between chunks: a single blocking call is still bounded by the httpd send/recv_wait_timeout,
+    //     so these limits bound the whole body. On violation the socket is closed once the handler returns.
+    //     The deadline is wall-clock time; the throughput floor only counts time spent in the socket calls, so our
+    //     own traffic shaping, cooperative turns and the handler's work between reads do not make a peer look slow.
+    // ja: チャンクの合間に判定する。1 回のブロッキング呼び出しは httpd の send/recv_wait_timeout で抑えられるため、
+    //     これらはボディ全体の上限となる。違反時はハンドラ復帰後にソケットを閉じる。
+    //     期限は実時間で判定する。最低スループットはソケット呼び出し内の時間のみで判定し、自身の帯域制御・協調
+    //     ターンの待ち・読み込み間のハンドラ処理で相手が遅いと誤判定しないようにする。
+    bool Server::transferWithinLimits(httpd_req_t *req, TransferProgress &progress, bool receiving)
+    {
+        const uint32_t deadlineMs = receiving ? _options.receiveDeadlineMs : _options.sendDeadlineMs;
+        const uint32_t minRate = receiving ? _options.minReceiveBytesPerSecond : _options.minSendBytesPerSecond;
+        if (deadlineMs == 0 && minRate == 0)
+        {
+            return true;
+        }
+        const int64_t elapsedUs = esp_timer_get_time() - progress.startedUs;
+        const char *reason = nullptr;
+        if (deadlineMs > 0 && elapsedUs > static_cast<int64_t>(deadlineMs) * 1000)
+        {
+            reason = "deadline";
+            receiving ? _abortStats.receiveDeadline++ : _abortStats.sendDeadline++;
+        }
+        else if (minRate > 0 && progress.activeUs > static_cast<int64_t>(_options.throughputGraceMs) * 1000 &&
+                 progress.bytes * 1000000 < static_cast<uint64_t>(minRate) * static_cast<uint64_t>(progress.activeUs))
+        {
+            reason = "throughput";
+            receiving ? _abortStats.receiveThroughput++ : _abortStats.sendThroughput++;
+        }
+        if (!reason)
+        {
+            return true;
+        }
+        const int sock = httpd_req_to_sockfd(req);
+        ESP_LOGW(TAG, "[%s] %s limit hit after %llu bytes in %lld ms, closing socket %d", receiving ? "REQ" : "RESP", reason,
+                 static_cast<unsigned long long>(progress.bytes), static_cast<long long>(elapsedUs / 1000), sock);
+        if (_handle && sock >= 0)
+        {
+            httpd_sess_trigger_close(_handle, sock);
+        }
+        return false;
+    }
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+    // en: Sends the first chunk inline (headers and status still point into the live Response), then queues the
+    //     rest so each turn sends chunksPerTurn chunks and re-queues itself behind other sockets and streams.
+    //     The inline chunk is charged to the class bucket but never waits; the deficit delays the next turn.
+    // ja: 最初のチャンクはその場で送信し（ヘッダ・ステータスは生存中の Response を参照）、残りはキューに積む。
+    //     各ターンで chunksPerTurn 個送ってから自身を再キューし、他のソケットやストリームと交互に進む。
+    //     最初のチャンクはクラスのバケットから差し引くが待たない。不足分は次のターンを遅らせる。
+    bool Server::startCooperativeStream(httpd_req_t *req, TrafficClass cls, ChunkSource &source, std::function<void()> &onDone, size_t sizeHint)
+    {
+        if (!_options.cooperativeStreaming || !_handle || !req || _streamsStopping.load())
+        {
+            return false;
+        }
+        if ((sizeHint > 0 && sizeHint < _options.cooperativeThreshold) || _streamJobs.size() >= _options.maxCooperativeStreams)
+        {
+            return false;
+        }
+        std::unique_ptr<StreamJob> job(new (std::nothrow) StreamJob());
+        if (!job)
+        {
+            return false;
+        }
+        const size_t capacity = initialChunkSize();
+        job->buffer = allocateBuffer<uint8_t>(this, AllocClass::IoBuffer, capacity);
+        if (!job->buffer)
+        {
+            return false;
+        }
+        httpd_req_t *asyncReq = nullptr;
+        if (httpd_req_async_handler_begin(req, &asyncReq) != ESP_OK)
+        {
+            ESP_LOGW(TAG, "[RESP] async hand-off failed, streaming inline");
+            return false;
+        }
+        _streamJobsLive++;
+        job->server = this;
+        job->req = asyncReq;
+        job->capacity = capacity;
+        job->progress.chunkSize = initialChunkSize();
+        job->trafficClass = cls;
+        job->source = std::move(source);
+        job->onDone = std::move(onDone);
+        _traffic[static_cast<size_t>(cls)].stats.activeStreams++;
+
+        const size_t len = job->source(job->buffer.get(), job->progress.chunkSize);
+        if (len == 0)
+        {
+            httpd_resp_send_chunk(asyncReq, nullptr, 0);
+            finishStreamJob(job.release());
+            return true;
+        }
+        const int64_t waitUs = reserveTraffic(cls, len);
+        if (transmitChunk(asyncReq, cls, job->buffer.get(), len, job->progress) != ESP_OK)
+        {
+            finishStreamJob(job.release(), true);
+            return true;
+        }
+        StreamJob *raw = job.release();
+        _streamJobs.push_back(raw);
+        if (!queueStreamJob(raw, waitUs))
+        {
+            finishStreamJob(raw, true);
+        }
+        return true;
+    }
+
+    // en: Delay 0 queues the next turn straight away; otherwise the job waits for the shared shaping timer, which
+    //     queues runShapedJobs once the earliest waiting bucket has refilled. Runs on the httpd task only.
+    // ja: 遅延 0 なら即座に次のターンをキューに積む。それ以外は共有の整形タイマーを待ち、最も早く回復する
+    //     バケットの時刻に runShapedJobs がキューに積まれる。httpd タスク上でのみ呼ぶ。
+    bool Server::queueStreamJob(StreamJob *job, int64_t delayUs)
+    {
+        job->queuedAtUs = esp_timer_get_time() + std::max<int64_t>(delayUs, 0);
+        if (delayUs > 0)
+        {
+            job->wakeAtUs = job->queuedAtUs;
+            return armShapeTimer();
+        }
+        job->queuedTurns++;
+        if (httpd_queue_work(_handle, &Server::runStreamJob, job) != ESP_OK)
+        {
+            job->queuedTurns--;
+            ESP_LOGE(TAG, "[RESP] httpd_queue_work failed");
+            return false;
+        }
+        return true;
+    }
+
+    bool Server::armShapeTimer()
+    {
+        if (_streamsStopping.load())
+        {
+            return false;
+        }
+        int64_t dueUs = INT64_MAX;
+        for (StreamJob *job : _streamJobs)
+        {
+            if (job->wakeAtUs > 0)
+            {
+                dueUs = std::min(dueUs, job->wakeAtUs);
+            }
+        }
+        if (dueUs == INT64_MAX)
+        {
+            return true;
+        }
+        if (!_shapeTimer)
+        {
+            esp_timer_create_args_t args = {};
+            args.callback = &Server::shapeTimerFired;
+            args.arg = this;
+            args.name = "http_shape";
+            if (esp_timer_create(&args, &_shapeTimer) != ESP_OK)
+            {
+                ESP_LOGE(TAG, "[RESP] shaping timer unavailable");
+                _shapeTimer = nullptr;
+                return false;
+            }
+        }
+        esp_timer_stop(_shapeTimer);
+        const int64_t delayUs = std::max<int64_t>(dueUs - esp_timer_get_time(), 1);
+        return esp_timer_start_once(_shapeTimer, static_cast<uint64_t>(delayUs)) == ESP_OK;
+    }
+
+    // en: Runs on the esp_timer task and touches only the server, never a job, so a stream finishing on the httpd
+    //     task cannot race it. When the work queue is full the timer retries shortly instead of stalling the streams.
+    // ja: esp_timer タスク上で実行し、ジョブには触れずサーバーのみ参照する。httpd タスクでストリームが終了しても
+    //     競合しない。作業キューが満杯なら少し後に再試行し、ストリームを止めたままにしない。
+    void Server::shapeTimerFired(void *arg)
+    {
+        constexpr uint64_t kRetryUs = 10000;
+        Server *server = static_cast<Server *>(arg);
+        server->_shapeTimerBusy = true;
+        if (!server->_streamsStopping.load() && server->_handle &&
+            httpd_queue_work(server->_handle, &Server::runShapedJobs, server) != ESP_OK)
+        {
+            ESP_LOGW(TAG, "[RESP] httpd_queue_work failed, shaping retry");
+            esp_timer_start_once(server->_shapeTimer, kRetryUs);
+        }
+        server->_shapeTimerBusy = false;
+    }
+
+    void Server::runShapedJobs(void *arg)
+    {
+        Server *server = static_cast<Server *>(arg);
+        const int64_t now = esp_timer_get_time();
+        std::vector<StreamJob *> due;
+        for (StreamJob *job : server->_streamJobs)
+        {
+            if (job->wakeAtUs > 0 && job->wakeAtUs <= now)
+            {
+                job->wakeAtUs = 0;
+                due.push_back(job);
+            }
+        }
+        for (StreamJob *job : due)
+        {
+            job->queuedTurns++;
+            runStreamJob(job);
+        }
+        if (!server->armShapeTimer() && !server->_streamsStopping.load())
+        {
+            for (StreamJob *job : std::vector<StreamJob *>(server->_streamJobs))
+            {
+                if (job->wakeAtUs > 0)
+                {
+                    server->finishStreamJob(job, true);
+                }
+            }
+        }
+    }
+
+    void Server::runStreamJob(void *arg)
+    {
+        StreamJob *job = static_cast<StreamJob *>(arg);
+        Server *server = job->server;
+        job->queuedTurns--;
+        if (job->finished)
+        {
+            server->releaseStreamJob(job);
+            return;
+        }
+        TrafficClassState &traffic = server->_traffic[static_cast<size_t>(job->trafficClass)];
+        const int64_t delay = esp_timer_get_time() - job->queuedAtUs;
+        if (delay > 0)
+        {
+            traffic.stats.queueDelayUsTotal += delay;
+            traffic.stats.queueDelayUsMax = std::max<uint32_t>(traffic.stats.queueDelayUsMax, static_cast<uint32_t>(std::min<int64_t>(delay, UINT32_MAX)));
+        }
+        traffic.stats.queueDelaySamples++;
+
+        uint8_t turns = traffic.config.chunksPerTurn ? traffic.config.chunksPerTurn : server->_options.chunksPerTurn;
+        turns = turns ? turns : 1;
+        for (uint8_t i = 0; i < turns; ++i)
+        {
+            if (job->pendingLen == 0)
+            {
+                server->fitChunkBuffer(job->buffer, job->capacity, job->progress.chunkSize);
+                const size_t len = job->source(job->buffer.get(), job->progress.chunkSize);
+                if (len == 0)
+                {
+                    httpd_resp_send_chunk(job->req, nullptr, 0);
+                    server->finishStreamJob(job);
+                    return;
+                }
+                job->pendingLen = len;
+                const int64_t waitUs = server->reserveTraffic(job->trafficClass, len);
+                if (waitUs > 0)
+                {
+                    if (!server->queueStreamJob(job, waitUs))
+                    {
+                        server->finishStreamJob(job, true);
+                    }
+                    return;
+                }
+            }
+            if (server->transmitChunk(job->req, job->trafficClass, job->buffer.get(), job->pendingLen, job->progress) != ESP_OK)
+            {
+                server->finishStreamJob(job, true);
+                return;
+            }
+            job->pendingLen = 0;
+        }
+        if (!server->queueStreamJob(job, 0))
+        {
+            server->finishStreamJob(job, true);
+        }
+    }
+
+    // en: Ends the response on the httpd task. An aborted stream closes its socket so the client does not wait on a
+    //     truncated chunked body. The job itself is freed once no queued turn still points at it.
+    // ja: httpd タスク上でレスポンスを終了する。中断時はソケットを閉じ、途中で切れたチャンク応答をクライアントが
+    //     待ち続けないようにする。ジョブ本体はキュー済みのターンが参照しなくなった時点で解放する。
+    void Server::finishStreamJob(StreamJob *job, bool aborted)
+    {
+        if (job->finished)
+        {
+            return;
+        }
+        job->finished = true;
+        job->wakeAtUs = 0;
+        _traffic[static_cast<size_t>(job->trafficClass)].stats.activeStreams--;
+        if (job->onDone)
+        {
+            job->onDone();
+        }
+        if (aborted)
+        {
+            const int sock = httpd_req_to_sockfd(job->req);
+            if (_handle && sock >= 0)
+            {
+                httpd_sess_trigger_close(_handle, sock);
+            }
+        }
+        httpd_req_async_handler_complete(job->req);
+        job->req = nullptr;
+        _streamJobs.erase(std::remove(_streamJobs.begin(), _streamJobs.end(), job), _streamJobs.end());
+        releaseStreamJob(job);
+    }
+
+    void Server::releaseStreamJob(StreamJob *job)
+    {
+        if (job->queuedTurns > 0)
+        {
+            return;
+        }
+        delete job;
+        _streamJobsLive--;
+    }
+
+    void Server::shutdownStreamJobs(void *arg)
+    {
+        Server *server = static_cast<Server *>(arg);
+        while (!server->_streamJobs.empty())
+        {
+            server->finishStreamJob(server->_streamJobs.back(), true);
+        }
+    }
+#else
+    bool Server::startCooperativeStream(httpd_req_t *req, TrafficClass cls, ChunkSource &source, std::function<void()> &onDone, size_t sizeHint)
+    {
+        (void)req;
+        (void)cls;
+        (void)source;
+        (void)onDone;
+        (void)sizeHint;
+        return false;
+    }
+
+    bool Server::queueStreamJob(StreamJob *job, int64_t delayUs)
+    {
+        (void)job;
+        (void)delayUs;
+        return false;
+    }
+
+    bool Server::armShapeTimer()
+    {
+        return false;
+    }
+
+    void Server::runStreamJob(void *arg)
+    {
+        (void)arg;
+    }
+
+    void Server::runShapedJobs(void *arg)
+    {
+        (void)arg;
+    }
+
+    void Server::shapeTimerFired(void *arg)
+    {
+        (void)arg;
+    }
+
+    void Server::shutdownStreamJobs(void *arg)
+    {
+        (void)arg;
+    }
+
+    void Server::finishStreamJob(StreamJob *job, bool aborted)
+    {
+        (void)aborted;
+        releaseStreamJob(job);
+    }
+
+    void Server::releaseStreamJob(StreamJob *job)
+    {
+        delete job;
+    }
+#endif
+
+    void Server::on(const String &uri, httpd_method_t method, RouteHandler handler)
+    {
+        on(uri, method, BodyPolicy(), std::move(handler));
+    }
+
+    void Server::on(const String &uri, httpd_method_t method, const BodyPolicy &policy, RouteHandler handler)
+    {
+        if (!handler)
+        {
+            return;
+        }
+
+        std::vector<RouteSegment> segments;
+        int score = 0;
+        if (!parseRoutePattern(uri, segments, score))
+        {
+            ESP_LOGE(TAG, "Invalid route pattern: %s", uri.c_str());
+            return;
+        }
+
+        if (!ensureMethodHook(method))
+        {
+            ESP_LOGE(TAG, "Failed to register method hook");
+            return;
+        }
+
+        DynamicRoute route;
+        route.method = method;
+        route.pattern = uri;
+        route.segments = std::move(segments);
+        route.score = score;
+        route.handler = std::move(handler);
+        route.bodyPolicy = policy;
+        _dynamicRoutes.push_back(std::move(route));
+    }
+
+    void Server::onNotFound(RouteHandler handler)
+    {
+        _notFoundHandler = std::move(handler);
+    }
+
+    void Server::serveStatic(const String &uriPrefix,
+                             fs::FS &fs,
+                             const String &basePath,
+                             StaticHandler handler)
+    {
+        serveStatic(uriPrefix, fs, basePath, std::move(handler), StaticOptions());
+    }
+
+    void Server::serveStatic(const String &uriPrefix,
+                             fs::FS &fs,
+                             const String &basePath,
+                             StaticHandler handler,
+                             const StaticOptions &options)
+    {
+        if (!handler)
+        {
+            return;
+        }
+        auto entry = std::make_unique<HandlerEntry>();
+        bindAllocators(*entry);
+        entry->type = HandlerType::StaticFS;
+        entry->staticHandler = std::move(handler);
+        entry->uriPrefix = normalizeUriPrefix(uriPrefix);
+        entry->basePath = basePath;
+        entry->fs = &fs;
+        entry->options = options;
+        entry->negativeCache.capacity = options.negativeCacheEntries;
+        entry->owner = this;
+
+        bool wantsScan = needsStaticIndex(options);
+#if LOG_LOCAL_LEVEL >= ESP_LOG_INFO
+        ESP_LOGI(TAG, "[SERVE][FS] %s -> %s", entry->uriPrefix.c_str(), entry->basePath.c_str());
+        wantsScan = true;
+#endif
+        if (options.fingerprintAssets)
+        {
+            _fingerprintHandlerCount++;
+        }
+        // en: The FS walk (index + Info listing) is deferred to a background task started by begin(), or to the first
+        //     request, so a populated SD card does not delay setup().
+        // ja: FS 走査（インデックスと Info 一覧）は begin() が起動するバックグラウンドタスク、または最初のリクエストまで
+        //     遅延し、ファイルの多い SD カードでも setup() を遅らせない。
+        if (wantsScan)
+        {
+            if (!_scanMutex)
+            {
+                _scanMutex = xSemaphoreCreateMutex();
+            }
+            entry->scanPending = true;
+        }
+
+        _handlers.push_back(std::move(entry));
+        ensureMethodHook(HTTP_GET);
+    }
+
+    void Server::serveStatic(const String &uriPrefix,
+                             const char *const *paths,
+                             const uint8_t *const *data,
+                             const size_t *sizes,
+                             size_t fileCount,
+                             StaticHandler handler)
+    {
+        serveStatic(uriPrefix, paths, data, sizes, fileCount, std::move(handler), StaticOptions());
+    }
+
+    void Server::serveStatic(const String &uriPrefix,
+                             const char *const *paths,
+                             const uint8_t *const *data,
+                             const size_t *sizes,
+                             size_t fileCount,
+                             StaticHandler handler,
+                             const StaticOptions &options)
+    {
+        if (!handler || !paths || !data || !sizes)
+        {
+            return;
+        }
+
+        auto entry = std::make_unique<HandlerEntry>();
+        bindAllocators(*entry);
+        entry->type = HandlerType::StaticMem;
+        entry->staticHandler = std::move(handler);
+        entry->uriPrefix = normalizeUriPrefix(uriPrefix);
+        entry->memPaths = paths;
+        entry->memData = data;
+        entry->memSizes = sizes;
+        entry->memCount = fileCount;
+        entry->options = options;
+        entry->owner = this;
+
+#if LOG_LOCAL_LEVEL >= ESP_LOG_INFO
+        ESP_LOGI(TAG, "[SERVE][MEM] %s count=%u", entry->uriPrefix.c_str(), static_cast<unsigned>(fileCount));
+        for (size_t i = 0; i < fileCount; ++i)
+        {
+            const char *name = paths[i] ? paths[i] : "(null)";
+            size_t size = sizes[i];
+            bool gz = false;
+            if (name)
+            {
+                size_t len = strlen(name);
+                gz = (len >= 3 && name[len - 3] == '.' && name[len - 2] == 'g' && name[len - 1] == 'z');
+            }
+            ESP_LOGI(TAG, "  [%02u] %s (%u bytes)%s",
+                     static_cast<unsigned>(i),
+                     name,
+                     static_cast<unsigned>(size),
+                     gz ? " gz" : "");
+        }
+#endif
+        if (options.fingerprintAssets)
+        {
+            _fingerprintHandlerCount++;
+        }
+        if (needsStaticIndex(options))
+        {
+            buildStaticIndex(entry.get());
+        }
+
+        _handlers.push_back(std::move(entry));
+        ensureMethodHook(HTTP_GET);
+    }
+
+    void Server::serveStatic(const String &uriPrefix,
+                             const EmbeddedAssetIndex &index,
+                             StaticHandler handler)
+    {
+        serveStatic(uriPrefix, index, std::move(handler), StaticOptions());
+    }
+
+    void Server::serveStatic(const String &uriPrefix,
+                             const EmbeddedAssetIndex &index,
+                             StaticHandler handler,
+                             const StaticOptions &options)
+    {
+        if (!handler || !index.assets)
+        {
+            return;
+        }
+
+        auto entry = std::make_unique<HandlerEntry>();
+        bindAllocators(*entry);
+        entry->type = HandlerType::StaticEmbedded;
+        entry->staticHandler = std::move(handler);
+        entry->uriPrefix = normalizeUriPrefix(uriPrefix);
+        entry->embeddedAssets = index.assets;
+        entry->embeddedCount = index.count;
+        entry->options = options;
+        entry->owner = this;
+
+#if LOG_LOCAL_LEVEL >= ESP_LOG_INFO
+        ESP_LOGI(TAG, "[SERVE][EMB] %s count=%u", entry->uriPrefix.c_str(), static_cast<unsigned>(index.count));
+        for (size_t i = 0; i < index.count; ++i)
+        {
+            const EmbeddedAsset &asset = index.assets[i];
+            ESP_LOGI(TAG, "  [%02u] %s (%u bytes)%s",
+                     static_cast<unsigned>(i),
+                     asset.path ? asset.path : "(null)",
+                     static_cast<unsigned>(asset.size),
+                     asset.encoding == kEmbeddedGzip ? " gz" : "");
+        }
+#endif
+        if (options.fingerprintAssets)
+        {
+            _fingerprintHandlerCount++;
+        }
+        if (needsStaticIndex(options))
+        {
+            buildStaticIndex(entry.get());
+        }
+
+        _handlers.push_back(std::move(entry));
+        ensureMethodHook(HTTP_GET);
+    }
+
+    void Server::requireAuth(const String &uriPrefix, const AuthConfig &cfg)
+    {
+        if (!cfg.verify || (!cfg.allowBasic && !cfg.allowBearer))
+        {
+            ESP_LOGE(TAG, "[AUTH] invalid config for %s", uriPrefix.c_str());
+            return;
+        }
+        auto rule = std::make_unique<AuthRule>();
+        rule->cache = ClassVector<AuthCacheEntry>(allocatorFor<AuthCacheEntry>(AllocClass::Session));
+        rule->denials = ClassVector<AuthCacheEntry>(allocatorFor<AuthCacheEntry>(AllocClass::Session));
+        rule->uriPrefix = normalizeUriPrefix(uriPrefix);
+        rule->config = cfg;
+        const String realm = cfg.realm.isEmpty() ? String("EspHttpServer") : cfg.realm;
+        rule->basicChallenge = "Basic realm=\"" + realm + "\", charset=\"UTF-8\"";
+        rule->bearerChallenge = "Bearer realm=\"" + realm + "\"";
+        rule->cache.resize(cfg.cacheEntries);
+        rule->denials.resize(cfg.cacheEntries > 0 ? cfg.denyCacheEntries : 0);
+        ESP_LOGI(TAG, "[AUTH] %s realm=%s cache=%u+%u", rule->uriPrefix.c_str(), realm.c_str(),
+                 static_cast<unsigned>(rule->cache.size()), static_cast<unsigned>(rule->denials.size()));
+        _authRules.push_back(std::move(rule));
+    }
+
+    bool Server::verifyAuthCredentials(AuthRule &rule, const AuthCredentials &cred)
+    {
+        if (rule.cache.empty())
+        {
+            return rule.config.verify(cred);
+        }
+
+        uint8_t digest[kAuthDigestLen];
+        if (!computeCredentialDigest(cred, digest))
+        {
+            return rule.config.verify(cred);
+        }
+
+        // en: Scan every slot of both pools without early exit so lookup time does not depend on the hit position
+        //     or on whether the credential was granted.
+        // ja: ヒット位置や許可/拒否で処理時間が変わらないよう、両プールの全スロットを途中終了せずに走査する。
+        const uint32_t now = millis();
+        auto matches = [&](ClassVector<AuthCacheEntry> &pool)
+        {
+            bool hit = false;
+            for (auto &slot : pool)
+            {
+                const bool live = slot.used && authDeadlinePending(slot.expiresAt, now);
+                hit |= constantTimeEquals(slot.digest, digest, kAuthDigestLen) && live;
+            }
+            return hit;
+        };
+        const bool grantHit = matches(rule.cache);
+        const bool denyHit = matches(rule.denials);
+        if (grantHit || denyHit)
+        {
+            ESP_LOGD(TAG, "[AUTH] cache hit (%s)", grantHit ? "grant" : "deny");
+            return grantHit;
+        }
+
+        const bool granted = rule.config.verify(cred);
+
+        // en: Grants and denials fill separate pools (free or expired slot first, then round-robin), so a stream of
+        //     bad credentials only recycles denial slots and cached grants stay until their TTL.
+        // ja: 許可と拒否は別々のプールに入れる（空き・失効スロット優先、無ければ順繰り）。不正な資格情報が続いても
+        //     拒否用スロットが入れ替わるだけで、キャッシュ済みの許可は TTL まで残る。
+        ClassVector<AuthCacheEntry> &pool = granted ? rule.cache : rule.denials;
+        size_t &next = granted ? rule.nextSlot : rule.nextDenial;
+        if (pool.empty())
+        {
+            return granted;
+        }
+        AuthCacheEntry *target = nullptr;
+        for (auto &slot : pool)
+        {
+            if (!slot.used || !authDeadlinePending(slot.expiresAt, now))
+            {
+                target = &slot;
+                break;
+            }
+        }
+        if (!target)
+        {
+            target = &pool[next];
+            next = (next + 1) % pool.size();
+        }
+        memcpy(target->digest, digest, kAuthDigestLen);
+        target->expiresAt = now + rule.config.cacheTtlMs;
+        target->used = true;
+        return granted;
+    }
+
+    bool Server::checkAuth(Request &req, Response &res, const String &normalizedPath)
+    {
+        AuthRule *rule = nullptr;
+        String rel;
+        for (auto &candidate : _authRules)
+        {
+            if (!extractRelativePath(normalizedPath, candidate->uriPrefix, rel))
+            {
+                continue;
+            }
+            if (!rule || candidate->uriPrefix.length() > rule->uriPrefix.length())
+            {
+                rule = candidate.get();
+            }
+        }
+        if (!rule)
+        {
+            return true;
+        }
+
+        char header[kAuthHeaderMax];
+        char decoded[kAuthDecodedMax];
+        AuthCredentials cred;
+        bool granted = false;
+        httpd_req_t *raw = req.raw();
+        const size_t len = raw ? httpd_req_get_hdr_value_len(raw, "Authorization") : 0;
+        if (len > 0 && len < sizeof(header) &&
+            httpd_req_get_hdr_value_str(raw, "Authorization", header, sizeof(header)) == ESP_OK &&
+            parseAuthorization(header, len, decoded, sizeof(decoded), cred))
+        {
+            const bool schemeAllowed = (cred.scheme == AuthCredentials::Basic) ? rule->config.allowBasic : rule->config.allowBearer;
+            granted = schemeAllowed && verifyAuthCredentials(*rule, cred);
+        }
+
+        if (granted)
+        {
+            req._authenticated = true;
+            if (cred.scheme == AuthCredentials::Basic)
+            {
+                req._authUser = String(cred.user, cred.userLen);
+            }
+        }
+        memset(header, 0, sizeof(header));
+        memset(decoded, 0, sizeof(decoded));
+        if (granted)
+        {
+            return true;
+        }
+
+        ESP_LOGI(TAG, "[AUTH] 401 %s", normalizedPath.c_str());
+        if (raw && !res._capture && rule->config.allowBasic)
+        {
+            httpd_resp_set_hdr(raw, "WWW-Authenticate", rule->basicChallenge.c_str());
+        }
+        if (raw && !res._capture && rule->config.allowBearer)
+        {
+            httpd_resp_set_hdr(raw, "WWW-Authenticate", rule->bearerChallenge.c_str());
+        }
+        res.sendError(401);
+        return false;
+    }
+
+    esp_err_t Server::handleDynamicHttpRequest(httpd_req_t *req)
+    {
+        auto *server = static_cast<Server *>(req->user_ctx);
+        if (!server)
+        {
+            return ESP_FAIL;
+        }
+        return server->dispatchDynamic(req);
+    }
+
+    const Server::StaticIndexEntry *Server::StaticIndex::find(const String &relPath) const
+    {
+        auto it = std::lower_bound(entries.begin(), entries.end(), relPath,
+                                   [](const StaticIndexEntry &item, const String &key)
+                                   { return strcmp(item.relPath.c_str(), key.c_str()) < 0; });
+        if (it != entries.end() && it->relPath == relPath)
+        {
+            return &*it;
+        }
+        return nullptr;
+    }
+
+    bool Server::NegativeCache::contains(const String &relPath, uint32_t generationNow)
+    {
+        if (capacity == 0)
+        {
+            return false;
+        }
+        if (generation != generationNow)
+        {
+            clear();
+            generation = generationNow;
+            return false;
+        }
+        const uint32_t hash = fnv1a(kFnvOffset, reinterpret_cast<const uint8_t *>(relPath.c_str()), relPath.length());
+        if (counters[hash % kBloomSlots] == 0 || counters[(hash >> 16) % kBloomSlots] == 0)
+        {
+            return false;
+        }
+        for (auto &slot : slots)
+        {
+            if (slot.hash == hash && slot.relPath == relPath)
+            {
+                slot.lastUse = ++clock;
+                hits++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Server::NegativeCache::remember(const String &relPath, uint32_t generationNow)
+    {
+        if (capacity == 0 || relPath.length() > kMaxPathLength)
+        {
+            return;
+        }
+        if (generation != generationNow)
+        {
+            clear();
+            generation = generationNow;
+        }
+        const uint32_t hash = fnv1a(kFnvOffset, reinterpret_cast<const uint8_t *>(relPath.c_str()), relPath.length());
+        for (const auto &slot : slots)
+        {
+            if (slot.hash == hash && slot.relPath == relPath)
+            {
+                return;
+            }
+        }
+
+        Slot *target = nullptr;
+        if (slots.size() < capacity)
+        {
+            slots.emplace_back();
+            target = &slots.back();
+        }
+        else
+        {
+            target = &*std::min_element(slots.begin(), slots.end(), [](const Slot &a, const Slot &b)
+                                        { return a.lastUse < b.lastUse; });
+            uint8_t &first = counters[target->hash % kBloomSlots];
+            uint8_t &second = counters[(target->hash >> 16) % kBloomSlots];
+            if (first > 0 && first < 0xFF)
+            {
+                first--;
+            }
+            if (second > 0 && second < 0xFF)
+            {
+                second--;
+            }
+        }
+        target->hash = hash;
+        target->relPath = relPath;
+        target->lastUse = ++clock;
+        uint8_t &first = counters[hash % kBloomSlots];
+        uint8_t &second = counters[(hash >> 16) % kBloomSlots];
+        if (first < 0xFF)
+        {
+            first++;
+        }
+        if (second < 0xFF)
+        {
+            second++;
+        }
+    }
+
+    void Server::NegativeCache::clear()
+    {
+        memset(counters, 0, sizeof(counters));
+        slots.clear();
+    }
+
+    void Server::invalidateStaticCache()
+    {
+        _staticCacheGeneration.fetch_add(1);
+        for (auto &entryPtr : _handlers)
+        {
+            if (entryPtr->type == HandlerType::StaticFS)
+            {
+                entryPtr->writeGeneration.fetch_add(1);
+            }
+        }
+    }
+
+    // en: The open-file and negative caches are server-wide and cheap to refill; only the handlers whose tree
+    //     contains path (or sits below it, for a directory rename) have their index marked stale.
+    // ja: オープンファイル・ネガティブキャッシュはサーバー全体で、再充填も安価。インデックスを古いとみなすのは
+    //     path を含む（ディレクトリの rename ならその配下にある）ハンドラのみ。
+    void Server::invalidateStaticCache(fs::FS &fs, const String &path)
+    {
+        _staticCacheGeneration.fetch_add(1);
+        const String written = normalizeUriPrefix(path);
+        for (auto &entryPtr : _handlers)
+        {
+            HandlerEntry *entry = entryPtr.get();
+            if (entry->type != HandlerType::StaticFS || entry->fs != &fs)
+            {
+                continue;
+            }
+            const String root = normalizeUriPrefix(entry->basePath);
+            String rel;
+            if (extractRelativePath(written, root, rel) || extractRelativePath(root, written, rel))
+            {
+                entry->writeGeneration.fetch_add(1);
+            }
+        }
+    }
+
+    void Server::setOpenFileCacheSize(size_t handles)
+    {
+        dropOpenFiles();
+        while (!_openFiles.empty() && !_openFiles.back().fs)
+        {
+            _openFiles.pop_back();
+        }
+        _openFileCapacity = handles;
+    }
+
+    StaticCacheStats Server::staticCacheStats() const
+    {
+        StaticCacheStats stats = _cacheStats;
+        stats.negativeHits = 0;
+        for (const auto &entry : _handlers)
+        {
+            stats.negativeHits += entry->negativeCache.hits;
+        }
+        stats.fileHandlesOpen = 0;
+        for (const auto &slot : _openFiles)
+        {
+            if (slot.fs)
+            {
+                stats.fileHandlesOpen++;
+            }
+        }
+        return stats;
+    }
+
+    // en: Hands out a cached read handle rewound to 0. A slot already streaming to another request is never shared
+    //     (that would share the file position); such callers get a private handle with slot -1 instead.
+    // ja: 先頭に巻き戻したキャッシュ済みハンドルを返す。別リクエストが使用中のスロットは位置を共有してしまうため
+    //     共有せず、その場合は専用ハンドル（slot -1）を返す。
+    // en: Existence check that never opens a file: a cached handle answers without touching the FS.
+    // ja: ファイルを開かずに存在を確認する。キャッシュ済みハンドルがあれば FS に触れずに答える。
+    bool Server::probeFile(fs::FS *fs, const String &path) const
+    {
+        if (!fs)
+        {
+            return false;
+        }
+        if (_staticCacheGeneration.load() == _openFileGeneration)
+        {
+            for (const OpenFileSlot &slot : _openFiles)
+            {
+                if (slot.fs == fs && !slot.stale && slot.path == path)
+                {
+                    return true;
+                }
+            }
+        }
+        return fs->exists(path);
+    }
+
+    File Server::acquireFile(fs::FS *fs, const String &path, int &slotOut)
+    {
+        slotOut = -1;
+        if (!fs)
+        {
+            return File();
+        }
+        const uint32_t generation = _staticCacheGeneration.load();
+        if (generation != _openFileGeneration)
+        {
+            dropOpenFiles();
+            _openFileGeneration = generation;
+        }
+
+        for (size_t i = 0; i < _openFiles.size(); ++i)
+        {
+            OpenFileSlot &slot = _openFiles[i];
+            if (slot.fs != fs || slot.stale || slot.path != path)
+            {
+                continue;
+            }
+            if (slot.refs == 0 && slot.file.seek(0))
+            {
+                slot.refs = 1;
+                slot.lastUse = ++_openFileClock;
+                _cacheStats.fileHandleHits++;
+                slotOut = static_cast<int>(i);
+                return slot.file;
+            }
+            break;
+        }
+
+        _cacheStats.fileHandleMisses++;
+        File file = fs->open(path, "r");
+        if (!file || _openFileCapacity == 0 || file.isDirectory())
+        {
+            return file;
+        }
+
+        int target = -1;
+        for (size_t i = 0; i < _openFiles.size(); ++i)
+        {
+            if (!_openFiles[i].fs)
+            {
+                target = static_cast<int>(i);
+                break;
+            }
+        }
+        if (target < 0 && _openFiles.size() < _openFileCapacity)
+        {
+            _openFiles.emplace_back();
+            target = static_cast<int>(_openFiles.size() - 1);
+        }
+        if (target < 0)
+        {
+            for (size_t i = 0; i < _openFiles.size(); ++i)
+            {
+                const OpenFileSlot &slot = _openFiles[i];
+                if (slot.refs == 0 && (target < 0 || slot.lastUse < _openFiles[target].lastUse))
+                {
+                    target = static_cast<int>(i);
+                }
+            }
+            if (target < 0)
+            {
+                return file;
+            }
+            _openFiles[target].file.close();
+            _cacheStats.fileHandleEvictions++;
+        }
+
+        OpenFileSlot &slot = _openFiles[target];
+        slot.fs = fs;
+        slot.path = path;
+        slot.file = file;
+        slot.refs = 1;
+        slot.lastUse = ++_openFileClock;
+        slot.stale = false;
+        slotOut = target;
+        return file;
+    }
+
+    void Server::releaseFile(File &file, int slot)
+    {
+        if (slot < 0 || static_cast<size_t>(slot) >= _openFiles.size())
+        {
+            if (file)
+            {
+                file.close();
+            }
+            return;
+        }
+        OpenFileSlot &entry = _openFiles[slot];
+        if (entry.refs > 0)
+        {
+            entry.refs--;
+        }
+        if (entry.stale && entry.refs == 0)
+        {
+            entry.file.close();
+            entry = OpenFileSlot();
+        }
+    }
+
+    // en: Closes idle handles now; busy ones are closed by releaseFile(). Slots are reset, never erased, so indices stay valid.
+    // ja: 未使用のハンドルは即座に閉じ、使用中のものは releaseFile() で閉じる。添字を保つためスロットは削除せずリセットする。
+    void Server::dropOpenFiles()
+    {
+        for (auto &slot : _openFiles)
+        {
+            if (!slot.fs)
+            {
+                continue;
+            }
+            if (slot.refs == 0)
+            {
+                slot.file.close();
+                slot = OpenFileSlot();
+            }
+            else
+            {
+                slot.stale = true;
+            }
+        }
+    }
+
+    void Server::buildStaticIndex(HandlerEntry *entry)
+    {
+        if (!entry)
+        {
+            return;
+        }
+        entry->index.ready = false;
+        entry->indexGeneration = entry->writeGeneration.load();
+        buildStaticIndex(entry, entry->index);
+        entry->index.ready = true;
+    }
+
+    // en: Fills index without touching entry->index, so the scan task can build a replacement while requests
+    //     keep reading the old one.
+    // ja: entry->index に触れずに index を構築する。スキャンタスクが差し替え用を作る間も、リクエストは旧版を読める。
+    void Server::buildStaticIndex(HandlerEntry *entry, StaticIndex &index)
+    {
+        auto &entries = index.entries;
+        entries.clear();
+        if (entry->type == HandlerType::StaticEmbedded)
+        {
+            entries.reserve(entry->embeddedCount);
+            for (size_t i = 0; i < entry->embeddedCount; ++i)
+            {
+                const EmbeddedAsset &asset = entry->embeddedAssets[i];
+                if (!asset.path)
+                {
+                    continue;
+                }
+                StaticIndexEntry item;
+                item.relPath = ensureLeadingSlash(String(asset.path));
+                item.size = asset.size;
+                item.memIndex = static_cast<int>(i);
+                entries.push_back(std::move(item));
+            }
+        }
+        else if (entry->type == HandlerType::StaticMem)
+        {
+            entries.reserve(entry->memCount);
+            for (size_t i = 0; i < entry->memCount; ++i)
+            {
+                if (!entry->memPaths[i])
+                {
+                    continue;
+                }
+                StaticIndexEntry item;
+                item.relPath = ensureLeadingSlash(String(entry->memPaths[i]));
+                item.size = entry->memSizes[i];
+                item.memIndex = static_cast<int>(i);
+                entries.push_back(std::move(item));
+            }
+        }
+        else if (entry->fs)
+        {
+            const String root = normalizeUriPrefix(entry->basePath);
+            walkFsTree(*entry->fs, root, root, 0, [&](const String &relPath, size_t size)
+                       {
+#if LOG_LOCAL_LEVEL >= ESP_LOG_INFO
+                           ESP_LOGI(TAG, "  %s (%u bytes)%s", relPath.c_str(), static_cast<unsigned>(size), relPath.endsWith(".gz") ? " gz" : "");
+#endif
+                           if (isUploadTempPath(entry->fs, joinFsPath(entry->basePath, relPath)))
+                           {
+                               return;
+                           }
+                           StaticIndexEntry item;
+                           item.relPath = relPath;
+                           item.size = size;
+                           entries.push_back(std::move(item)); });
+        }
+        std::sort(entries.begin(), entries.end(), [](const StaticIndexEntry &a, const StaticIndexEntry &b)
+                  { return strcmp(a.relPath.c_str(), b.relPath.c_str()) < 0; });
+        if (entry->options.fingerprintAssets)
+        {
+            buildFingerprints(entry, index);
+        }
+        if (entry->options.derivePreload || !entry->options.preload.empty())
+        {
+            buildPreloads(entry, index);
+        }
+        ESP_LOGI(TAG, "[SERVE] index %s entries=%u", entry->uriPrefix.c_str(), static_cast<unsigned>(entries.size()));
+    }
+
+    void Server::ensureStaticScan(HandlerEntry *entry)
+    {
+        if (!entry)
+        {
+            return;
+        }
+        // en: Writes reported through WriteThroughFS / invalidateStaticCache() bump the handler's generation. Re-hashing
+        //     the tree is left to the scan task; until the rebuilt index is installed, indexCurrent() is false and the
+        //     lookups that would trust it (content ETags, variants, asset URLs) fall back to plain file probes.
+        // ja: WriteThroughFS / invalidateStaticCache() による書き込み通知でハンドラの世代が進む。ツリーの再ハッシュは
+        //     スキャンタスクに任せ、再構築版が差し替わるまで indexCurrent() は false となり、インデックスを信頼する
+        //     参照（内容 ETag・バリアント・アセット URL）は通常のファイルプローブに戻る。
+        if (entry->type == HandlerType::StaticFS && entry->index.ready.load() &&
+            entry->indexGeneration.load() != entry->writeGeneration.load() &&
+            entry->rebuildState.load() == RebuildIdle)
+        {
+            startBackgroundScan();
+        }
+        if (!entry->scanPending.load())
+        {
+            return;
+        }
+        if (_scanMutex)
+        {
+            xSemaphoreTake(_scanMutex, portMAX_DELAY);
+        }
+        if (entry->scanPending.load())
+        {
+            const uint32_t startedAt = millis();
+            if (needsStaticIndex(entry->options))
+            {
+                buildStaticIndex(entry);
+            }
+#if LOG_LOCAL_LEVEL >= ESP_LOG_INFO
+            else if (entry->fs)
+            {
+                const String root = normalizeUriPrefix(entry->basePath);
+                walkFsTree(*entry->fs, root, root, 0, [](const String &relPath, size_t size)
+                           { ESP_LOGI(TAG, "  %s (%u bytes)%s", relPath.c_str(), static_cast<unsigned>(size), relPath.endsWith(".gz") ? " gz" : ""); });
+            }
+#endif
+            entry->scanPending = false;
+            ESP_LOGI(TAG, "[SERVE][FS] scanned %s in %u ms", entry->uriPrefix.c_str(), static_cast<unsigned>(millis() - startedAt));
+        }
+        if (_scanMutex)
+        {
+            xSemaphoreGive(_scanMutex);
+        }
+    }
+
+    bool Server::indexCurrent(const HandlerEntry *entry) const
+    {
+        return entry && entry->index.ready.load() && entry->indexGeneration.load() == entry->writeGeneration.load();
+    }
+
+    // en: Runs on the scan task. The replacement is complete before rebuildState says so; the httpd task installs it.
+    // ja: スキャンタスク上で実行。差し替え版の構築完了後に rebuildState を進め、httpd タスクが取り込む。
+    void Server::rebuildStaticIndex(HandlerEntry *entry)
+    {
+        const uint32_t generation = entry->writeGeneration.load();
+        const uint32_t startedAt = millis();
+        std::unique_ptr<StaticIndex> fresh(new (std::nothrow) StaticIndex());
+        if (fresh)
+        {
+            bindAllocators(*fresh);
+            if (_scanMutex)
+            {
+                xSemaphoreTake(_scanMutex, portMAX_DELAY);
+            }
+            buildStaticIndex(entry, *fresh);
+            if (_scanMutex)
+            {
+                xSemaphoreGive(_scanMutex);
+            }
+        }
+        if (!fresh || _scanAbort.load())
+        {
+            entry->rebuildState = RebuildIdle;
+            return;
+        }
+        entry->freshIndex = std::move(fresh);
+        entry->freshGeneration = generation;
+        entry->rebuildState = RebuildReady;
+        ESP_LOGI(TAG, "[SERVE][FS] rebuilt %s in %u ms", entry->uriPrefix.c_str(), static_cast<unsigned>(millis() - startedAt));
+    }
+
+    // en: Called at the start of each request on the httpd task, where no StaticIndex pointer is held.
+    // ja: 各リクエストの先頭で httpd タスク上から呼ぶ。この時点では StaticIndex のポインタを保持していない。
+    void Server::installRebuiltIndexes()
+    {
+        if (!_rebuildsReady.load())
+        {
+            return;
+        }
+        _rebuildsReady = false;
+        for (auto &entryPtr : _handlers)
+        {
+            HandlerEntry *entry = entryPtr.get();
+            if (entry->rebuildState.load() != RebuildReady)
+            {
+                continue;
+            }
+            std::swap(entry->index.entries, entry->freshIndex->entries);
+            std::swap(entry->index.fingerprints, entry->freshIndex->fingerprints);
+            std::swap(entry->index.preloads, entry->freshIndex->preloads);
+            entry->indexGeneration = entry->freshGeneration;
+            entry->freshIndex.reset();
+            entry->rebuildState = RebuildIdle;
+        }
+    }
+
+    void Server::startBackgroundScan()
+    {
+        if (_scanTaskRunning.load())
+        {
+            return;
+        }
+        _scanQueue.clear();
+        for (auto &entryPtr : _handlers)
+        {
+            HandlerEntry *entry = entryPtr.get();
+            if (entry->scanPending.load() && entry->options.backgroundScan)
+            {
+                _scanQueue.push_back(entry);
+            }
+            else if (entry->type == HandlerType::StaticFS && entry->index.ready.load() &&
+                     entry->indexGeneration.load() != entry->writeGeneration.load() &&
+                     entry->rebuildState.load() == RebuildIdle)
+            {
+                entry->rebuildState = RebuildQueued;
+                _scanQueue.push_back(entry);
+            }
+        }
+        if (_scanQueue.empty())
+        {
+            return;
+        }
+        _scanAbort = false;
+        _scanTaskRunning = true;
+        if (xTaskCreate(&Server::backgroundScanTask, "httpd_scan", 6144, this, tskIDLE_PRIORITY + 1, nullptr) != pdPASS)
+        {
+            _scanTaskRunning = false;
+            for (HandlerEntry *entry : _scanQueue)
+            {
+                if (entry->rebuildState.load() == RebuildQueued)
+                {
+                    entry->rebuildState = RebuildIdle;
+                }
+            }
+            ESP_LOGW(TAG, "[SERVE] background scan task not started; scanning on first request");
+        }
+    }
+
+    // en: Low-priority task that builds pending FS inventories one handler at a time; requests that arrive first
+    //     scan their own handler under the same mutex. Stale indexes are rebuilt aside and swapped in later.
+    // ja: 保留中の FS 一覧をハンドラ単位で構築する低優先度タスク。先に届いたリクエストは同じミューテックス下で
+    //     自身のハンドラを走査する。古いインデックスは別領域に再構築し、後で差し替える。
+    void Server::backgroundScanTask(void *arg)
+    {
+        auto *server = static_cast<Server *>(arg);
+        for (HandlerEntry *entry : server->_scanQueue)
+        {
+            if (server->_scanAbort.load())
+            {
+                if (entry->rebuildState.load() == RebuildQueued)
+                {
+                    entry->rebuildState = RebuildIdle;
+                }
+                continue;
+            }
+            if (entry->rebuildState.load() == RebuildQueued)
+            {
+                server->rebuildStaticIndex(entry);
+                if (entry->rebuildState.load() == RebuildReady)
+                {
+                    server->_rebuildsReady = true;
+                }
+            }
+            else
+            {
+                server->ensureStaticScan(entry);
+            }
+        }
+        server->_scanTaskRunning = false;
+        vTaskDelete(nullptr);
+    }
+
+    const Server::StaticIndexEntry *Server::selectImageVariant(HandlerEntry *entry, Request &req, const String &logicalPath) const
+    {
+        if (!indexCurrent(entry))
+        {
+            return nullptr;
+        }
+        const String accept = req.header("Accept");
+        if (accept.isEmpty())
+        {
+            return nullptr;
+        }
+        // en: Ordered by preference; a later format must be strictly better by q-value to win.
+        // ja: 優先順。後続の形式は q 値が厳密に高い場合のみ採用。
+        static const char *const kVariants[][2] = {
+            {"image/avif", ".avif"},
+            {"image/webp", ".webp"},
+        };
+        const StaticIndexEntry *best = nullptr;
+        int bestQuality = 0;
+        for (const auto &variant : kVariants)
+        {
+            const int quality = mediaTypeQuality(accept, variant[0]);
+            if (quality <= bestQuality)
+            {
+                continue;
+            }
+            const StaticIndexEntry *found = entry->index.find(replaceExtension(logicalPath, variant[1]));
+            if (found)
+            {
+                best = found;
+                bestQuality = quality;
+            }
+        }
+        return best;
+    }
+
+    const Server::FingerprintEntry *Server::StaticIndex::findFingerprint(const String &logicalPath) const
+    {
+        auto it = std::lower_bound(fingerprints.begin(), fingerprints.end(), logicalPath,
+                                   [](const FingerprintEntry &item, const String &key)
+                                   { return strcmp(item.logicalPath.c_str(), key.c_str()) < 0; });
+        if (it != fingerprints.end() && it->logicalPath == logicalPath)
+        {
+            return &*it;
+        }
+        return nullptr;
+    }
+
+    const Server::PreloadEntry *Server::StaticIndex::findPreload(const String &page) const
+    {
+        auto it = std::lower_bound(preloads.begin(), preloads.end(), page,
+                                   [](const PreloadEntry &item, const String &key)
+                                   { return strcmp(item.page.c_str(), key.c_str()) < 0; });
+        if (it != preloads.end() && it->page == page)
+        {
+            return &*it;
+        }
+        return nullptr;
+    }
+
+    // en: Manifest rules win over headers derived from the page; only plain HTML files are scanned.
+    // ja: マニフェストの指定をページからの導出より優先する。走査するのは平文の HTML のみ。
+    void Server::buildPreloads(HandlerEntry *entry, StaticIndex &index)
+    {
+        auto &preloads = index.preloads;
+        preloads.clear();
+        for (const auto &rule : entry->options.preload)
+        {
+            PreloadEntry item;
+            item.page = ensureLeadingSlash(rule.page);
+            for (const auto &asset : rule.assets)
+            {
+                if (!isSafeLinkUrl(asset))
+                {
+                    ESP_LOGW(TAG, "[SERVE] preload %s: URL not allowed in a Link header, skipped", asset.c_str());
+                    continue;
+                }
+                bool crossOrigin = false;
+                const char *as = preloadDestination(asset, crossOrigin);
+                if (!as)
+                {
+                    ESP_LOGW(TAG, "[SERVE] preload %s: unknown type, skipped", asset.c_str());
+                    continue;
+                }
+                appendPreloadLink(item.link, asset, "preload", as, crossOrigin);
+            }
+            if (!item.link.isEmpty())
+            {
+                preloads.push_back(std::move(item));
+            }
+        }
+        const size_t manual = preloads.size();
+
+        if (entry->options.derivePreload)
+        {
+            ClassBuffer<char> scratch;
+            for (const auto &item : index.entries)
+            {
+                if (item.relPath.endsWith(".gz") || !isHtmlMime(determineMimeType(item.relPath)))
+                {
+                    continue;
+                }
+                const bool listed = std::any_of(preloads.begin(), preloads.begin() + manual, [&](const PreloadEntry &rule)
+                                                { return rule.page == item.relPath; });
+                if (listed)
+                {
+                    continue;
+                }
+                const char *html = nullptr;
+                size_t length = std::min(item.size, kPreloadScanBytes);
+                if (item.memIndex >= 0 && entry->type == HandlerType::StaticEmbedded)
+                {
+                    html = reinterpret_cast<const char *>(entry->embeddedAssets[item.memIndex].data);
+                }
+                else if (item.memIndex >= 0)
+                {
+                    html = reinterpret_cast<const char *>(entry->memData[item.memIndex]);
+                }
+                else if (entry->fs)
+                {
+                    if (!scratch)
+                    {
+                        scratch = allocateBuffer<char>(this, AllocClass::IoBuffer, kPreloadScanBytes);
+                    }
+                    File file = entry->fs->open(joinFsPath(entry->basePath, item.relPath), "r");
+                    length = (file && scratch) ? file.read(reinterpret_cast<uint8_t *>(scratch.get()), kPreloadScanBytes) : 0;
+                    if (file)
+                    {
+                        file.close();
+                    }
+                    html = scratch.get();
+                }
+                if (!html || length == 0)
+                {
+                    continue;
+                }
+                PreloadEntry derived;
+                derived.page = item.relPath;
+                derived.link = derivePreloadHeader(html, length);
+                if (!derived.link.isEmpty())
+                {
+                    preloads.push_back(std::move(derived));
+                }
+            }
+        }
+        std::sort(preloads.begin(), preloads.end(), [](const PreloadEntry &a, const PreloadEntry &b)
+                  { return strcmp(a.page.c_str(), b.page.c_str()) < 0; });
+        ESP_LOGI(TAG, "[SERVE] preloads %s pages=%u", entry->uriPrefix.c_str(), static_cast<unsigned>(preloads.size()));
+    }
+
+    // en: Link header for an HTML page. With earlyHints the value is also queued as a 103 that sendStatic() writes
+    //     only once it knows the answer is 200. esp_http_server does not expose the request version, so the
+    //     Host header (mandatory since HTTP/1.1) stands in for it: no 1xx may go to an HTTP/1.0 client.
+    // ja: HTML ページに Link ヘッダーを付ける。earlyHints 有効時は 103 として予約し、sendStatic() が 200 と
+    //     確定した時点でだけ書き込む。esp_http_server はリクエストのバージョンを公開しないため、HTTP/1.1 で
+    //     必須の Host ヘッダーで代用する（HTTP/1.0 クライアントに 1xx を送ってはならない）。
+    void Server::applyPreload(HandlerEntry *entry, Response &res, const StaticInfo &info)
+    {
+        if (!info.exists || info.isDir || !entry->index.ready || entry->index.preloads.empty())
+        {
+            return;
+        }
+        const PreloadEntry *preload = entry->index.findPreload(info.logicalPath);
+        if (!preload)
+        {
+            return;
+        }
+        res.setHeader("Link", preload->link);
+        if (!entry->options.earlyHints || res._capture || !res._raw || !res._requestContext ||
+            res._requestContext->header("Host").isEmpty())
+        {
+            return;
+        }
+        res._earlyHints = preload->link;
+    }
+
+    void Server::buildFingerprints(HandlerEntry *entry, StaticIndex &index)
+    {
+        auto &fingerprints = index.fingerprints;
+        fingerprints.clear();
+        for (const auto &item : index.entries)
+        {
+            const bool gz = item.relPath.endsWith(".gz");
+            const String logical = gz ? item.relPath.substring(0, item.relPath.length() - 3) : item.relPath;
+            if (isHtmlMime(String(determineMimeType(logical))))
+            {
+                continue;
+            }
+            // en: Hash the plain file when both forms exist so the fingerprint tracks the source content.
+            // ja: 平文と .gz が両方ある場合は平文をハッシュし、元コンテンツに追従させる。
+            if (gz && index.find(logical))
+            {
+                continue;
+            }
+            uint32_t hash = kFnvOffset;
+            bool ok = false;
+            if (item.memIndex >= 0 && entry->type == HandlerType::StaticEmbedded)
+            {
+                hash = entry->embeddedAssets[item.memIndex].contentHash;
+                ok = true;
+            }
+            else if (item.memIndex >= 0)
+            {
+                hash = fnv1a(hash, entry->memData[item.memIndex], entry->memSizes[item.memIndex]);
+                ok = true;
+            }
+            else if (entry->fs)
+            {
+                ok = hashFsFile(*entry->fs, joinFsPath(entry->basePath, item.relPath), hash);
+            }
+            if (!ok)
+            {
+                continue;
+            }
+            FingerprintEntry fingerprint;
+            fingerprint.logicalPath = logical;
+            fingerprint.fingerprintPath = insertPathTag(logical, formatHash(hash));
+            fingerprint.hash = hash;
+            fingerprints.push_back(std::move(fingerprint));
+        }
+        std::sort(fingerprints.begin(), fingerprints.end(), [](const FingerprintEntry &a, const FingerprintEntry &b)
+                  { return strcmp(a.logicalPath.c_str(), b.logicalPath.c_str()) < 0; });
+        ESP_LOGI(TAG, "[SERVE] fingerprints %s count=%u", entry->uriPrefix.c_str(), static_cast<unsigned>(fingerprints.size()));
+    }
+
+    bool Server::resolveAssetUrl(const String &url, String &out)
+    {
+        for (const auto &entryPtr : _handlers)
+        {
+            HandlerEntry *entry = entryPtr.get();
+            if (!entry || !entry->options.fingerprintAssets)
+            {
+                continue;
+            }
+            ensureStaticScan(entry);
+            if (!indexCurrent(entry))
+            {
+                continue;
+            }
+            String rel;
+            if (!extractRelativePath(url, entry->uriPrefix, rel))
+            {
+                continue;
+            }
+            const FingerprintEntry *fingerprint = entry->index.findFingerprint(rel);
+            if (!fingerprint)
+            {
+                continue;
+            }
+            out = (entry->uriPrefix == "/") ? fingerprint->fingerprintPath : entry->uriPrefix + fingerprint->fingerprintPath;
+            return true;
+        }
+        return false;
+    }
+
+    void Server::resolveFingerprintAlias(HandlerEntry *entry, Response &res, String &relPath) const
+    {
+        String logical;
+        uint32_t hash = 0;
+        if (!entry->index.ready || !stripFingerprint(relPath, logical, hash))
+        {
+            return;
+        }
+        const FingerprintEntry *fingerprint = entry->index.findFingerprint(logical);
+        if (!fingerprint || fingerprint->hash != hash)
+        {
+            return;
+        }
+        // en: A real file that merely looks fingerprinted (name.<8 hex>.ext) is served as itself. The index is
+        //     trusted while current; while a rebuild is pending the filesystem is asked directly.
+        // ja: 名前が指紋付きに見えるだけの実ファイル（name.<16進8桁>.ext）はそのまま返す。インデックスが最新なら
+        //     それを信用し、再構築待ちの間はファイルシステムに直接問い合わせる。
+        const bool current = indexCurrent(entry);
+        bool literal = entry->index.find(relPath) || entry->index.find(relPath + ".gz");
+        if (!literal && !current && entry->fs)
+        {
+            const String fsPath = joinFsPath(entry->basePath, relPath);
+            literal = entry->fs->exists(fsPath) || entry->fs->exists(fsPath + ".gz");
+        }
+        if (literal)
+        {
+            return;
+        }
+        // en: An index awaiting its rebuild may hold a hash of bytes that have since changed, so the alias is served
+        //     but not cached as immutable.
+        // ja: 再構築待ちのインデックスのハッシュは変更前の内容のものかもしれないため、返しはするが immutable にはしない。
+        res.setHeader("Cache-Control", current ? "public, max-age=31536000, immutable" : "no-cache");
+        relPath = logical;
+    }
+
+    // en: The gzip variant gets its own tag ("<hash>-gz") so caches never answer a 304 for the other encoding.
+    // ja: gzip 版には別のタグ（"<hash>-gz"）を付け、キャッシュが他方のエンコーディングに 304 を返さないようにする。
+    String Server::fingerprintEtag(HandlerEntry *entry, const String &logicalPath, bool gzip) const
+    {
+        if (!entry || !entry->options.fingerprintAssets || !indexCurrent(entry))
+        {
+            return String();
+        }
+        const FingerprintEntry *fingerprint = entry->index.findFingerprint(logicalPath);
+        if (!fingerprint)
+        {
+            return String();
+        }
+        return "\"" + formatHash(fingerprint->hash) + (gzip ? "-gz\"" : "\"");
+    }
+
+    const Server::StaticIndexEntry *Server::selectLanguageVariant(HandlerEntry *entry, Request &req, Response &res, const String &resolvedPath, const String &relPath, String &languageOut) const
+    {
+        languageOut.clear();
+        if (!entry || entry->options.languages.empty() || !indexCurrent(entry) || relPath.endsWith(".gz"))
+        {
+            return nullptr;
+        }
+        const std::vector<String> &languages = entry->options.languages;
+
+        // en: Candidate base paths: the resolved file, otherwise the request itself or its directory index.
+        // ja: 候補のベースパス。解決済みならそのファイル、未解決ならリクエストパスとディレクトリの index。
+        std::vector<String> bases;
+        if (!resolvedPath.isEmpty())
+        {
+            bases.push_back(resolvedPath);
+        }
+        else
+        {
+            const String rel = ensureLeadingSlash(relPath);
+            String dir = rel;
+            if (!dir.endsWith("/"))
+            {
+                bases.push_back(rel);
+                dir += "/";
+            }
+            bases.push_back(dir + "index.html");
+            bases.push_back(dir + "index.htm");
+        }
+
+        // en: Rank configured languages once: cookie override, then Accept-Language q, default last.
+        // ja: 設定言語を一度だけ順位付け。Cookie 指定、Accept-Language の q 値、最後に既定言語。
+        const String acceptLanguage = req.header("Accept-Language");
+        const String cookieLanguage = entry->options.languageCookie.isEmpty() ? String() : req.cookie(entry->options.languageCookie);
+        std::vector<std::pair<int, size_t>> ranked;
+        ranked.reserve(languages.size());
+        for (size_t i = 0; i < languages.size(); ++i)
+        {
+            int score = languageQuality(acceptLanguage, languages[i]);
+            if (!cookieLanguage.isEmpty() && cookieLanguage.equalsIgnoreCase(languages[i]))
+            {
+                score = 2000;
+            }
+            // en: q=0 excludes a language; only the default stays, ranked last, as the fallback.
+            // ja: q=0 の言語は除外する。既定言語だけはフォールバックとして最下位に残す。
+            if (i == 0 && score < 0)
+            {
+                score = 0;
+            }
+            if (score > 0 || i == 0)
+            {
+                ranked.push_back({score, i});
+            }
+        }
+        std::stable_sort(ranked.begin(), ranked.end(), [](const std::pair<int, size_t> &a, const std::pair<int, size_t> &b)
+                         { return a.first > b.first; });
+
+        for (const auto &base : bases)
+        {
+            for (const auto &rank : ranked)
+            {
+                const String variant = insertPathTag(base, languages[rank.second]);
+                const String gzVariant = variant + ".gz";
+                // en: Captured sub-requests (batch) take the plain variant when there is one.
+                // ja: キャプチャするサブリクエスト（バッチ）は平文のバリアントがあればそちらを選ぶ。
+                const StaticIndexEntry *found = entry->index.find(res._capture ? variant : gzVariant);
+                if (!found)
+                {
+                    found = entry->index.find(res._capture ? gzVariant : variant);
+                }
+                if (found)
+                {
+                    res.setHeader("Vary", entry->options.languageCookie.isEmpty() ? "Accept-Language" : "Accept-Language, Cookie");
+                    res.setHeader("Content-Language", languages[rank.second]);
+                    languageOut = languages[rank.second];
+                    return found;
+                }
+            }
+            for (const auto &language : languages)
+            {
+                const String variant = insertPathTag(base, language);
+                if (entry->index.find(variant) || entry->index.find(variant + ".gz"))
+                {
+                    res.setHeader("Vary", entry->options.languageCookie.isEmpty() ? "Accept-Language" : "Accept-Language, Cookie");
+                    return nullptr;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    void Server::setupStaticInfoFromFS(HandlerEntry *entry, Request &req, Response &res, const String &normalizedUri, const String &relPath)
+    {
+        if (!entry || !entry->fs)
+        {
+            ESP_LOGE(TAG, "[RESP] 500 static fs missing");
+            res.sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        StaticInfo info;
+        info.uri = normalizedUri;
+        info.relPath = relPath;
+        info.logicalPath = relPath;
+
+        const bool requestGz = relPath.endsWith(".gz");
+        String relBase = relPath;
+        if (requestGz)
+        {
+            relBase = relPath.substring(0, relPath.length() - 3);
+            if (relBase.isEmpty())
+            {
+                relBase = "/";
+            }
+        }
+        const String plainFsPath = joinFsPath(entry->basePath, relBase);
+        const String gzFsPath = plainFsPath + ".gz";
+
+        bool exists = false;
+        bool isDir = false;
+        bool useGz = false;
+
+        // en: A remembered miss skips every probe below; the generation guards against a concurrent invalidation.
+        // ja: 記録済みの 404 なら以下のプローブを全て省略。世代番号で並行した無効化を検出する。
+        const uint32_t cacheGeneration = _staticCacheGeneration.load();
+        const bool knownMiss = isUploadTempPath(entry->fs, plainFsPath) || entry->negativeCache.contains(relPath, cacheGeneration);
+
+        // en: Candidates are probed with exists() (a failed VFS open() logs an error per miss); only the chosen one is
+        //     opened, and that handle supplies size/isDir and is handed to sendStatic().
+        //     Captured sub-requests (batch) return bodies as text, so they take the plain file when there is one.
+        // ja: 候補は exists() でプローブし（VFS の open() は失敗のたびにエラーログを出す）、選んだものだけを開く。
+        //     そのハンドルからサイズ・ディレクトリ判定を得て sendStatic() に引き渡す。
+        //     キャプチャするサブリクエスト（バッチ）はボディをテキストで返すため、平文があればそちらを選ぶ。
+        const bool preferGzip = !res._capture;
+        File opened;
+        int openedSlot = -1;
+        info.fsPath = requestGz ? gzFsPath : plainFsPath;
+        useGz = requestGz;
+        if (!knownMiss)
+        {
+            const String *candidates[2] = {&gzFsPath, &plainFsPath};
+            if (!preferGzip)
+            {
+                std::swap(candidates[0], candidates[1]);
+            }
+            for (const String *candidate : candidates)
+            {
+                const bool candidateGz = candidate == &gzFsPath;
+                if ((requestGz && !candidateGz) || !probeFile(entry->fs, *candidate))
+                {
+                    continue;
+                }
+                opened = acquireFile(entry->fs, *candidate, openedSlot);
+                if (opened)
+                {
+                    info.fsPath = *candidate;
+                    exists = true;
+                    useGz = candidateGz;
+                    isDir = !candidateGz && opened.isDirectory();
+                    break;
+                }
+            }
+        }
+
+        if (exists && isDir)
+        {
+            releaseFile(opened, openedSlot);
+            opened = File();
+            openedSlot = -1;
+            String dirRel = ensureLeadingSlash(relBase);
+            if (!dirRel.endsWith("/"))
+            {
+                dirRel += "/";
+            }
+            static const char *kIndexCandidates[] = {"index.html", "index.htm"};
+            bool foundIndex = false;
+            for (const char *candidateName : kIndexCandidates)
+            {
+                if (!candidateName)
+                {
+                    continue;
+                }
+                String candidateRel = dirRel + candidateName;
+                const String candidatePlain = joinFsPath(entry->basePath, candidateRel);
+                const String candidateGz = candidatePlain + ".gz";
+                const String *variants[2] = {&candidateGz, &candidatePlain};
+                if (!preferGzip)
+                {
+                    std::swap(variants[0], variants[1]);
+                }
+                for (const String *variant : variants)
+                {
+                    if (probeFile(entry->fs, *variant))
+                    {
+                        opened = acquireFile(entry->fs, *variant, openedSlot);
+                    }
+                    if (opened && (variant == &candidateGz || !opened.isDirectory()))
+                    {
+                        info.fsPath = *variant;
+                        info.logicalPath = ensureLeadingSlash(candidateRel);
+                        exists = true;
+                        useGz = variant == &candidateGz;
+                        isDir = false;
+                        foundIndex = true;
+                        break;
+                    }
+                    releaseFile(opened, openedSlot);
+                    opened = File();
+                    openedSlot = -1;
+                }
+                if (foundIndex)
+                {
+                    break;
+                }
+            }
+            if (!foundIndex)
+            {
+                exists = false;
+                isDir = false;
+            }
+        }
+
+        if (!exists && !knownMiss && _staticCacheGeneration.load() == cacheGeneration)
+        {
+            entry->negativeCache.remember(relPath, cacheGeneration);
+        }
+
+        info.exists = exists;
+        info.isDir = isDir;
+        info.isGzipped = useGz;
+        if (info.isGzipped && info.logicalPath.endsWith(".gz"))
+        {
+            info.logicalPath = info.logicalPath.substring(0, info.logicalPath.length() - 3);
+        }
+
+        const String openedPath = opened ? info.fsPath : String();
+
+        String language;
+        const StaticIndexEntry *localized = selectLanguageVariant(entry, req, res, info.exists ? info.logicalPath : String(), relPath, language);
+        if (localized)
+        {
+            info.fsPath = joinFsPath(entry->basePath, localized->relPath);
+            info.isGzipped = localized->relPath.endsWith(".gz");
+            info.logicalPath = info.isGzipped ? localized->relPath.substring(0, localized->relPath.length() - 3) : localized->relPath;
+            info.exists = true;
+            info.isDir = false;
+        }
+
+        if (entry->options.negotiateImageFormats && info.exists && !info.isGzipped && isNegotiableImage(info.logicalPath))
+        {
+            res.setHeader("Vary", "Accept");
+            const StaticIndexEntry *variant = selectImageVariant(entry, req, info.logicalPath);
+            if (variant)
+            {
+                info.fsPath = joinFsPath(entry->basePath, variant->relPath);
+                info.logicalPath = variant->relPath;
+            }
+        }
+
+#if LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG
+        ESP_LOGD(TAG, "[STATIC][FS] path=%s gz=%d exists=%d", info.fsPath.c_str(), info.isGzipped, info.exists);
+#endif
+
+        if (info.exists)
+        {
+            info.etag = fingerprintEtag(entry, info.logicalPath, info.isGzipped);
+        }
+
+        // en: A language/image variant replaced the probed file, so its handle is not the one to stream.
+        // ja: 言語・画像バリアントに差し替わった場合、プローブしたハンドルは送信対象ではない。
+        if (opened && (!info.exists || info.fsPath != openedPath))
+        {
+            releaseFile(opened, openedSlot);
+            opened = File();
+            openedSlot = -1;
+        }
+        if (opened)
+        {
+            info.size = opened.size();
+        }
+
+        res.setStaticFileSystem(entry->fs);
+        res.setStaticInfo(info);
+        res.setPendingStaticFile(opened, openedSlot);
+
+        applyPreload(entry, res, info);
+        if (entry->staticHandler)
+        {
+            entry->staticHandler(info, req, res);
+        }
+        if (!res.committed())
+        {
+            if (info.exists)
+            {
+                res.sendStatic();
+            }
+            else
+            {
+                res.sendError(HTTPD_404_NOT_FOUND);
+            }
+        }
+        res.releasePendingStaticFile();
+    }
+
+    void Server::setupStaticInfoFromMemory(HandlerEntry *entry, Request &req, Response &res, const String &normalizedUri, const String &relPath)
+    {
+        StaticInfo info;
+        info.uri = normalizedUri;
+        info.relPath = relPath;
+        info.logicalPath = relPath;
+
+        const bool requestGz = relPath.endsWith(".gz");
+        String relBase = relPath;
+        if (requestGz)
+        {
+            relBase = relPath.substring(0, relPath.length() - 3);
+            if (relBase.isEmpty())
+            {
+                relBase = "/";
+            }
+        }
+        relBase = ensureLeadingSlash(relBase);
+        const String gzRel = relBase + ".gz";
+        String dirPrefix = relBase;
+        if (!dirPrefix.endsWith("/"))
+        {
+            dirPrefix += "/";
+        }
+
+        bool hasChildPrefix = false;
+        int plainIndex = -1;
+        int gzIndex = -1;
+        for (size_t i = 0; i < entry->memCount; ++i)
+        {
+            const char *candidate = entry->memPaths[i];
+            if (!candidate)
+            {
+                continue;
+            }
+            String candidateStr(candidate);
+            if (plainIndex < 0 && candidateStr == relBase)
+            {
+                plainIndex = static_cast<int>(i);
+            }
+            else if (gzIndex < 0 && candidateStr == gzRel)
+            {
+                gzIndex = static_cast<int>(i);
+            }
+            if (!hasChildPrefix && candidateStr.startsWith(dirPrefix))
+            {
+                hasChildPrefix = true;
+            }
+        }
+
+        auto findIndexByPath = [&](const String &target) -> int
+        {
+            if (target.isEmpty())
+            {
+                return -1;
+            }
+            for (size_t i = 0; i < entry->memCount; ++i)
+            {
+                const char *candidate = entry->memPaths[i];
+                if (!candidate)
+                {
+                    continue;
+                }
+                if (target == candidate)
+                {
+                    return static_cast<int>(i);
+                }
+            }
+            return -1;
+        };
+
+        bool directoryHint = relPath.endsWith("/") || hasChildPrefix;
+        if (plainIndex < 0 && gzIndex < 0 && directoryHint)
+        {
+            static const char *kIndexCandidates[] = {"index.html", "index.htm"};
+            for (const char *candidateName : kIndexCandidates)
+            {
+                if (!candidateName)
+                {
+                    continue;
+                }
+                String candidateRel = dirPrefix + candidateName;
+                const int gzCandidate = findIndexByPath(candidateRel + ".gz");
+                const int plainCandidate = findIndexByPath(candidateRel);
+                if (gzCandidate >= 0 || plainCandidate >= 0)
+                {
+                    gzIndex = gzCandidate;
+                    plainIndex = plainCandidate;
+                    info.logicalPath = candidateRel;
+                    relBase = candidateRel;
+                    break;
+                }
+            }
+        }
+
+        // en: Captured sub-requests (batch) return bodies as text, so they take the plain entry when there is one.
+        // ja: キャプチャするサブリクエスト（バッチ）はボディをテキストで返すため、平文があればそちらを選ぶ。
+        const bool preferGzip = !res._capture;
+        int chosenIndex = -1;
+        bool gz = false;
+        if (requestGz)
+        {
+            if (gzIndex >= 0)
+            {
+                chosenIndex = gzIndex;
+                gz = true;
+            }
+        }
+        else if (gzIndex >= 0 && (preferGzip || plainIndex < 0))
+        {
+            chosenIndex = gzIndex;
+            gz = true;
+        }
+        else if (plainIndex >= 0)
+        {
+            chosenIndex = plainIndex;
+            gz = false;
+        }
+
+        String language;
+        const StaticIndexEntry *localized = selectLanguageVariant(entry, req, res, chosenIndex >= 0 ? info.logicalPath : String(), relPath, language);
+        if (localized && localized->memIndex >= 0)
+        {
+            chosenIndex = localized->memIndex;
+            gz = localized->relPath.endsWith(".gz");
+            info.logicalPath = gz ? localized->relPath.substring(0, localized->relPath.length() - 3) : localized->relPath;
+        }
+
+        if (chosenIndex >= 0 && !gz && entry->options.negotiateImageFormats && isNegotiableImage(info.logicalPath))
+        {
+            res.setHeader("Vary", "Accept");
+            const StaticIndexEntry *variant = selectImageVariant(entry, req, info.logicalPath);
+            if (variant && variant->memIndex >= 0)
+            {
+                chosenIndex = variant->memIndex;
+                info.logicalPath = variant->relPath;
+            }
+        }
+
+        if (chosenIndex >= 0)
+        {
+            info.exists = true;
+            info.fsPath = entry->memPaths[chosenIndex];
+            info.isGzipped = gz;
+            if (info.isGzipped && info.logicalPath.endsWith(".gz"))
+            {
+                info.logicalPath = info.logicalPath.substring(0, info.logicalPath.length() - 3);
+            }
+            const uint8_t *dataPtr = entry->memData[chosenIndex];
+            const size_t dataSize = entry->memSizes[chosenIndex];
+            info.size = dataSize;
+            res.setStaticMemorySource(dataPtr, dataSize);
+            info.etag = fingerprintEtag(entry, info.logicalPath, info.isGzipped);
+        }
+        else
+        {
+            info.exists = false;
+            info.isGzipped = requestGz;
+            res.clearStaticSource();
+        }
+
+#if LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG
+        ESP_LOGD(TAG, "[STATIC][MEM] path=%s gz=%d exists=%d", info.fsPath.c_str(), info.isGzipped, info.exists);
+#endif
+
+        res.setStaticInfo(info);
+
+        applyPreload(entry, res, info);
+        if (entry->staticHandler)
+        {
+            entry->staticHandler(info, req, res);
+        }
+        if (!res.committed())
+        {
+            if (info.exists)
+            {
+                res.sendStatic();
+            }
+            else
+            {
+                res.sendError(HTTPD_404_NOT_FOUND);
+            }
+        }
+    }
+
+    void Server::setupStaticInfoFromEmbedded(HandlerEntry *entry, Request &req, Response &res, const String &normalizedUri, const String &relPath)
+    {
+        StaticInfo info;
+        info.uri = normalizedUri;
+        info.relPath = relPath;
+        info.logicalPath = relPath;
+
+        const EmbeddedAsset *assets = entry->embeddedAssets;
+        const size_t count = entry->embeddedCount;
+        const bool requestGz = relPath.endsWith(".gz");
+
+        // en: Plain path -> its linked .gz sibling, else a gz-only entry. Captured sub-requests (batch) return bodies
+        //     as text, so they keep the plain entry.
+        // ja: 平文パス -> リンク済みの .gz、無ければ .gz のみのエントリ。キャプチャするサブリクエスト（バッチ）は
+        //     ボディをテキストで返すため平文のままにする。
+        const bool preferGzip = !res._capture;
+        auto resolve = [&](const String &path) -> int
+        {
+            const int plain = findEmbeddedAsset(assets, count, path);
+            if (plain >= 0)
+            {
+                return preferGzip && assets[plain].gzSibling >= 0 ? assets[plain].gzSibling : plain;
+            }
+            return findEmbeddedAsset(assets, count, path + ".gz");
+        };
+
+        int chosenIndex = -1;
+        if (requestGz)
+        {
+            chosenIndex = findEmbeddedAsset(assets, count, ensureLeadingSlash(relPath));
+        }
+        else
+        {
+            const String relBase = ensureLeadingSlash(relPath);
+            if (!relBase.endsWith("/"))
+            {
+                chosenIndex = resolve(relBase);
+            }
+            if (chosenIndex < 0)
+            {
+                String dirPrefix = relBase;
+                if (!dirPrefix.endsWith("/"))
+                {
+                    dirPrefix += "/";
+                }
+                static const char *kIndexCandidates[] = {"index.html", "index.htm"};
+                for (const char *candidateName : kIndexCandidates)
+                {
+                    const String candidateRel = dirPrefix + candidateName;
+                    const int found = resolve(candidateRel);
+                    if (found >= 0)
+                    {
+                        chosenIndex = found;
+                        info.logicalPath = candidateRel;
+                        break;
+                    }
+                }
+            }
+        }
+
+        String language;
+        const StaticIndexEntry *localized = selectLanguageVariant(entry, req, res, chosenIndex >= 0 ? info.logicalPath : String(), relPath, language);
+        if (localized && localized->memIndex >= 0)
+        {
+            const bool gzEntry = localized->relPath.endsWith(".gz");
+            chosenIndex = gzEntry ? localized->memIndex : resolve(localized->relPath);
+            info.logicalPath = gzEntry ? localized->relPath.substring(0, localized->relPath.length() - 3) : localized->relPath;
+        }
+
+        if (chosenIndex >= 0 && assets[chosenIndex].encoding != kEmbeddedGzip && entry->options.negotiateImageFormats && isNegotiableImage(info.logicalPath))
+        {
+            res.setHeader("Vary", "Accept");
+            const StaticIndexEntry *variant = selectImageVariant(entry, req, info.logicalPath);
+            if (variant && variant->memIndex >= 0)
+            {
+                chosenIndex = variant->memIndex;
+                info.logicalPath = variant->relPath;
+            }
+        }
+
+        if (chosenIndex >= 0)
+        {
+            const EmbeddedAsset &asset = assets[chosenIndex];
+            info.exists = true;
+            info.fsPath = asset.path;
+            info.isGzipped = (asset.encoding == kEmbeddedGzip);
+            if (info.logicalPath.endsWith(".gz"))
+            {
+                info.logicalPath = info.logicalPath.substring(0, info.logicalPath.length() - 3);
+            }
+            info.etag = asset.etag ? String(asset.etag) : String();
+            info.size = asset.size;
+            res.setStaticMemorySource(asset.data, asset.size);
+            res.setStaticMimeType(mimeTypeForId(asset.mimeId));
+        }
+        else
+        {
+            info.exists = false;
+            info.isGzipped = requestGz;
+            res.clearStaticSource();
+        }
+
+#if LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG
+        ESP_LOGD(TAG, "[STATIC][EMB] path=%s gz=%d exists=%d", info.fsPath.c_str(), info.isGzipped, info.exists);
+#endif
+
+        res.setStaticInfo(info);
+
+        applyPreload(entry, res, info);
+        if (entry->staticHandler)
+        {
+            entry->staticHandler(info, req, res);
+        }
+        if (!res.committed())
+        {
+            if (info.exists)
+            {
+                res.sendStatic();
+            }
+            else
+            {
+                res.sendError(HTTPD_404_NOT_FOUND);
+            }
+        }
+    }
+
+    // en: One part of a combo in the requested encoding. Only exact paths count: no directory index,
+    //     language or image variants, so every client gets the same bytes for the same URL.
+    // ja: 指定エンコーディングでのコンボの 1 パート。完全一致のパスのみを対象とし、ディレクトリ index や
+    //     言語・画像バリアントは使わない（同じ URL には常に同じバイト列を返す）。
+    bool Server::resolveComboPart(HandlerEntry *entry, const String &path, bool gzip, ComboPart &part)
+    {
+        switch (entry->type)
+        {
+        case HandlerType::StaticEmbedded:
+        {
+            const EmbeddedAsset *assets = entry->embeddedAssets;
+            int index = findEmbeddedAsset(assets, entry->embeddedCount, path);
+            if (gzip)
+            {
+                index = index >= 0 ? assets[index].gzSibling : findEmbeddedAsset(assets, entry->embeddedCount, path + ".gz");
+            }
+            if (index < 0)
+            {
+                return false;
+            }
+            part.data = assets[index].data;
+            part.size = assets[index].size;
+            part.etag = assets[index].etag ? String(assets[index].etag) : formatHash(assets[index].contentHash);
+            return true;
+        }
+        case HandlerType::StaticMem:
+        {
+            const String target = gzip ? path + ".gz" : path;
+            for (size_t i = 0; i < entry->memCount; ++i)
+            {
+                if (!entry->memPaths[i] || target != entry->memPaths[i])
+                {
+                    continue;
+                }
+                part.data = entry->memData[i];
+                part.size = entry->memSizes[i];
+                part.etag = fingerprintEtag(entry, path, gzip);
+                if (part.etag.isEmpty())
+                {
+                    part.etag = formatHash(fnv1a(kFnvOffset, part.data, part.size));
+                }
+                return true;
+            }
+            return false;
+        }
+        case HandlerType::StaticFS:
+        {
+            part.fsPath = joinFsPath(entry->basePath, path);
+            if (isUploadTempPath(entry->fs, part.fsPath))
+            {
+                return false;
+            }
+            if (gzip)
+            {
+                part.fsPath += ".gz";
+            }
+            if (!probeFile(entry->fs, part.fsPath))
+            {
+                return false;
+            }
+            int slot = -1;
+            File file = acquireFile(entry->fs, part.fsPath, slot);
+            const bool found = file && !file.isDirectory();
+            if (found)
+            {
+                part.size = file.size();
+                part.etag = fingerprintEtag(entry, path, gzip);
+                if (part.etag.isEmpty())
+                {
+                    part.etag = part.fsPath + ":" + String(static_cast<unsigned>(part.size)) + ":" + String(static_cast<unsigned long>(file.getLastWrite()));
+                }
+            }
+            releaseFile(file, slot);
+            return found;
+        }
+        }
+        return false;
+    }
+
+    // en: <prefix><comboPath>?/a.css,/b.css -> the parts back to back. gzip members are concatenated when every
+    //     part has a .gz sibling (a multi-member stream is valid gzip), otherwise all parts are sent plain.
+    // ja: <prefix><comboPath>?/a.css,/b.css でパートを連結して返す。全パートに .gz があれば gzip メンバーを
+    //     連結し（複数メンバーも正しい gzip）、そうでなければ全パートを平文で送る。
+    void Server::handleCombo(HandlerEntry *entry, Request &req, Response &res)
+    {
+        const String uri = req.uri();
+        const int query = uri.indexOf('?');
+        std::vector<String> paths;
+        bool valid = query >= 0;
+        int start = query + 1;
+        while (valid && start <= static_cast<int>(uri.length()))
+        {
+            int comma = uri.indexOf(',', start);
+            if (comma < 0)
+            {
+                comma = uri.length();
+            }
+            String normalized;
+            std::vector<String> segments;
+            valid = comma > start && paths.size() < entry->options.comboMaxParts &&
+                    normalizeRoutePath(uri.substring(start, comma), normalized, segments) &&
+                    std::find(segments.begin(), segments.end(), String("..")) == segments.end();
+            if (valid)
+            {
+                paths.push_back(normalized);
+            }
+            start = comma + 1;
+        }
+        const String mime = paths.empty() ? String() : determineMimeType(paths.front());
+        for (const auto &path : paths)
+        {
+            valid = valid && determineMimeType(path) == mime;
+        }
+        if (!valid || paths.empty())
+        {
+            ESP_LOGW(TAG, "[STATIC][COMBO] 400 %s", uri.c_str());
+            res.sendError(HTTPD_400_BAD_REQUEST);
+            return;
+        }
+
+        std::vector<ComboPart> parts;
+        auto resolveAll = [&](bool gzip) -> bool
+        {
+            parts.clear();
+            for (const auto &path : paths)
+            {
+                ComboPart part;
+                if (!resolveComboPart(entry, path, gzip, part))
+                {
+                    return false;
+                }
+                parts.push_back(std::move(part));
+            }
+            return true;
+        };
+        const bool gzip = resolveAll(true);
+        if (!gzip && !resolveAll(false))
+        {
+            ESP_LOGI(TAG, "[STATIC][COMBO] 404 %s", uri.c_str());
+            res.sendError(HTTPD_404_NOT_FOUND);
+            return;
+        }
+
+        uint32_t hash = fnv1a(kFnvOffset, reinterpret_cast<const uint8_t *>(gzip ? "gzip" : "identity"), gzip ? 4 : 8);
+        size_t total = 0;
+        for (const auto &part : parts)
+        {
+            hash = fnv1a(hash, reinterpret_cast<const uint8_t *>(part.etag.c_str()), part.etag.length());
+            hash = fnv1a(hash, reinterpret_cast<const uint8_t *>(","), 1);
+            total += part.size;
+        }
+        const String etag = "\"combo-" + formatHash(hash) + "\"";
+        res.setHeader("ETag", etag);
+        if (entry->options.comboMaxAge > 0)
+        {
+            res.setHeader("Cache-Control", "public, max-age=" + String(static_cast<unsigned long>(entry->options.comboMaxAge)));
+        }
+        else
+        {
+            res.setHeader("Cache-Control", "no-cache");
+        }
+        const String ifNoneMatch = req.header("If-None-Match");
+        if (!ifNoneMatch.isEmpty() && (ifNoneMatch == "*" || ifNoneMatch.indexOf(etag) >= 0))
+        {
+            ESP_LOGI(TAG, "[STATIC][COMBO] 304 %u parts", static_cast<unsigned>(parts.size()));
+            res.send(304, nullptr, nullptr, 0);
+            return;
+        }
+        if (gzip)
+        {
+            res.setHeader("Content-Encoding", "gzip");
+        }
+        ESP_LOGI(TAG, "[STATIC][COMBO] %u parts %u bytes (%s)", static_cast<unsigned>(parts.size()), static_cast<unsigned>(total), gzip ? "gzip" : "plain");
+
+        // en: FS parts are opened one at a time as the stream reaches them; the cursor releases the open one when dropped.
+        // ja: FS のパートはストリームが到達した時点で 1 つずつ開く。カーソル破棄時に開いているハンドルを解放する。
+        struct ComboCursor
+        {
+            Server *server = nullptr;
+            fs::FS *fs = nullptr;
+            std::vector<ComboPart> parts;
+            size_t index = 0;
+            size_t offset = 0;
+            File file;
+            int slot = -1;
+
+            ~ComboCursor() { closePart(); }
+
+            void closePart()
+            {
+                if (file)
+                {
+                    server->releaseFile(file, slot);
+                }
+                file = File();
+                slot = -1;
+            }
+        };
+        auto cursor = std::make_shared<ComboCursor>();
+        cursor->server = this;
+        cursor->fs = entry->fs;
+        cursor->parts = std::move(parts);
+        auto source = [cursor](uint8_t *buffer, size_t capacity) -> size_t
+        {
+            size_t written = 0;
+            while (written < capacity && cursor->index < cursor->parts.size())
+            {
+                const ComboPart &part = cursor->parts[cursor->index];
+                size_t len = 0;
+                if (part.fsPath.isEmpty())
+                {
+                    len = std::min(capacity - written, part.size - cursor->offset);
+                    memcpy(buffer + written, part.data + cursor->offset, len);
+                }
+                else
+                {
+                    if (!cursor->file)
+                    {
+                        cursor->file = cursor->server->acquireFile(cursor->fs, part.fsPath, cursor->slot);
+                    }
+                    const int read = cursor->file ? cursor->file.read(buffer + written, capacity - written) : 0;
+                    len = read > 0 ? static_cast<size_t>(read) : 0;
+                }
+                written += len;
+                cursor->offset += len;
+                if (len == 0 || cursor->offset >= part.size)
+                {
+                    cursor->closePart();
+                    ++cursor->index;
+                    cursor->offset = 0;
+                }
+            }
+            return written;
+        };
+        res.sendStream(200, mime.c_str(), source, total);
+    }
+
+    bool Server::ensureMethodHook(httpd_method_t method)
+    {
+        for (auto &hook : _methodHooks)
+        {
+            if (hook->method == method)
+            {
+                return true;
+            }
+        }
+
+        auto hook = std::make_unique<MethodHook>();
+        hook->method = method;
+        hook->uriDef.uri = "/*";
+        hook->uriDef.method = method;
+        hook->uriDef.handler = &Server::handleDynamicHttpRequest;
+        hook->uriDef.user_ctx = this;
+        MethodHook *hookPtr = hook.get();
+        _methodHooks.push_back(std::move(hook));
+        if (_handle)
+        {
+            return registerMethodHook(hookPtr);
+        }
+        return true;
+    }
+
+    bool Server::registerMethodHook(MethodHook *hook)
+    {
+        if (!_handle || !hook)
+        {
+            return false;
+        }
+        hook->uriDef.user_ctx = this;
+        const esp_err_t err = httpd_register_uri_handler(_handle, &hook->uriDef);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to register dynamic hook: %s", esp_err_to_name(err));
+            return false;
+        }
+        hook->registered = true;
+        return true;
+    }
+
+    esp_err_t Server::dispatchDynamic(httpd_req_t *req)
+    {
+        installRebuiltIndexes();
+        Request request(req);
+        request._server = this;
+        Response response(req);
+        response.setRequestContext(&request);
+        response.setServerContext(this);
+
+        const String rawUri = request.uri();
+#if LOG_LOCAL_LEVEL >= ESP_LOG_INFO
+        {
+            const String remote = clientAddress(req);
+            ESP_LOGI(TAG, "[REQ] %s %s from %s", request.method().c_str(), rawUri.c_str(), remote.c_str());
+        }
+#endif
+
+        String normalized;
+        std::vector<String> pathSegments;
+        if (!normalizeRoutePath(rawUri, normalized, pathSegments))
+        {
+            ESP_LOGW(TAG, "[RESP] 400 invalid path %s", rawUri.c_str());
+            response.sendError(HTTPD_400_BAD_REQUEST);
+            return ESP_OK;
+        }
+
+        ParamList emptyParams;
+        request.setPathInfo(normalized, emptyParams);
+        response._trafficClass = trafficClassFor(normalized);
+
+        if (!checkAuth(request, response, normalized))
+        {
+            return ESP_OK;
+        }
+
+        httpd_method_t method = static_cast<httpd_method_t>(req->method);
+        if (method == HTTP_GET)
+        {
+            if (tryHandleStaticRequest(request, response, method, rawUri, normalized))
+            {
+                return ESP_OK;
+            }
+        }
+
+        ParamList bestParams;
+        DynamicRoute *bestRoute = findRoute(method, pathSegments, bestParams);
+
+        if (!bestRoute)
+        {
+            if (_notFoundHandler)
+            {
+                _notFoundHandler(request, response);
+                if (!response.committed())
+                {
+                    response.sendError(HTTPD_404_NOT_FOUND);
+                }
+                return ESP_OK;
+            }
+            ESP_LOGI(TAG, "[404] %s %s", request.method().c_str(), normalized.c_str());
+            response.sendError(HTTPD_404_NOT_FOUND);
+            return ESP_OK;
+        }
+
+        request.setPathInfo(normalized, bestParams);
+#if LOG_LOCAL_LEVEL >= ESP_LOG_INFO
+        {
+            ESP_LOGI(TAG, "[ROUTE] %s -> %s", normalized.c_str(), bestRoute->pattern.c_str());
+        }
+#endif
+#if LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG
+        {
+            logParams(bestParams);
+        }
+#endif
+        if (!admitBody(request, response, bestRoute->bodyPolicy))
+        {
+            // en: ESP_FAIL makes httpd drop the session as is; ESP_OK would first read and discard the unread body
+            //     (or wait recv_wait_timeout for an Expect client that never sends it).
+            // ja: ESP_FAIL を返すと httpd はそのままセッションを閉じる。ESP_OK では未読のボディを読み捨てる
+            //     （Expect で送ってこないクライアントなら recv_wait_timeout まで待つ）。
+            return ESP_FAIL;
+        }
+        bestRoute->handler(request, response);
+        if (!response.committed())
+        {
+            response.sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+        }
+        return ESP_OK;
+    }
+
+    Server::DynamicRoute *Server::findRoute(httpd_method_t method, const std::vector<String> &pathSegments, ParamList &params)
+    {
+        DynamicRoute *bestRoute = nullptr;
+        int bestScore = -1;
+        ParamList tempParams;
+
+        for (auto &route : _dynamicRoutes)
+        {
+            if (route.method != method)
+            {
+                continue;
+            }
+            tempParams.clear();
+            if (matchRoute(route, pathSegments, tempParams))
+            {
+                if (route.score > bestScore)
+                {
+                    bestScore = route.score;
+                    bestRoute = &route;
+                    params = tempParams;
                 }
             }
         }
+        return bestRoute;
+    }
 
-        if (state == TemplateState::OpenBrace && braceCount > 0)
+    // en: Runs after routing and auth, before the handler can touch the body. Rejections answer 413/415 with
+    //     Connection: close and return false, and the caller then fails the request so the session is closed
+    //     without draining the body; accepted "Expect: 100-continue" bodies get the interim 100.
+    // ja: ルーティングと認証の後、ハンドラがボディに触れる前に実行する。拒否時は Connection: close 付きの 413/415 を
+    //     返して false とし、呼び出し側がリクエストを失敗扱いにしてボディを読み捨てずにセッションを閉じる。
+    //     受け入れた "Expect: 100-continue" には中間応答 100 を返す。
+    bool Server::admitBody(Request &request, Response &response, const BodyPolicy &policy)
+    {
+        httpd_req_t *req = request.raw();
+        const size_t length = req->content_len;
+        String expect = request.header("Expect");
+        expect.trim();
+        const bool expectContinue = expect.equalsIgnoreCase("100-continue");
+        if (length == 0 && !expectContinue)
         {
-            if (!emitRepeat('{', braceCount))
-            {
-                return false;
-            }
+            return true;
         }
-        else if (state == TemplateState::Placeholder)
+
+        int status = 0;
+        const size_t limit = policy.maxBodySize ? policy.maxBodySize : _options.maxBodySize;
+        if (limit > 0 && length > limit)
         {
-            const int needed = triple ? 3 : 2;
-            if (!emitRepeat('{', needed))
-            {
-                return false;
-            }
-            if (!emitString(placeholderRaw))
+            status = 413;
+        }
+        else if (!policy.contentTypes.empty())
+        {
+            String type = request.header("Content-Type");
+            const int semi = type.indexOf(';');
+            if (semi >= 0)
             {
-                return false;
+                type.remove(semi);
             }
-            if (closingCount > 0)
+            type.trim();
+            type.toLowerCase();
+            bool allowed = false;
+            for (const auto &candidate : policy.contentTypes)
             {
-                if (!emitRepeat('}', closingCount))
+                String pattern = candidate;
+                pattern.toLowerCase();
+                if (pattern.endsWith("/*") ? type.startsWith(pattern.substring(0, pattern.length() - 1)) : type == pattern)
                 {
-                    return false;
+                    allowed = true;
+                    break;
                 }
             }
+            status = allowed ? 0 : 415;
         }
 
-        if (!flushChunk())
+        if (status != 0)
         {
+            ESP_LOGW(TAG, "[REQ] body rejected (%u bytes) -> %d", static_cast<unsigned>(length), status);
+            response.setHeader("Connection", "close");
+            response.sendError(status);
             return false;
         }
-        return httpd_resp_send_chunk(_raw, nullptr, 0) == ESP_OK;
+        if (expectContinue)
+        {
+            static const char kContinue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+            if (httpd_send(req, kContinue, sizeof(kContinue) - 1) < 0)
+            {
+                ESP_LOGW(TAG, "[REQ] failed to send 100 Continue");
+                return false;
+            }
+        }
+        return true;
     }
 
     namespace
     {
-        String defaultSessionId(size_t idBytes)
+        void skipJsonSpace(const char *&p, const char *end)
         {
-            const size_t bytes = idBytes > 0 ? idBytes : 16;
-            String out;
-            out.reserve(bytes * 2);
-            static const char kHex[] = "0123456789abcdef";
-            for (size_t i = 0; i < bytes; ++i)
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
             {
-                uint8_t b = static_cast<uint8_t>(esp_random() & 0xFF);
-                out += kHex[(b >> 4) & 0x0F];
-                out += kHex[b & 0x0F];
+                ++p;
             }
-            return out;
         }
 
-        bool defaultValidateSessionId(const String &id, size_t idBytes)
+        // en: Reads the JSON string literal whose opening quote is at p. Surrogate \uXXXX escapes are rejected;
+        //     targets are expected to be ASCII or percent-encoded anyway.
+        // ja: p 位置の開き引用符から JSON 文字列リテラルを読む。サロゲートの \uXXXX は拒否する
+        //     （ターゲットは ASCII かパーセントエンコード済みの想定）。
+        bool readJsonString(const char *&p, const char *end, String &out)
         {
-            if (id.isEmpty())
+            if (p >= end || *p != '"')
             {
                 return false;
             }
-            size_t minLen = idBytes ? (idBytes * 2) / 3 : 8;
-            if (minLen < 8)
+            ++p;
+            out = String();
+            while (p < end && *p != '"')
             {
-                minLen = 8;
+                const unsigned char c = static_cast<unsigned char>(*p++);
+                if (c < 0x20)
+                {
+                    return false;
+                }
+                if (c != '\\')
+                {
+                    out += static_cast<char>(c);
+                    continue;
+                }
+                if (p >= end)
+                {
+                    return false;
+                }
+                const char escape = *p++;
+                switch (escape)
+                {
+                case '"':
+                case '\\':
+                case '/':
+                    out += escape;
+                    break;
+                case 'b':
+                    out += '\b';
+                    break;
+                case 'f':
+                    out += '\f';
+                    break;
+                case 'n':
+                    out += '\n';
+                    break;
+                case 'r':
+                    out += '\r';
+                    break;
+                case 't':
+                    out += '\t';
+                    break;
+                case 'u':
+                {
+                    if (end - p < 4)
+                    {
+                        return false;
+                    }
+                    uint32_t code = 0;
+                    for (int i = 0; i < 4; ++i)
+                    {
+                        const int digit = hexValue(p[i]);
+                        if (digit < 0)
+                        {
+                            return false;
+                        }
+                        code = (code << 4) | static_cast<uint32_t>(digit);
+                    }
+                    p += 4;
+                    if (code >= 0xD800 && code <= 0xDFFF)
+                    {
+                        return false;
+                    }
+                    if (code < 0x80)
+                    {
+                        out += static_cast<char>(code);
+                    }
+                    else if (code < 0x800)
+                    {
+                        out += static_cast<char>(0xC0 | (code >> 6));
+                        out += static_cast<char>(0x80 | (code & 0x3F));
+                    }
+                    else
+                    {
+                        out += static_cast<char>(0xE0 | (code >> 12));
+                        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                        out += static_cast<char>(0x80 | (code & 0x3F));
+                    }
+                    break;
+                }
+                default:
+                    return false;
+                }
             }
-            if (id.length() < minLen)
+            if (p >= end)
             {
                 return false;
             }
-            for (size_t i = 0; i < id.length(); ++i)
+            ++p;
+            return true;
+        }
+
+        // en: Batch body: a JSON array of request targets, e.g. ["/api/status", "/api/items?page=2"].
+        // ja: バッチのボディ。リクエスト先の JSON 配列（例: ["/api/status", "/api/items?page=2"]）。
+        bool parseBatchTargets(const char *data, size_t length, size_t maxCount, std::vector<String> &out)
+        {
+            const char *p = data;
+            const char *end = data + length;
+            skipJsonSpace(p, end);
+            if (p >= end || *p != '[')
             {
-                const unsigned char c = static_cast<unsigned char>(id.charAt(i));
-                if (!(isalnum(c) || c == '-' || c == '_' || c == '.'))
+                return false;
+            }
+            ++p;
+            skipJsonSpace(p, end);
+            if (p < end && *p == ']')
+            {
+                ++p;
+            }
+            else
+            {
+                while (true)
                 {
+                    String target;
+                    if (out.size() >= maxCount || !readJsonString(p, end, target))
+                    {
+                        return false;
+                    }
+                    out.push_back(std::move(target));
+                    skipJsonSpace(p, end);
+                    if (p < end && *p == ',')
+                    {
+                        ++p;
+                        skipJsonSpace(p, end);
+                        continue;
+                    }
+                    if (p < end && *p == ']')
+                    {
+                        ++p;
+                        break;
+                    }
                     return false;
                 }
             }
-            return true;
-        }
-
-        Cookie buildSessionCookie(const SessionConfig &cfg, const String &value)
-        {
-            Cookie c;
-            c.name = cfg.cookieName.isEmpty() ? String("sid") : cfg.cookieName;
-            c.value = value;
-            c.path = cfg.path.isEmpty() ? String("/") : cfg.path;
-            c.maxAge = cfg.maxAgeSeconds;
-            c.secure = cfg.secure;
-            c.httpOnly = cfg.httpOnly;
-            c.sameSite = cfg.sameSite;
-            return c;
+            skipJsonSpace(p, end);
+            return p == end;
         }
-    } // namespace
-
-    SessionInfo beginSession(Request &req, Response &res, const SessionConfig &cfg)
-    {
-        SessionInfo info;
-
-        const String cookieName = cfg.cookieName.isEmpty() ? String("sid") : cfg.cookieName;
-        const String existing = req.cookie(cookieName);
 
-        bool valid = false;
-        if (!existing.isEmpty())
+        // en: Skips a JSON string literal at p without decoding it; only the escape syntax is checked.
+        // ja: p 位置の JSON 文字列リテラルをデコードせずに読み飛ばす。エスケープの構文だけを確認する。
+        bool skipJsonString(const char *&p, const char *end)
         {
-            if (cfg.validate)
+            if (p >= end || *p != '"')
             {
-                valid = cfg.validate(existing);
+                return false;
             }
-            else
+            ++p;
+            while (p < end && *p != '"')
             {
-                valid = defaultValidateSessionId(existing, cfg.idBytes);
+                const unsigned char c = static_cast<unsigned char>(*p++);
+                if (c < 0x20)
+                {
+                    return false;
+                }
+                if (c != '\\')
+                {
+                    continue;
+                }
+                if (p >= end)
+                {
+                    return false;
+                }
+                const char escape = *p++;
+                if (escape == 'u')
+                {
+                    if (end - p < 4)
+                    {
+                        return false;
+                    }
+                    for (int i = 0; i < 4; ++i)
+                    {
+                        if (hexValue(p[i]) < 0)
+                        {
+                            return false;
+                        }
+                    }
+                    p += 4;
+                }
+                else if (!strchr("\"\\/bfnrt", escape) || escape == '\0')
+                {
+                    return false;
+                }
+            }
+            if (p >= end)
+            {
+                return false;
             }
+            ++p;
+            return true;
         }
 
-        if (valid)
-        {
-            info.id = existing;
-            info.isNew = false;
-        }
-        else
+        bool skipJsonDigits(const char *&p, const char *end)
         {
-            info.id = cfg.generate ? cfg.generate() : defaultSessionId(cfg.idBytes);
-            if (info.id.isEmpty())
+            const char *start = p;
+            while (p < end && *p >= '0' && *p <= '9')
             {
-                info.id = defaultSessionId(cfg.idBytes);
+                ++p;
             }
-            info.isNew = true;
+            return p > start;
         }
-        info.rotated = false;
 
-        if (!info.id.isEmpty() && (info.isNew || cfg.maxAgeSeconds >= 0))
+        // en: Scalar value at p: string, number, true, false or null.
+        // ja: p 位置のスカラー値（文字列・数値・true・false・null）を読み飛ばす。
+        bool skipJsonScalar(const char *&p, const char *end)
         {
-            Cookie c = buildSessionCookie(cfg, info.id);
-            res.setCookie(c);
+            if (p >= end)
+            {
+                return false;
+            }
+            if (*p == '"')
+            {
+                return skipJsonString(p, end);
+            }
+            static const char *const kLiterals[] = {"true", "false", "null"};
+            for (const char *literal : kLiterals)
+            {
+                const size_t len = strlen(literal);
+                if (static_cast<size_t>(end - p) >= len && memcmp(p, literal, len) == 0)
+                {
+                    p += len;
+                    return true;
+                }
+            }
+            if (*p == '-')
+            {
+                ++p;
+            }
+            if (p < end && *p == '0')
+            {
+                ++p;
+            }
+            else if (!skipJsonDigits(p, end))
+            {
+                return false;
+            }
+            if (p < end && *p == '.')
+            {
+                ++p;
+                if (!skipJsonDigits(p, end))
+                {
+                    return false;
+                }
+            }
+            if (p < end && (*p == 'e' || *p == 'E'))
+            {
+                ++p;
+                if (p < end && (*p == '+' || *p == '-'))
+                {
+                    ++p;
+                }
+                if (!skipJsonDigits(p, end))
+                {
+                    return false;
+                }
+            }
+            return true;
         }
 
-        return info;
-    }
-
-    SessionInfo rotateSession(SessionInfo &cur, Response &res, const SessionConfig &cfg)
-    {
-        SessionInfo updated = cur;
-        const String oldId = cur.id;
-        updated.id = cfg.generate ? cfg.generate() : defaultSessionId(cfg.idBytes);
-        if (updated.id.isEmpty())
+        // en: Whole-document JSON syntax check, iterative with one bit per open container (so at most 32 levels).
+        //     Batch uses it before splicing a sub-response body into the reply unquoted.
+        // ja: JSON 文書全体の構文チェック。開いているコンテナを 1 ビットずつ持つ反復処理（最大 32 階層）。
+        //     バッチでサブレスポンスのボディを引用符なしで埋め込む前に使う。
+        bool isValidJsonDocument(const char *data, size_t length)
         {
-            updated.id = defaultSessionId(cfg.idBytes);
-        }
-        updated.rotated = true;
-        updated.isNew = false;
+            constexpr size_t kMaxDepth = 32;
+            const char *p = data;
+            const char *end = data + length;
+            uint32_t objects = 0; // bit set = that level is an object
+            size_t depth = 0;
+            bool expectKey = false;
+            skipJsonSpace(p, end);
+            while (true)
+            {
+                if (expectKey)
+                {
+                    if (!skipJsonString(p, end))
+                    {
+                        return false;
+                    }
+                    skipJsonSpace(p, end);
+                    if (p >= end || *p != ':')
+                    {
+                        return false;
+                    }
+                    ++p;
+                    skipJsonSpace(p, end);
+                    expectKey = false;
+                }
+                if (p < end && (*p == '{' || *p == '['))
+                {
+                    const bool object = *p == '{';
+                    if (depth >= kMaxDepth)
+                    {
+                        return false;
+                    }
+                    objects = (objects << 1) | (object ? 1u : 0u);
+                    ++depth;
+                    ++p;
+                    skipJsonSpace(p, end);
+                    if (p >= end || *p != (object ? '}' : ']'))
+                    {
+                        expectKey = object;
+                        continue;
+                    }
+                    // en: Empty container: close it below like any other value.
+                    // ja: 空のコンテナ。下で他の値と同様に閉じる。
+                }
+                else if (!skipJsonScalar(p, end))
+                {
+                    return false;
+                }
+                else
+                {
+                    skipJsonSpace(p, end);
+                }
 
-        if (!updated.id.isEmpty())
-        {
-            Cookie c = buildSessionCookie(cfg, updated.id);
-            res.setCookie(c);
+                while (true)
+                {
+                    if (depth == 0)
+                    {
+                        return p == end;
+                    }
+                    if (p >= end)
+                    {
+                        return false;
+                    }
+                    const bool object = (objects & 1u) != 0;
+                    if (*p == (object ? '}' : ']'))
+                    {
+                        ++p;
+                        objects >>= 1;
+                        --depth;
+                        skipJsonSpace(p, end);
+                        continue;
+                    }
+                    if (*p != ',')
+                    {
+                        return false;
+                    }
+                    ++p;
+                    skipJsonSpace(p, end);
+                    expectKey = object;
+                    break;
+                }
+            }
         }
 
-        if (cfg.onRotate && !oldId.isEmpty() && !updated.id.isEmpty())
+        bool isJsonMime(const String &type)
         {
-            cfg.onRotate(oldId, updated.id);
+            const int semi = type.indexOf(';');
+            String base = semi >= 0 ? type.substring(0, semi) : type;
+            base.trim();
+            base.toLowerCase();
+            return base == "application/json" || base.endsWith("+json");
         }
+    } // namespace
 
-        cur = updated;
-        return updated;
-    }
-
-    void touchSessionCookie(SessionInfo &cur, Response &res, const SessionConfig &cfg)
+    void Server::enableBatch(const String &uri, const BatchOptions &options)
     {
-        if (cur.id.isEmpty() || cfg.maxAgeSeconds < 0)
+        BodyPolicy policy;
+        policy.maxBodySize = options.maxRequestBody;
+        policy.contentTypes = {"application/json"};
+        auto handler = [this, options](Request &req, Response &res)
         {
-            return;
-        }
-        Cookie c = buildSessionCookie(cfg, cur.id);
-        res.setCookie(c);
+            handleBatch(req, res, options);
+        };
+        on(uri, HTTP_POST, policy, handler);
     }
 
-    // -------- Server --------
-
-    Server::Server() = default;
-    Server::~Server() { end(); }
-
-    bool Server::begin(const httpd_config_t &cfg)
+    // en: Runs every target through auth, static handlers and the route table into one capture buffer, then
+    //     appends {"path","status","type","body"} to the streamed array before the next target runs.
+    // ja: 各ターゲットを認証・静的ハンドラ・ルート表に通して 1 つのキャプチャバッファへ書き、
+    //     次のターゲットを処理する前に {"path","status","type","body"} をストリーム中の配列へ追記する。
+    void Server::handleBatch(Request &req, Response &res, const BatchOptions &options)
     {
-        if (_handle)
-            return true;
-        httpd_config_t localCfg = cfg;
-        localCfg.uri_match_fn = httpd_uri_match_wildcard;
-        esp_err_t err = httpd_start(&_handle, &localCfg);
-        if (err != ESP_OK)
+        httpd_req_t *raw = req.raw();
+        const size_t length = raw ? raw->content_len : 0;
+        ClassBuffer<char> body = allocateBuffer<char>(this, AllocClass::RequestArena, length + 1);
+        if (!body)
         {
-            ESP_LOGE(TAG, "httpd_start failed: %s", esp_err_to_name(err));
-            return false;
+            res.sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+            return;
         }
-        for (auto &hook : _methodHooks)
+        TransferProgress progress;
+        size_t received = 0;
+        while (received < length)
         {
-            registerMethodHook(hook.get());
+            const int ret = req.receiveBody(body.get() + received, length - received, progress);
+            if (ret <= 0)
+            {
+                ESP_LOGW(TAG, "[BATCH] body receive failed");
+                res.sendError(HTTPD_400_BAD_REQUEST);
+                return;
+            }
+            received += static_cast<size_t>(ret);
         }
-        return true;
-    }
 
-#if LOG_LOCAL_LEVEL >= ESP_LOG_INFO
-    String normalizeBasePathForLog(const String &input)
-    {
-        String normalized = input;
-        if (normalized.isEmpty())
-        {
-            normalized = "/";
-        }
-        while (normalized.length() > 1 && normalized.endsWith("/"))
-        {
-            normalized.remove(normalized.length() - 1);
-        }
-        if (!normalized.startsWith("/"))
+        std::vector<String> targets;
+        if (!parseBatchTargets(body.get(), length, options.maxRequests, targets))
         {
-            normalized = "/" + normalized;
+            ESP_LOGW(TAG, "[BATCH] invalid target list (%u bytes)", static_cast<unsigned>(length));
+            res.sendError(HTTPD_400_BAD_REQUEST);
+            return;
         }
-        return normalized;
-    }
+        body.reset();
 
-    String relativePathForLog(const String &normalizedBase, const String &fullPath)
-    {
-        if (fullPath.isEmpty())
+        ClassBuffer<uint8_t> scratch = allocateBuffer<uint8_t>(this, AllocClass::RequestArena, options.maxResponseBytes);
+        ClassBuffer<char> writerBuffer = allocateBuffer<char>(this, AllocClass::IoBuffer, ListingWriter::kCapacity);
+        if ((!scratch && options.maxResponseBytes > 0) || !writerBuffer)
         {
-            return String("/");
+            res.sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+            return;
         }
-        String relative = fullPath;
-        if (normalizedBase != "/")
+        ESP_LOGI(TAG, "[BATCH] %u requests", static_cast<unsigned>(targets.size()));
+
+        res.beginChunked(200, "application/json");
+        ListingWriter out(res, writerBuffer.get());
+        out.raw("{\"responses\":[");
+        for (size_t i = 0; i < targets.size(); ++i)
         {
-            if (relative.startsWith(normalizedBase))
+            Response::Capture capture;
+            capture.data = scratch.get();
+            capture.capacity = options.maxResponseBytes;
+            {
+                Response sub(raw);
+                sub._capture = &capture;
+                dispatchSubRequest(req, targets[i], sub);
+            }
+
+            out.raw(i == 0 ? "{\"path\":\"" : ",{\"path\":\"");
+            out.json(targets[i].c_str(), targets[i].length());
+            out.raw("\",\"status\":");
+            out.number(static_cast<uint64_t>(capture.status));
+            out.raw(",\"type\":\"");
+            out.json(capture.contentType.c_str(), capture.contentType.length());
+            out.raw("\"");
+            if (capture.truncated)
+            {
+                out.raw(",\"truncated\":true");
+            }
+            if (capture.gzip)
             {
-                relative = relative.substring(normalizedBase.length());
+                out.raw(",\"encoding\":\"gzip\",\"body\":null}");
+                continue;
+            }
+            out.raw(",\"body\":");
+            // en: Only well-formed JSON is spliced in raw; anything else (empty, truncated, broken) becomes a string.
+            // ja: 正しい JSON だけをそのまま埋め込み、空・切り詰め・不正なボディは文字列にする。
+            if (capture.length > 0 && !capture.truncated && isJsonMime(capture.contentType) &&
+                isValidJsonDocument(reinterpret_cast<const char *>(capture.data), capture.length))
+            {
+                out.flush();
+                res.sendChunk(capture.data, capture.length);
             }
             else
             {
-                String baseNoSlash = normalizedBase.substring(1);
-                if (relative.startsWith(baseNoSlash))
-                {
-                    relative = relative.substring(baseNoSlash.length());
-                }
+                out.put('"');
+                out.json(reinterpret_cast<const char *>(capture.data), capture.length);
+                out.put('"');
             }
+            out.put('}');
         }
-        if (relative.startsWith("/"))
-        {
-            relative.remove(0, 1);
-        }
-        if (relative.isEmpty())
-        {
-            return String("/");
-        }
-        return relative;
+        out.raw("]}");
+        out.flush();
+        res.endChunked();
     }
 
-    String makeLogIndent(int depth)
+    void Server::dispatchSubRequest(Request &outer, const String &target, Response &res)
     {
-        String indent;
-        if (depth <= 0)
-        {
-            return indent;
-        }
-        indent.reserve(depth * 2);
-        for (int i = 0; i < depth; ++i)
+        Request sub(outer.raw());
+        sub._server = this;
+        sub._subRequest = true;
+        sub._subUri = target;
+        res.setRequestContext(&sub);
+        res.setServerContext(this);
+
+        String normalized;
+        std::vector<String> pathSegments;
+        if (!target.startsWith("/") || !normalizeRoutePath(target, normalized, pathSegments))
         {
-            indent += "  ";
+            res.sendError(HTTPD_400_BAD_REQUEST);
+            return;
         }
-        return indent;
-    }
-
-    String buildFullPath(const String &base, const String &entryName)
-    {
-        if (entryName.isEmpty())
+        ParamList emptyParams;
+        sub.setPathInfo(normalized, emptyParams);
+        if (!checkAuth(sub, res, normalized))
         {
-            return base;
+            return;
         }
-        if (entryName.startsWith("/"))
+        if (tryHandleStaticRequest(sub, res, HTTP_GET, target, normalized))
         {
-            return entryName;
+            return;
         }
-        if (base == "/")
+
+        ParamList params;
+        DynamicRoute *route = findRoute(HTTP_GET, pathSegments, params);
+        if (!route)
         {
-            return String("/") + entryName;
+            if (_notFoundHandler)
+            {
+                _notFoundHandler(sub, res);
+            }
+            if (!res.committed())
+            {
+                res.sendError(HTTPD_404_NOT_FOUND);
+            }
+            return;
         }
-        String combined = base;
-        if (!combined.endsWith("/"))
+        sub.setPathInfo(normalized, params);
+        ESP_LOGD(TAG, "[BATCH] %s -> %s", normalized.c_str(), route->pattern.c_str());
+        route->handler(sub, res);
+        if (!res.committed())
         {
-            combined += "/";
+            res.sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
         }
-        combined += entryName;
-        return combined;
     }
 
-    void logFsDirectory(fs::FS &fs, const String &normalizedBase, const String &fsPath, int depth)
+    namespace
     {
-        File dir = fs.open(fsPath);
-        if (!dir || !dir.isDirectory())
+        constexpr const char *kTusVersion = "1.0.0";
+        constexpr size_t kUploadIdBytes = 8;
+        constexpr size_t kMaxUploadFileName = 64;
+        constexpr size_t kMaxUploadMetaLine = 160;
+
+        bool isUploadId(const String &id)
         {
-            if (dir)
+            if (id.length() != kUploadIdBytes * 2)
             {
-                dir.close();
+                return false;
             }
-            return;
+            for (size_t i = 0; i < id.length(); ++i)
+            {
+                if (!isxdigit(static_cast<unsigned char>(id[i])) || isupper(static_cast<unsigned char>(id[i])))
+                {
+                    return false;
+                }
+            }
+            return true;
         }
 
-        while (true)
+        // en: Every tus request except OPTIONS names the protocol version; an absent or unknown one answers 412.
+        // ja: OPTIONS 以外の tus リクエストはプロトコルのバージョンを示す。無いか未対応なら 412 を返す。
+        bool acceptTusVersion(Request &req, Response &res)
         {
-            File entry = dir.openNextFile();
-            if (!entry)
+            res.setHeader("Tus-Resumable", kTusVersion);
+            String version = req.header("Tus-Resumable");
+            version.trim();
+            if (version == kTusVersion)
             {
-                break;
+                return true;
             }
-            const char *rawName = entry.name();
-            String entryName = rawName ? String(rawName) : String();
-            String fullPath = buildFullPath(fsPath, entryName);
-            if (fullPath.isEmpty())
+            ESP_LOGW(TAG, "[UPLOAD] unsupported Tus-Resumable '%s'", version.c_str());
+            res.setHeader("Tus-Version", kTusVersion);
+            res.sendError(412);
+            return false;
+        }
+
+        String uploadFile(const String &dir, const String &id, const char *suffix)
+        {
+            return dir + "/" + id + suffix;
+        }
+
+        // en: Plain decimal only (no sign, spaces or suffix), as the tus Upload-Length / Upload-Offset headers require.
+        // ja: tus の Upload-Length / Upload-Offset と同じく、符号・空白・接尾辞の無い 10 進数のみ受け付ける。
+        bool parseUploadSize(const String &text, size_t &out)
+        {
+            if (text.isEmpty() || text.length() > 10)
             {
-                fullPath = fsPath;
+                return false;
             }
-            String relative = relativePathForLog(normalizedBase, fullPath);
-            String indent = makeLogIndent(depth);
-            if (entry.isDirectory())
+            uint64_t value = 0;
+            for (size_t i = 0; i < text.length(); ++i)
             {
-                ESP_LOGI(TAG, "  %s%s/ [%s]", indent.c_str(), relative.c_str(), fullPath.c_str());
-                entry.close();
-                logFsDirectory(fs, normalizedBase, fullPath, depth + 1);
+                const char c = text[i];
+                if (c < '0' || c > '9')
+                {
+                    return false;
+                }
+                value = value * 10 + static_cast<uint64_t>(c - '0');
             }
-            else
+            if (value > SIZE_MAX)
             {
-                size_t size = entry.size();
-                bool gz = fullPath.endsWith(".gz");
-                ESP_LOGI(TAG, "  %s%s (%u bytes)%s [%s]",
-                         indent.c_str(),
-                         relative.c_str(),
-                         static_cast<unsigned>(size),
-                         gz ? " gz" : "",
-                         fullPath.c_str());
-                entry.close();
+                return false;
             }
+            out = static_cast<size_t>(value);
+            return true;
         }
 
-        dir.close();
-    }
-
-    void logFileSystemListing(fs::FS &fs, const String &basePath)
-    {
-        String openPath = basePath;
-        if (openPath.isEmpty())
+        // en: "crc32 <base64 of the big-endian CRC>"; other algorithms are rejected.
+        // ja: "crc32 <ビッグエンディアン CRC の base64>"。他のアルゴリズムは拒否する。
+        bool parseCrc32Checksum(const String &header, uint32_t &out)
         {
-            openPath = "/";
+            String text = header;
+            text.trim();
+            const int space = text.indexOf(' ');
+            if (space <= 0 || !text.substring(0, space).equalsIgnoreCase("crc32"))
+            {
+                return false;
+            }
+            String encoded = text.substring(space + 1);
+            encoded.trim();
+            unsigned char digest[8];
+            size_t digestLen = 0;
+            if (mbedtls_base64_decode(digest, sizeof(digest), &digestLen, reinterpret_cast<const unsigned char *>(encoded.c_str()), encoded.length()) != 0 ||
+                digestLen != 4)
+            {
+                return false;
+            }
+            out = (static_cast<uint32_t>(digest[0]) << 24) | (static_cast<uint32_t>(digest[1]) << 16) |
+                  (static_cast<uint32_t>(digest[2]) << 8) | static_cast<uint32_t>(digest[3]);
+            return true;
         }
-        File root = fs.open(openPath);
-        if (!root && !openPath.startsWith("/"))
+
+        // en: The "filename" entry of tus Upload-Metadata ("key base64,key base64"), reduced to a safe base name.
+        // ja: tus の Upload-Metadata（"key base64,key base64"）の "filename" を安全なベース名にして返す。
+        String uploadFileName(const String &metadata)
         {
-            String alt = "/" + openPath;
-            root = fs.open(alt);
-            if (root)
+            int start = 0;
+            while (start < static_cast<int>(metadata.length()))
             {
-                openPath = alt;
+                int end = metadata.indexOf(',', start);
+                if (end < 0)
+                {
+                    end = metadata.length();
+                }
+                String pair = metadata.substring(start, end);
+                start = end + 1;
+                pair.trim();
+                const int space = pair.indexOf(' ');
+                if (space <= 0 || pair.substring(0, space) != "filename")
+                {
+                    continue;
+                }
+                String encoded = pair.substring(space + 1);
+                encoded.trim();
+                unsigned char decoded[kMaxUploadFileName * 2 + 1];
+                size_t decodedLen = 0;
+                if (mbedtls_base64_decode(decoded, sizeof(decoded) - 1, &decodedLen, reinterpret_cast<const unsigned char *>(encoded.c_str()), encoded.length()) != 0)
+                {
+                    return String();
+                }
+                decoded[decodedLen] = '\0';
+                String name(baseName(reinterpret_cast<const char *>(decoded)));
+                const int backslash = name.lastIndexOf('\\');
+                if (backslash >= 0)
+                {
+                    name.remove(0, backslash + 1);
+                }
+                if (name.isEmpty() || name == "." || name == ".." || name.length() > kMaxUploadFileName || strlen(name.c_str()) != name.length())
+                {
+                    return String();
+                }
+                for (size_t i = 0; i < name.length(); ++i)
+                {
+                    if (static_cast<unsigned char>(name[i]) < 0x20 || name[i] == 0x7F)
+                    {
+                        return String();
+                    }
+                }
+                return name;
             }
+            return String();
         }
-        if (!root)
+
+        String trimTrailingSlash(const String &path)
         {
-            ESP_LOGW(TAG, "[SERVE][FS] unable to list %s", basePath.c_str());
-            return;
+            String out = path;
+            while (out.endsWith("/"))
+            {
+                out.remove(out.length() - 1);
+            }
+            return out;
         }
+    } // namespace
 
-        String normalizedBase = normalizeBasePathForLog(openPath);
-        if (!root.isDirectory())
+    void Server::enableResumableUploads(const String &uri, fs::FS &fs, const String &destDir, const UploadOptions &options, UploadCompleteHandler onComplete)
+    {
+        std::unique_ptr<UploadEndpoint> endpoint(new (std::nothrow) UploadEndpoint());
+        if (!endpoint)
         {
-            size_t size = root.size();
-            bool gz = normalizedBase.endsWith(".gz");
-            ESP_LOGI(TAG, "[SERVE][FS] %s (%u bytes)%s [%s]",
-                     normalizedBase.c_str(),
-                     static_cast<unsigned>(size),
-                     gz ? " gz" : "",
-                     normalizedBase.c_str());
-            root.close();
+            ESP_LOGE(TAG, "[UPLOAD] endpoint alloc failed");
             return;
         }
-
-        ESP_LOGI(TAG, "[SERVE][FS] listing %s", normalizedBase.c_str());
-        root.close();
-        logFsDirectory(fs, normalizedBase, normalizedBase, 0);
-    }
-#endif
-
-    void Server::end()
-    {
-        if (_handle)
+        endpoint->uri = trimTrailingSlash(uri);
+        endpoint->fs = &fs;
+        endpoint->destDir = trimTrailingSlash(destDir);
+        endpoint->options = options;
+        endpoint->options.tempDir = trimTrailingSlash(options.tempDir);
+        if (endpoint->options.blockSize == 0)
         {
-            httpd_stop(_handle);
-            _handle = nullptr;
+            endpoint->options.blockSize = 512;
         }
-    }
+        endpoint->onComplete = onComplete;
+        UploadEndpoint *ep = endpoint.get();
+        _uploadEndpoints.push_back(std::move(endpoint));
 
-    void Server::on(const String &uri, httpd_method_t method, RouteHandler handler)
-    {
-        if (!handler)
+        auto discover = [ep](Request &req, Response &res)
+        {
+            (void)req;
+            res.setHeader("Tus-Resumable", kTusVersion);
+            res.setHeader("Tus-Version", kTusVersion);
+            res.setHeader("Tus-Extension", "creation,termination,checksum");
+            res.setHeader("Tus-Checksum-Algorithm", "crc32");
+            if (ep->options.maxUploadSize > 0)
+            {
+                res.setHeader("Tus-Max-Size", String(static_cast<unsigned long>(ep->options.maxUploadSize)));
+            }
+            res.send(204, nullptr, nullptr, 0);
+        };
+        auto create = [this, ep](Request &req, Response &res)
+        {
+            handleUploadCreate(ep, req, res);
+        };
+        auto head = [this, ep](Request &req, Response &res)
+        {
+            handleUploadHead(ep, req, res);
+        };
+        auto patch = [this, ep](Request &req, Response &res)
+        {
+            handleUploadPatch(ep, req, res);
+        };
+        auto terminate = [this, ep](Request &req, Response &res)
+        {
+            handleUploadDelete(ep, req, res);
+        };
+        BodyPolicy patchPolicy;
+        patchPolicy.maxBodySize = options.maxUploadSize;
+        patchPolicy.contentTypes = {"application/offset+octet-stream"};
+        const String item = ep->uri + "/:id";
+        on(ep->uri, HTTP_OPTIONS, discover);
+        on(ep->uri, HTTP_POST, create);
+        on(item, HTTP_HEAD, head);
+        on(item, HTTP_PATCH, patchPolicy, patch);
+        on(item, HTTP_DELETE, terminate);
+
+        if (options.expireSeconds == 0)
         {
             return;
         }
-
-        std::vector<RouteSegment> segments;
-        int score = 0;
-        if (!parseRoutePattern(uri, segments, score))
+        const uint64_t periodUs = static_cast<uint64_t>(std::max<uint32_t>(options.gcIntervalSeconds, 1)) * 1000000ULL;
+        if (!_uploadGcTimer)
         {
-            ESP_LOGE(TAG, "Invalid route pattern: %s", uri.c_str());
-            return;
+            esp_timer_create_args_t args = {};
+            args.callback = &Server::uploadGcTimer;
+            args.arg = this;
+            args.name = "http_upload_gc";
+            if (esp_timer_create(&args, &_uploadGcTimer) != ESP_OK)
+            {
+                ESP_LOGE(TAG, "[UPLOAD] gc timer unavailable");
+                _uploadGcTimer = nullptr;
+                return;
+            }
         }
-
-        if (!ensureMethodHook(method))
+        if (_uploadGcPeriodUs == 0 || periodUs < _uploadGcPeriodUs)
         {
-            ESP_LOGE(TAG, "Failed to register method hook");
-            return;
+            esp_timer_stop(_uploadGcTimer);
+            if (esp_timer_start_periodic(_uploadGcTimer, periodUs) == ESP_OK)
+            {
+                _uploadGcPeriodUs = periodUs;
+            }
         }
-
-        DynamicRoute route;
-        route.method = method;
-        route.pattern = uri;
-        route.segments = std::move(segments);
-        route.score = score;
-        route.handler = std::move(handler);
-        _dynamicRoutes.push_back(std::move(route));
-    }
-
-    void Server::onNotFound(RouteHandler handler)
-    {
-        _notFoundHandler = std::move(handler);
     }
 
-    void Server::serveStatic(const String &uriPrefix,
-                             fs::FS &fs,
-                             const String &basePath,
-                             StaticHandler handler)
+    void Server::handleUploadCreate(UploadEndpoint *ep, Request &req, Response &res)
     {
-        if (!handler)
+        if (!acceptTusVersion(req, res))
         {
             return;
         }
-        auto entry = std::make_unique<HandlerEntry>();
-        entry->type = HandlerType::StaticFS;
-        entry->staticHandler = std::move(handler);
-        String prefix = uriPrefix;
-        if (prefix.isEmpty())
+        UploadState state;
+        if (!parseUploadSize(req.header("Upload-Length"), state.length))
         {
-            prefix = "/";
+            ESP_LOGW(TAG, "[UPLOAD] missing or invalid Upload-Length");
+            res.sendError(HTTPD_400_BAD_REQUEST);
+            return;
         }
-        if (!prefix.startsWith("/"))
+        if (ep->options.maxUploadSize > 0 && state.length > ep->options.maxUploadSize)
         {
-            prefix = "/" + prefix;
+            ESP_LOGW(TAG, "[UPLOAD] %u bytes over the %u byte limit", static_cast<unsigned>(state.length), static_cast<unsigned>(ep->options.maxUploadSize));
+            res.sendError(413);
+            return;
         }
-        while (prefix.length() > 1 && prefix.endsWith("/"))
+        const String checksum = req.header("Upload-Checksum");
+        if (!checksum.isEmpty())
         {
-            prefix.remove(prefix.length() - 1);
+            if (!parseCrc32Checksum(checksum, state.expectedCrc))
+            {
+                ESP_LOGW(TAG, "[UPLOAD] unsupported Upload-Checksum");
+                res.sendError(HTTPD_400_BAD_REQUEST);
+                return;
+            }
+            state.hasExpectedCrc = true;
         }
-        entry->uriPrefix = prefix;
-        entry->basePath = basePath;
-        entry->fs = &fs;
-        entry->owner = this;
-
-#if LOG_LOCAL_LEVEL >= ESP_LOG_INFO
-        ESP_LOGI(TAG, "[SERVE][FS] %s -> %s", entry->uriPrefix.c_str(), entry->basePath.c_str());
-        logFileSystemListing(fs, basePath);
-#endif
+        state.fileName = uploadFileName(req.header("Upload-Metadata"));
 
-        _handlers.push_back(std::move(entry));
-        ensureMethodHook(HTTP_GET);
-    }
-
-    void Server::serveStatic(const String &uriPrefix,
-                             const char *const *paths,
-                             const uint8_t *const *data,
-                             const size_t *sizes,
-                             size_t fileCount,
-                             StaticHandler handler)
-    {
-        if (!handler || !paths || !data || !sizes)
+        if (!ep->scanned)
         {
-            return;
+            collectStaleUploads(ep, false);
+        }
+        if (ep->activity.size() >= ep->options.maxUploads)
+        {
+            collectStaleUploads(ep, true);
+            if (ep->activity.size() >= ep->options.maxUploads)
+            {
+                ESP_LOGW(TAG, "[UPLOAD] %u partial uploads pending", static_cast<unsigned>(ep->activity.size()));
+                res.sendError(503);
+                return;
+            }
         }
 
-        auto entry = std::make_unique<HandlerEntry>();
-        entry->type = HandlerType::StaticMem;
-        entry->staticHandler = std::move(handler);
-        String prefix = uriPrefix;
-        if (prefix.isEmpty())
+        const String id = defaultSessionId(kUploadIdBytes);
+        if (!ep->fs->exists(ep->options.tempDir))
         {
-            prefix = "/";
+            ep->fs->mkdir(ep->options.tempDir);
         }
-        if (!prefix.startsWith("/"))
+        File part = ep->fs->open(uploadFile(ep->options.tempDir, id, ".part"), FILE_WRITE);
+        if (!part)
         {
-            prefix = "/" + prefix;
+            ESP_LOGE(TAG, "[UPLOAD] cannot create %s", uploadFile(ep->options.tempDir, id, ".part").c_str());
+            res.sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+            return;
         }
-        while (prefix.length() > 1 && prefix.endsWith("/"))
+        part.close();
+        if (!saveUploadState(ep, id, state))
         {
-            prefix.remove(prefix.length() - 1);
+            removeUpload(ep, id);
+            res.sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+            return;
         }
-        entry->uriPrefix = prefix;
-        entry->memPaths = paths;
-        entry->memData = data;
-        entry->memSizes = sizes;
-        entry->memCount = fileCount;
-        entry->owner = this;
+        touchUpload(ep, id);
+        ESP_LOGI(TAG, "[UPLOAD] %s created (%u bytes, %s)", id.c_str(), static_cast<unsigned>(state.length),
+                 state.fileName.isEmpty() ? "unnamed" : state.fileName.c_str());
 
-#if LOG_LOCAL_LEVEL >= ESP_LOG_INFO
-        ESP_LOGI(TAG, "[SERVE][MEM] %s count=%u", entry->uriPrefix.c_str(), static_cast<unsigned>(fileCount));
-        for (size_t i = 0; i < fileCount; ++i)
+        res.setHeader("Location", ep->uri + "/" + id);
+        res.setHeader("Upload-Offset", "0");
+        if (state.length == 0)
         {
-            const char *name = paths[i] ? paths[i] : "(null)";
-            size_t size = sizes[i];
-            bool gz = false;
-            if (name)
+            UploadInfo info;
+            const int status = finishUpload(ep, id, state, info);
+            if (status != 0)
             {
-                size_t len = strlen(name);
-                gz = (len >= 3 && name[len - 3] == '.' && name[len - 2] == 'g' && name[len - 1] == 'z');
+                res.sendError(status);
+                return;
             }
-            ESP_LOGI(TAG, "  [%02u] %s (%u bytes)%s",
-                     static_cast<unsigned>(i),
-                     name,
-                     static_cast<unsigned>(size),
-                     gz ? " gz" : "");
+            res.send(201, nullptr, nullptr, 0);
+            if (ep->onComplete)
+            {
+                ep->onComplete(info);
+            }
+            return;
         }
-#endif
-
-        _handlers.push_back(std::move(entry));
-        ensureMethodHook(HTTP_GET);
+        res.send(201, nullptr, nullptr, 0);
     }
 
-    esp_err_t Server::handleDynamicHttpRequest(httpd_req_t *req)
+    void Server::handleUploadHead(UploadEndpoint *ep, Request &req, Response &res)
     {
-        auto *server = static_cast<Server *>(req->user_ctx);
-        if (!server)
+        if (!acceptTusVersion(req, res))
         {
-            return ESP_FAIL;
+            return;
         }
-        return server->dispatchDynamic(req);
+        res.setHeader("Cache-Control", "no-store");
+        const String id = req.pathParam("id");
+        UploadState state;
+        if (!isUploadId(id) || !loadUploadState(ep, id, state))
+        {
+            res.sendError(HTTPD_404_NOT_FOUND);
+            return;
+        }
+        touchUpload(ep, id);
+        res.setHeader("Upload-Offset", String(static_cast<unsigned long>(state.offset)));
+        res.setHeader("Upload-Length", String(static_cast<unsigned long>(state.length)));
+        res.send(200, nullptr, nullptr, 0);
     }
 
-    void Server::setupStaticInfoFromFS(HandlerEntry *entry, Request &req, Response &res, const String &normalizedUri, const String &relPath)
+    // en: Data is staged in one blockSize buffer: the first write tops the file up to the next block boundary and every
+    //     later write is a whole block. The CRCs only advance over bytes that reached the file, so a PATCH cut short
+    //     keeps what it wrote unless it carried a chunk checksum, which makes it all or nothing.
+    // ja: データは blockSize のバッファ 1 つに溜める。最初の書き込みで次のブロック境界まで埋め、以後は常にブロック単位で書く。
+    //     CRC はファイルに書けたバイトだけで更新するため、途中で切れた PATCH も書けた分を残す。ただしチャンクの
+    //     チェックサム付きの PATCH は全体が揃ったときだけ反映する。
+    void Server::handleUploadPatch(UploadEndpoint *ep, Request &req, Response &res)
     {
-        if (!entry || !entry->fs)
+        if (!acceptTusVersion(req, res))
         {
-            ESP_LOGE(TAG, "[RESP] 500 static fs missing");
-            res.sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
             return;
         }
-
-        StaticInfo info;
-        info.uri = normalizedUri;
-        info.relPath = relPath;
-        info.logicalPath = relPath;
-
-        const bool requestGz = relPath.endsWith(".gz");
-        String relBase = relPath;
-        if (requestGz)
+        const String id = req.pathParam("id");
+        UploadState state;
+        if (!isUploadId(id) || !loadUploadState(ep, id, state))
         {
-            relBase = relPath.substring(0, relPath.length() - 3);
-            if (relBase.isEmpty())
-            {
-                relBase = "/";
-            }
+            res.sendError(HTTPD_404_NOT_FOUND);
+            return;
         }
-        const String plainFsPath = joinFsPath(entry->basePath, relBase);
-        const String gzFsPath = plainFsPath + ".gz";
-
-        bool exists = false;
-        bool isDir = false;
-        bool useGz = false;
-
-        const bool hasGz = entry->fs->exists(gzFsPath);
-        const bool hasPlain = entry->fs->exists(plainFsPath);
-
-        if (requestGz)
+        touchUpload(ep, id);
+        size_t offset = 0;
+        if (!parseUploadSize(req.header("Upload-Offset"), offset))
         {
-            if (hasGz)
-            {
-                info.fsPath = gzFsPath;
-                exists = true;
-                useGz = true;
-            }
-            else
-            {
-                info.fsPath = gzFsPath;
-                exists = false;
-                useGz = true;
-            }
+            res.sendError(HTTPD_400_BAD_REQUEST);
+            return;
         }
-        else if (hasGz)
+        if (offset != state.offset)
         {
-            info.fsPath = gzFsPath;
-            exists = true;
-            useGz = true;
+            ESP_LOGW(TAG, "[UPLOAD] %s offset %u, stored %u", id.c_str(), static_cast<unsigned>(offset), static_cast<unsigned>(state.offset));
+            res.setHeader("Upload-Offset", String(static_cast<unsigned long>(state.offset)));
+            res.sendError(409);
+            return;
+        }
+        httpd_req_t *raw = req.raw();
+        const size_t length = raw ? raw->content_len : 0;
+        if (length > state.length - state.offset)
+        {
+            ESP_LOGW(TAG, "[UPLOAD] %s PATCH of %u bytes past Upload-Length", id.c_str(), static_cast<unsigned>(length));
+            res.sendError(413);
+            return;
         }
-        else if (hasPlain)
+        bool verifyChunk = false;
+        uint32_t expectedChunkCrc = 0;
+        const String checksum = req.header("Upload-Checksum");
+        if (!checksum.isEmpty())
         {
-            info.fsPath = plainFsPath;
-            exists = true;
-            useGz = false;
-            File test = entry->fs->open(plainFsPath, "r");
-            if (test)
+            if (!parseCrc32Checksum(checksum, expectedChunkCrc))
             {
-                isDir = test.isDirectory();
-                test.close();
+                res.sendError(HTTPD_400_BAD_REQUEST);
+                return;
             }
+            verifyChunk = true;
         }
-        else
+
+        const size_t blockSize = ep->options.blockSize;
+        ClassBuffer<uint8_t> block = allocateBuffer<uint8_t>(this, AllocClass::RequestArena, blockSize);
+        if (!block)
+        {
+            res.sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+            return;
+        }
+        File part = ep->fs->open(uploadFile(ep->options.tempDir, id, ".part"), "r+");
+        if (!part || !part.seek(state.offset))
         {
-            info.fsPath = plainFsPath;
+            ESP_LOGE(TAG, "[UPLOAD] %s partial file unavailable", id.c_str());
+            res.sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+            return;
         }
 
-        if (exists && isDir)
+        TransferProgress progress;
+        size_t written = 0;
+        uint32_t fileCrc = state.crc;
+        uint32_t chunkCrc = 0;
+        bool receiveFailed = false;
+        bool writeFailed = false;
+        while (written < length)
         {
-            String dirRel = ensureLeadingSlash(relBase);
-            if (!dirRel.endsWith("/"))
+            const size_t position = state.offset + written;
+            const size_t want = std::min(blockSize - (position % blockSize), length - written);
+            size_t fill = 0;
+            while (fill < want)
             {
-                dirRel += "/";
-            }
-            static const char *kIndexCandidates[] = {"index.html", "index.htm"};
-            bool foundIndex = false;
-            for (const char *candidateName : kIndexCandidates)
-            {
-                if (!candidateName)
-                {
-                    continue;
-                }
-                String candidateRel = dirRel + candidateName;
-                const String candidatePlain = joinFsPath(entry->basePath, candidateRel);
-                const String candidateGz = candidatePlain + ".gz";
-                if (entry->fs->exists(candidateGz))
-                {
-                    info.fsPath = candidateGz;
-                    info.logicalPath = ensureLeadingSlash(candidateRel);
-                    exists = true;
-                    useGz = true;
-                    isDir = false;
-                    foundIndex = true;
-                    break;
-                }
-                if (entry->fs->exists(candidatePlain))
+                const int ret = req.receiveBody(reinterpret_cast<char *>(block.get()) + fill, want - fill, progress);
+                if (ret <= 0)
                 {
-                    info.fsPath = candidatePlain;
-                    info.logicalPath = ensureLeadingSlash(candidateRel);
-                    exists = true;
-                    useGz = false;
-                    isDir = false;
-                    foundIndex = true;
+                    receiveFailed = true;
                     break;
                 }
+                fill += static_cast<size_t>(ret);
             }
-            if (!foundIndex)
+            const size_t stored = fill > 0 ? part.write(block.get(), fill) : 0;
+            fileCrc = esp_rom_crc32_le(fileCrc, block.get(), stored);
+            chunkCrc = esp_rom_crc32_le(chunkCrc, block.get(), stored);
+            written += stored;
+            if (stored != fill)
             {
-                exists = false;
-                isDir = false;
+                writeFailed = true;
+                break;
+            }
+            if (receiveFailed)
+            {
+                break;
             }
         }
+        part.close();
 
-        info.exists = exists;
-        info.isDir = isDir;
-        info.isGzipped = useGz;
-        if (info.isGzipped && info.logicalPath.endsWith(".gz"))
+        const bool whole = !receiveFailed && !writeFailed;
+        if (verifyChunk && (!whole || chunkCrc != expectedChunkCrc))
         {
-            info.logicalPath = info.logicalPath.substring(0, info.logicalPath.length() - 3);
+            // en: The stored offset stays put; the next PATCH from there overwrites these bytes.
+            // ja: 保存済みオフセットは動かさない。そこからの次の PATCH がこのバイト列を上書きする。
+            ESP_LOGW(TAG, "[UPLOAD] %s chunk at %u rejected (%s)", id.c_str(), static_cast<unsigned>(state.offset), whole ? "checksum mismatch" : "incomplete");
+            res.setHeader("Upload-Offset", String(static_cast<unsigned long>(state.offset)));
+            res.sendError(whole ? 460 : (writeFailed ? HTTPD_500_INTERNAL_SERVER_ERROR : HTTPD_400_BAD_REQUEST));
+            return;
         }
-
-#if LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG
-        ESP_LOGD(TAG, "[STATIC][FS] path=%s gz=%d exists=%d", info.fsPath.c_str(), info.isGzipped, info.exists);
-#endif
-
-        res.setStaticFileSystem(entry->fs);
-        res.setStaticInfo(info);
-
-        if (entry->staticHandler)
+        state.offset += written;
+        state.crc = fileCrc;
+        if (written > 0 && !saveUploadState(ep, id, state))
         {
-            entry->staticHandler(info, req, res);
+            res.sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+            return;
         }
-        if (!res.committed())
+        res.setHeader("Upload-Offset", String(static_cast<unsigned long>(state.offset)));
+        if (!whole)
         {
-            if (info.exists)
-            {
-                res.sendStatic();
-            }
-            else
-            {
-                res.sendError(HTTPD_404_NOT_FOUND);
-            }
+            ESP_LOGW(TAG, "[UPLOAD] %s stopped at %u of %u bytes (%s)", id.c_str(), static_cast<unsigned>(state.offset),
+                     static_cast<unsigned>(state.length), writeFailed ? "write failed" : "receive failed");
+            res.sendError(writeFailed ? HTTPD_500_INTERNAL_SERVER_ERROR : HTTPD_400_BAD_REQUEST);
+            return;
+        }
+        ESP_LOGD(TAG, "[UPLOAD] %s %u/%u", id.c_str(), static_cast<unsigned>(state.offset), static_cast<unsigned>(state.length));
+        if (state.offset < state.length)
+        {
+            res.send(204, nullptr, nullptr, 0);
+            return;
+        }
+        UploadInfo info;
+        const int status = finishUpload(ep, id, state, info);
+        if (status != 0)
+        {
+            res.sendError(status);
+            return;
+        }
+        res.send(204, nullptr, nullptr, 0);
+        if (ep->onComplete)
+        {
+            ep->onComplete(info);
         }
     }
 
-    void Server::setupStaticInfoFromMemory(HandlerEntry *entry, Request &req, Response &res, const String &normalizedUri, const String &relPath)
+    void Server::handleUploadDelete(UploadEndpoint *ep, Request &req, Response &res)
     {
-        StaticInfo info;
-        info.uri = normalizedUri;
-        info.relPath = relPath;
-        info.logicalPath = relPath;
-
-        const bool requestGz = relPath.endsWith(".gz");
-        String relBase = relPath;
-        if (requestGz)
+        if (!acceptTusVersion(req, res))
         {
-            relBase = relPath.substring(0, relPath.length() - 3);
-            if (relBase.isEmpty())
-            {
-                relBase = "/";
-            }
+            return;
         }
-        relBase = ensureLeadingSlash(relBase);
-        const String gzRel = relBase + ".gz";
-        String dirPrefix = relBase;
-        if (!dirPrefix.endsWith("/"))
+        const String id = req.pathParam("id");
+        if (!isUploadId(id) || !ep->fs->exists(uploadFile(ep->options.tempDir, id, ".meta")))
         {
-            dirPrefix += "/";
+            res.sendError(HTTPD_404_NOT_FOUND);
+            return;
         }
+        removeUpload(ep, id);
+        ESP_LOGI(TAG, "[UPLOAD] %s terminated", id.c_str());
+        res.send(204, nullptr, nullptr, 0);
+    }
 
-        bool hasChildPrefix = false;
-        int plainIndex = -1;
-        int gzIndex = -1;
-        for (size_t i = 0; i < entry->memCount; ++i)
+    // en: Returns 0 once the data sits at destDir/<filename>, or the status to answer. A failed move keeps the upload,
+    //     so an empty PATCH at the final offset retries it.
+    // ja: データが destDir/<filename> に移動できたら 0、そうでなければ返すステータスを返す。移動に失敗した場合は
+    //     アップロードを残すため、最終オフセットへの空の PATCH で再試行できる。
+    int Server::finishUpload(UploadEndpoint *ep, const String &id, const UploadState &state, UploadInfo &info)
+    {
+        if (state.hasExpectedCrc && state.crc != state.expectedCrc)
         {
-            const char *candidate = entry->memPaths[i];
-            if (!candidate)
-            {
-                continue;
-            }
-            String candidateStr(candidate);
-            if (plainIndex < 0 && candidateStr == relBase)
-            {
-                plainIndex = static_cast<int>(i);
-            }
-            else if (gzIndex < 0 && candidateStr == gzRel)
-            {
-                gzIndex = static_cast<int>(i);
-            }
-            if (!hasChildPrefix && candidateStr.startsWith(dirPrefix))
-            {
-                hasChildPrefix = true;
-            }
+            ESP_LOGW(TAG, "[UPLOAD] %s checksum mismatch (%08lx, expected %08lx)", id.c_str(),
+                     static_cast<unsigned long>(state.crc), static_cast<unsigned long>(state.expectedCrc));
+            removeUpload(ep, id);
+            return 460;
         }
-
-        auto findIndexByPath = [&](const String &target) -> int
+        info.id = id;
+        info.path = ep->destDir + "/" + (state.fileName.isEmpty() ? id : state.fileName);
+        // en: A client-chosen name must not replace someone else's file unless the sketch allows it.
+        // ja: クライアントが指定した名前で既存ファイルを置き換えるのは、スケッチが許可した場合のみ。
+        if (!ep->options.overwrite && !state.fileName.isEmpty() && ep->fs->exists(info.path))
         {
-            if (target.isEmpty())
-            {
-                return -1;
-            }
-            for (size_t i = 0; i < entry->memCount; ++i)
-            {
-                const char *candidate = entry->memPaths[i];
-                if (!candidate)
-                {
-                    continue;
-                }
-                if (target == candidate)
-                {
-                    return static_cast<int>(i);
-                }
-            }
-            return -1;
-        };
-
-        bool directoryHint = relPath.endsWith("/") || hasChildPrefix;
-        if (plainIndex < 0 && gzIndex < 0 && directoryHint)
+            info.path = ep->destDir + "/" + id + "-" + state.fileName;
+        }
+        if (!ep->options.overwrite && ep->fs->exists(info.path))
         {
-            static const char *kIndexCandidates[] = {"index.html", "index.htm"};
-            for (const char *candidateName : kIndexCandidates)
-            {
-                if (!candidateName)
-                {
-                    continue;
-                }
-                String candidateRel = dirPrefix + candidateName;
-                int gzCandidate = findIndexByPath(candidateRel + ".gz");
-                if (gzCandidate >= 0)
-                {
-                    gzIndex = gzCandidate;
-                    plainIndex = -1;
-                    info.logicalPath = candidateRel;
-                    relBase = candidateRel;
-                    break;
-                }
-                int plainCandidate = findIndexByPath(candidateRel);
-                if (plainCandidate >= 0)
-                {
-                    plainIndex = plainCandidate;
-                    info.logicalPath = candidateRel;
-                    relBase = candidateRel;
-                    break;
-                }
-            }
+            ESP_LOGW(TAG, "[UPLOAD] %s destination %s exists", id.c_str(), info.path.c_str());
+            return 409;
         }
-
-        int chosenIndex = -1;
-        bool gz = false;
-        if (requestGz)
+        info.size = state.length;
+        info.crc32 = state.crc;
+        if (!ep->destDir.isEmpty() && !ep->fs->exists(ep->destDir))
         {
-            if (gzIndex >= 0)
-            {
-                chosenIndex = gzIndex;
-                gz = true;
-            }
+            ep->fs->mkdir(ep->destDir);
         }
-        else if (gzIndex >= 0)
+        // en: destDir may be served by serveStatic(): close cached handles (in-flight streams keep theirs until done)
+        //     and invalidate the indexes before the file appears or the old one is replaced.
+        // ja: destDir は serveStatic() で配信中かもしれない。ファイルの追加・置き換えの前にキャッシュ済みハンドルを
+        //     閉じ（送信中のものは完了まで保持）、インデックスを無効化する。
+        dropOpenFiles();
+        invalidateStaticCache(*ep->fs, info.path);
+        if (ep->options.overwrite && ep->fs->exists(info.path))
         {
-            chosenIndex = gzIndex;
-            gz = true;
+            ep->fs->remove(info.path);
         }
-        else if (plainIndex >= 0)
+        if (!ep->fs->rename(uploadFile(ep->options.tempDir, id, ".part"), info.path))
         {
-            chosenIndex = plainIndex;
-            gz = false;
+            ESP_LOGE(TAG, "[UPLOAD] %s cannot move to %s", id.c_str(), info.path.c_str());
+            return HTTPD_500_INTERNAL_SERVER_ERROR;
         }
+        removeUpload(ep, id);
+        ESP_LOGI(TAG, "[UPLOAD] %s complete -> %s (%u bytes)", id.c_str(), info.path.c_str(), static_cast<unsigned>(info.size));
+        return 0;
+    }
 
-        if (chosenIndex >= 0)
+    // en: Partial uploads live on the destination filesystem, possibly under a served prefix; static lookups and
+    //     indexes skip them so .part/.meta files are never downloadable or hashed.
+    // ja: 途中のアップロードは配置先の FS 上にあり、配信中のプレフィックス配下かもしれない。静的ルックアップと
+    //     インデックスはこれを除外し、.part/.meta をダウンロードやハッシュの対象にしない。
+    bool Server::isUploadTempPath(const fs::FS *fs, const String &fsPath) const
+    {
+        for (const auto &ep : _uploadEndpoints)
         {
-            info.exists = true;
-            info.fsPath = entry->memPaths[chosenIndex];
-            info.isGzipped = gz;
-            if (info.isGzipped && info.logicalPath.endsWith(".gz"))
+            String rel;
+            if (ep->fs == fs && extractRelativePath(fsPath, normalizeUriPrefix(ep->options.tempDir), rel))
             {
-                info.logicalPath = info.logicalPath.substring(0, info.logicalPath.length() - 3);
+                return true;
             }
-            const uint8_t *dataPtr = entry->memData[chosenIndex];
-            const size_t dataSize = entry->memSizes[chosenIndex];
-            res.setStaticMemorySource(dataPtr, dataSize);
         }
-        else
+        return false;
+    }
+
+    bool Server::loadUploadState(UploadEndpoint *ep, const String &id, UploadState &state)
+    {
+        const String path = uploadFile(ep->options.tempDir, id, ".meta");
+        if (!ep->fs->exists(path))
         {
-            info.exists = false;
-            info.isGzipped = requestGz;
-            res.clearStaticSource();
+            return false;
         }
+        File file = ep->fs->open(path, FILE_READ);
+        if (!file)
+        {
+            return false;
+        }
+        char line[kMaxUploadMetaLine + 1];
+        const size_t len = file.read(reinterpret_cast<uint8_t *>(line), kMaxUploadMetaLine);
+        file.close();
+        line[len] = '\0';
 
-#if LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG
-        ESP_LOGD(TAG, "[STATIC][MEM] path=%s gz=%d exists=%d", info.fsPath.c_str(), info.isGzipped, info.exists);
-#endif
-
-        res.setStaticInfo(info);
-
-        if (entry->staticHandler)
+        // en: "<length> <offset> <crc> <expected crc or -> [filename]"
+        // ja: "<length> <offset> <crc> <期待 CRC または -> [filename]"
+        char *cursor = line;
+        char *end = nullptr;
+        const unsigned long length = strtoul(cursor, &end, 10);
+        if (end == cursor || *end != ' ')
         {
-            entry->staticHandler(info, req, res);
+            return false;
         }
-        if (!res.committed())
+        cursor = end + 1;
+        const unsigned long offset = strtoul(cursor, &end, 10);
+        if (end == cursor || *end != ' ' || offset > length)
         {
-            if (info.exists)
-            {
-                res.sendStatic();
-            }
-            else
-            {
-                res.sendError(HTTPD_404_NOT_FOUND);
-            }
+            return false;
         }
-    }
-
-    bool Server::ensureMethodHook(httpd_method_t method)
-    {
-        for (auto &hook : _methodHooks)
+        cursor = end + 1;
+        const unsigned long crc = strtoul(cursor, &end, 16);
+        if (end == cursor || *end != ' ')
         {
-            if (hook->method == method)
+            return false;
+        }
+        cursor = end + 1;
+        state.hasExpectedCrc = *cursor != '-';
+        if (state.hasExpectedCrc)
+        {
+            state.expectedCrc = static_cast<uint32_t>(strtoul(cursor, &end, 16));
+            if (end == cursor)
             {
-                return true;
+                return false;
             }
         }
-
-        auto hook = std::make_unique<MethodHook>();
-        hook->method = method;
-        hook->uriDef.uri = "/*";
-        hook->uriDef.method = method;
-        hook->uriDef.handler = &Server::handleDynamicHttpRequest;
-        hook->uriDef.user_ctx = this;
-        MethodHook *hookPtr = hook.get();
-        _methodHooks.push_back(std::move(hook));
-        if (_handle)
+        else
         {
-            return registerMethodHook(hookPtr);
+            end = cursor + 1;
+        }
+        state.length = length;
+        state.offset = offset;
+        state.crc = static_cast<uint32_t>(crc);
+        state.fileName = String();
+        if (*end == ' ')
+        {
+            char *name = end + 1;
+            char *newline = strchr(name, '\n');
+            if (newline)
+            {
+                *newline = '\0';
+            }
+            state.fileName = name;
         }
         return true;
     }
 
-    bool Server::registerMethodHook(MethodHook *hook)
+    bool Server::saveUploadState(UploadEndpoint *ep, const String &id, const UploadState &state)
     {
-        if (!_handle || !hook)
+        char line[kMaxUploadMetaLine + 1];
+        char expected[9] = "-";
+        if (state.hasExpectedCrc)
+        {
+            snprintf(expected, sizeof(expected), "%08lx", static_cast<unsigned long>(state.expectedCrc));
+        }
+        const int len = snprintf(line, sizeof(line), "%lu %lu %08lx %s%s%s\n", static_cast<unsigned long>(state.length),
+                                 static_cast<unsigned long>(state.offset), static_cast<unsigned long>(state.crc), expected,
+                                 state.fileName.isEmpty() ? "" : " ", state.fileName.c_str());
+        if (len <= 0 || static_cast<size_t>(len) >= sizeof(line))
         {
             return false;
         }
-        hook->uriDef.user_ctx = this;
-        const esp_err_t err = httpd_register_uri_handler(_handle, &hook->uriDef);
-        if (err != ESP_OK)
+        File file = ep->fs->open(uploadFile(ep->options.tempDir, id, ".meta"), FILE_WRITE);
+        if (!file)
         {
-            ESP_LOGE(TAG, "Failed to register dynamic hook: %s", esp_err_to_name(err));
+            ESP_LOGE(TAG, "[UPLOAD] %s cannot write metadata", id.c_str());
             return false;
         }
-        hook->registered = true;
-        return true;
+        const size_t stored = file.write(reinterpret_cast<const uint8_t *>(line), static_cast<size_t>(len));
+        file.close();
+        return stored == static_cast<size_t>(len);
     }
 
-    esp_err_t Server::dispatchDynamic(httpd_req_t *req)
+    void Server::removeUpload(UploadEndpoint *ep, const String &id)
     {
-        Request request(req);
-        Response response(req);
-        response.setRequestContext(&request);
-
-        const String rawUri = request.uri();
-#if LOG_LOCAL_LEVEL >= ESP_LOG_INFO
+        for (const char *suffix : {".part", ".meta"})
         {
-            const String remote = clientAddress(req);
-            ESP_LOGI(TAG, "[REQ] %s %s from %s", request.method().c_str(), rawUri.c_str(), remote.c_str());
+            const String path = uploadFile(ep->options.tempDir, id, suffix);
+            if (ep->fs->exists(path))
+            {
+                ep->fs->remove(path);
+            }
         }
-#endif
+        ep->activity.erase(std::remove_if(ep->activity.begin(), ep->activity.end(), [&id](const UploadActivity &item)
+                                          { return item.id == id; }),
+                           ep->activity.end());
+    }
 
-        String normalized;
-        std::vector<String> pathSegments;
-        if (!normalizeRoutePath(rawUri, normalized, pathSegments))
+    void Server::touchUpload(UploadEndpoint *ep, const String &id)
+    {
+        const int64_t now = esp_timer_get_time();
+        for (auto &item : ep->activity)
         {
-            ESP_LOGW(TAG, "[RESP] 400 invalid path %s", rawUri.c_str());
-            response.sendError(HTTPD_400_BAD_REQUEST);
-            return ESP_OK;
+            if (item.id == id)
+            {
+                item.lastUs = now;
+                return;
+            }
         }
+        UploadActivity item;
+        item.id = id;
+        item.lastUs = now;
+        ep->activity.push_back(item);
+    }
 
-        std::vector<std::pair<String, String>> emptyParams;
-        request.setPathInfo(normalized, emptyParams);
-
-        httpd_method_t method = static_cast<httpd_method_t>(req->method);
-        if (method == HTTP_GET)
+    // en: Rebuilds the activity list from tempDir: uploads found on disk (e.g. after a reboot) start their idle clock
+    //     now, .part files without metadata are deleted and, with expire, uploads idle past expireSeconds go too.
+    // ja: tempDir からアクティビティ一覧を作り直す。ディスク上で見つけたアップロード（再起動後など）はここから
+    //     待機時間を数え、メタデータの無い .part は削除し、expire 指定時は expireSeconds を過ぎたものも削除する。
+    void Server::collectStaleUploads(UploadEndpoint *ep, bool expire)
+    {
+        ep->scanned = true;
+        File dir = ep->fs->open(ep->options.tempDir);
+        if (!dir || !dir.isDirectory())
         {
-            if (tryHandleStaticRequest(request, response, method, rawUri, normalized))
+            ep->activity.clear();
+            return;
+        }
+        std::vector<String> metas;
+        std::vector<String> parts;
+        while (true)
+        {
+            File item = dir.openNextFile();
+            if (!item)
             {
-                return ESP_OK;
+                break;
+            }
+            String name(baseName(item.name()));
+            item.close();
+            if (name.endsWith(".meta"))
+            {
+                name.remove(name.length() - 5);
+                metas.push_back(name);
+            }
+            else if (name.endsWith(".part"))
+            {
+                name.remove(name.length() - 5);
+                parts.push_back(name);
             }
         }
+        dir.close();
 
-        DynamicRoute *bestRoute = nullptr;
-        int bestScore = -1;
-        std::vector<std::pair<String, String>> bestParams;
-        std::vector<std::pair<String, String>> tempParams;
-
-        for (auto &route : _dynamicRoutes)
+        const int64_t now = esp_timer_get_time();
+        std::vector<UploadActivity> activity;
+        for (const auto &id : metas)
         {
-            if (route.method != method)
+            if (!isUploadId(id))
             {
                 continue;
             }
-            tempParams.clear();
-            if (matchRoute(route, pathSegments, tempParams))
+            UploadActivity item;
+            item.id = id;
+            item.lastUs = now;
+            for (const auto &known : ep->activity)
             {
-                if (route.score > bestScore)
+                if (known.id == id)
                 {
-                    bestScore = route.score;
-                    bestRoute = &route;
-                    bestParams = tempParams;
+                    item.lastUs = known.lastUs;
+                    break;
                 }
             }
+            activity.push_back(item);
         }
+        ep->activity.swap(activity);
 
-        if (!bestRoute)
+        for (const auto &id : parts)
         {
-            if (_notFoundHandler)
+            if (std::find(metas.begin(), metas.end(), id) == metas.end())
             {
-                _notFoundHandler(request, response);
-                if (!response.committed())
-                {
-                    response.sendError(HTTPD_404_NOT_FOUND);
-                }
-                return ESP_OK;
+                ESP_LOGI(TAG, "[UPLOAD] removing orphan %s.part", id.c_str());
+                ep->fs->remove(uploadFile(ep->options.tempDir, id, ".part"));
             }
-            ESP_LOGI(TAG, "[404] %s %s", request.method().c_str(), normalized.c_str());
-            response.sendError(HTTPD_404_NOT_FOUND);
-            return ESP_OK;
         }
-
-        request.setPathInfo(normalized, bestParams);
-#if LOG_LOCAL_LEVEL >= ESP_LOG_INFO
+        if (!expire || ep->options.expireSeconds == 0)
         {
-            ESP_LOGI(TAG, "[ROUTE] %s -> %s", normalized.c_str(), bestRoute->pattern.c_str());
+            return;
         }
-#endif
-#if LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG
+        const int64_t idleUs = static_cast<int64_t>(ep->options.expireSeconds) * 1000000;
+        std::vector<String> stale;
+        for (const auto &item : ep->activity)
         {
-            logParams(bestParams);
+            if (now - item.lastUs >= idleUs)
+            {
+                stale.push_back(item.id);
+            }
         }
-#endif
-        bestRoute->handler(request, response);
-        if (!response.committed())
+        for (const auto &id : stale)
         {
-            response.sendError(HTTPD_500_INTERNAL_SERVER_ERROR);
+            ESP_LOGI(TAG, "[UPLOAD] %s expired", id.c_str());
+            removeUpload(ep, id);
+        }
+    }
+
+    void Server::uploadGcTimer(void *arg)
+    {
+        Server *server = static_cast<Server *>(arg);
+        // en: Runs on the esp_timer task; the sweep itself is queued onto the httpd task so it never races a handler.
+        //     end() raises _streamsStopping before stopping this timer and waits out a callback already running.
+        // ja: esp_timer タスク上で実行。掃除自体は httpd タスクへキューし、ハンドラと競合しないようにする。
+        //     end() はこのタイマーを止める前に _streamsStopping を立て、実行中のコールバックの終了を待つ。
+        server->_uploadGcBusy = true;
+        if (!server->_streamsStopping.load() && server->_handle &&
+            httpd_queue_work(server->_handle, &Server::runUploadGc, server) != ESP_OK)
+        {
+            ESP_LOGW(TAG, "[UPLOAD] gc not queued");
+        }
+        server->_uploadGcBusy = false;
+    }
+
+    void Server::runUploadGc(void *arg)
+    {
+        Server *server = static_cast<Server *>(arg);
+        for (auto &ep : server->_uploadEndpoints)
+        {
+            server->collectStaleUploads(ep.get(), true);
         }
-        return ESP_OK;
     }
 
     bool Server::tryHandleStaticRequest(Request &req, Response &res, httpd_method_t method, const String &rawPath, const String &normalizedPath)
@@ -2901,7 +8957,7 @@ namespace EspHttpServer
         {
             return false;
         }
-        std::vector<std::pair<String, String>> emptyParams;
+        ParamList emptyParams;
         for (auto &entryPtr : _handlers)
         {
             HandlerEntry *entry = entryPtr.get();
@@ -2920,6 +8976,16 @@ namespace EspHttpServer
                 relNormalized = relRaw;
             }
             req.setPathInfo(normalizedPath, emptyParams);
+            ensureStaticScan(entry);
+            if (!entry->options.comboPath.isEmpty() && relNormalized == entry->options.comboPath)
+            {
+                handleCombo(entry, req, res);
+                return true;
+            }
+            if (entry->options.fingerprintAssets)
+            {
+                resolveFingerprintAlias(entry, res, relNormalized);
+            }
             switch (entry->type)
             {
             case HandlerType::StaticFS:
@@ -2934,6 +9000,12 @@ namespace EspHttpServer
 #endif
                 setupStaticInfoFromMemory(entry, req, res, normalizedPath, relNormalized);
                 return true;
+            case HandlerType::StaticEmbedded:
+#if LOG_LOCAL_LEVEL >= ESP_LOG_INFO
+                ESP_LOGI(TAG, "[STATIC][EMB] %s (rel=%s)", rawPath.c_str(), relRaw.c_str());
+#endif
+                setupStaticInfoFromEmbedded(entry, req, res, normalizedPath, relNormalized);
+                return true;
             }
         }
         return false;
@@ -3040,7 +9112,11 @@ namespace EspHttpServer
         {
             working = "/" + working;
         }
-        String decoded = urlDecode(working);
+        String decoded;
+        if (!urlDecode(working, decoded))
+        {
+            return false;
+        }
         segments.clear();
         String current;
         for (size_t i = 0; i < decoded.length(); ++i)
@@ -3074,7 +9150,7 @@ namespace EspHttpServer
         return true;
     }
 
-    bool Server::matchRoute(const DynamicRoute &route, const std::vector<String> &pathSegments, std::vector<std::pair<String, String>> &outParams) const
+    bool Server::matchRoute(const DynamicRoute &route, const std::vector<String> &pathSegments, ParamList &outParams) const
     {
         outParams.clear();
         size_t pathIndex = 0;
@@ -3123,50 +9199,13 @@ namespace EspHttpServer
         return true;
     }
 
-    String Server::urlDecode(const String &input) const
+    bool Server::urlDecode(const String &input, String &output) const
     {
-        auto hexToInt = [](char c) -> int
-        {
-            if (c >= '0' && c <= '9')
-                return c - '0';
-            if (c >= 'a' && c <= 'f')
-                return c - 'a' + 10;
-            if (c >= 'A' && c <= 'F')
-                return c - 'A' + 10;
-            return -1;
-        };
-
-        String out;
-        out.reserve(input.length());
-        for (size_t i = 0; i < input.length(); ++i)
-        {
-            char c = input.charAt(i);
-            if (c == '%')
-            {
-                if (i + 2 < input.length())
-                {
-                    int hi = hexToInt(input.charAt(i + 1));
-                    int lo = hexToInt(input.charAt(i + 2));
-                    if (hi >= 0 && lo >= 0)
-                    {
-                        out += static_cast<char>((hi << 4) | lo);
-                        i += 2;
-                        continue;
-                    }
-                }
-            }
-            else if (c == '+')
-            {
-                out += ' ';
-                continue;
-            }
-            out += c;
-        }
-        return out;
+        return urlDecodeString(input, output, false);
     }
 
 #if LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG
-    void Server::logParams(const std::vector<std::pair<String, String>> &params) const
+    void Server::logParams(const ParamList &params) const
     {
         if (params.empty())
         {
@@ -3179,14 +9218,14 @@ namespace EspHttpServer
             {
                 buffer += ", ";
             }
-            buffer += kv.first;
+            buffer += kv.first.c_str();
             buffer += "=";
-            buffer += kv.second;
+            buffer += kv.second.c_str();
         }
         ESP_LOGD(TAG, "[PARAMS] %s", buffer.c_str());
     }
 #else
-    void Server::logParams(const std::vector<std::pair<String, String>> &params) const
+    void Server::logParams(const ParamList &params) const
     {
         (void)params;
     }
@@ -3219,4 +9258,137 @@ namespace EspHttpServer
     }
 #endif
 
+    namespace
+    {
+        // en: Forwards to the real handle and invalidates once more when it is closed (or its last copy dropped),
+        //     so the background rebuild hashes the finished file rather than whatever was on disk at open().
+        // ja: 実ハンドルへ委譲し、クローズ時（または最後のコピー破棄時）にもう一度無効化する。バックグラウンドの
+        //     再構築が open() 時点の内容ではなく書き終えたファイルをハッシュするようにする。
+        class WriteThroughFileImpl : public fs::FileImpl
+        {
+        public:
+            WriteThroughFileImpl(Server &server, fs::FS &fs, const File &file, const char *path)
+                : _server(server), _fs(fs), _file(file), _path(path)
+            {
+            }
+            ~WriteThroughFileImpl() override { close(); }
+
+            size_t write(const uint8_t *buf, size_t size) override { return _file.write(buf, size); }
+            size_t read(uint8_t *buf, size_t size) override { return _file.read(buf, size); }
+            void flush() override { _file.flush(); }
+            bool seek(uint32_t pos, fs::SeekMode mode) override { return _file.seek(pos, mode); }
+            size_t position() const override { return _file.position(); }
+            size_t size() const override { return _file.size(); }
+            bool setBufferSize(size_t size) override { return _file.setBufferSize(size); }
+            void close() override
+            {
+                if (_closed)
+                {
+                    return;
+                }
+                _closed = true;
+                _file.close();
+                _server.invalidateStaticCache(_fs, _path);
+            }
+            time_t getLastWrite() override { return _file.getLastWrite(); }
+            const char *path() const override { return _file.path(); }
+            const char *name() const override { return _file.name(); }
+            boolean isDirectory(void) override { return _file.isDirectory(); }
+            // en: A handle opened for writing is never a directory iterator.
+            // ja: 書き込み用に開いたハンドルがディレクトリ走査に使われることはない。
+            fs::FileImplPtr openNextFile(const char *mode) override
+            {
+                (void)mode;
+                return fs::FileImplPtr();
+            }
+            boolean seekDir(long position) override { return _file.seekDir(position); }
+            String getNextFileName(void) override { return _file.getNextFileName(); }
+            String getNextFileName(bool *isDir) override { return _file.getNextFileName(isDir); }
+            void rewindDirectory(void) override { _file.rewindDirectory(); }
+            operator bool() override { return !_closed && _file; }
+
+        private:
+            Server &_server;
+            fs::FS &_fs;
+            File _file;
+            String _path;
+            bool _closed = false;
+        };
+    } // namespace
+
+    File WriteThroughFS::open(const char *path, const char *mode, bool create)
+    {
+        File file = _fs.open(path, mode, create);
+        if (!mode || strcmp(mode, FILE_READ) == 0)
+        {
+            return file;
+        }
+        _server.invalidateStaticCache(_fs, path);
+        if (!file)
+        {
+            return file;
+        }
+        std::shared_ptr<WriteThroughFileImpl> impl(new (std::nothrow) WriteThroughFileImpl(_server, _fs, file, path));
+        if (!impl)
+        {
+            ESP_LOGW(TAG, "[SERVE] %s: write-through wrapper alloc failed; call invalidateStaticCache() after close", path);
+            return file;
+        }
+        return File(impl, &_fs);
+    }
+
+    File WriteThroughFS::open(const String &path, const char *mode, bool create)
+    {
+        return open(path.c_str(), mode, create);
+    }
+
+    bool WriteThroughFS::remove(const char *path)
+    {
+        const bool ok = _fs.remove(path);
+        _server.invalidateStaticCache(_fs, path);
+        return ok;
+    }
+
+    bool WriteThroughFS::remove(const String &path)
+    {
+        return remove(path.c_str());
+    }
+
+    bool WriteThroughFS::rename(const char *pathFrom, const char *pathTo)
+    {
+        const bool ok = _fs.rename(pathFrom, pathTo);
+        _server.invalidateStaticCache(_fs, pathFrom);
+        _server.invalidateStaticCache(_fs, pathTo);
+        return ok;
+    }
+
+    bool WriteThroughFS::rename(const String &pathFrom, const String &pathTo)
+    {
+        return rename(pathFrom.c_str(), pathTo.c_str());
+    }
+
+    bool WriteThroughFS::mkdir(const char *path)
+    {
+        const bool ok = _fs.mkdir(path);
+        _server.invalidateStaticCache(_fs, path);
+        return ok;
+    }
+
+    bool WriteThroughFS::mkdir(const String &path)
+    {
+        return mkdir(path.c_str());
+    }
+
+    bool WriteThroughFS::rmdir(const char *path)
+    {
+        const bool ok = _fs.rmdir(path);
+        _server.invalidateStaticCache(_fs, path);
+        return ok;
+    }
+
+    bool WriteThroughFS::rmdir(const String &path)
+    {
+        return rmdir(path.c_str());
+    }
+
 } // namespace EspHttpServer
@@ -2,8 +2,11 @@
 
 #include <Arduino.h>
 #include <FS.h>
+#include <atomic>
 #include <functional>
+#include <initializer_list>
 #include <memory>
+#include <new>
 #include <vector>
 #include <utility>
 
@@ -11,6 +14,10 @@ extern "C"
 {
 #include <esp_http_server.h>
 }
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 
 namespace EspHttpServer
 {
@@ -28,7 +35,58 @@ namespace EspHttpServer
         bool exists = false;
         bool isDir = false;
         bool isGzipped = false;
+        size_t size = 0; // bytes of the resolved source, 0 when unknown
         String logicalPath;
+        String etag; // quoted; empty when unknown
+    };
+
+    // en: Assets one page should preload (StaticOptions::preload).
+    // ja: 1 ページがプリロードすべきアセット（StaticOptions::preload）。
+    struct PreloadRule
+    {
+        String page;                // logical path below the handler, e.g. "/index.html"
+        std::vector<String> assets; // URLs as the page uses them, e.g. {"/app.css", "/app.js"}
+    };
+
+    // en: Optional serveStatic behaviors; the defaults keep the plain path-for-path lookup.
+    // ja: serveStatic の追加オプション。既定値ではパスどおりの単純な探索のみ。
+    struct StaticOptions
+    {
+        bool negotiateImageFormats = false; // serve name.avif / name.webp siblings when Accept allows
+        std::vector<String> languages;      // e.g. {"en", "ja"}: serve name.<lang>.ext variants; first is the default
+        String languageCookie;              // cookie whose value overrides Accept-Language (e.g. "lang")
+        bool fingerprintAssets = false;     // expose /name.<hash>.ext aliases and expand {{asset:/path}}
+        size_t negativeCacheEntries = 16;   // FS backend: remember recent 404 paths to skip probes (0 disables)
+        bool backgroundScan = true;         // FS backend: scan after begin() on a low-priority task (false = on first request)
+        String comboPath;                   // e.g. "/combo": <prefix>/combo?/a.css,/b.css streams same-type assets back to back
+        size_t comboMaxParts = 16;          // assets per combo request
+        uint32_t comboMaxAge = 0;           // combo Cache-Control max-age in seconds (0 = no-cache, revalidate by ETag)
+        std::vector<PreloadRule> preload;   // per-page manifest turned into precomputed Link: rel=preload headers
+        bool derivePreload = false;         // also derive them from each HTML page's <head> at index-build time
+        bool earlyHints = false;            // send the Link header as 103 Early Hints before the page itself
+    };
+
+    // en: One entry of the build-time asset index emitted by tools/embed_assets.py. The table is sorted by
+    //     (pathHash, path) and lives in flash, so serving it needs no indexing work at boot.
+    // ja: tools/embed_assets.py が生成するビルド時アセットインデックスの 1 エントリ。(pathHash, path) 順に
+    //     ソート済みでフラッシュに置かれるため、起動時のインデックス構築は不要。
+    struct EmbeddedAsset
+    {
+        uint32_t pathHash;    // FNV-1a 32 of path
+        const char *path;     // "/app.js" or "/app.js.gz"
+        const uint8_t *data;  // deduplicated blob
+        uint32_t size;
+        uint8_t mimeId;       // index into the library MIME table, 0xFF = application/octet-stream
+        uint8_t encoding;     // 0 = identity, 1 = gzip
+        int16_t gzSibling;    // index of the "<path>.gz" entry, -1 if none
+        uint32_t contentHash; // FNV-1a 32 of data
+        const char *etag;     // quoted contentHash
+    };
+
+    struct EmbeddedAssetIndex
+    {
+        const EmbeddedAsset *assets;
+        size_t count;
     };
 
     struct Cookie
@@ -50,14 +108,376 @@ namespace EspHttpServer
         SameSite sameSite = Lax;
     };
 
+    // en: Credentials parsed from the Authorization header. Pointers refer to a request-scoped
+    //     stack buffer and are only valid while the verifier runs.
+    // ja: Authorization ヘッダーから取り出した資格情報。ポインタは検証中のみ有効なスタック上のバッファを指す。
+    struct AuthCredentials
+    {
+        enum Scheme
+        {
+            Basic,
+            Bearer
+        };
+
+        Scheme scheme = Basic;
+        const char *user = nullptr; // Basic only
+        size_t userLen = 0;
+        const char *secret = nullptr; // password (Basic) or token (Bearer)
+        size_t secretLen = 0;
+    };
+
+    using AuthVerifier = std::function<bool(const AuthCredentials &cred)>;
+
+    struct AuthConfig
+    {
+        String realm = "EspHttpServer";
+        bool allowBasic = true;
+        bool allowBearer = false;
+        AuthVerifier verify;
+        uint32_t cacheTtlMs = 5 * 60 * 1000;
+        size_t cacheEntries = 8;     // granted credentials; 0 disables the verification cache
+        size_t denyCacheEntries = 4; // denied credentials, kept apart so failed attempts never evict a grant
+    };
+
+    // en: Constant-time helpers for verifier backends.
+    // ja: 検証バックエンド向けの定数時間比較/パスワードハッシュヘルパー。
+    bool constantTimeEquals(const void *a, const void *b, size_t len);
+    bool verifyPbkdf2Sha256(const char *password,
+                            size_t passwordLen,
+                            const uint8_t *salt,
+                            size_t saltLen,
+                            uint32_t iterations,
+                            const uint8_t *expected,
+                            size_t expectedLen);
+
+    // en: Options for Response::sendDirectoryListing(); pages are addressed by an opaque cursor.
+    // ja: Response::sendDirectoryListing() のオプション。ページは不透明なカーソルで指定する。
+    struct DirectoryListingOptions
+    {
+        enum class Format
+        {
+            Json,
+            Html
+        };
+
+        static constexpr size_t kMaxLimit = 1000;
+        static constexpr size_t kMaxSortWindow = 16;
+
+        Format format = Format::Json;
+        String cursor;                      // "next" value of the previous page; empty = first page
+        size_t limit = 100;                 // entries per page (1..kMaxLimit)
+        bool sortByName = false;            // sort each page by name (limit is capped to kMaxSortWindow)
+        String pageLinkPrefix = "?cursor="; // HTML: next-page href = prefix + cursor
+        String entryLinkPrefix;             // HTML: entry href = prefix + name (default: relative)
+    };
+
+    // en: Server-wide behaviors passed to Server::begin(); the defaults match the plain blocking server.
+    // ja: Server::begin() に渡すサーバー全体の設定。既定値は従来のブロッキング動作と同じ。
+    struct ServerOptions
+    {
+        bool cooperativeStreaming = false;   // interleave large bodies one chunk per httpd_queue_work turn (IDF >= 5.1)
+        size_t cooperativeThreshold = 16384; // bodies at least this large (or of unknown size) are interleaved
+        size_t maxCooperativeStreams = 4;    // beyond this, large bodies fall back to a blocking send
+        uint8_t chunksPerTurn = 1;           // chunks a stream sends before yielding the httpd task
+        size_t minChunkSize = 512;           // adaptive body chunk bounds; equal values fix the size
+        size_t maxChunkSize = 4096;
+        uint32_t receiveDeadlineMs = 0;      // total time allowed to read a request body, 0 = unlimited
+        uint32_t sendDeadlineMs = 0;         // total time allowed to send a response body, 0 = unlimited
+        uint32_t minReceiveBytesPerSecond = 0;
+        uint32_t minSendBytesPerSecond = 0;
+        uint32_t throughputGraceMs = 2000;   // minimum-throughput checks start after this much socket time
+        size_t maxBodySize = 0;              // Content-Length cap for routes without their own, 0 = unlimited
+    };
+
+    // en: Per-route admission rules, checked from Content-Length and headers before any body byte is read.
+    // ja: ルート単位の受け入れ条件。ボディを 1 バイトも読む前に Content-Length とヘッダで判定する。
+    struct BodyPolicy
+    {
+        size_t maxBodySize = 0;           // 0 = ServerOptions::maxBodySize
+        std::vector<String> contentTypes; // allowed media types ("image/*" matches the family); empty = any
+    };
+
+    // en: Limits for the built-in batch route (Server::enableBatch).
+    // ja: 組み込みバッチルート（Server::enableBatch）の上限。
+    struct BatchOptions
+    {
+        size_t maxRequests = 16;        // targets per batch
+        size_t maxRequestBody = 2048;   // bytes of the JSON target list
+        size_t maxResponseBytes = 8192; // captured body per target; longer bodies are cut and flagged "truncated"
+    };
+
+    // en: Settings of a resumable upload endpoint (Server::enableResumableUploads).
+    // ja: 再開可能アップロード（Server::enableResumableUploads）の設定。
+    struct UploadOptions
+    {
+        String tempDir = "/.uploads";     // <id>.part data and <id>.meta state, on the destination filesystem (never served)
+        size_t maxUploadSize = 0;         // Upload-Length cap and PATCH body cap, 0 = ServerOptions::maxBodySize for PATCH only
+        size_t maxUploads = 4;            // partial uploads kept at once
+        size_t blockSize = 4096;          // file writes start on multiples of this (flash sector / SD cluster)
+        uint32_t expireSeconds = 3600;    // partial uploads untouched this long are removed
+        uint32_t gcIntervalSeconds = 300; // how often stale uploads are looked for
+        bool overwrite = false;           // replace an existing destination file instead of storing <id>-<filename>
+    };
+
+    // en: A finished upload, already moved to its destination.
+    // ja: 完了済みのアップロード（配置先へ移動済み）。
+    struct UploadInfo
+    {
+        String id;
+        String path; // destination path on the filesystem
+        size_t size = 0;
+        uint32_t crc32 = 0;
+    };
+
+    // en: Transfers aborted (socket closed) by the ServerOptions deadlines and throughput floors.
+    // ja: ServerOptions の期限・最低スループットにより中断（ソケット切断）した転送の数。
+    struct TransferAbortStats
+    {
+        uint32_t receiveDeadline = 0;
+        uint32_t receiveThroughput = 0;
+        uint32_t sendDeadline = 0;
+        uint32_t sendThroughput = 0;
+    };
+
+    // en: Per-body bookkeeping shared by the send and receive paths (adaptive chunk size, elapsed time, bytes).
+    // ja: 送受信経路で共有するボディ単位の状態（適応チャンクサイズ・経過時間・バイト数）。
+    struct TransferProgress
+    {
+        size_t chunkSize = 0;
+        int64_t startedUs = 0;
+        int64_t activeUs = 0; // time spent inside httpd send/recv calls, excluding shaping and queue waits
+        uint64_t bytes = 0;
+    };
+
+    // en: Body chunk sizes picked by the adaptive sizer (see Server::chunkSizeStats()).
+    // ja: 適応チャンクサイズの選択結果（Server::chunkSizeStats() 参照）。
+    struct ChunkSizeStats
+    {
+        uint32_t chunks = 0;
+        uint64_t bytes = 0;
+        uint32_t grows = 0;        // fast full-size sends that doubled the size
+        uint32_t shrinks = 0;      // slow sends that halved the size
+        size_t smallestChosen = 0; // 0 until the first chunk
+        size_t largestChosen = 0;
+        uint64_t sendUsTotal = 0;  // time spent inside httpd_resp_send_chunk
+    };
+
+    // en: Priority class of a response, chosen per URI prefix with Server::setTrafficClass().
+    // ja: レスポンスの優先クラス。Server::setTrafficClass() で URI プレフィックスごとに指定する。
+    enum class TrafficClass : uint8_t
+    {
+        Interactive = 0,
+        Normal,
+        Bulk
+    };
+
+    struct TrafficClassConfig
+    {
+        uint32_t bytesPerSecond = 0; // token-bucket cap on body bytes, 0 = unlimited
+        uint32_t burstBytes = 0;     // bucket depth, 0 = a quarter second of bytesPerSecond
+        uint8_t chunksPerTurn = 0;   // cooperative weight, 0 = ServerOptions::chunksPerTurn
+    };
+
+    struct TrafficClassStats
+    {
+        uint64_t bytesSent = 0;
+        uint32_t chunksSent = 0;
+        uint32_t throttledChunks = 0;   // chunks that had to wait for tokens
+        uint64_t throttleWaitUs = 0;    // total time spent waiting for tokens
+        uint64_t queueDelayUsTotal = 0; // cooperative streams: time between a turn being queued and running
+        uint32_t queueDelayUsMax = 0;
+        uint32_t queueDelaySamples = 0;
+        uint32_t activeStreams = 0;
+    };
+
     class Request;
     class Response;
+    class Server;
+
+    // en: What a library allocation is for; each class has its own placement policy, budget and counters.
+    // ja: ライブラリ内の確保の用途。クラスごとに配置ポリシー・予算・カウンタを持つ。
+    enum class AllocClass : uint8_t
+    {
+        IoBuffer = 0, // stream and chunk buffers
+        Cache,        // static index, fingerprints, negative cache
+        RouteTable,   // dynamic route table
+        RequestArena, // per-request bodies, header copies, decode scratch
+        Session       // auth verification cache
+    };
+
+    enum class MemoryPlacement : uint8_t
+    {
+        Default = 0, // heap_caps default (what malloc would pick)
+        Internal,    // internal DRAM only
+        PreferPsram, // PSRAM, falling back to internal RAM
+        PsramOnly    // PSRAM or fail
+    };
+
+    struct AllocPolicy
+    {
+        MemoryPlacement placement = MemoryPlacement::Default;
+        size_t budget = 0; // bytes in use allowed for the class, 0 = unlimited
+    };
+
+    struct AllocStats
+    {
+        size_t bytesInUse = 0;
+        size_t peakBytes = 0;
+        uint32_t allocations = 0;
+        uint32_t failures = 0;           // allocator returned nothing, or a buffer was refused by the budget
+        uint32_t overBudget = 0;         // requests that would exceed the budget (containers still proceed)
+        uint32_t placementFallbacks = 0; // PreferPsram satisfied from internal RAM, or container storage moved to Default
+    };
+
+    // en: Backing store for every library allocation routed through Server; set before registering routes.
+    // ja: Server 経由のライブラリ内確保の実体。ルート登録前に設定すること。
+    class Allocator
+    {
+    public:
+        virtual ~Allocator() = default;
+        // en: Returns nullptr on failure; sets *fellBack when the placement was only partially honoured.
+        // ja: 失敗時は nullptr。配置を妥協した場合は *fellBack を true にする。
+        virtual void *allocate(size_t size, MemoryPlacement placement, bool *fellBack) = 0;
+        virtual void deallocate(void *ptr) = 0;
+    };
+
+    // en: Default allocator built on heap_caps_malloc().
+    // ja: heap_caps_malloc() による既定のアロケータ。
+    class HeapCapsAllocator : public Allocator
+    {
+    public:
+        void *allocate(size_t size, MemoryPlacement placement, bool *fellBack) override;
+        void deallocate(void *ptr) override;
+    };
+
+    // en: STL adapter charging container storage to an AllocClass of a Server (global heap when server is null).
+    // ja: コンテナの領域を Server の AllocClass に計上する STL アダプタ（server が null ならグローバルヒープ）。
+    template <typename T>
+    class ServerAllocator
+    {
+    public:
+        using value_type = T;
+        using propagate_on_container_copy_assignment = std::true_type;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+
+        ServerAllocator() noexcept = default;
+        ServerAllocator(Server *server, AllocClass cls) noexcept : server(server), cls(cls) {}
+        template <typename U>
+        ServerAllocator(const ServerAllocator<U> &other) noexcept : server(other.server), cls(other.cls)
+        {
+        }
+
+        T *allocate(size_t count);
+        void deallocate(T *ptr, size_t count) noexcept;
+
+        template <typename U>
+        bool operator==(const ServerAllocator<U> &other) const { return server == other.server && cls == other.cls; }
+        template <typename U>
+        bool operator!=(const ServerAllocator<U> &other) const { return !(*this == other); }
+
+        Server *server = nullptr;
+        AllocClass cls = AllocClass::Cache;
+    };
+
+    template <typename T>
+    using ClassVector = std::vector<T, ServerAllocator<T>>;
+
+    struct ClassBufferDeleter
+    {
+        Server *server = nullptr;
+        AllocClass cls = AllocClass::IoBuffer;
+        size_t size = 0;
+        void operator()(void *ptr) const;
+    };
+
+    template <typename T>
+    using ClassBuffer = std::unique_ptr<T[], ClassBufferDeleter>;
+
+    // en: Counters for the static lookup caches (see Server::staticCacheStats()).
+    // ja: 静的ルックアップ用キャッシュのカウンタ（Server::staticCacheStats() 参照）。
+    struct StaticCacheStats
+    {
+        uint32_t negativeHits = 0;   // 404s answered without probing the FS
+        uint32_t fileHandleHits = 0; // fs->open() calls saved by the open-file cache
+        uint32_t fileHandleMisses = 0;
+        uint32_t fileHandleEvictions = 0;
+        size_t fileHandlesOpen = 0;
+    };
     class StaticInputStream;
 
+    // en: Internal string with 23 bytes of inline storage so short keys and values never touch the heap;
+    //     converted to String only where the public API hands values out.
+    // ja: 23 バイトのインライン領域を持つ内部用文字列。短いキーや値はヒープを使わない。
+    //     公開 API で値を返す箇所でのみ String に変換する。
+    class SmallString
+    {
+    public:
+        SmallString() = default;
+        SmallString(const char *text);
+        SmallString(const char *text, size_t length);
+        SmallString(const String &text);
+        SmallString(const SmallString &other);
+        SmallString(SmallString &&other) noexcept;
+        SmallString &operator=(const SmallString &other);
+        SmallString &operator=(SmallString &&other) noexcept;
+        ~SmallString();
+
+        const char *c_str() const { return _heap ? _heap : _inline; }
+        size_t length() const { return _length; }
+        bool isEmpty() const { return _length == 0; }
+        bool equals(const char *text, size_t length) const;
+        String toString() const;
+
+        bool operator==(const SmallString &other) const { return equals(other.c_str(), other._length); }
+        bool operator==(const String &other) const { return equals(other.c_str(), other.length()); }
+        bool operator==(const char *other) const { return other && equals(other, strlen(other)); }
+        bool operator!=(const String &other) const { return !(*this == other); }
+
+    private:
+        void assign(const char *text, size_t length);
+        void release();
+
+        static constexpr size_t kInlineCapacity = 23;
+        char *_heap = nullptr;
+        size_t _length = 0;
+        char _inline[kInlineCapacity + 1] = {0};
+    };
+
+    inline bool operator==(const String &lhs, const SmallString &rhs) { return rhs == lhs; }
+    inline bool operator!=(const String &lhs, const SmallString &rhs) { return !(rhs == lhs); }
+
+    using ParamList = std::vector<std::pair<SmallString, SmallString>>;
+
+    // en: Non-owning, percent-decoded view of a query/form key or value; valid only for the call that received it.
+    // ja: クエリ／フォームのキーまたは値を指す非所有・デコード済みビュー。受け取った呼び出しの間だけ有効。
+    struct ParamView
+    {
+        const char *data = nullptr;
+        size_t length = 0;
+
+        bool equals(const char *text) const;
+        String toString() const;
+    };
+
+    enum class ParamError : uint8_t
+    {
+        None = 0,
+        Missing,
+        Invalid,
+        OutOfRange
+    };
+
+    using ParamViewCallback = std::function<bool(const ParamView &name, const ParamView &value)>;
+
     using TemplateHandler = std::function<bool(const String &key, Print &out)>;
+    // en: Pull-style body producer: fill up to capacity bytes and return the count; 0 ends the body.
+    // ja: プル型のボディ生成関数。最大 capacity バイトを書き込みその長さを返す。0 で終端。
+    using ChunkSource = std::function<size_t(uint8_t *buffer, size_t capacity)>;
     using StaticHandler = std::function<void(const StaticInfo &info, Request &req, Response &res)>;
     using RouteHandler = std::function<void(Request &req, Response &res)>;
     using ErrorRenderer = std::function<void(int status, Request &req, Response &res)>;
+    using UploadCompleteHandler = std::function<void(const UploadInfo &info)>;
 
     // en: Lightweight holder for esp_http_server request data.
     // ja: esp_http_server のリクエスト情報を扱う薄いラッパークラス。
@@ -69,12 +489,19 @@ namespace EspHttpServer
         httpd_req_t *raw() const { return _raw; }
         String uri() const;
         String method() const;
+        bool hasHeader(const char *name) const;
+        String header(const char *name) const;
         const String &path() const { return _normalizedPath; }
         String pathParam(const String &key) const;
         bool hasPathParam(const String &key) const;
         bool hasCookie(const String &name) const;
         String cookie(const String &name) const;
+        // en: The String overloads reuse one name/value pair of Strings across the loop; the *View variants hand
+        //     out views and never allocate. Either argument is only valid during the callback.
+        // ja: String 版はループ中で同じ名前／値の String を使い回す。*View 版はビューを渡し確保を行わない。
+        //     いずれも引数はコールバック中のみ有効。
         void forEachCookie(std::function<bool(const String &name, const String &value)> cb) const;
+        void forEachCookieView(ParamViewCallback cb) const;
         bool hasQueryParam(const String &name) const;
         String queryParam(const String &name) const;
         void forEachQueryParam(std::function<bool(const String &name, const String &value)> cb) const;
@@ -84,6 +511,21 @@ namespace EspHttpServer
         void forEachFormParam(std::function<bool(const String &name, const String &value)> cb) const;
         static void setMaxFormSize(size_t bytes);
 
+        // en: Typed accessors parse straight from the raw query / form body; the last occurrence wins and
+        //     defaultValue is returned (with *error set) when the key is missing or the value does not parse.
+        // ja: 生のクエリ／フォームボディから直接解析する型付きアクセサ。最後の出現が優先され、キーが無い・解析できない
+        //     場合は defaultValue を返し *error を設定する。
+        long queryInt(const char *name, long defaultValue = 0, ParamError *error = nullptr) const;
+        float queryFloat(const char *name, float defaultValue = 0.0f, ParamError *error = nullptr) const;
+        bool queryBool(const char *name, bool defaultValue = false, ParamError *error = nullptr) const;
+        int queryEnum(const char *name, std::initializer_list<const char *> choices, int defaultValue = -1, ParamError *error = nullptr) const;
+        long formInt(const char *name, long defaultValue = 0, ParamError *error = nullptr) const;
+        float formFloat(const char *name, float defaultValue = 0.0f, ParamError *error = nullptr) const;
+        bool formBool(const char *name, bool defaultValue = false, ParamError *error = nullptr) const;
+        int formEnum(const char *name, std::initializer_list<const char *> choices, int defaultValue = -1, ParamError *error = nullptr) const;
+        void forEachQueryView(ParamViewCallback cb) const;
+        void forEachFormView(ParamViewCallback cb) const;
+
         struct MultipartFieldInfo
         {
             String name;
@@ -98,30 +540,55 @@ namespace EspHttpServer
         String multipartField(const String &name) const;
         void onMultipart(MultipartFieldHandler handler) const;
 
+        bool authenticated() const { return _authenticated; }
+        const String &authUser() const { return _authUser; }
+
     private:
         friend class Server;
 
-        void setPathInfo(const String &path, const std::vector<std::pair<String, String>> &params);
+        void setPathInfo(const String &path, const ParamList &params);
         void clearPathInfo();
         bool ensureCookiesParsed() const;
         bool ensureQueryParsed() const;
         bool ensureFormParsed() const;
+        bool ensureFormBody() const;
+        bool paramSource(bool form, const char *&data, size_t &length) const;
+        // en: Templates on the callable (defined in the .cpp, the only user) so the typed accessors' lambdas are
+        //     called directly instead of through a heap-allocated std::function.
+        // ja: 呼び出し対象を型引数に取るテンプレート（定義は唯一の利用箇所である .cpp）。型付きアクセサのラムダを
+        //     ヒープ確保を伴う std::function を介さずに直接呼ぶ。
+        template <typename Fn>
+        bool visitParam(bool form, const char *name, Fn &&fn) const;
+        template <typename Fn>
+        void forEachView(bool form, Fn &&cb) const;
+        long paramInt(bool form, const char *name, long defaultValue, ParamError *error) const;
+        float paramFloat(bool form, const char *name, float defaultValue, ParamError *error) const;
+        bool paramBool(bool form, const char *name, bool defaultValue, ParamError *error) const;
+        int paramEnum(bool form, const char *name, std::initializer_list<const char *> choices, int defaultValue, ParamError *error) const;
         bool ensureMultipartParsed() const;
-        bool parseUrlEncoded(const String &text, std::vector<std::pair<String, String>> &out) const;
+        bool parseUrlEncoded(const String &text, ParamList &out) const;
         static bool decodeComponent(const String &input, String &output);
         static bool isUrlEncodedContentType(const String &contentType);
         static bool extractBoundary(const String &contentType, String &boundaryOut);
 
+        int receiveBody(char *buffer, size_t len, TransferProgress &progress) const;
+
         httpd_req_t *_raw = nullptr;
+        bool _subRequest = false; // batch sub-request: GET _subUri with the outer headers and no body
+        String _subUri;
+        Server *_server = nullptr;
         String _normalizedPath = "/";
-        std::vector<std::pair<String, String>> _pathParams;
+        ParamList _pathParams;
         mutable bool _cookiesParsed = false;
-        mutable std::vector<std::pair<String, String>> _cookies;
+        mutable ParamList _cookies;
         mutable bool _queryParsed = false;
-        mutable std::vector<std::pair<String, String>> _queryParams;
+        mutable ParamList _queryParams;
         mutable bool _formParsed = false;
         mutable bool _formOverflow = false;
-        mutable std::vector<std::pair<String, String>> _formParams;
+        mutable bool _formBodyRead = false;
+        mutable ClassBuffer<char> _formBody;
+        mutable size_t _formBodyLength = 0;
+        mutable ParamList _formParams;
         mutable bool _multipartParsed = false;
         mutable bool _multipartOverflow = false;
         struct MultipartField
@@ -130,6 +597,8 @@ namespace EspHttpServer
             String data;
         };
         mutable std::vector<MultipartField> _multipartFields;
+        bool _authenticated = false;
+        String _authUser;
         static size_t _maxFormSize;
     };
 
@@ -139,6 +608,7 @@ namespace EspHttpServer
     {
     public:
         explicit Response(httpd_req_t *raw = nullptr);
+        ~Response();
 
         void attachRequest(httpd_req_t *raw);
 
@@ -160,21 +630,45 @@ namespace EspHttpServer
         void sendChunk(const String &text);
         void endChunked();
 
+        void sendStream(int code, const char *type, ChunkSource source, size_t sizeHint = 0);
+
         void sendStatic();
         void sendFile(fs::FS &fs, const String &fsPath);
+        void sendFile(File &file);
+        void sendDirectoryListing(fs::FS &fs, const String &dirPath, const DirectoryListingOptions &options = DirectoryListingOptions());
         void sendError(int status);
         bool committed() const;
 
+        // en: Render only the {{$block name}}...{{/block}} part of an HTML template (200 text/html, 404 when absent).
+        //     The no-source overload uses the file resolved for a StaticHandler, like sendStatic().
+        // ja: HTML テンプレートの {{$block name}}...{{/block}} 部分だけを描画する（200 text/html、無ければ 404）。
+        //     引数なし版は sendStatic() と同様に StaticHandler で解決済みのファイルを使う。
+        void sendFragment(const String &block);
+        void sendFragment(fs::FS &fs, const String &fsPath, const String &block);
+        void sendFragment(const uint8_t *data, size_t len, const String &block);
+
         void redirect(const char *location, int status = 302);
 
         static void setErrorRenderer(ErrorRenderer handler);
         static void clearErrorRenderer();
+        // en: Preformatted error body sent straight from memory (typically a PROGMEM blob; not copied).
+        //     A status may have one page per content type; the request's Accept header picks among them.
+        // ja: メモリ上の整形済みエラーボディをそのまま送る（通常は PROGMEM。コピーしない）。
+        //     ステータスごとに Content-Type 別のページを持て、リクエストの Accept で選ぶ。
+        static void setErrorPage(int status, const char *contentType, const uint8_t *data, size_t length);
+        // en: Keep the ErrorRenderer's first send() per (status, content-type) for these statuses and replay it.
+        // ja: 指定ステータスでは ErrorRenderer の最初の send() を (status, content-type) ごとに保持して再利用する。
+        static void memoizeErrorPages(std::initializer_list<int> statuses);
+        static void clearErrorPages();
 
         void setStaticInfo(const StaticInfo &info);
 
         void setCookie(const Cookie &cookie);
         void clearCookie(const String &name, const String &path = "/");
 
+        void setHeader(const char *name, const char *value);
+        void setHeader(const char *name, const String &value);
+
     private:
         friend class Server;
 
@@ -187,12 +681,53 @@ namespace EspHttpServer
 
         void setStaticFileSystem(fs::FS *fs);
         void setStaticMemorySource(const uint8_t *data, size_t size);
+        void setStaticMimeType(const char *mime);
         void clearStaticSource();
-        bool streamHtmlFromSource(StaticInputStream &stream);
+        File openStaticFile(int &slot);
+        void closeStaticFile(File &file, int slot);
+        void setPendingStaticFile(File file, int slot);
+        void releasePendingStaticFile();
+        bool streamHtmlFromSource(StaticInputStream &stream, const String *block = nullptr, bool *blockFound = nullptr);
+        bool streamBody(ChunkSource source, size_t sizeHint, std::function<void()> onDone, bool allowCooperative);
+        esp_err_t writeBodyChunk(const uint8_t *data, size_t len);
+        size_t bodyChunkSize();
         const char *statusString(int code);
         void setRequestContext(Request *req);
+        void setServerContext(Server *server);
+        bool assetRewriteActive() const;
         void markCommitted();
         static const char *defaultErrorMessage(int status);
+        bool sendErrorPage(int status);
+        void sendEarlyHints(const String &logicalPath);
+        void writeHead(int code, const char *type);
+        esp_err_t writeBody(const uint8_t *data, size_t len);
+        esp_err_t endBody();
+        void storeErrorPage(int status, const char *type, const uint8_t *data, size_t length);
+        static SemaphoreHandle_t errorPageLock();
+
+        // en: Sink for a batch sub-request: status, type and body land here instead of on the socket.
+        // ja: バッチのサブリクエスト用の受け皿。ステータス・タイプ・ボディをソケットではなくここへ書く。
+        struct Capture
+        {
+            int status = 0;
+            String contentType;
+            bool gzip = false;
+            uint8_t *data = nullptr;
+            size_t capacity = 0;
+            size_t length = 0;
+            bool truncated = false;
+        };
+
+        struct ErrorPage
+        {
+            int status = 0;
+            const char *contentType = nullptr;
+            const uint8_t *data = nullptr;
+            size_t length = 0;
+            const char *headers = nullptr; // "name\0value\0" pairs the renderer set; memoized pages only
+            size_t headerCount = 0;
+            std::shared_ptr<uint8_t[]> owned; // memoized copy ("type\0headers body"); null for registered pages
+        };
 
         httpd_req_t *_raw = nullptr;
         TemplateHandler _templateHandler;
@@ -200,6 +735,7 @@ namespace EspHttpServer
         const char *_headInjectionPtr = nullptr;
         bool _headInjectionIsRawPtr = false;
         Request *_requestContext = nullptr;
+        Server *_server = nullptr;
         StaticInfo _staticInfo;
         bool _chunked = false;
         int _lastStatusCode = 0;
@@ -208,9 +744,22 @@ namespace EspHttpServer
         fs::FS *_staticFs = nullptr;
         const uint8_t *_memData = nullptr;
         size_t _memSize = 0;
-        std::vector<std::unique_ptr<char[]>> _setCookieBuffers;
+        const char *_staticMimeType = nullptr;
+        TrafficClass _trafficClass = TrafficClass::Normal;
+        TransferProgress _sendProgress;
+        File _pendingFile; // handle opened while resolving, consumed by sendStatic()
+        int _pendingSlot = -1;
+        String _pendingPath;
+        std::vector<ClassBuffer<char>> _setCookieBuffers;
+        std::vector<ClassBuffer<char>> _headerBuffers;
         char _statusBuffer[16] = {0};
+        int _memoizeStatus = 0;
+        size_t _memoHeaderStart = 0; // first _headerBuffers entry set by the ErrorRenderer
+        String _earlyHints; // Link value for a 103, written by sendStatic() only on the 200 path
+        Capture *_capture = nullptr;
         static ErrorRenderer _errorRenderer;
+        static std::vector<ErrorPage> _errorPages;
+        static std::vector<int> _memoizedErrorStatuses;
     };
 
     struct SessionConfig
@@ -247,14 +796,64 @@ namespace EspHttpServer
         ~Server();
 
         bool begin(const httpd_config_t &cfg = HTTPD_DEFAULT_CONFIG());
+        bool begin(const httpd_config_t &cfg, const ServerOptions &options);
+        const ServerOptions &options() const { return _options; }
+
+        // en: Longest matching prefix decides the class of a request's body; unmatched paths are Normal.
+        // ja: 最長一致したプレフィックスでボディの優先クラスを決める。一致しなければ Normal。
+        void setTrafficClass(const String &uriPrefix, TrafficClass cls);
+        void configureTrafficClass(TrafficClass cls, const TrafficClassConfig &config);
+        TrafficClassStats trafficStats(TrafficClass cls) const;
+
+        // en: Route library buffers and containers through allocator (nullptr restores HeapCapsAllocator).
+        //     Call before begin() and before registering routes or static handlers.
+        // ja: ライブラリのバッファとコンテナを allocator 経由にする（nullptr で HeapCapsAllocator に戻す）。
+        //     begin() やルート・静的ハンドラの登録より前に呼ぶこと。
+        void setAllocator(Allocator *allocator);
+        void setAllocPolicy(AllocClass cls, const AllocPolicy &policy);
+        AllocStats allocStats(AllocClass cls) const;
+        ChunkSizeStats chunkSizeStats() const { return _chunkStats; }
+        TransferAbortStats transferAbortStats() const { return _abortStats; }
         void end();
 
         void on(const String &uri, httpd_method_t method, RouteHandler handler);
+        void on(const String &uri, httpd_method_t method, const BodyPolicy &policy, RouteHandler handler);
         void onNotFound(RouteHandler handler);
 
+        // en: POST uri with a JSON array of GET targets; each runs through auth, static handlers and routes
+        //     in-process and the results stream back as one JSON document.
+        // ja: GET ターゲットの JSON 配列を uri へ POST すると、各ターゲットを認証・静的ハンドラ・ルートに
+        //     プロセス内で通し、結果を 1 つの JSON としてストリーム返却する。
+        void enableBatch(const String &uri = "/_batch", const BatchOptions &options = BatchOptions());
+
+        // en: tus-style resumable uploads into destDir: POST uri creates an upload, HEAD uri/<id> reports the stored
+        //     offset, PATCH uri/<id> continues from it and DELETE uri/<id> abandons it. Call after the FS is mounted.
+        // ja: destDir への tus 互換の再開可能アップロード。POST uri で作成、HEAD uri/<id> で保存済みオフセットを返し、
+        //     PATCH uri/<id> でその位置から続きを書き、DELETE uri/<id> で破棄する。FS のマウント後に呼ぶこと。
+        void enableResumableUploads(const String &uri,
+                                    fs::FS &fs,
+                                    const String &destDir,
+                                    const UploadOptions &options = UploadOptions(),
+                                    UploadCompleteHandler onComplete = nullptr);
+
+        void requireAuth(const String &uriPrefix, const AuthConfig &cfg);
+
+        void serveStatic(const String &uriPrefix,
+                         fs::FS &fs,
+                         const String &basePath,
+                         StaticHandler handler);
+
         void serveStatic(const String &uriPrefix,
                          fs::FS &fs,
                          const String &basePath,
+                         StaticHandler handler,
+                         const StaticOptions &options);
+
+        void serveStatic(const String &uriPrefix,
+                         const char *const *paths,
+                         const uint8_t *const *data,
+                         const size_t *sizes,
+                         size_t fileCount,
                          StaticHandler handler);
 
         void serveStatic(const String &uriPrefix,
@@ -262,19 +861,166 @@ namespace EspHttpServer
                          const uint8_t *const *data,
                          const size_t *sizes,
                          size_t fileCount,
+                         StaticHandler handler,
+                         const StaticOptions &options);
+
+        void serveStatic(const String &uriPrefix,
+                         const EmbeddedAssetIndex &index,
                          StaticHandler handler);
 
+        void serveStatic(const String &uriPrefix,
+                         const EmbeddedAssetIndex &index,
+                         StaticHandler handler,
+                         const StaticOptions &options);
+
+        // en: Drops cached static lookups (negative cache) and schedules a background rebuild of every FS index.
+        //     Safe to call from any task.
+        // ja: 静的ルックアップのキャッシュ（ネガティブキャッシュ）を破棄し、全 FS インデックスの再構築を
+        //     バックグラウンドに予約する。任意のタスクから呼び出し可。
+        void invalidateStaticCache();
+        // en: Same, but only handlers serving fs at or around path get their index rebuilt.
+        // ja: 同上。ただしインデックスを再構築するのは fs の path 周辺を配信するハンドラのみ。
+        void invalidateStaticCache(fs::FS &fs, const String &path);
+
+        // en: Bounded cache of read-only handles for hot FS assets (default 0 = off). Call before begin().
+        //     Cached handles use maxOpenFiles slots and can block remove/rename on FAT; see SPEC 11.5.
+        // ja: よく使う FS アセットの読み取りハンドルを保持する有界キャッシュ（既定 0 = 無効）。begin() 前に設定する。
+        //     保持中のハンドルは maxOpenFiles を消費し、FAT では remove/rename を妨げうる。SPEC 11.5 参照。
+        void setOpenFileCacheSize(size_t handles);
+        StaticCacheStats staticCacheStats() const;
+
     private:
+        friend class Request;
+        friend class Response;
+
         enum class HandlerType
         {
             StaticFS,
-            StaticMem
+            StaticMem,
+            StaticEmbedded
+        };
+
+        // en: Background rebuild of a stale FS index; the fresh copy is swapped in on the httpd task.
+        // ja: 古くなった FS インデックスのバックグラウンド再構築。新しい版は httpd タスク上で差し替える。
+        enum IndexRebuild : uint8_t
+        {
+            RebuildIdle = 0,
+            RebuildQueued = 1,
+            RebuildReady = 2
+        };
+
+        // en: Sorted inventory of a static source so variant lookups avoid per-request probes.
+        // ja: 静的ソースのソート済み一覧。バリアント探索でリクエスト毎のプローブを避ける。
+        struct StaticIndexEntry
+        {
+            String relPath; // leading slash, relative to basePath
+            size_t size = 0;
+            int memIndex = -1;
+        };
+
+        struct FingerprintEntry
+        {
+            String logicalPath;     // /app.js
+            String fingerprintPath; // /app.1a2b3c4d.js
+            uint32_t hash = 0;
+        };
+
+        struct PreloadEntry
+        {
+            String page; // logical path
+            String link; // complete Link header value
+        };
+
+        struct StaticIndex
+        {
+            std::atomic<bool> ready{false};
+            ClassVector<StaticIndexEntry> entries;
+            ClassVector<FingerprintEntry> fingerprints; // sorted by logicalPath
+            ClassVector<PreloadEntry> preloads;         // sorted by page
+
+            const StaticIndexEntry *find(const String &relPath) const;
+            const FingerprintEntry *findFingerprint(const String &logicalPath) const;
+            const PreloadEntry *findPreload(const String &page) const;
+        };
+
+        // en: Bounded memory of static misses: a counting Bloom filter screens lookups and a small exact LRU confirms them.
+        // ja: 静的 404 の有界キャッシュ。カウンティング Bloom フィルタで絞り込み、小さな LRU で厳密に確認する。
+        struct NegativeCache
+        {
+            static constexpr size_t kBloomSlots = 256;
+            static constexpr size_t kMaxPathLength = 128;
+
+            struct Slot
+            {
+                uint32_t hash = 0;
+                uint32_t lastUse = 0;
+                String relPath;
+            };
+
+            uint8_t counters[kBloomSlots] = {0};
+            ClassVector<Slot> slots;
+            size_t capacity = 0;
+            uint32_t generation = 0;
+            uint32_t clock = 0;
+            uint32_t hits = 0;
+
+            bool contains(const String &relPath, uint32_t generationNow);
+            void remember(const String &relPath, uint32_t generationNow);
+            void clear();
+        };
+
+        struct OpenFileSlot
+        {
+            fs::FS *fs = nullptr;
+            String path;
+            File file;
+            uint32_t refs = 0;
+            uint32_t lastUse = 0;
+            bool stale = false;
+        };
+
+        // en: Continuation of a body handed off with httpd_req_async_handler_begin(); advanced by httpd_queue_work.
+        // ja: httpd_req_async_handler_begin() で引き継いだボディの続き。httpd_queue_work で 1 ターンずつ進める。
+        struct StreamJob
+        {
+            Server *server = nullptr;
+            httpd_req_t *req = nullptr;
+            ChunkSource source;
+            std::function<void()> onDone;
+            ClassBuffer<uint8_t> buffer;
+            size_t capacity = 0;
+            TransferProgress progress;
+            size_t pendingLen = 0; // produced chunk still waiting for tokens
+            TrafficClass trafficClass = TrafficClass::Normal;
+            int64_t queuedAtUs = 0;
+            int64_t wakeAtUs = 0;    // waiting on traffic tokens until then, 0 = not waiting
+            uint8_t queuedTurns = 0; // runStreamJob work items not yet run; the job is freed only at zero
+            bool finished = false;
+        };
+
+        static constexpr size_t kTrafficClassCount = 3;
+
+        struct TrafficClassState
+        {
+            TrafficClassConfig config;
+            int64_t tokens = 0;
+            int64_t lastRefillUs = 0;
+            TrafficClassStats stats;
         };
 
         struct HandlerEntry
         {
             HandlerType type = HandlerType::StaticFS;
             StaticHandler staticHandler;
+            StaticOptions options;
+            StaticIndex index;
+            NegativeCache negativeCache;
+            std::atomic<bool> scanPending{false}; // FS inventory (index and/or Info listing) not built yet
+            std::atomic<uint32_t> writeGeneration{0}; // bumped by invalidations that touch this handler's files
+            std::atomic<uint32_t> indexGeneration{0}; // writeGeneration the index was built from
+            std::atomic<uint8_t> rebuildState{0};     // IndexRebuild
+            std::unique_ptr<StaticIndex> freshIndex;  // built by the scan task, installed on the httpd task
+            uint32_t freshGeneration = 0;
             String uriPrefix;
             String basePath;
             fs::FS *fs = nullptr;
@@ -282,6 +1028,8 @@ namespace EspHttpServer
             const uint8_t *const *memData = nullptr;
             const size_t *memSizes = nullptr;
             size_t memCount = 0;
+            const EmbeddedAsset *embeddedAssets = nullptr;
+            size_t embeddedCount = 0;
             Server *owner = nullptr;
         };
 
@@ -295,7 +1043,7 @@ namespace EspHttpServer
             };
 
             Type type = Type::Literal;
-            String value;
+            SmallString value;
         };
 
         struct DynamicRoute
@@ -305,6 +1053,55 @@ namespace EspHttpServer
             std::vector<RouteSegment> segments;
             int score = 0;
             RouteHandler handler;
+            BodyPolicy bodyPolicy;
+        };
+
+        struct AuthCacheEntry
+        {
+            uint8_t digest[32] = {0};
+            uint32_t expiresAt = 0;
+            bool used = false;
+        };
+
+        struct AuthRule
+        {
+            String uriPrefix;
+            AuthConfig config;
+            String basicChallenge;
+            String bearerChallenge;
+            ClassVector<AuthCacheEntry> cache;   // grants
+            ClassVector<AuthCacheEntry> denials; // denials, a separate pool so they cannot evict grants
+            size_t nextSlot = 0;
+            size_t nextDenial = 0;
+        };
+
+        // en: Resume point of a partial upload, persisted as one text line in <tempDir>/<id>.meta.
+        // ja: 途中のアップロードの再開位置。<tempDir>/<id>.meta に 1 行のテキストとして保存する。
+        struct UploadState
+        {
+            size_t length = 0;
+            size_t offset = 0;
+            uint32_t crc = 0; // CRC-32 of bytes [0, offset)
+            bool hasExpectedCrc = false;
+            uint32_t expectedCrc = 0; // whole-file checksum from the creation request
+            String fileName;
+        };
+
+        struct UploadActivity
+        {
+            String id;
+            int64_t lastUs = 0;
+        };
+
+        struct UploadEndpoint
+        {
+            String uri;
+            fs::FS *fs = nullptr;
+            String destDir;
+            UploadOptions options;
+            UploadCompleteHandler onComplete;
+            std::vector<UploadActivity> activity; // uploads on disk, by last request time
+            bool scanned = false;                 // tempDir adopted into activity
         };
 
         struct MethodHook
@@ -317,22 +1114,210 @@ namespace EspHttpServer
         static esp_err_t handleDynamicHttpRequest(httpd_req_t *req);
         void setupStaticInfoFromFS(HandlerEntry *entry, Request &req, Response &res, const String &normalizedUri, const String &relPath);
         void setupStaticInfoFromMemory(HandlerEntry *entry, Request &req, Response &res, const String &normalizedUri, const String &relPath);
+        void setupStaticInfoFromEmbedded(HandlerEntry *entry, Request &req, Response &res, const String &normalizedUri, const String &relPath);
+        struct ComboPart
+        {
+            const uint8_t *data = nullptr; // memory / embedded backends
+            String fsPath;                 // FS backend, opened when the part is streamed
+            size_t size = 0;
+            String etag;
+        };
+        void handleCombo(HandlerEntry *entry, Request &req, Response &res);
+        bool resolveComboPart(HandlerEntry *entry, const String &path, bool gzip, ComboPart &part);
+        void buildStaticIndex(HandlerEntry *entry);
+        void buildStaticIndex(HandlerEntry *entry, StaticIndex &index);
+        void ensureStaticScan(HandlerEntry *entry);
+        bool indexCurrent(const HandlerEntry *entry) const;
+        void rebuildStaticIndex(HandlerEntry *entry);
+        void installRebuiltIndexes();
+        void startBackgroundScan();
+        static void backgroundScanTask(void *arg);
+        void buildFingerprints(HandlerEntry *entry, StaticIndex &index);
+        void buildPreloads(HandlerEntry *entry, StaticIndex &index);
+        void applyPreload(HandlerEntry *entry, Response &res, const StaticInfo &info);
+        bool resolveAssetUrl(const String &url, String &out);
+        void resolveFingerprintAlias(HandlerEntry *entry, Response &res, String &relPath) const;
+        String fingerprintEtag(HandlerEntry *entry, const String &logicalPath, bool gzip) const;
+        const StaticIndexEntry *selectLanguageVariant(HandlerEntry *entry, Request &req, Response &res, const String &resolvedPath, const String &relPath, String &languageOut) const;
+        const StaticIndexEntry *selectImageVariant(HandlerEntry *entry, Request &req, const String &logicalPath) const;
+        bool probeFile(fs::FS *fs, const String &path) const;
+        File acquireFile(fs::FS *fs, const String &path, int &slotOut);
+        void releaseFile(File &file, int slot);
+        void dropOpenFiles();
+        bool startCooperativeStream(httpd_req_t *req, TrafficClass cls, ChunkSource &source, std::function<void()> &onDone, size_t sizeHint);
+        void finishStreamJob(StreamJob *job, bool aborted = false);
+        void releaseStreamJob(StreamJob *job);
+        bool queueStreamJob(StreamJob *job, int64_t delayUs);
+        bool armShapeTimer();
+        static void runStreamJob(void *arg);
+        static void runShapedJobs(void *arg);
+        static void shapeTimerFired(void *arg);
+        static void shutdownStreamJobs(void *arg);
+        TrafficClass trafficClassFor(const String &path) const;
+        int64_t reserveTraffic(TrafficClass cls, size_t len);
+        void noteChunkSent(TrafficClass cls, size_t len);
+        template <typename T>
+        friend class ServerAllocator;
+        friend struct ClassBufferDeleter;
+
+        static constexpr size_t kAllocClassCount = 5;
+
+        struct AllocState
+        {
+            AllocPolicy policy;
+            std::atomic<size_t> bytesInUse{0};
+            std::atomic<size_t> peakBytes{0};
+            std::atomic<uint32_t> allocations{0};
+            std::atomic<uint32_t> failures{0};
+            std::atomic<uint32_t> overBudget{0};
+            std::atomic<uint32_t> placementFallbacks{0};
+        };
+
+        void *allocateFor(AllocClass cls, size_t size, bool enforceBudget);
+        void releaseFor(AllocClass cls, void *ptr, size_t size);
+        static void *allocateRaw(Server *server, AllocClass cls, size_t size);
+        void bindAllocators(HandlerEntry &entry);
+        void bindAllocators(StaticIndex &index);
+        // en: server may be null (a Request or Response outside dispatch); the buffer then uses the default heap.
+        // ja: server は null でもよい（dispatch 外の Request/Response）。その場合は既定のヒープを使う。
+        template <typename T>
+        static ClassBuffer<T> allocateBuffer(Server *server, AllocClass cls, size_t count)
+        {
+            const size_t bytes = count * sizeof(T);
+            return ClassBuffer<T>(static_cast<T *>(allocateRaw(server, cls, bytes)), ClassBufferDeleter{server, cls, bytes});
+        }
+        template <typename T>
+        ServerAllocator<T> allocatorFor(AllocClass cls)
+        {
+            return ServerAllocator<T>(this, cls);
+        }
+
+        esp_err_t sendBodyChunk(httpd_req_t *req, TrafficClass cls, const uint8_t *data, size_t len, TransferProgress &progress);
+        esp_err_t transmitChunk(httpd_req_t *req, TrafficClass cls, const uint8_t *data, size_t len, TransferProgress &progress);
+        size_t initialChunkSize() const;
+        void fitChunkBuffer(ClassBuffer<uint8_t> &buffer, size_t &capacity, size_t &chunkSize);
+        int receiveChunk(httpd_req_t *req, char *buffer, size_t len, TransferProgress &progress);
+        bool transferWithinLimits(httpd_req_t *req, TransferProgress &progress, bool receiving);
+        bool admitBody(Request &request, Response &response, const BodyPolicy &policy);
         bool ensureMethodHook(httpd_method_t method);
         bool registerMethodHook(MethodHook *hook);
         esp_err_t dispatchDynamic(httpd_req_t *req);
+        DynamicRoute *findRoute(httpd_method_t method, const std::vector<String> &pathSegments, ParamList &params);
+        void handleBatch(Request &req, Response &res, const BatchOptions &options);
+        void dispatchSubRequest(Request &outer, const String &target, Response &res);
+        void handleUploadCreate(UploadEndpoint *ep, Request &req, Response &res);
+        void handleUploadHead(UploadEndpoint *ep, Request &req, Response &res);
+        void handleUploadPatch(UploadEndpoint *ep, Request &req, Response &res);
+        void handleUploadDelete(UploadEndpoint *ep, Request &req, Response &res);
+        int finishUpload(UploadEndpoint *ep, const String &id, const UploadState &state, UploadInfo &info);
+        bool isUploadTempPath(const fs::FS *fs, const String &fsPath) const;
+        bool loadUploadState(UploadEndpoint *ep, const String &id, UploadState &state);
+        bool saveUploadState(UploadEndpoint *ep, const String &id, const UploadState &state);
+        void removeUpload(UploadEndpoint *ep, const String &id);
+        void touchUpload(UploadEndpoint *ep, const String &id);
+        void collectStaleUploads(UploadEndpoint *ep, bool expire);
+        static void uploadGcTimer(void *arg);
+        static void runUploadGc(void *arg);
         bool tryHandleStaticRequest(Request &req, Response &res, httpd_method_t method, const String &rawPath, const String &normalizedPath);
+        bool checkAuth(Request &req, Response &res, const String &normalizedPath);
+        bool verifyAuthCredentials(AuthRule &rule, const AuthCredentials &cred);
         bool parseRoutePattern(const String &pattern, std::vector<RouteSegment> &segments, int &score);
         bool normalizeRoutePath(const String &raw, String &normalized, std::vector<String> &segments) const;
-        bool matchRoute(const DynamicRoute &route, const std::vector<String> &pathSegments, std::vector<std::pair<String, String>> &outParams) const;
-        String urlDecode(const String &input) const;
-        void logParams(const std::vector<std::pair<String, String>> &params) const;
+        bool matchRoute(const DynamicRoute &route, const std::vector<String> &pathSegments, ParamList &outParams) const;
+        bool urlDecode(const String &input, String &output) const;
+        void logParams(const ParamList &params) const;
         String clientAddress(httpd_req_t *req) const;
 
         httpd_handle_t _handle = nullptr;
+        ServerOptions _options;
+        std::vector<StreamJob *> _streamJobs;
+        esp_timer_handle_t _shapeTimer = nullptr; // shared by every stream waiting on traffic tokens
+        std::atomic<bool> _shapeTimerBusy{false};
+        std::atomic<bool> _streamsStopping{false};
+        std::atomic<uint32_t> _streamJobsLive{0}; // allocated jobs, including finished ones awaiting a queued turn
+        std::vector<std::pair<String, TrafficClass>> _trafficRules;
+        TrafficClassState _traffic[kTrafficClassCount];
+        ChunkSizeStats _chunkStats;
+        TransferAbortStats _abortStats;
+        Allocator *_allocator = nullptr;
+        AllocState _alloc[kAllocClassCount];
         std::vector<std::unique_ptr<HandlerEntry>> _handlers;
-        std::vector<DynamicRoute> _dynamicRoutes;
+        ClassVector<DynamicRoute> _dynamicRoutes{ServerAllocator<DynamicRoute>(this, AllocClass::RouteTable)};
         std::vector<std::unique_ptr<MethodHook>> _methodHooks;
+        std::vector<std::unique_ptr<AuthRule>> _authRules;
+        size_t _fingerprintHandlerCount = 0;
+        std::atomic<uint32_t> _staticCacheGeneration{0};
+        std::vector<OpenFileSlot> _openFiles;
+        size_t _openFileCapacity = 0;
+        uint32_t _openFileGeneration = 0;
+        uint32_t _openFileClock = 0;
+        StaticCacheStats _cacheStats;
+        SemaphoreHandle_t _scanMutex = nullptr;
+        std::vector<HandlerEntry *> _scanQueue;
+        std::atomic<bool> _scanTaskRunning{false};
+        std::atomic<bool> _scanAbort{false};
+        std::atomic<bool> _rebuildsReady{false};
+        std::vector<std::unique_ptr<UploadEndpoint>> _uploadEndpoints;
+        esp_timer_handle_t _uploadGcTimer = nullptr;
+        uint64_t _uploadGcPeriodUs = 0; // running period, restarted by begin() after end()
+        std::atomic<bool> _uploadGcBusy{false};
         RouteHandler _notFoundHandler;
     };
 
+    template <typename T>
+    T *ServerAllocator<T>::allocate(size_t count)
+    {
+        const size_t bytes = count * sizeof(T);
+        void *ptr = server ? server->allocateFor(cls, bytes, false) : ::operator new(bytes, std::nothrow);
+        if (!ptr)
+        {
+#if defined(__cpp_exceptions)
+            throw std::bad_alloc();
+#else
+            abort();
+#endif
+        }
+        return static_cast<T *>(ptr);
+    }
+
+    template <typename T>
+    void ServerAllocator<T>::deallocate(T *ptr, size_t count) noexcept
+    {
+        if (server)
+        {
+            server->releaseFor(cls, ptr, count * sizeof(T));
+        }
+        else
+        {
+            ::operator delete(ptr);
+        }
+    }
+
+    // en: Write-side wrapper for a filesystem served by serveStatic; every mutation invalidates the server's static caches,
+    //     and files opened for writing invalidate again when closed.
+    // ja: serveStatic で配信中の FS への書き込み用ラッパー。変更のたびにサーバーの静的キャッシュを無効化し、
+    //     書き込み用に開いたファイルはクローズ時にも無効化する。
+    class WriteThroughFS
+    {
+    public:
+        WriteThroughFS(Server &server, fs::FS &fs) : _server(server), _fs(fs) {}
+
+        fs::FS &fs() const { return _fs; }
+
+        File open(const char *path, const char *mode = FILE_WRITE, bool create = false);
+        File open(const String &path, const char *mode = FILE_WRITE, bool create = false);
+        bool remove(const char *path);
+        bool remove(const String &path);
+        bool rename(const char *pathFrom, const char *pathTo);
+        bool rename(const String &pathFrom, const String &pathTo);
+        bool mkdir(const char *path);
+        bool mkdir(const String &path);
+        bool rmdir(const char *path);
+        bool rmdir(const String &path);
+
+    private:
+        Server &_server;
+        fs::FS &_fs;
+    };
+
 } // namespace EspHttpServer
@@ -0,0 +1,249 @@
+// en: Percent-decoding kernel shared by path, query, form and cookie parsing. Header-only and free of Arduino /
+//     ESP-IDF dependencies so tests/host/url_decode_test.cpp can exercise it on the host.
+// ja: パス・クエリ・フォーム・Cookie 解析で共有するパーセントデコード処理。Arduino / ESP-IDF に依存しない
+//     ヘッダのみの実装で、tests/host/url_decode_test.cpp からホスト上で検証できる。
+#ifndef ESPHTTPSERVER_URLDECODE_H
+#define ESPHTTPSERVER_URLDECODE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace EspHttpServer
+{
+    namespace detail
+    {
+        inline int hexValue(char c)
+        {
+            if (c >= '0' && c <= '9')
+                return c - '0';
+            if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+            return -1;
+        }
+
+        constexpr uint32_t kByteOnes = 0x01010101u;
+        constexpr uint32_t kByteHighs = 0x80808080u;
+
+        inline bool wordHasByte(uint32_t word, uint8_t value)
+        {
+            const uint32_t x = word ^ (kByteOnes * value);
+            return ((x - kByteOnes) & ~x & kByteHighs) != 0;
+        }
+
+        // en: Exact for limit <= 0x80: a borrow may flag the wrong byte, but only when some byte really is below limit.
+        // ja: limit <= 0x80 で正確。借りにより別のバイトが立つことはあるが、limit 未満のバイトがある場合に限る。
+        inline bool wordHasLess(uint32_t word, uint8_t limit)
+        {
+            return ((word - kByteOnes * limit) & ~word & kByteHighs) != 0;
+        }
+
+        inline bool isUrlSpecial(unsigned char c, bool plusIsSpecial)
+        {
+            return c == '%' || (plusIsSpecial && c == '+') || c < 0x20 || c == 0x7f;
+        }
+
+        // en: Offset of the first '%', '+' (when it means space) or control byte, or length if there is none.
+        //     Four bytes are tested per step with SWAR bit tricks; a hit is then pinned down byte by byte.
+        // ja: 最初の '%'・'+'（空白扱い時）・制御文字の位置。無ければ length。SWAR で 4 バイトずつ判定し、
+        //     ヒットした語だけ 1 バイトずつ確認する。
+        inline size_t findUrlSpecial(const char *data, size_t length, bool plusIsSpecial)
+        {
+            size_t i = 0;
+            for (; i + sizeof(uint32_t) <= length; i += sizeof(uint32_t))
+            {
+                uint32_t word;
+                memcpy(&word, data + i, sizeof(word));
+                if (wordHasByte(word, '%') || (plusIsSpecial && wordHasByte(word, '+')) || wordHasLess(word, 0x20) || wordHasByte(word, 0x7f))
+                {
+                    break;
+                }
+            }
+            for (; i < length; ++i)
+            {
+                if (isUrlSpecial(static_cast<unsigned char>(data[i]), plusIsSpecial))
+                {
+                    return i;
+                }
+            }
+            return length;
+        }
+
+        // en: Clean runs are bulk-copied, dst may equal src (decoding in place never overtakes the reader).
+        //     Truncated or non-hex escapes and control characters (raw or decoded) fail the whole span;
+        //     '+' becomes a space only when asked.
+        // ja: 特殊文字の無い区間は一括コピーし、dst と src は同一でもよい（インプレースでも読み取り位置を追い越さない）。
+        //     途中で切れた／16 進でないエスケープと制御文字（生・デコード後とも）は失敗とする。'+' は指定時のみ空白に変換する。
+        inline bool urlDecodeSpan(const char *src, size_t length, char *dst, size_t &outLength, bool plusAsSpace)
+        {
+            size_t in = 0;
+            size_t out = 0;
+            while (in < length)
+            {
+                const size_t run = findUrlSpecial(src + in, length - in, plusAsSpace);
+                if (dst + out != src + in)
+                {
+                    memmove(dst + out, src + in, run);
+                }
+                in += run;
+                out += run;
+                if (in >= length)
+                {
+                    break;
+                }
+                const unsigned char c = static_cast<unsigned char>(src[in]);
+                if (c == '+')
+                {
+                    dst[out++] = ' ';
+                    ++in;
+                    continue;
+                }
+                if (c != '%' || in + 2 >= length)
+                {
+                    return false;
+                }
+                const int hi = hexValue(src[in + 1]);
+                const int lo = hexValue(src[in + 2]);
+                if (hi < 0 || lo < 0)
+                {
+                    return false;
+                }
+                const unsigned char decoded = static_cast<unsigned char>((hi << 4) | lo);
+                if (decoded < 0x20 || decoded == 0x7f)
+                {
+                    return false;
+                }
+                dst[out++] = static_cast<char>(decoded);
+                in += 3;
+            }
+            outLength = out;
+            return true;
+        }
+
+        inline bool needsUrlDecoding(const char *data, size_t length)
+        {
+            return findUrlSpecial(data, length, true) < length;
+        }
+
+        // en: Decodes data[begin, end) into the same offsets of scratch, or returns a view of the raw bytes when
+        //     scratch is null (the caller only skips scratch when the whole input has no escapes or control bytes).
+        //     View is any aggregate with data/length members (ParamView on the device).
+        // ja: data[begin, end) を scratch の同じ位置へデコードする。scratch が null なら生のバイトを指すビューを返す
+        //     （入力全体にエスケープも制御文字も無い場合のみ null が渡される）。View は data/length を持つ任意の型
+        //     （実機では ParamView）。
+        template <typename View>
+        bool decodeParamView(const char *data, size_t begin, size_t end, char *scratch, View &out)
+        {
+            if (!scratch)
+            {
+                out.data = data + begin;
+                out.length = end - begin;
+                return true;
+            }
+            size_t length = 0;
+            if (!urlDecodeSpan(data + begin, end - begin, scratch + begin, length, true))
+            {
+                return false;
+            }
+            out.data = scratch + begin;
+            out.length = length;
+            return true;
+        }
+
+        // en: Splits application/x-www-form-urlencoded data into decoded key/value views without allocating.
+        //     Pairs with an empty key or a bad escape are skipped; fn returns false to stop.
+        // ja: application/x-www-form-urlencoded をデコード済みのキー／値ビューに分割する（確保なし）。
+        //     キーが空、またはエスケープが不正なペアは飛ばす。fn が false を返すと中断。
+        template <typename View, typename Fn>
+        void walkUrlEncodedViews(const char *data, size_t length, char *scratch, Fn &&fn)
+        {
+            size_t start = 0;
+            while (start <= length)
+            {
+                const char *amp = static_cast<const char *>(memchr(data + start, '&', length - start));
+                const size_t end = amp ? static_cast<size_t>(amp - data) : length;
+                const char *eq = static_cast<const char *>(memchr(data + start, '=', end - start));
+                const size_t keyEnd = eq ? static_cast<size_t>(eq - data) : end;
+                const size_t valueBegin = eq ? keyEnd + 1 : end;
+                View key;
+                View value;
+                if (keyEnd > start && decodeParamView(data, start, keyEnd, scratch, key) && decodeParamView(data, valueBegin, end, scratch, value))
+                {
+                    if (!fn(key, value))
+                    {
+                        return;
+                    }
+                }
+                start = end + 1;
+            }
+        }
+
+        inline bool isCookieSpace(char c)
+        {
+            return c == ' ' || (c >= '\t' && c <= '\r');
+        }
+
+        inline bool hasControlByte(const char *data, size_t length)
+        {
+            for (size_t i = 0; i < length; ++i)
+            {
+                const unsigned char c = static_cast<unsigned char>(data[i]);
+                if (c < 0x20 || c == 0x7f)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // en: Splits a Cookie header ("a=1; b=2") into trimmed name/value views without allocating. Tokens
+        //     without '=', with an empty name, or with control bytes are skipped; values are not decoded.
+        // ja: Cookie ヘッダー（"a=1; b=2"）を前後の空白を除いた名前／値ビューに分割する（確保なし）。'=' が無い、
+        //     名前が空、制御文字を含むトークンは飛ばす。値はデコードしない。
+        template <typename View, typename Fn>
+        void walkCookieViews(const char *data, size_t length, Fn &&fn)
+        {
+            size_t start = 0;
+            while (start <= length)
+            {
+                const char *semi = static_cast<const char *>(memchr(data + start, ';', length - start));
+                const size_t end = semi ? static_cast<size_t>(semi - data) : length;
+                const char *eq = static_cast<const char *>(memchr(data + start, '=', end - start));
+                if (eq)
+                {
+                    size_t nameBegin = start;
+                    size_t nameEnd = static_cast<size_t>(eq - data);
+                    size_t valueBegin = nameEnd + 1;
+                    size_t valueEnd = end;
+                    while (nameBegin < nameEnd && isCookieSpace(data[nameBegin]))
+                        ++nameBegin;
+                    while (nameEnd > nameBegin && isCookieSpace(data[nameEnd - 1]))
+                        --nameEnd;
+                    while (valueBegin < valueEnd && isCookieSpace(data[valueBegin]))
+                        ++valueBegin;
+                    while (valueEnd > valueBegin && isCookieSpace(data[valueEnd - 1]))
+                        --valueEnd;
+                    if (nameEnd > nameBegin && !hasControlByte(data + nameBegin, nameEnd - nameBegin) &&
+                        !hasControlByte(data + valueBegin, valueEnd - valueBegin))
+                    {
+                        View name;
+                        View value;
+                        name.data = data + nameBegin;
+                        name.length = nameEnd - nameBegin;
+                        value.data = data + valueBegin;
+                        value.length = valueEnd - valueBegin;
+                        if (!fn(name, value))
+                        {
+                            return;
+                        }
+                    }
+                }
+                start = end + 1;
+            }
+        }
+    } // namespace detail
+} // namespace EspHttpServer
+
+#endif // ESPHTTPSERVER_URLDECODE_H
@@ -0,0 +1,129 @@
+// en: Host test for the requireAuth() verification cache: grants and denials live in separate pools, so a run of
+//     bad credentials never evicts a cached grant, and denyCacheEntries = 0 stops caching denials only.
+//       g++ -std=gnu++17 -O1 -Wall -Itests/host/stub -Isrc src/EspHttpServer.cpp tests/host/stub/host_stubs.cpp
+//           tests/host/auth_cache_test.cpp -o auth_cache_test && ./auth_cache_test
+// ja: requireAuth() の検証キャッシュのホストテスト。許可と拒否は別プールに入るため、不正な資格情報が続いても
+//     キャッシュ済みの許可は追い出されない。denyCacheEntries = 0 は拒否のキャッシュだけを止める。
+//       g++ -std=gnu++17 -O1 -Wall -Itests/host/stub -Isrc src/EspHttpServer.cpp tests/host/stub/host_stubs.cpp
+//           tests/host/auth_cache_test.cpp -o auth_cache_test && ./auth_cache_test
+#include "EspHttpServer.h"
+#include "host_httpd.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace EspHttpServer;
+
+namespace
+{
+    int failures = 0;
+    int verifyCalls = 0;
+    int nextTag = 0;
+
+    void check(bool condition, const char *what)
+    {
+        if (!condition)
+        {
+            ++failures;
+            std::printf("FAIL: %s\n", what);
+        }
+    }
+
+    AuthConfig bearerConfig(size_t grants, size_t denials)
+    {
+        AuthConfig cfg;
+        cfg.allowBasic = false;
+        cfg.allowBearer = true;
+        cfg.cacheEntries = grants;
+        cfg.denyCacheEntries = denials;
+        cfg.verify = [](const AuthCredentials &cred)
+        {
+            ++verifyCalls;
+            return cred.secretLen >= 4 && strncmp(cred.secret, "good", 4) == 0;
+        };
+        return cfg;
+    }
+
+    // en: Sends one request with the given bearer token and returns the status line.
+    // ja: 指定したベアラートークンでリクエストを 1 つ送り、ステータス行を返す。
+    std::string get(const char *token)
+    {
+        const int tag = nextTag++;
+        httpd_req_t *req = hosthttpd::makeRequest(HTTP_GET, "/secure/x", tag);
+        const std::string header = std::string("Bearer ") + token;
+        hosthttpd::setHeader(req, "Authorization", header.c_str());
+        hosthttpd::dispatch(req);
+        return hosthttpd::response(tag).status;
+    }
+
+    void addRoute(Server &server)
+    {
+        server.on("/secure/x", HTTP_GET, [](Request &, Response &res)
+                  { res.send(200, "text/plain", "ok"); });
+    }
+
+    void testDenialsDoNotEvictGrants()
+    {
+        hosthttpd::reset();
+        verifyCalls = 0;
+        Server server;
+        server.requireAuth("/secure", bearerConfig(2, 2));
+        addRoute(server);
+        server.begin();
+
+        check(get("good-a").rfind("200", 0) == 0, "good-a granted");
+        check(get("good-b").rfind("200", 0) == 0, "good-b granted");
+        check(verifyCalls == 2, "each grant verified once");
+
+        char token[16];
+        for (int i = 0; i < 10; ++i)
+        {
+            snprintf(token, sizeof(token), "bad-%d", i);
+            check(get(token).rfind("401", 0) == 0, "bad token denied");
+        }
+        check(verifyCalls == 12, "each new bad token is verified");
+
+        const int before = verifyCalls;
+        check(get("good-a").rfind("200", 0) == 0, "good-a still granted");
+        check(get("good-b").rfind("200", 0) == 0, "good-b still granted");
+        check(verifyCalls == before, "cached grants survive a run of denials");
+
+        check(get("bad-9").rfind("401", 0) == 0, "recent denial answered");
+        check(verifyCalls == before, "a recent denial is cached");
+        check(get("bad-0").rfind("401", 0) == 0, "old denial answered");
+        check(verifyCalls == before + 1, "old denials are recycled in their own pool");
+        server.end();
+    }
+
+    void testDenialCacheDisabled()
+    {
+        hosthttpd::reset();
+        verifyCalls = 0;
+        Server server;
+        server.requireAuth("/secure", bearerConfig(2, 0));
+        addRoute(server);
+        server.begin();
+
+        get("good-a");
+        get("bad-0");
+        get("bad-0");
+        get("good-a");
+        check(verifyCalls == 3, "denyCacheEntries = 0 caches grants only");
+        server.end();
+    }
+} // namespace
+
+int main()
+{
+    testDenialsDoNotEvictGrants();
+    testDenialCacheDisabled();
+    hosthttpd::reset();
+    if (failures)
+    {
+        std::printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("auth cache: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,151 @@
+// en: Host test for memoized error pages (Response::memoizeErrorPages): a replayed page carries the headers its
+//     ErrorRenderer set, but not headers the route set before sendError(), and renderers that set cookies are
+//     never memoized.
+//       g++ -std=gnu++17 -O1 -Wall -Itests/host/stub -Isrc src/EspHttpServer.cpp tests/host/stub/host_stubs.cpp
+//           tests/host/error_page_test.cpp -o error_page_test && ./error_page_test
+// ja: 保持済みエラーページ（Response::memoizeErrorPages）のホストテスト。再送するページは ErrorRenderer が
+//     設定したヘッダを含み、sendError() 前にルートが設定したヘッダは含まない。Cookie を設定するレンダラーの
+//     出力は保持しない。
+//       g++ -std=gnu++17 -O1 -Wall -Itests/host/stub -Isrc src/EspHttpServer.cpp tests/host/stub/host_stubs.cpp
+//           tests/host/error_page_test.cpp -o error_page_test && ./error_page_test
+#include "EspHttpServer.h"
+#include "host_httpd.h"
+
+#include <cstdio>
+#include <string>
+
+using namespace EspHttpServer;
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const char *what)
+    {
+        if (!condition)
+        {
+            ++failures;
+            std::printf("FAIL: %s\n", what);
+        }
+    }
+
+    bool hasHeader(int tag, const char *name, const char *value)
+    {
+        const std::string *found = hosthttpd::response(tag).header(name);
+        return found && *found == value;
+    }
+
+    void testRendererHeadersReplayed()
+    {
+        hosthttpd::reset();
+        Response::clearErrorPages();
+        int renders = 0;
+        Response::setErrorRenderer([&renders](int status, Request &, Response &res)
+                                   {
+                                       ++renders;
+                                       res.setHeader("Retry-After", "120");
+                                       res.setHeader("Cache-Control", "no-store");
+                                       res.sendText(status, "text/plain", "busy, try again later"); });
+        Response::memoizeErrorPages({503});
+
+        Server server;
+        server.on("/busy", HTTP_GET, [](Request &, Response &res)
+                  {
+                      res.setHeader("X-Route", "first");
+                      res.sendError(503); });
+        server.begin();
+
+        hosthttpd::dispatch(hosthttpd::makeRequest(HTTP_GET, "/busy", 0));
+        hosthttpd::dispatch(hosthttpd::makeRequest(HTTP_GET, "/busy", 1));
+        hosthttpd::dispatch(hosthttpd::makeRequest(HTTP_GET, "/busy", 2));
+        check(renders == 1, "the renderer runs once for a memoized status");
+        for (int tag = 0; tag < 3; ++tag)
+        {
+            check(hosthttpd::response(tag).status.rfind("503", 0) == 0, "status 503");
+            check(hosthttpd::response(tag).body == "busy, try again later", "memoized body");
+            check(hasHeader(tag, "Retry-After", "120"), "Retry-After from the renderer");
+            check(hasHeader(tag, "Cache-Control", "no-store"), "Cache-Control from the renderer");
+            check(hasHeader(tag, "X-Route", "first"), "the route's own header is still sent");
+            size_t retryAfter = 0;
+            for (const auto &field : hosthttpd::response(tag).headers)
+            {
+                retryAfter += field.first == "Retry-After" ? 1 : 0;
+            }
+            check(retryAfter == 1, "Retry-After sent once");
+        }
+        server.end();
+        Response::clearErrorPages();
+        Response::clearErrorRenderer();
+    }
+
+    void testRouteHeadersNotMemoized()
+    {
+        hosthttpd::reset();
+        Response::clearErrorPages();
+        Response::setErrorRenderer([](int status, Request &, Response &res)
+                                   { res.sendText(status, "text/plain", "nope"); });
+        Response::memoizeErrorPages({403});
+
+        Server server;
+        server.on("/a", HTTP_GET, [](Request &, Response &res)
+                  {
+                      res.setHeader("X-Only-A", "1");
+                      res.sendError(403); });
+        server.on("/b", HTTP_GET, [](Request &, Response &res)
+                  { res.sendError(403); });
+        server.begin();
+
+        hosthttpd::dispatch(hosthttpd::makeRequest(HTTP_GET, "/a", 0));
+        hosthttpd::dispatch(hosthttpd::makeRequest(HTTP_GET, "/b", 1));
+        check(hasHeader(0, "X-Only-A", "1"), "route header on its own response");
+        check(!hosthttpd::response(1).header("X-Only-A"), "route header is not part of the memoized page");
+        check(hosthttpd::response(1).body == "nope", "memoized body replayed");
+        server.end();
+        Response::clearErrorPages();
+        Response::clearErrorRenderer();
+    }
+
+    void testCookieRendererNotMemoized()
+    {
+        hosthttpd::reset();
+        Response::clearErrorPages();
+        int renders = 0;
+        Response::setErrorRenderer([&renders](int status, Request &, Response &res)
+                                   {
+                                       ++renders;
+                                       Cookie cookie;
+                                       cookie.name = "seen";
+                                       cookie.value = String(renders);
+                                       res.setCookie(cookie);
+                                       res.sendText(status, "text/plain", "gone"); });
+        Response::memoizeErrorPages({410});
+
+        Server server;
+        server.on("/old", HTTP_GET, [](Request &, Response &res)
+                  { res.sendError(410); });
+        server.begin();
+
+        hosthttpd::dispatch(hosthttpd::makeRequest(HTTP_GET, "/old", 0));
+        hosthttpd::dispatch(hosthttpd::makeRequest(HTTP_GET, "/old", 1));
+        check(renders == 2, "a renderer that sets a cookie is not memoized");
+        check(hosthttpd::response(1).header("Set-Cookie") != nullptr, "each response gets its own cookie");
+        server.end();
+        Response::clearErrorPages();
+        Response::clearErrorRenderer();
+    }
+} // namespace
+
+int main()
+{
+    testRendererHeadersReplayed();
+    testRouteHeadersNotMemoized();
+    testCookieRendererNotMemoized();
+    hosthttpd::reset();
+    if (failures)
+    {
+        std::printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("error pages: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,151 @@
+// en: Host test for fingerprinted asset aliases (StaticOptions::fingerprintAssets) on the memory and FS backends: an
+//     alias is rewritten only when its hash matches and no real file has that name, and the gzip variant gets its own
+//     ETag.
+//       g++ -std=gnu++17 -O1 -Wall -Itests/host/stub -Isrc src/EspHttpServer.cpp tests/host/stub/host_stubs.cpp
+//           tests/host/fingerprint_test.cpp -o fingerprint_test && ./fingerprint_test
+// ja: メモリ／FS バックエンドでのフィンガープリント付きエイリアス（StaticOptions::fingerprintAssets）のホストテスト。
+//     ハッシュが一致し、同名の実ファイルが無い場合にのみ書き換え、gzip 版には別の ETag を付ける。
+//       g++ -std=gnu++17 -O1 -Wall -Itests/host/stub -Isrc src/EspHttpServer.cpp tests/host/stub/host_stubs.cpp
+//           tests/host/fingerprint_test.cpp -o fingerprint_test && ./fingerprint_test
+#include "EspHttpServer.h"
+#include "host_fs.h"
+#include "host_httpd.h"
+
+#include <cstdio>
+#include <string>
+
+using namespace EspHttpServer;
+
+namespace
+{
+    int failures = 0;
+    int nextTag = 0;
+
+    const std::string kApp = "console.log('app');";
+    const std::string kAppGz = "gzip-bytes-of-app";
+    const std::string kStyle = "body{margin:0}";
+    const std::string kLookalike = "a different file that only looks fingerprinted";
+
+    void check(bool condition, const char *what)
+    {
+        if (!condition)
+        {
+            ++failures;
+            std::printf("FAIL: %s\n", what);
+        }
+    }
+
+    std::string hashOf(const std::string &data)
+    {
+        uint32_t hash = 2166136261u;
+        for (unsigned char c : data)
+        {
+            hash = (hash ^ c) * 16777619u;
+        }
+        char buf[9];
+        snprintf(buf, sizeof(buf), "%08x", static_cast<unsigned>(hash));
+        return buf;
+    }
+
+    const hosthttpd::ResponseHead &get(const std::string &uri)
+    {
+        const int tag = nextTag++;
+        hosthttpd::dispatch(hosthttpd::makeRequest(HTTP_GET, uri.c_str(), tag));
+        return hosthttpd::response(tag);
+    }
+
+    bool headerIs(const hosthttpd::ResponseHead &head, const char *name, const std::string &value)
+    {
+        const std::string *found = head.header(name);
+        return found && *found == value;
+    }
+
+    void serve(const StaticInfo &info, Request &, Response &res)
+    {
+        if (info.exists)
+        {
+            res.sendStatic();
+        }
+        else
+        {
+            res.sendError(404);
+        }
+    }
+
+    // en: The same checks for both backends. Each holds /app.js with a .gz sibling (served gzipped), a plain-only
+    //     /style.css, and /lib.js next to a real /lib.<hash of lib.js>.js lookalike.
+    // ja: 両バックエンド共通の確認。どちらも .gz 付きの /app.js（gzip で返る）、平文のみの /style.css、
+    //     /lib.js とその指紋と同名の実ファイル /lib.<lib.js のハッシュ>.js を持つ。
+    void checkAliases()
+    {
+        const std::string appHash = hashOf(kApp);
+        const std::string styleHash = hashOf(kStyle);
+
+        const hosthttpd::ResponseHead &gz = get("/s/app." + appHash + ".js");
+        check(gz.status.rfind("200", 0) == 0 && gz.body == kAppGz, "a matching alias serves the logical file (gzipped)");
+        check(headerIs(gz, "Cache-Control", "public, max-age=31536000, immutable"), "a matching alias is immutable");
+        check(headerIs(gz, "ETag", "\"" + appHash + "-gz\""), "the gzip variant has its own ETag");
+
+        const hosthttpd::ResponseHead &plain = get("/s/style." + styleHash + ".css");
+        check(plain.status.rfind("200", 0) == 0 && plain.body == kStyle, "a plain alias serves the logical file");
+        check(headerIs(plain, "ETag", "\"" + styleHash + "\""), "the plain ETag is the bare hash");
+
+        const hosthttpd::ResponseHead &stale = get("/s/app.0badf00d.js");
+        check(stale.status.rfind("404", 0) == 0, "a hash that does not match is not rewritten");
+
+        const hosthttpd::ResponseHead &real = get("/s/lib." + appHash + ".js");
+        check(real.status.rfind("200", 0) == 0 && real.body == kLookalike, "a real file that looks fingerprinted is served as itself");
+        check(!headerIs(real, "Cache-Control", "public, max-age=31536000, immutable"), "the real file is not marked immutable");
+    }
+
+    void testMemoryBackend()
+    {
+        hosthttpd::reset();
+        static const std::string lookalikePath = "/lib." + hashOf(kApp) + ".js";
+        static const char *paths[] = {"/app.js", "/app.js.gz", "/style.css", "/lib.js", lookalikePath.c_str()};
+        static const uint8_t *data[] = {reinterpret_cast<const uint8_t *>(kApp.data()), reinterpret_cast<const uint8_t *>(kAppGz.data()),
+                                        reinterpret_cast<const uint8_t *>(kStyle.data()), reinterpret_cast<const uint8_t *>(kApp.data()),
+                                        reinterpret_cast<const uint8_t *>(kLookalike.data())};
+        static const size_t sizes[] = {kApp.size(), kAppGz.size(), kStyle.size(), kApp.size(), kLookalike.size()};
+        Server server;
+        StaticOptions options;
+        options.fingerprintAssets = true;
+        server.serveStatic("/s", paths, data, sizes, 5, serve, options);
+        server.begin();
+        checkAliases();
+        server.end();
+    }
+
+    void testFsBackend()
+    {
+        hosthttpd::reset();
+        hostfs::Volume volume;
+        volume.files->put("/www/app.js", kApp);
+        volume.files->put("/www/app.js.gz", kAppGz);
+        volume.files->put("/www/style.css", kStyle);
+        volume.files->put("/www/lib.js", kApp);
+        volume.files->put("/www/lib." + hashOf(kApp) + ".js", kLookalike);
+        Server server;
+        StaticOptions options;
+        options.fingerprintAssets = true;
+        options.backgroundScan = false;
+        server.serveStatic("/s", volume.fs, "/www", serve, options);
+        server.begin();
+        checkAliases();
+        server.end();
+    }
+} // namespace
+
+int main()
+{
+    testMemoryBackend();
+    testFsBackend();
+    hosthttpd::reset();
+    if (failures)
+    {
+        std::printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("fingerprints: all checks passed\n");
+    return 0;
+}
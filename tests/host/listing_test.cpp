@@ -0,0 +1,153 @@
+// en: Host test for Response::sendDirectoryListing() paging over tests/host/stub/host_fs.h: the cursor resumes
+//     after the last returned name, so entries removed before it neither skip nor repeat entries, and a removed
+//     anchor resumes at its old position.
+//       g++ -std=gnu++17 -O1 -Wall -Itests/host/stub -Isrc src/EspHttpServer.cpp tests/host/stub/host_stubs.cpp
+//           tests/host/listing_test.cpp -o listing_test && ./listing_test
+// ja: tests/host/stub/host_fs.h 上での Response::sendDirectoryListing() のページングのホストテスト。カーソルは
+//     最後に返した名前の直後から再開するため、その手前でエントリが消えても取りこぼしや重複が起きず、基準の
+//     エントリ自体が消えた場合は元の位置から再開する。
+//       g++ -std=gnu++17 -O1 -Wall -Itests/host/stub -Isrc src/EspHttpServer.cpp tests/host/stub/host_stubs.cpp
+//           tests/host/listing_test.cpp -o listing_test && ./listing_test
+#include "EspHttpServer.h"
+#include "host_fs.h"
+#include "host_httpd.h"
+
+#include <cstdio>
+#include <string>
+
+using namespace EspHttpServer;
+
+namespace
+{
+    int failures = 0;
+    int nextTag = 0;
+
+    void check(bool condition, const char *what)
+    {
+        if (!condition)
+        {
+            ++failures;
+            std::printf("FAIL: %s\n", what);
+        }
+    }
+
+    void checkEqual(const char *what, const std::string &expected, const std::string &actual)
+    {
+        if (actual != expected)
+        {
+            ++failures;
+            std::printf("FAIL: %s\n  expected %s\n  actual   %s\n", what, expected.c_str(), actual.c_str());
+        }
+    }
+
+    struct Page
+    {
+        std::string names; // entry names joined with ','
+        std::string next;  // empty when the listing ended
+        std::string body;
+    };
+
+    // en: Pulls the entry names and the "next" cursor out of a JSON page.
+    // ja: JSON のページからエントリ名と "next" のカーソルを取り出す。
+    Page parse(const std::string &body)
+    {
+        Page page;
+        page.body = body;
+        for (size_t at = body.find("{\"name\":\""); at != std::string::npos; at = body.find("{\"name\":\"", at + 1))
+        {
+            const size_t start = at + 9;
+            page.names += (page.names.empty() ? "" : ",") + body.substr(start, body.find('"', start) - start);
+        }
+        const size_t next = body.find("\"next\":\"");
+        if (next != std::string::npos)
+        {
+            page.next = body.substr(next + 8, body.find('"', next + 8) - next - 8);
+        }
+        return page;
+    }
+
+    Page fetch(const std::string &uri)
+    {
+        const int tag = nextTag++;
+        hosthttpd::dispatch(hosthttpd::makeRequest(HTTP_GET, uri.c_str(), tag));
+        return parse(hosthttpd::response(tag).body);
+    }
+
+    void addListing(Server &server, fs::FS &fs, DirectoryListingOptions::Format format)
+    {
+        server.on("/list", HTTP_GET, [&fs, format](Request &req, Response &res)
+                  {
+                      DirectoryListingOptions options;
+                      options.format = format;
+                      options.limit = 2;
+                      options.cursor = req.queryParam("cursor");
+                      res.sendDirectoryListing(fs, "/d", options); });
+    }
+
+    void fill(hostfs::Volume &volume)
+    {
+        for (const char *name : {"c", "a", "f", "b", "e", "d"})
+        {
+            volume.files->put(std::string("/d/") + name, name);
+        }
+    }
+
+    void testNameCursor()
+    {
+        hosthttpd::reset();
+        hostfs::Volume volume;
+        fill(volume);
+        Server server;
+        addListing(server, volume.fs, DirectoryListingOptions::Format::Json);
+        server.begin();
+
+        Page page = fetch("/list");
+        checkEqual("first page in directory order", "c,a", page.names);
+        checkEqual("cursor names the last entry", "2:a", page.next);
+
+        volume.files->remove("/d/c");
+        page = fetch("/list?cursor=" + page.next);
+        checkEqual("an entry removed before the cursor skips nothing", "f,b", page.names);
+        checkEqual("cursor after the shift", "3:b", page.next);
+
+        volume.files->remove("/d/b");
+        page = fetch("/list?cursor=" + page.next);
+        checkEqual("a removed anchor resumes at its old position", "e,d", page.names);
+        check(page.next.empty(), "last page has no cursor");
+
+        page = fetch("/list?cursor=2");
+        checkEqual("a bare offset still pages", "e,d", page.names);
+        server.end();
+    }
+
+    void testHtmlLink()
+    {
+        hosthttpd::reset();
+        hostfs::Volume volume;
+        fill(volume);
+        volume.files->put("/d/a b", "x");
+        Server server;
+        addListing(server, volume.fs, DirectoryListingOptions::Format::Html);
+        server.begin();
+
+        Page page = fetch("/list?cursor=6:d");
+        check(page.body.find(">a b</a>") != std::string::npos, "page after d lists \"a b\"");
+        page = fetch("/list");
+        check(page.body.find("href=\"?cursor=2%3Aa\"") != std::string::npos, "next link carries the encoded cursor");
+        server.end();
+    }
+} // namespace
+
+int main()
+{
+    testNameCursor();
+    testHtmlLink();
+    hosthttpd::reset();
+    if (failures)
+    {
+        std::printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("directory listing: all checks passed\n");
+    return 0;
+}
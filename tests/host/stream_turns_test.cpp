@@ -0,0 +1,331 @@
+// en: Host test of cooperative streaming turns (ServerOptions::cooperativeStreaming). Builds the whole library
+//     against tests/host/stub, whose httpd_queue_work() is a FIFO, and checks the order in which streams' chunks
+//     reach the socket: round-robin with chunksPerTurn, per-class weights, admission limits and shaping delays. Also
+//     checks that stream buffers start at the first chunk size and grow only with the chunk.
+//       g++ -std=gnu++17 -O1 -Wall -Itests/host/stub -Isrc src/EspHttpServer.cpp tests/host/stub/host_stubs.cpp
+//           tests/host/stream_turns_test.cpp -o stream_turns_test && ./stream_turns_test
+// ja: 協調ストリーミング（ServerOptions::cooperativeStreaming）のターン順序のホストテスト。httpd_queue_work() が
+//     FIFO である tests/host/stub に対してライブラリ全体をビルドし、各ストリームのチャンクがソケットに届く順序を
+//     確認する（chunksPerTurn による巡回、クラスごとの重み、同時数の上限、帯域整形による遅延）。ストリームバッファが
+//     最初のチャンクサイズで確保され、チャンクの拡大に合わせてのみ大きくなることも確認する。
+//       g++ -std=gnu++17 -O1 -Wall -Itests/host/stub -Isrc src/EspHttpServer.cpp tests/host/stub/host_stubs.cpp
+//           tests/host/stream_turns_test.cpp -o stream_turns_test && ./stream_turns_test
+#include "EspHttpServer.h"
+#include "host_httpd.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace EspHttpServer;
+
+namespace
+{
+    constexpr size_t kChunk = 64;
+
+    int failures = 0;
+
+    void check(bool condition, const char *what)
+    {
+        if (!condition)
+        {
+            ++failures;
+            std::printf("FAIL: %s\n", what);
+        }
+    }
+
+    std::string describe(const std::vector<int> &tags)
+    {
+        std::string out;
+        for (int tag : tags)
+        {
+            out += static_cast<char>('A' + tag);
+        }
+        return out;
+    }
+
+    void checkOrder(const char *what, const std::string &expected)
+    {
+        const std::string actual = describe(hosthttpd::chunkTags());
+        if (actual != expected)
+        {
+            ++failures;
+            std::printf("FAIL: %s\n  expected %s\n  actual   %s\n", what, expected.c_str(), actual.c_str());
+        }
+    }
+
+    size_t endedStreams()
+    {
+        size_t ended = 0;
+        for (const auto &write : hosthttpd::bodyWrites())
+        {
+            ended += write.last ? 1 : 0;
+        }
+        return ended;
+    }
+
+    ServerOptions streamingOptions(uint8_t chunksPerTurn)
+    {
+        ServerOptions options;
+        options.cooperativeStreaming = true;
+        options.cooperativeThreshold = 1024;
+        options.maxCooperativeStreams = 4;
+        options.chunksPerTurn = chunksPerTurn;
+        options.minChunkSize = kChunk;
+        options.maxChunkSize = kChunk;
+        return options;
+    }
+
+    // en: Every route streams ?n= chunks of kChunk bytes with an unknown size (sizeHint 0), or a known size when
+    //     ?known=1 is given.
+    // ja: 各ルートは ?n= 個の kChunk バイトのチャンクをサイズ不明（sizeHint 0）で送る。?known=1 ならサイズ既知。
+    void addStreamRoute(Server &server, const char *uri)
+    {
+        server.on(uri, HTTP_GET, [](Request &req, Response &res)
+                  {
+                      const size_t total = static_cast<size_t>(req.queryParam("n").toInt()) * kChunk;
+                      const size_t sizeHint = req.queryParam("known") == "1" ? total : 0;
+                      auto sent = std::make_shared<size_t>(0);
+                      res.sendStream(200, "application/octet-stream", [sent, total](uint8_t *buffer, size_t capacity)
+                                     {
+                                         const size_t len = std::min(capacity, total - *sent);
+                                         memset(buffer, 'x', len);
+                                         *sent += len;
+                                         return len; }, sizeHint);
+                  });
+    }
+
+    void start(int tag, const char *uri)
+    {
+        httpd_req_t *req = hosthttpd::makeRequest(HTTP_GET, uri, tag);
+        check(hosthttpd::dispatch(req) == ESP_OK, "handler returns ESP_OK");
+    }
+
+    // en: chunksPerTurn = 1: after the inline first chunks, each queued turn sends one chunk and re-queues behind
+    //     the others, so three equal streams interleave strictly.
+    // ja: chunksPerTurn = 1: その場で送る最初のチャンクの後、各ターンは 1 チャンク送って他の後ろに再キューするため、
+    //     同じ長さの 3 本は厳密に交互に進む。
+    void testRoundRobin()
+    {
+        hosthttpd::reset();
+        Server server;
+        addStreamRoute(server, "/s");
+        check(server.begin(HTTPD_DEFAULT_CONFIG(), streamingOptions(1)), "begin");
+
+        start(0, "/s?n=5");
+        start(1, "/s?n=5");
+        start(2, "/s?n=5");
+        checkOrder("first chunks are sent inline by each handler", "ABC");
+        check(hosthttpd::queuedWork() == 3, "one queued turn per stream");
+        check(hosthttpd::openAsyncRequests() == 3, "each stream holds an async request copy");
+
+        hosthttpd::runQueuedWork();
+        checkOrder("equal streams interleave one chunk per turn", "ABCABCABCABCABC");
+        check(endedStreams() == 3, "every stream ends its chunked body");
+        check(hosthttpd::openAsyncRequests() == 0, "async request copies are completed");
+        check(hosthttpd::closedSessions() == 0, "no stream was aborted");
+        check(server.trafficStats(TrafficClass::Normal).activeStreams == 0, "no active stream left");
+        server.end();
+    }
+
+    // en: A shorter stream leaves the rotation as soon as it ends; the others keep alternating.
+    // ja: 短いストリームは終わり次第巡回から外れ、残りは交互に進み続ける。
+    void testUnevenLengths()
+    {
+        hosthttpd::reset();
+        Server server;
+        addStreamRoute(server, "/s");
+        server.begin(HTTPD_DEFAULT_CONFIG(), streamingOptions(1));
+
+        start(0, "/s?n=2");
+        start(1, "/s?n=5");
+        start(2, "/s?n=3");
+        hosthttpd::runQueuedWork();
+        checkOrder("finished streams drop out of the rotation", "ABCABCBCBB");
+        check(hosthttpd::openAsyncRequests() == 0, "async request copies are completed");
+        server.end();
+    }
+
+    // en: chunksPerTurn is a weight: the server-wide value applies to every class without its own, and a class
+    //     override sends that many chunks per turn.
+    // ja: chunksPerTurn は重み。クラス個別の設定が無ければサーバー全体の値を使い、個別に設定したクラスは
+    //     1 ターンでその数だけ送る。
+    void testClassWeights()
+    {
+        hosthttpd::reset();
+        Server server;
+        addStreamRoute(server, "/fast");
+        addStreamRoute(server, "/s");
+        server.setTrafficClass("/fast", TrafficClass::Interactive);
+        TrafficClassConfig interactive;
+        interactive.chunksPerTurn = 3;
+        server.configureTrafficClass(TrafficClass::Interactive, interactive);
+        server.begin(HTTPD_DEFAULT_CONFIG(), streamingOptions(1));
+
+        start(0, "/fast?n=7");
+        start(1, "/s?n=7");
+        hosthttpd::runQueuedWork();
+        checkOrder("an Interactive turn sends three chunks per Normal chunk", "ABAAABAAABBBBB");
+        check(endedStreams() == 2, "both streams end");
+        check(server.trafficStats(TrafficClass::Interactive).chunksSent == 7, "Interactive chunks counted");
+        check(server.trafficStats(TrafficClass::Normal).chunksSent == 7, "Normal chunks counted");
+        server.end();
+
+        hosthttpd::reset();
+        Server wide;
+        addStreamRoute(wide, "/s");
+        wide.begin(HTTPD_DEFAULT_CONFIG(), streamingOptions(2));
+        start(0, "/s?n=5");
+        start(1, "/s?n=5");
+        hosthttpd::runQueuedWork();
+        checkOrder("ServerOptions::chunksPerTurn applies to every class", "ABAABBAABB");
+        wide.end();
+    }
+
+    // en: Traffic-class prefixes are normalized and matched on whole path segments.
+    // ja: トラフィッククラスのプレフィックスは正規化し、パスセグメント単位で一致させる。
+    void testClassPrefixSegments()
+    {
+        hosthttpd::reset();
+        Server server;
+        addStreamRoute(server, "/api/x");
+        addStreamRoute(server, "/apix");
+        server.setTrafficClass("api/", TrafficClass::Interactive);
+        server.begin(HTTPD_DEFAULT_CONFIG(), streamingOptions(1));
+
+        start(0, "/api/x?n=2");
+        start(1, "/apix?n=3");
+        hosthttpd::runQueuedWork();
+        check(server.trafficStats(TrafficClass::Interactive).chunksSent == 2, "\"api/\" covers /api/x");
+        check(server.trafficStats(TrafficClass::Normal).chunksSent == 3, "\"api/\" does not cover /apix");
+        server.end();
+    }
+
+    // en: Known bodies below cooperativeThreshold, and streams beyond maxCooperativeStreams, are sent inline
+    //     by the handler without touching the work queue.
+    // ja: cooperativeThreshold 未満の既知サイズのボディと、maxCooperativeStreams を超えたストリームは、
+    //     作業キューを使わずハンドラ内でそのまま送る。
+    void testInlineFallbacks()
+    {
+        hosthttpd::reset();
+        Server server;
+        addStreamRoute(server, "/s");
+        ServerOptions options = streamingOptions(1);
+        options.maxCooperativeStreams = 2;
+        server.begin(HTTPD_DEFAULT_CONFIG(), options);
+
+        start(0, "/s?n=3&known=1");
+        checkOrder("a small known body is sent inline", "AAA");
+        check(hosthttpd::queuedWork() == 0, "small body queues nothing");
+        check(endedStreams() == 1, "small body ends inline");
+
+        start(1, "/s?n=4");
+        start(2, "/s?n=4");
+        start(3, "/s?n=4");
+        checkOrder("a stream over maxCooperativeStreams is sent inline", "AAABCDDDD");
+        check(hosthttpd::queuedWork() == 2, "only admitted streams are queued");
+        hosthttpd::runQueuedWork();
+        checkOrder("admitted streams then interleave", "AAABCDDDDBCBCBC");
+        check(hosthttpd::openAsyncRequests() == 0, "async request copies are completed");
+        server.end();
+    }
+
+    // en: A shaped class waits on the shaping timer instead of holding a turn, so an unshaped stream started later
+    //     runs through while it waits, and the shaped stream still finishes no faster than its rate.
+    // ja: 帯域整形されたクラスはターンを占有せず整形タイマーを待つため、後から始めた整形なしのストリームが
+    //     その間に進む。整形されたストリームも規定レートより速くは終わらない。
+    void testShapedClassYields()
+    {
+        hosthttpd::reset();
+        Server server;
+        addStreamRoute(server, "/bulk");
+        addStreamRoute(server, "/s");
+        server.setTrafficClass("/bulk", TrafficClass::Bulk);
+        TrafficClassConfig bulk;
+        bulk.bytesPerSecond = kChunk * 100; // one chunk every 10 ms
+        bulk.burstBytes = kChunk;
+        server.configureTrafficClass(TrafficClass::Bulk, bulk);
+        server.begin(HTTPD_DEFAULT_CONFIG(), streamingOptions(1));
+
+        const int64_t startedUs = hosthttpd::nowUs();
+        start(0, "/bulk?n=5");
+        start(1, "/s?n=5");
+        hosthttpd::runQueuedWork();
+        const std::string order = describe(hosthttpd::chunkTags());
+        check(order.size() == 10, "all chunks sent");
+        check(order.rfind('B') < order.rfind('A'), "the unshaped stream finishes first");
+        check(hosthttpd::nowUs() - startedUs >= 30000, "the shaped stream is held to its rate");
+        check(server.trafficStats(TrafficClass::Bulk).throttledChunks > 0, "shaped chunks are counted");
+        check(hosthttpd::openAsyncRequests() == 0, "async request copies are completed");
+        server.end();
+    }
+
+    // en: Buffers are allocated at the first chunk size (1024) and replaced only when the adaptive chunk grows, so a
+    //     short stream never holds maxChunkSize. The host clock does not move during a send, so every full chunk
+    //     counts as fast and doubles the next one.
+    // ja: バッファは最初のチャンクサイズ（1024）で確保し、適応チャンクが大きくなった時だけ置き換える。短いストリームが
+    //     maxChunkSize 分を抱えることはない。ホストの時計は送信中に進まないため、満杯のチャンクは常に速いとみなされ
+    //     次のチャンクが 2 倍になる。
+    void testBufferGrowth()
+    {
+        for (const bool cooperative : {false, true})
+        {
+            hosthttpd::reset();
+            Server server;
+            auto requested = std::make_shared<std::vector<size_t>>();
+            server.on("/grow", HTTP_GET, [requested](Request &req, Response &res)
+                      {
+                          const size_t total = static_cast<size_t>(req.queryParam("bytes").toInt());
+                          auto sent = std::make_shared<size_t>(0);
+                          res.sendStream(200, "application/octet-stream", [sent, total, requested](uint8_t *buffer, size_t capacity)
+                                         {
+                                             requested->push_back(capacity);
+                                             const size_t len = std::min(capacity, total - *sent);
+                                             memset(buffer, 'x', len);
+                                             *sent += len;
+                                             return len; });
+                      });
+            ServerOptions options;
+            options.cooperativeStreaming = cooperative;
+            options.minChunkSize = 512;
+            options.maxChunkSize = 4096;
+            server.begin(HTTPD_DEFAULT_CONFIG(), options);
+
+            start(0, "/grow?bytes=300");
+            hosthttpd::runQueuedWork();
+            check(server.allocStats(AllocClass::IoBuffer).peakBytes == 1024, "a short stream holds only the first chunk size");
+
+            requested->clear();
+            start(1, "/grow?bytes=20000");
+            hosthttpd::runQueuedWork();
+            const std::vector<size_t> growth = {1024, 2048, 4096, 4096};
+            check(requested->size() > growth.size() && std::equal(growth.begin(), growth.end(), requested->begin()),
+                  "the buffer follows the chunk size up to maxChunkSize");
+            check(server.allocStats(AllocClass::IoBuffer).peakBytes <= 4096 + 2048, "growth holds at most the old and new buffer");
+            check(server.allocStats(AllocClass::IoBuffer).bytesInUse == 0, "stream buffers are released");
+            server.end();
+        }
+    }
+} // namespace
+
+int main()
+{
+    testRoundRobin();
+    testUnevenLengths();
+    testClassWeights();
+    testClassPrefixSegments();
+    testInlineFallbacks();
+    testShapedClassYields();
+    testBufferGrowth();
+    hosthttpd::reset();
+    if (failures)
+    {
+        std::printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("stream turns: all checks passed\n");
+    return 0;
+}
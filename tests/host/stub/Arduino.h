@@ -0,0 +1,237 @@
+// en: Minimal Arduino core for host tests: a std::string-backed String plus Print/Stream and the clock functions.
+//     Only what src/EspHttpServer.cpp uses; clock and other symbols are defined in host_stubs.cpp.
+// ja: ホストテスト用の最小限の Arduino コア。std::string ベースの String と Print/Stream、時刻関数のみ。
+//     src/EspHttpServer.cpp が使う範囲に限る。時刻などの実体は host_stubs.cpp にある。
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <strings.h>
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define PROGMEM
+
+class String
+{
+public:
+    String() {}
+    String(const char *c) : s(c ? c : "") {}
+    String(const __FlashStringHelper *c) : s(c ? reinterpret_cast<const char *>(c) : "") {}
+    String(const char *c, unsigned len) : s(c, len) {}
+    explicit String(char c) : s(1, c) {}
+    explicit String(int v) : s(std::to_string(v)) {}
+    explicit String(unsigned v) : s(std::to_string(v)) {}
+    explicit String(long v) : s(std::to_string(v)) {}
+    explicit String(unsigned long v) : s(std::to_string(v)) {}
+    explicit String(long long v) : s(std::to_string(v)) {}
+    explicit String(unsigned long long v) : s(std::to_string(v)) {}
+    explicit String(float v, unsigned decimals = 2) : String(static_cast<double>(v), decimals) {}
+    explicit String(double v, unsigned decimals = 2)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.*f", static_cast<int>(decimals), v);
+        s = buffer;
+    }
+
+    unsigned length() const { return static_cast<unsigned>(s.size()); }
+    bool isEmpty() const { return s.empty(); }
+    const char *c_str() const { return s.c_str(); }
+    char *begin() { return &s[0]; }
+    char charAt(unsigned i) const { return i < s.size() ? s[i] : 0; }
+    char operator[](unsigned i) const { return i < s.size() ? s[i] : 0; }
+    char &operator[](unsigned i) { return s[i]; }
+    bool reserve(unsigned n)
+    {
+        s.reserve(n);
+        return true;
+    }
+    explicit operator bool() const { return true; }
+
+    String &operator+=(const String &o) { return append(o.s); }
+    String &operator+=(const char *o) { return append(o ? o : ""); }
+    String &operator+=(const __FlashStringHelper *o) { return append(reinterpret_cast<const char *>(o)); }
+    String &operator+=(char o) { return append(std::string(1, o)); }
+    String &operator+=(int o) { return append(std::to_string(o)); }
+    String &operator+=(unsigned o) { return append(std::to_string(o)); }
+    String &operator+=(long o) { return append(std::to_string(o)); }
+    String &operator+=(unsigned long o) { return append(std::to_string(o)); }
+    String &operator+=(long long o) { return append(std::to_string(o)); }
+    String &operator+=(unsigned long long o) { return append(std::to_string(o)); }
+    bool concat(const char *c, unsigned n)
+    {
+        s.append(c, n);
+        return true;
+    }
+    bool concat(const char *c)
+    {
+        s.append(c ? c : "");
+        return true;
+    }
+    bool concat(const String &o)
+    {
+        s += o.s;
+        return true;
+    }
+    bool concat(char c)
+    {
+        s += c;
+        return true;
+    }
+
+    bool operator==(const String &o) const { return s == o.s; }
+    bool operator==(const char *o) const { return s == (o ? o : ""); }
+    bool operator!=(const String &o) const { return s != o.s; }
+    bool operator!=(const char *o) const { return !(*this == o); }
+    bool operator<(const String &o) const { return s < o.s; }
+    bool equals(const String &o) const { return s == o.s; }
+    bool equalsIgnoreCase(const String &o) const { return strcasecmp(s.c_str(), o.s.c_str()) == 0; }
+    int compareTo(const String &o) const { return s.compare(o.s); }
+    bool startsWith(const String &p) const { return s.compare(0, p.s.size(), p.s) == 0; }
+    bool startsWith(const String &p, unsigned off) const { return off <= s.size() && s.compare(off, p.s.size(), p.s) == 0; }
+    bool endsWith(const String &p) const { return s.size() >= p.s.size() && s.compare(s.size() - p.s.size(), p.s.size(), p.s) == 0; }
+    int indexOf(char c, unsigned from = 0) const { return found(s.find(c, from)); }
+    int indexOf(const String &c, unsigned from = 0) const { return found(s.find(c.s, from)); }
+    int lastIndexOf(char c) const { return found(s.rfind(c)); }
+    int lastIndexOf(char c, unsigned from) const { return found(s.rfind(c, from)); }
+    int lastIndexOf(const String &c) const { return found(s.rfind(c.s)); }
+    String substring(unsigned a) const { return a < s.size() ? String(s.c_str() + a) : String(); }
+    String substring(unsigned a, unsigned b) const
+    {
+        if (a > b)
+            std::swap(a, b);
+        return a < s.size() ? String(s.substr(a, b - a).c_str()) : String();
+    }
+    void remove(unsigned i)
+    {
+        if (i < s.size())
+            s.erase(i);
+    }
+    void remove(unsigned i, unsigned n)
+    {
+        if (i < s.size())
+            s.erase(i, n);
+    }
+    void clear() { s.clear(); }
+    void trim()
+    {
+        const size_t first = s.find_first_not_of(" \t\r\n\f\v");
+        if (first == std::string::npos)
+        {
+            s.clear();
+            return;
+        }
+        s = s.substr(first, s.find_last_not_of(" \t\r\n\f\v") - first + 1);
+    }
+    void toLowerCase()
+    {
+        for (char &c : s)
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+    void toUpperCase()
+    {
+        for (char &c : s)
+            c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+    }
+    void replace(const String &from, const String &to)
+    {
+        if (from.s.empty())
+            return;
+        for (size_t pos = s.find(from.s); pos != std::string::npos; pos = s.find(from.s, pos + to.s.size()))
+            s.replace(pos, from.s.size(), to.s);
+    }
+    long toInt() const { return atol(s.c_str()); }
+    float toFloat() const { return static_cast<float>(atof(s.c_str())); }
+
+private:
+    String &append(const std::string &o)
+    {
+        s += o;
+        return *this;
+    }
+    static int found(size_t pos) { return pos == std::string::npos ? -1 : static_cast<int>(pos); }
+
+    std::string s;
+};
+
+inline String operator+(const String &a, const String &b)
+{
+    String r = a;
+    r += b;
+    return r;
+}
+inline String operator+(const char *a, const String &b)
+{
+    String r(a);
+    r += b;
+    return r;
+}
+inline String operator+(const String &a, const char *b)
+{
+    String r = a;
+    r += b;
+    return r;
+}
+inline String operator+(const String &a, char b)
+{
+    String r = a;
+    r += b;
+    return r;
+}
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t *b, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            write(b[i]);
+        return n;
+    }
+    size_t write(const char *s) { return write(reinterpret_cast<const uint8_t *>(s), strlen(s)); }
+    size_t print(const String &s) { return write(reinterpret_cast<const uint8_t *>(s.c_str()), s.length()); }
+    size_t print(const char *s) { return write(s); }
+    size_t print(int v) { return print(String(v)); }
+    size_t print(unsigned v) { return print(String(v)); }
+    size_t print(long v) { return print(String(v)); }
+    size_t print(unsigned long v) { return print(String(v)); }
+    size_t print(double v, int d = 2) { return print(String(v, static_cast<unsigned>(d))); }
+    size_t println(const String &s) { return print(s) + write("\r\n"); }
+    size_t printf(const char *fmt, ...)
+    {
+        char buffer[256];
+        va_list args;
+        va_start(args, fmt);
+        const int len = vsnprintf(buffer, sizeof(buffer), fmt, args);
+        va_end(args);
+        return len > 0 ? write(reinterpret_cast<const uint8_t *>(buffer), std::min<size_t>(len, sizeof(buffer) - 1)) : 0;
+    }
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+    virtual size_t readBytes(char *buffer, size_t len)
+    {
+        size_t n = 0;
+        for (int c; n < len && (c = read()) >= 0; ++n)
+            buffer[n] = static_cast<char>(c);
+        return n;
+    }
+};
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
@@ -0,0 +1,148 @@
+// en: fs::File / fs::FS as in arduino-esp32 3.x. File forwards to its FileImpl and FS to its FSImpl; an FS built
+//     without one has no backing store, so every path is missing (tests that need files pass their own FSImpl).
+// ja: arduino-esp32 3.x 相当の fs::File / fs::FS。File は FileImpl に、FS は FSImpl に委譲する。FSImpl 無しの FS は
+//     実体が無く全パスが存在しない（ファイルが必要なテストは独自の FSImpl を渡す）。
+#pragma once
+#include <Arduino.h>
+#include <ctime>
+#include <memory>
+
+typedef bool boolean;
+
+namespace fs
+{
+    enum SeekMode
+    {
+        SeekSet = 0,
+        SeekCur = 1,
+        SeekEnd = 2
+    };
+
+    class FS;
+    class FileImpl;
+    typedef std::shared_ptr<FileImpl> FileImplPtr;
+
+    class FileImpl
+    {
+    public:
+        virtual ~FileImpl() {}
+        virtual size_t write(const uint8_t *buf, size_t size) = 0;
+        virtual size_t read(uint8_t *buf, size_t size) = 0;
+        virtual void flush() = 0;
+        virtual bool seek(uint32_t pos, SeekMode mode) = 0;
+        virtual size_t position() const = 0;
+        virtual size_t size() const = 0;
+        virtual bool setBufferSize(size_t size) = 0;
+        virtual void close() = 0;
+        virtual time_t getLastWrite() = 0;
+        virtual const char *path() const = 0;
+        virtual const char *name() const = 0;
+        virtual boolean isDirectory(void) = 0;
+        virtual FileImplPtr openNextFile(const char *mode) = 0;
+        virtual boolean seekDir(long position) = 0;
+        virtual String getNextFileName(void) = 0;
+        virtual String getNextFileName(bool *isDir) = 0;
+        virtual void rewindDirectory(void) = 0;
+        virtual operator bool() = 0;
+    };
+
+    class File : public Stream
+    {
+    public:
+        File(FileImplPtr p = FileImplPtr(), FS *baseFS = nullptr) : _p(p) { (void)baseFS; }
+
+        size_t write(uint8_t c) override { return write(&c, 1); }
+        size_t write(const uint8_t *buf, size_t size) override { return _p ? _p->write(buf, size) : 0; }
+        int available() override { return _p ? static_cast<int>(_p->size() - _p->position()) : 0; }
+        int read() override
+        {
+            uint8_t c = 0;
+            return read(&c, 1) == 1 ? c : -1;
+        }
+        int peek() override
+        {
+            const int c = read();
+            if (c >= 0)
+                _p->seek(static_cast<uint32_t>(_p->position() - 1), SeekSet);
+            return c;
+        }
+        void flush() override
+        {
+            if (_p)
+                _p->flush();
+        }
+        size_t read(uint8_t *buf, size_t size) { return _p ? _p->read(buf, size) : 0; }
+        size_t readBytes(char *buffer, size_t length) override { return read(reinterpret_cast<uint8_t *>(buffer), length); }
+        bool seek(uint32_t pos, SeekMode mode) { return _p && _p->seek(pos, mode); }
+        bool seek(uint32_t pos) { return seek(pos, SeekSet); }
+        size_t position() const { return _p ? _p->position() : 0; }
+        size_t size() const { return _p ? _p->size() : 0; }
+        bool setBufferSize(size_t size) { return _p && _p->setBufferSize(size); }
+        void close()
+        {
+            if (_p)
+            {
+                _p->close();
+                _p = nullptr;
+            }
+        }
+        operator bool() const { return _p && *_p; }
+        time_t getLastWrite() { return _p ? _p->getLastWrite() : 0; }
+        const char *path() const { return _p ? _p->path() : nullptr; }
+        const char *name() const { return _p ? _p->name() : nullptr; }
+        bool isDirectory(void) { return _p && _p->isDirectory(); }
+        File openNextFile(const char *mode = "r") { return _p ? File(_p->openNextFile(mode)) : File(); }
+        String getNextFileName(void) { return _p ? _p->getNextFileName() : String(); }
+        String getNextFileName(bool *isDir) { return _p ? _p->getNextFileName(isDir) : String(); }
+        void rewindDirectory(void)
+        {
+            if (_p)
+                _p->rewindDirectory();
+        }
+        boolean seekDir(long position) { return _p && _p->seekDir(position); }
+
+    private:
+        FileImplPtr _p;
+    };
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+    class FSImpl
+    {
+    public:
+        virtual ~FSImpl() {}
+        virtual FileImplPtr open(const char *path, const char *mode, const bool create) = 0;
+        virtual bool exists(const char *path) = 0;
+    };
+    typedef std::shared_ptr<FSImpl> FSImplPtr;
+
+    class FS
+    {
+    public:
+        FS(FSImplPtr impl = FSImplPtr()) : _impl(impl) {}
+        virtual ~FS() {}
+        File open(const char *path, const char *mode = FILE_READ, const bool create = false)
+        {
+            return _impl ? File(_impl->open(path, mode, create), this) : File();
+        }
+        File open(const String &path, const char *mode = FILE_READ, const bool create = false) { return open(path.c_str(), mode, create); }
+        bool exists(const char *path) { return _impl && _impl->exists(path); }
+        bool exists(const String &path) { return exists(path.c_str()); }
+        bool remove(const char *path) { return (void)path, false; }
+        bool remove(const String &path) { return remove(path.c_str()); }
+        bool rename(const char *from, const char *to) { return (void)from, (void)to, false; }
+        bool rename(const String &from, const String &to) { return rename(from.c_str(), to.c_str()); }
+        bool mkdir(const char *path) { return (void)path, false; }
+        bool mkdir(const String &path) { return mkdir(path.c_str()); }
+        bool rmdir(const char *path) { return (void)path, false; }
+        bool rmdir(const String &path) { return rmdir(path.c_str()); }
+
+    private:
+        FSImplPtr _impl;
+    };
+} // namespace fs
+
+using fs::File;
+using fs::FS;
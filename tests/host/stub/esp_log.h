@@ -0,0 +1,18 @@
+// en: Log macros routed to hostLog(), which prints warnings and errors only (set HOST_LOG=1 for everything).
+// ja: ログマクロは hostLog() に渡す。警告とエラーのみ表示する（HOST_LOG=1 で全て表示）。
+#pragma once
+#define ESP_LOG_NONE 0
+#define ESP_LOG_ERROR 1
+#define ESP_LOG_WARN 2
+#define ESP_LOG_INFO 3
+#define ESP_LOG_DEBUG 4
+#define ESP_LOG_VERBOSE 5
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+#endif
+void hostLog(int level, const char *tag, const char *fmt, ...);
+#define ESP_LOGE(tag, fmt, ...) hostLog(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) hostLog(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) hostLog(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) hostLog(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) hostLog(ESP_LOG_VERBOSE, tag, fmt, ##__VA_ARGS__)
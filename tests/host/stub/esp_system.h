@@ -0,0 +1,6 @@
+#pragma once
+#include <esp_http_server.h>
+#include <stdint.h>
+uint32_t esp_random(void);
+void esp_fill_random(void *buf, size_t len);
+const char *esp_err_to_name(esp_err_t code);
@@ -0,0 +1,11 @@
+// en: Tasks are never started on the host (xTaskCreate fails), so the library takes its inline fallbacks.
+// ja: ホストではタスクを起動しない（xTaskCreate は失敗する）ため、ライブラリはその場で処理する経路を取る。
+#pragma once
+#include <freertos/FreeRTOS.h>
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *out);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *out, BaseType_t core);
+void vTaskDelete(TaskHandle_t t);
+void vTaskDelay(TickType_t t);
+#define tskIDLE_PRIORITY 0
@@ -0,0 +1,167 @@
+// en: In-memory filesystem for host tests: files are kept in insertion order (that is the directory order), and
+//     directories exist implicitly while they contain a file. Pass fs() to anything that takes an fs::FS.
+// ja: ホストテスト用のメモリ上のファイルシステム。ファイルは追加順（＝ディレクトリ順）に保持し、ディレクトリは
+//     ファイルを含む間だけ暗黙に存在する。fs::FS を受け取る箇所には fs() を渡す。
+#pragma once
+#include <FS.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hostfs
+{
+    using Entries = std::vector<std::pair<std::string, std::string>>;
+
+    class MemoryFile : public fs::FileImpl
+    {
+    public:
+        MemoryFile(std::string path, std::string data, bool isDir, std::vector<std::pair<std::string, bool>> children)
+            : _path(std::move(path)), _data(std::move(data)), _isDir(isDir), _children(std::move(children)) {}
+
+        size_t write(const uint8_t *, size_t) override { return 0; }
+        size_t read(uint8_t *buf, size_t size) override
+        {
+            const size_t take = std::min(size, _data.size() - _pos);
+            std::copy(_data.begin() + _pos, _data.begin() + _pos + take, buf);
+            _pos += take;
+            return take;
+        }
+        void flush() override {}
+        bool seek(uint32_t pos, fs::SeekMode mode) override
+        {
+            const size_t base = mode == fs::SeekCur ? _pos : (mode == fs::SeekEnd ? _data.size() : 0);
+            if (base + pos > _data.size())
+                return false;
+            _pos = base + pos;
+            return true;
+        }
+        size_t position() const override { return _pos; }
+        size_t size() const override { return _data.size(); }
+        bool setBufferSize(size_t) override { return true; }
+        void close() override { _open = false; }
+        time_t getLastWrite() override { return 0; }
+        const char *path() const override { return _path.c_str(); }
+        const char *name() const override
+        {
+            const size_t slash = _path.rfind('/');
+            return _path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+        }
+        boolean isDirectory(void) override { return _isDir; }
+        fs::FileImplPtr openNextFile(const char *) override;
+        boolean seekDir(long position) override
+        {
+            _next = static_cast<size_t>(std::max(0L, position));
+            return true;
+        }
+        String getNextFileName(void) override
+        {
+            bool isDir = false;
+            return getNextFileName(&isDir);
+        }
+        String getNextFileName(bool *isDir) override
+        {
+            if (_next >= _children.size())
+                return String();
+            const auto &child = _children[_next++];
+            *isDir = child.second;
+            return String(child.first.c_str());
+        }
+        void rewindDirectory(void) override { _next = 0; }
+        operator bool() override { return _open; }
+
+        // en: Set by MemoryFS::open(); directory entries open against the same snapshot of the file list.
+        // ja: MemoryFS::open() が設定する。ディレクトリのエントリは同じファイル一覧のスナップショットから開く。
+        Entries snapshot;
+
+    private:
+        std::string _path;
+        std::string _data;
+        bool _isDir;
+        std::vector<std::pair<std::string, bool>> _children; // full paths in directory order
+        size_t _pos = 0;
+        size_t _next = 0;
+        bool _open = true;
+    };
+
+    class MemoryFS : public fs::FSImpl
+    {
+    public:
+        void put(const std::string &path, const std::string &data)
+        {
+            for (auto &entry : _entries)
+            {
+                if (entry.first == path)
+                {
+                    entry.second = data;
+                    return;
+                }
+            }
+            _entries.emplace_back(path, data);
+        }
+
+        void remove(const std::string &path)
+        {
+            _entries.erase(std::remove_if(_entries.begin(), _entries.end(), [&](const std::pair<std::string, std::string> &entry)
+                                          { return entry.first == path; }),
+                           _entries.end());
+        }
+
+        fs::FileImplPtr open(const char *path, const char *mode, const bool) override
+        {
+            return mode && mode[0] == 'r' ? openIn(_entries, path) : fs::FileImplPtr();
+        }
+
+        bool exists(const char *path) override { return openIn(_entries, path) != nullptr; }
+
+        static fs::FileImplPtr openIn(const Entries &entries, const std::string &path)
+        {
+            for (const auto &entry : entries)
+            {
+                if (entry.first == path)
+                {
+                    auto file = std::make_shared<MemoryFile>(entry.first, entry.second, false, std::vector<std::pair<std::string, bool>>());
+                    file->snapshot = entries;
+                    return file;
+                }
+            }
+            const std::string prefix = path == "/" ? std::string("/") : path + "/";
+            std::vector<std::pair<std::string, bool>> children;
+            for (const auto &entry : entries)
+            {
+                if (entry.first.compare(0, prefix.size(), prefix) != 0)
+                    continue;
+                const size_t slash = entry.first.find('/', prefix.size());
+                const std::string child = entry.first.substr(0, slash);
+                const bool isDir = slash != std::string::npos;
+                if (std::none_of(children.begin(), children.end(), [&](const std::pair<std::string, bool> &c)
+                                 { return c.first == child; }))
+                    children.emplace_back(child, isDir);
+            }
+            if (children.empty() && path != "/")
+                return fs::FileImplPtr();
+            auto dir = std::make_shared<MemoryFile>(path, std::string(), true, std::move(children));
+            dir->snapshot = entries;
+            return dir;
+        }
+
+    private:
+        Entries _entries;
+    };
+
+    inline fs::FileImplPtr MemoryFile::openNextFile(const char *)
+    {
+        bool isDir = false;
+        const String next = getNextFileName(&isDir);
+        return next.isEmpty() ? fs::FileImplPtr() : MemoryFS::openIn(snapshot, next.c_str());
+    }
+
+    // en: A filesystem plus the fs::FS that fronts it.
+    // ja: ファイルシステムと、それを包む fs::FS の組。
+    struct Volume
+    {
+        std::shared_ptr<MemoryFS> files = std::make_shared<MemoryFS>();
+        fs::FS fs{files};
+    };
+} // namespace hostfs
@@ -0,0 +1,63 @@
+// en: Test-side controls of the host esp_http_server (host_stubs.cpp): fake requests, the httpd_queue_work FIFO,
+//     the clock, and a log of every response body call in the order the "socket" saw it.
+// ja: ホスト版 esp_http_server（host_stubs.cpp）をテストから操作する API。偽リクエスト、httpd_queue_work の FIFO、
+//     時計、ソケットに届いた順の応答ボディ呼び出しの記録。
+#pragma once
+#include <esp_http_server.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hosthttpd
+{
+    // en: One body write. `tag` identifies the request (async copies keep the tag of their original).
+    // ja: ボディの書き込み 1 回分。`tag` はリクエストの識別子（非同期コピーは元のタグを引き継ぐ）。
+    struct BodyWrite
+    {
+        int tag = 0;
+        size_t length = 0;
+        bool chunked = true; // false for httpd_resp_send
+        bool last = false;   // terminating zero-length chunk, or httpd_resp_send
+    };
+
+    // en: Creates a request owned by the harness (freed by reset()).
+    // ja: ハーネスが所有するリクエストを作る（reset() で解放）。
+    httpd_req_t *makeRequest(httpd_method_t method, const char *uri, int tag);
+    void setHeader(httpd_req_t *req, const char *name, const char *value);
+
+    // en: Runs the handler registered for req->method, as the httpd task would for a new request.
+    // ja: httpd タスクが新しいリクエストに対して行うのと同様に、req->method に登録されたハンドラを実行する。
+    esp_err_t dispatch(httpd_req_t *req);
+
+    // en: Drains the work FIFO in order; when it is empty, advances the clock to the next one-shot esp_timer and
+    //     fires it. Returns the number of work items run. Periodic timers are never fired here.
+    // ja: 作業 FIFO を順に処理する。空になれば次の単発 esp_timer まで時計を進めて発火させる。実行した作業数を返す。
+    //     周期タイマーはここでは発火させない。
+    size_t runQueuedWork(size_t limit = 100000);
+    size_t queuedWork();
+
+    // en: Status line, Content-Type and headers set on a request (or its async copies).
+    // ja: リクエスト（またはその非同期コピー）に設定されたステータス行・Content-Type・ヘッダ。
+    struct ResponseHead
+    {
+        std::string status;
+        std::string type;
+        std::vector<std::pair<std::string, std::string>> headers;
+        std::string body; // httpd_resp_send() / chunk payloads, concatenated
+
+        const std::string *header(const char *name) const;
+    };
+
+    const ResponseHead &response(int tag);
+    const std::vector<BodyWrite> &bodyWrites();
+    std::vector<int> chunkTags(); // tags of the non-terminating chunked writes, in order
+    size_t openAsyncRequests();   // httpd_req_async_handler_begin() copies not yet completed
+    size_t closedSessions();      // httpd_sess_trigger_close() calls
+
+    int64_t nowUs();
+    void advanceUs(int64_t us);
+
+    void reset();
+} // namespace hosthttpd
@@ -0,0 +1,584 @@
+// en: Single-threaded host implementations of the ESP-IDF, FreeRTOS, lwIP and mbedTLS symbols the library links
+//     against. Only the httpd request/response path, the work queue and the clock behave. The keyed digest is a
+//     deterministic non-cryptographic stand-in (enough for cache keys); other crypto calls fail.
+// ja: ライブラリがリンクする ESP-IDF・FreeRTOS・lwIP・mbedTLS シンボルの単一スレッド版ホスト実装。
+//     httpd のリクエスト/レスポンス経路・作業キュー・時計のみ動作する。鍵付きダイジェストはキャッシュキーに足りる
+//     決定的な非暗号の代用品で、その他の暗号関数は失敗を返す。
+#include "host_httpd.h"
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <lwip/ip4_addr.h>
+#include <mbedtls/base64.h>
+#include <mbedtls/md.h>
+#include <mbedtls/pkcs5.h>
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <strings.h>
+
+struct esp_timer
+{
+    esp_timer_cb_t callback = nullptr;
+    void *arg = nullptr;
+    int64_t dueUs = 0;
+    uint64_t periodUs = 0;
+    bool armed = false;
+};
+
+namespace
+{
+    struct Handler
+    {
+        std::string uri;
+        httpd_method_t method;
+        esp_err_t (*fn)(httpd_req_t *);
+        void *userCtx;
+    };
+
+    struct RequestState
+    {
+        int tag = 0;
+        std::map<std::string, std::string> headers; // lower-case names
+    };
+
+    struct Work
+    {
+        httpd_work_fn_t fn;
+        void *arg;
+    };
+
+    struct Host
+    {
+        int64_t clockUs = 1000000;
+        int serverToken = 0;
+        bool running = false;
+        std::vector<Handler> handlers;
+        std::deque<Work> work;
+        std::vector<esp_timer *> timers;
+        std::map<const httpd_req_t *, RequestState> requests;
+        std::vector<httpd_req_t *> owned;
+        std::vector<hosthttpd::BodyWrite> writes;
+        std::map<int, hosthttpd::ResponseHead> responses;
+        size_t openAsync = 0;
+        size_t closedSessions = 0;
+        uint32_t randomState = 0x12345678u;
+    };
+
+    Host &host()
+    {
+        static Host instance;
+        return instance;
+    }
+
+    httpd_req_t *newRequest()
+    {
+        return static_cast<httpd_req_t *>(calloc(1, sizeof(httpd_req_t)));
+    }
+
+    int tagOf(const httpd_req_t *req)
+    {
+        auto it = host().requests.find(req);
+        return it == host().requests.end() ? -1 : it->second.tag;
+    }
+
+    const std::string *headerOf(httpd_req_t *req, const char *field)
+    {
+        auto it = host().requests.find(req);
+        if (it == host().requests.end() || !field)
+            return nullptr;
+        std::string key(field);
+        for (char &c : key)
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        auto found = it->second.headers.find(key);
+        return found == it->second.headers.end() ? nullptr : &found->second;
+    }
+
+    bool fireNextTimer()
+    {
+        esp_timer *next = nullptr;
+        for (esp_timer *timer : host().timers)
+        {
+            if (timer->armed && timer->periodUs == 0 && (!next || timer->dueUs < next->dueUs))
+                next = timer;
+        }
+        if (!next)
+            return false;
+        if (next->dueUs > host().clockUs)
+            host().clockUs = next->dueUs;
+        next->armed = false;
+        next->callback(next->arg);
+        return true;
+    }
+} // namespace
+
+namespace hosthttpd
+{
+    httpd_req_t *makeRequest(httpd_method_t method, const char *uri, int tag)
+    {
+        httpd_req_t *req = newRequest();
+        req->handle = &host().serverToken;
+        req->method = method;
+        strncpy(const_cast<char *>(req->uri), uri, HTTPD_MAX_URI_LEN);
+        host().requests[req].tag = tag;
+        host().owned.push_back(req);
+        return req;
+    }
+
+    void setHeader(httpd_req_t *req, const char *name, const char *value)
+    {
+        std::string key(name);
+        for (char &c : key)
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        host().requests[req].headers[key] = value;
+    }
+
+    esp_err_t dispatch(httpd_req_t *req)
+    {
+        for (const Handler &handler : host().handlers)
+        {
+            if (handler.method == req->method && httpd_uri_match_wildcard(handler.uri.c_str(), req->uri, strlen(req->uri)))
+            {
+                req->user_ctx = handler.userCtx;
+                return handler.fn(req);
+            }
+        }
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    size_t runQueuedWork(size_t limit)
+    {
+        size_t ran = 0;
+        while (ran < limit)
+        {
+            if (host().work.empty())
+            {
+                if (!fireNextTimer())
+                    break;
+                continue;
+            }
+            const Work item = host().work.front();
+            host().work.pop_front();
+            item.fn(item.arg);
+            ++ran;
+        }
+        return ran;
+    }
+
+    size_t queuedWork() { return host().work.size(); }
+
+    const std::string *ResponseHead::header(const char *name) const
+    {
+        for (const auto &field : headers)
+        {
+            if (strcasecmp(field.first.c_str(), name) == 0)
+                return &field.second;
+        }
+        return nullptr;
+    }
+
+    const ResponseHead &response(int tag) { return host().responses[tag]; }
+
+    const std::vector<BodyWrite> &bodyWrites() { return host().writes; }
+
+    std::vector<int> chunkTags()
+    {
+        std::vector<int> tags;
+        for (const BodyWrite &write : host().writes)
+        {
+            if (write.chunked && !write.last)
+                tags.push_back(write.tag);
+        }
+        return tags;
+    }
+
+    size_t openAsyncRequests() { return host().openAsync; }
+    size_t closedSessions() { return host().closedSessions; }
+
+    int64_t nowUs() { return host().clockUs; }
+    void advanceUs(int64_t us) { host().clockUs += us; }
+
+    void reset()
+    {
+        for (httpd_req_t *req : host().owned)
+        {
+            host().requests.erase(req);
+            free(req);
+        }
+        host().owned.clear();
+        host().writes.clear();
+        host().responses.clear();
+        host().work.clear();
+        host().closedSessions = 0;
+    }
+} // namespace hosthttpd
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    (void)config;
+    host().running = true;
+    *handle = &host().serverToken;
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    (void)handle;
+    host().running = false;
+    host().handlers.clear();
+    host().work.clear(); // en: like IDF, queued work is dropped / ja: IDF 同様、キュー済みの作業は破棄
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri)
+{
+    (void)handle;
+    host().handlers.push_back({uri->uri, uri->method, uri->handler, uri->user_ctx});
+    return ESP_OK;
+}
+
+bool httpd_uri_match_wildcard(const char *reference_uri, const char *uri_to_match, size_t match_upto)
+{
+    const size_t refLen = strlen(reference_uri);
+    if (refLen > 0 && reference_uri[refLen - 1] == '*')
+        return strncmp(reference_uri, uri_to_match, std::min(refLen - 1, match_upto)) == 0 && match_upto >= refLen - 1;
+    return refLen == match_upto && strncmp(reference_uri, uri_to_match, match_upto) == 0;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    const size_t len = buf_len < 0 ? (buf ? strlen(buf) : 0) : static_cast<size_t>(buf_len);
+    host().writes.push_back({tagOf(r), len, false, true});
+    host().responses[tagOf(r)].body.append(buf ? buf : "", len);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    const size_t len = buf_len < 0 ? (buf ? strlen(buf) : 0) : static_cast<size_t>(buf_len);
+    host().writes.push_back({tagOf(r), len, true, len == 0});
+    host().responses[tagOf(r)].body.append(buf ? buf : "", len);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+    host().responses[tagOf(r)].status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    host().responses[tagOf(r)].type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+    host().responses[tagOf(r)].headers.emplace_back(field, value);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg)
+{
+    (void)error;
+    return httpd_resp_send(req, msg ? msg : "", -1);
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len) { return (void)r, (void)buf, (void)buf_len, 0; }
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+    const std::string *value = headerOf(r, field);
+    return value ? value->size() : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+{
+    const std::string *value = headerOf(r, field);
+    if (!value)
+        return ESP_ERR_NOT_FOUND;
+    if (!val || val_size == 0)
+        return ESP_ERR_INVALID_ARG;
+    snprintf(val, val_size, "%s", value->c_str());
+    return value->size() < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    const char *query = strchr(r->uri, '?');
+    if (!query)
+        return ESP_ERR_NOT_FOUND;
+    snprintf(buf, buf_len, "%s", query + 1);
+    return ESP_OK;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r) { return (void)r, -1; }
+int httpd_send(httpd_req_t *r, const char *buf, size_t buf_len) { return (void)r, (void)buf, static_cast<int>(buf_len); }
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg)
+{
+    if (!host().running || handle != &host().serverToken)
+        return ESP_FAIL;
+    host().work.push_back({work, arg});
+    return ESP_OK;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+    (void)handle, (void)sockfd;
+    host().closedSessions++;
+    return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out)
+{
+    httpd_req_t *copy = newRequest();
+    if (!copy)
+        return ESP_ERR_NO_MEM;
+    memcpy(static_cast<void *>(copy), r, sizeof(httpd_req_t));
+    host().requests[copy] = host().requests[r];
+    host().openAsync++;
+    *out = copy;
+    return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *r)
+{
+    host().requests.erase(r);
+    host().openAsync--;
+    free(r);
+    return ESP_OK;
+}
+
+int64_t esp_timer_get_time(void) { return host().clockUs; }
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    esp_timer *timer = new esp_timer();
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    host().timers.push_back(timer);
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    if (timer->armed)
+        return ESP_ERR_INVALID_STATE;
+    timer->dueUs = host().clockUs + static_cast<int64_t>(timeout_us);
+    timer->periodUs = 0;
+    timer->armed = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    if (timer->armed)
+        return ESP_ERR_INVALID_STATE;
+    timer->dueUs = host().clockUs + static_cast<int64_t>(period);
+    timer->periodUs = period;
+    timer->armed = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer->armed)
+        return ESP_ERR_INVALID_STATE;
+    timer->armed = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    auto &timers = host().timers;
+    for (size_t i = 0; i < timers.size(); ++i)
+    {
+        if (timers[i] == timer)
+        {
+            timers.erase(timers.begin() + static_cast<long>(i));
+            break;
+        }
+    }
+    delete timer;
+    return ESP_OK;
+}
+
+uint32_t esp_random(void)
+{
+    uint32_t x = host().randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return host().randomState = x;
+}
+
+void esp_fill_random(void *buf, size_t len)
+{
+    uint8_t *out = static_cast<uint8_t *>(buf);
+    for (size_t i = 0; i < len; ++i)
+        out[i] = static_cast<uint8_t>(esp_random());
+}
+
+const char *esp_err_to_name(esp_err_t code) { return code == ESP_OK ? "ESP_OK" : "ESP_FAIL"; }
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; ++i)
+    {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) { return (void)caps, malloc(size); }
+void heap_caps_free(void *ptr) { free(ptr); }
+size_t heap_caps_get_free_size(uint32_t caps) { return (void)caps, 256 * 1024; }
+size_t heap_caps_get_total_size(uint32_t caps) { return (void)caps, 320 * 1024; }
+
+void hostLog(int level, const char *tag, const char *fmt, ...)
+{
+    static const bool verbose = getenv("HOST_LOG") != nullptr;
+    if (level > ESP_LOG_WARN && !verbose)
+        return;
+    va_list args;
+    va_start(args, fmt);
+    printf("[%s] ", tag);
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+}
+
+unsigned long millis() { return static_cast<unsigned long>(host().clockUs / 1000); }
+unsigned long micros() { return static_cast<unsigned long>(host().clockUs); }
+void delay(unsigned long ms) { host().clockUs += static_cast<int64_t>(ms) * 1000; }
+void yield() {}
+
+namespace
+{
+    struct HostMutex
+    {
+        int depth = 0;
+    };
+
+    BaseType_t takeMutex(SemaphoreHandle_t s, TickType_t t, bool recursive)
+    {
+        HostMutex *mutex = static_cast<HostMutex *>(s);
+        if (mutex->depth > 0 && !recursive)
+        {
+            if (t == 0)
+                return pdFALSE;
+            // en: One thread only: a blocking re-take would deadlock on the device too.
+            // ja: 単一スレッドのため、待機付きの再取得は実機でもデッドロックする。
+            fprintf(stderr, "host: mutex taken twice on one task\n");
+            abort();
+        }
+        mutex->depth++;
+        return pdTRUE;
+    }
+} // namespace
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { return new HostMutex(); }
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void) { return new HostMutex(); }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t t) { return takeMutex(s, t, false); }
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t s, TickType_t t) { return takeMutex(s, t, true); }
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s)
+{
+    HostMutex *mutex = static_cast<HostMutex *>(s);
+    if (mutex->depth == 0)
+        return pdFALSE;
+    mutex->depth--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t s) { return xSemaphoreGive(s); }
+void vSemaphoreDelete(SemaphoreHandle_t s) { delete static_cast<HostMutex *>(s); }
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *out)
+{
+    (void)fn, (void)name, (void)stack, (void)arg, (void)prio, (void)out;
+    return pdFAIL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *out, BaseType_t core)
+{
+    (void)core;
+    return xTaskCreate(fn, name, stack, arg, prio, out);
+}
+
+void vTaskDelete(TaskHandle_t t) { (void)t; }
+void vTaskDelay(TickType_t t) { host().clockUs += static_cast<int64_t>(t) * 1000; }
+
+char *ip4addr_ntoa_r(const ip4_addr_t *addr, char *buf, int buflen)
+{
+    const uint8_t *b = reinterpret_cast<const uint8_t *>(&addr->addr);
+    snprintf(buf, static_cast<size_t>(buflen), "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+    return buf;
+}
+
+int mbedtls_base64_decode(unsigned char *, size_t, size_t *olen, const unsigned char *, size_t) { return *olen = 0, -1; }
+int mbedtls_base64_encode(unsigned char *, size_t, size_t *olen, const unsigned char *, size_t) { return *olen = 0, -1; }
+namespace
+{
+    // en: FNV-1a state kept in the context's first pointer; stands in for HMAC-SHA256 (32-byte output).
+    // ja: コンテキストの先頭ポインタに FNV-1a の状態を置き、HMAC-SHA256（32 バイト出力）の代わりにする。
+    uint64_t &digestState(mbedtls_md_context_t *ctx) { return *reinterpret_cast<uint64_t *>(&ctx->a); }
+
+    void digestMix(mbedtls_md_context_t *ctx, const unsigned char *input, size_t ilen)
+    {
+        for (size_t i = 0; i < ilen; ++i)
+            digestState(ctx) = (digestState(ctx) ^ input[i]) * 1099511628211ull;
+    }
+} // namespace
+
+const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t type)
+{
+    static const int sha256 = 0;
+    return type == MBEDTLS_MD_SHA256 ? reinterpret_cast<const mbedtls_md_info_t *>(&sha256) : nullptr;
+}
+int mbedtls_md_hmac(const mbedtls_md_info_t *, const unsigned char *, size_t, const unsigned char *, size_t, unsigned char *) { return -1; }
+void mbedtls_md_init(mbedtls_md_context_t *ctx) { memset(ctx, 0, sizeof(*ctx)); }
+void mbedtls_md_free(mbedtls_md_context_t *) {}
+int mbedtls_md_setup(mbedtls_md_context_t *ctx, const mbedtls_md_info_t *md_info, int hmac) { return (void)ctx, md_info && hmac ? 0 : -1; }
+int mbedtls_md_starts(mbedtls_md_context_t *) { return -1; }
+int mbedtls_md_update(mbedtls_md_context_t *, const unsigned char *, size_t) { return -1; }
+int mbedtls_md_finish(mbedtls_md_context_t *, unsigned char *) { return -1; }
+int mbedtls_md_hmac_starts(mbedtls_md_context_t *ctx, const unsigned char *key, size_t keylen)
+{
+    digestState(ctx) = 14695981039346656037ull;
+    digestMix(ctx, key, keylen);
+    return 0;
+}
+int mbedtls_md_hmac_update(mbedtls_md_context_t *ctx, const unsigned char *input, size_t ilen)
+{
+    digestMix(ctx, input, ilen);
+    return 0;
+}
+int mbedtls_md_hmac_finish(mbedtls_md_context_t *ctx, unsigned char *output)
+{
+    for (size_t i = 0; i < 32; ++i)
+    {
+        const unsigned char round = static_cast<unsigned char>(i);
+        digestMix(ctx, &round, 1);
+        output[i] = static_cast<unsigned char>(digestState(ctx) >> 56);
+    }
+    return 0;
+}
+int mbedtls_pkcs5_pbkdf2_hmac_ext(mbedtls_md_type_t, const unsigned char *, size_t, const unsigned char *, size_t, unsigned int, uint32_t, unsigned char *) { return -1; }
@@ -0,0 +1,7 @@
+#pragma once
+#define IP4ADDR_STRLEN_MAX 16
+typedef struct
+{
+    unsigned addr;
+} ip4_addr_t;
+char *ip4addr_ntoa_r(const ip4_addr_t *addr, char *buf, int buflen);
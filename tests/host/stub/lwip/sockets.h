@@ -0,0 +1,5 @@
+#pragma once
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
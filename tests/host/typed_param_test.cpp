@@ -0,0 +1,140 @@
+// en: Host test for the typed query accessors (queryInt/queryFloat/queryBool/queryEnum and forEachQueryView):
+//     runs them inside a route handler through tests/host/stub and fails if a lookup on a plain query allocates.
+//       g++ -std=gnu++17 -O1 -Wall -Itests/host/stub -Isrc src/EspHttpServer.cpp tests/host/stub/host_stubs.cpp
+//           tests/host/typed_param_test.cpp -o typed_param_test && ./typed_param_test
+// ja: 型付きクエリアクセサ（queryInt/queryFloat/queryBool/queryEnum と forEachQueryView）のホストテスト。
+//     tests/host/stub 上のルートハンドラ内で呼び出し、エンコードなしのクエリの参照で確保が起きれば失敗とする。
+//       g++ -std=gnu++17 -O1 -Wall -Itests/host/stub -Isrc src/EspHttpServer.cpp tests/host/stub/host_stubs.cpp
+//           tests/host/typed_param_test.cpp -o typed_param_test && ./typed_param_test
+#include "EspHttpServer.h"
+#include "host_httpd.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace EspHttpServer;
+
+namespace
+{
+    size_t allocations = 0;
+}
+
+void *operator new(size_t size)
+{
+    ++allocations;
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    ++allocations;
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { std::free(ptr); }
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const char *what)
+    {
+        if (!condition)
+        {
+            ++failures;
+            std::printf("FAIL: %s\n", what);
+        }
+    }
+
+    // en: Runs one accessor call and reports how many heap allocations it made.
+    // ja: アクセサを 1 回呼び、その間のヒープ確保数を報告する。
+    template <typename Call>
+    void expectNoAllocation(const char *what, Call &&call)
+    {
+        const size_t before = allocations;
+        call();
+        const size_t used = allocations - before;
+        if (used != 0)
+        {
+            std::printf("  %s: %zu allocation(s)\n", what, used);
+        }
+        check(used == 0, what);
+    }
+
+    void testTypedQuery()
+    {
+        hosthttpd::reset();
+        Server server;
+        bool ran = false;
+        server.on("/p", HTTP_GET, [&](Request &req, Response &res)
+                  {
+                      ran = true;
+                      long page = 0;
+                      float ratio = 0;
+                      bool debug = false;
+                      int sort = -1;
+                      int mode = -1;
+                      ParamError error = ParamError::None;
+                      expectNoAllocation("queryInt", [&]
+                                         { page = req.queryInt("page", 1, &error); });
+                      check(page == 7 && error == ParamError::None, "page=7");
+                      expectNoAllocation("queryFloat", [&]
+                                         { ratio = req.queryFloat("ratio"); });
+                      check(ratio > 0.49f && ratio < 0.51f, "ratio=0.5");
+                      expectNoAllocation("queryBool", [&]
+                                         { debug = req.queryBool("debug"); });
+                      check(debug, "bare debug is true");
+                      expectNoAllocation("queryEnum", [&]
+                                         { sort = req.queryEnum("sort", {"name", "size", "date", "type"}, -1, &error); });
+                      check(sort == 2 && error == ParamError::None, "sort=date");
+                      expectNoAllocation("queryEnum (no match)", [&]
+                                         { mode = req.queryEnum("mode", {"list", "grid"}, 0, &error); });
+                      check(mode == 0 && error == ParamError::Invalid, "mode=tiles is invalid");
+
+                      size_t pairs = 0;
+                      ParamViewCallback count = [&pairs](const ParamView &, const ParamView &)
+                      {
+                          ++pairs;
+                          return true;
+                      };
+                      expectNoAllocation("forEachQueryView", [&]
+                                         { req.forEachQueryView(count); });
+                      check(pairs == 5, "five query pairs");
+                      res.send(200, "text/plain", "ok");
+                  });
+        server.begin();
+
+        hosthttpd::dispatch(hosthttpd::makeRequest(HTTP_GET, "/p?page=7&ratio=0.5&debug&sort=date&mode=tiles", 0));
+        check(ran, "handler ran");
+        server.end();
+        hosthttpd::reset();
+    }
+} // namespace
+
+int main()
+{
+    testTypedQuery();
+    if (failures)
+    {
+        std::printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("typed params: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,260 @@
+// en: Host test for the percent-decoding kernel (src/esphttpserver_urldecode.h). Needs no Arduino core:
+//       g++ -std=c++17 -O2 -Wall -Isrc tests/host/url_decode_test.cpp -o url_decode_test && ./url_decode_test
+//     Add -fsanitize=address,undefined to catch over-reads past the span. Exits non-zero if any check fails and
+//     prints a rough SWAR vs byte-loop timing (not asserted).
+// ja: パーセントデコード処理（src/esphttpserver_urldecode.h）のホストテスト。Arduino コア不要:
+//       g++ -std=c++17 -O2 -Wall -Isrc tests/host/url_decode_test.cpp -o url_decode_test && ./url_decode_test
+//     -fsanitize=address,undefined を付けると範囲外読み込みも検出する。失敗があれば非 0 で終了し、
+//     SWAR と 1 バイトずつの比較時間を参考表示する（判定には使わない）。
+#include "esphttpserver_urldecode.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+
+using EspHttpServer::detail::findUrlSpecial;
+using EspHttpServer::detail::hexValue;
+using EspHttpServer::detail::urlDecodeSpan;
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const char *what, const std::string &input)
+    {
+        if (!condition)
+        {
+            ++failures;
+            std::printf("FAIL: %s (input \"", what);
+            for (unsigned char c : input)
+            {
+                if (c < 0x20 || c >= 0x7f)
+                    std::printf("\\x%02x", c);
+                else
+                    std::printf("%c", c);
+            }
+            std::printf("\")\n");
+        }
+    }
+
+    // en: Decodes from an exact-size heap copy (no trailing NUL) so -fsanitize=address flags any over-read.
+    // ja: 終端 NUL の無いちょうどのサイズのヒープ領域からデコードし、-fsanitize=address で読み越しを検出できるようにする。
+    bool decode(const std::string &input, std::string &output, bool plusAsSpace)
+    {
+        std::unique_ptr<char[]> source(new char[input.size()]);
+        std::unique_ptr<char[]> buffer(new char[input.size()]);
+        memcpy(source.get(), input.data(), input.size());
+        size_t length = 0;
+        if (!urlDecodeSpan(source.get(), input.size(), buffer.get(), length, plusAsSpace))
+            return false;
+        output.assign(buffer.get(), length);
+        return true;
+    }
+
+    void expectDecoded(const std::string &input, const std::string &expected, bool plusAsSpace)
+    {
+        std::string output;
+        const bool ok = decode(input, output, plusAsSpace);
+        check(ok, "decode should succeed", input);
+        check(!ok || output == expected, "decoded value mismatch", input);
+    }
+
+    void expectRejected(const std::string &input, bool plusAsSpace)
+    {
+        std::string output;
+        check(!decode(input, output, plusAsSpace), "decode should fail", input);
+    }
+
+    // en: Byte-at-a-time reference with the same acceptance rules as the kernel.
+    // ja: カーネルと同じ受理規則で 1 バイトずつ処理する参照実装。
+    bool referenceDecode(const std::string &input, std::string &output, bool plusAsSpace)
+    {
+        output.clear();
+        for (size_t i = 0; i < input.size(); ++i)
+        {
+            const unsigned char c = static_cast<unsigned char>(input[i]);
+            if (c < 0x20 || c == 0x7f)
+                return false;
+            if (plusAsSpace && c == '+')
+            {
+                output += ' ';
+                continue;
+            }
+            if (c != '%')
+            {
+                output += static_cast<char>(c);
+                continue;
+            }
+            if (i + 2 >= input.size())
+                return false;
+            const int hi = hexValue(input[i + 1]);
+            const int lo = hexValue(input[i + 2]);
+            if (hi < 0 || lo < 0)
+                return false;
+            const unsigned char decoded = static_cast<unsigned char>((hi << 4) | lo);
+            if (decoded < 0x20 || decoded == 0x7f)
+                return false;
+            output += static_cast<char>(decoded);
+            i += 2;
+        }
+        return true;
+    }
+
+    size_t referenceFind(const char *data, size_t length, bool plusIsSpecial)
+    {
+        for (size_t i = 0; i < length; ++i)
+        {
+            const unsigned char c = static_cast<unsigned char>(data[i]);
+            if (c == '%' || (plusIsSpecial && c == '+') || c < 0x20 || c == 0x7f)
+                return i;
+        }
+        return length;
+    }
+
+    void testValidEscapes()
+    {
+        expectDecoded("", "", false);
+        expectDecoded("plain", "plain", false);
+        expectDecoded("a%20b", "a b", false);
+        expectDecoded("%41%62%7E", "Ab~", false);
+        expectDecoded("%e3%81%82", "\xe3\x81\x82", false);
+        expectDecoded("caf\xc3\xa9", "caf\xc3\xa9", false);
+        expectDecoded("%25%2B", "%+", true);
+    }
+
+    void testMalformedPercent()
+    {
+        expectRejected("%", false);
+        expectRejected("%zz", false);
+        expectRejected("%g0", false);
+        expectRejected("%0g", false);
+        expectRejected("a%%41", false);
+        expectRejected("100%", true);
+        expectRejected("%4", false);
+        expectRejected("abcdefg%4", false);
+        expectRejected("abcdefgh%", true);
+    }
+
+    void testControlBytes()
+    {
+        expectRejected(std::string("a\0b", 3), false);
+        expectRejected("a\rb", false);
+        expectRejected("line\n", true);
+        expectRejected("tab\there", false);
+        expectRejected("del\x7f", false);
+        expectRejected("%00", false);
+        expectRejected("%0d%0a", true);
+        expectRejected("%1f", false);
+        expectRejected("%7F", false);
+    }
+
+    void testPlusInPathAndQuery()
+    {
+        expectDecoded("a+b", "a+b", false);
+        expectDecoded("a+b", "a b", true);
+        expectDecoded("++++++++", "++++++++", false);
+        expectDecoded("++++++++", "        ", true);
+        expectDecoded("a%2Bb+c", "a+b+c", false);
+        expectDecoded("a%2Bb+c", "a+b c", true);
+    }
+
+    void testInPlace()
+    {
+        std::string buffer = "x%41y+z%2fend";
+        size_t length = 0;
+        const bool ok = urlDecodeSpan(buffer.data(), buffer.size(), &buffer[0], length, true);
+        check(ok && std::string(buffer.data(), length) == "xAy z/end", "in-place decode", "x%41y+z%2fend");
+    }
+
+    // en: Put each special byte at every offset of short inputs so every SWAR lane and the byte tail are hit.
+    // ja: 短い入力の全位置に特殊文字を置き、SWAR の各レーンと末尾のバイトループを通す。
+    void testEveryOffset()
+    {
+        const char specials[] = {'%', '+', '\0', '\x01', '\x1f', '\x7f'};
+        for (size_t length = 1; length <= 9; ++length)
+        {
+            for (size_t at = 0; at < length; ++at)
+            {
+                for (char special : specials)
+                {
+                    std::string input(length, 'a');
+                    input[at] = special;
+                    for (int plus = 0; plus < 2; ++plus)
+                    {
+                        const bool plusIsSpecial = plus != 0;
+                        const size_t expected = (special == '+' && !plusIsSpecial) ? length : at;
+                        check(findUrlSpecial(input.data(), input.size(), plusIsSpecial) == expected, "findUrlSpecial offset", input);
+                    }
+                }
+            }
+            const std::string clean(length, 'z');
+            check(findUrlSpecial(clean.data(), clean.size(), true) == length, "findUrlSpecial clean input", clean);
+        }
+    }
+
+    void testAgainstReference()
+    {
+        const char alphabet[] = {'a', 'Z', '0', '9', 'f', 'G', '%', '+', '/', ' ', '\0', '\n', '\x7f', '\x80', '\xff'};
+        std::mt19937 rng(20240601u);
+        for (int round = 0; round < 200000; ++round)
+        {
+            std::string input(rng() % 24, '\0');
+            for (char &c : input)
+                c = alphabet[rng() % sizeof(alphabet)];
+            for (int plus = 0; plus < 2; ++plus)
+            {
+                const bool plusAsSpace = plus != 0;
+                std::string expected;
+                std::string actual;
+                const bool expectedOk = referenceDecode(input, expected, plusAsSpace);
+                const bool actualOk = decode(input, actual, plusAsSpace);
+                check(expectedOk == actualOk && (!expectedOk || expected == actual), "differs from reference decoder", input);
+                check(findUrlSpecial(input.data(), input.size(), plusAsSpace) == referenceFind(input.data(), input.size(), plusAsSpace), "findUrlSpecial differs from reference", input);
+                if (failures > 20)
+                    return;
+            }
+        }
+    }
+
+    void reportTiming()
+    {
+        std::string path;
+        for (int i = 0; i < 64; ++i)
+            path += "/static/assets/app-bundle.min.js";
+        path += "%20";
+        const int iterations = 20000;
+        size_t sink = 0;
+        const auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            sink += findUrlSpecial(path.data(), path.size() - (i & 1), false);
+        const auto t1 = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            sink += referenceFind(path.data(), path.size() - (i & 1), false);
+        const auto t2 = std::chrono::steady_clock::now();
+        const auto swar = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+        const auto bytewise = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+        std::printf("scan %zu-byte path x%d: swar %lld us, byte loop %lld us (sink %zu)\n", path.size(), iterations,
+                    static_cast<long long>(swar), static_cast<long long>(bytewise), sink);
+    }
+} // namespace
+
+int main()
+{
+    testValidEscapes();
+    testMalformedPercent();
+    testControlBytes();
+    testPlusInPathAndQuery();
+    testInPlace();
+    testEveryOffset();
+    testAgainstReference();
+    reportTiming();
+    if (failures != 0)
+    {
+        std::printf("%d failure(s)\n", failures);
+        return 1;
+    }
+    std::printf("url decode: all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,208 @@
+#!/usr/bin/env python3
+"""Generate a C++ header that embeds a directory tree for EspHttpServer::serveStatic.
+
+The output contains one PROGMEM blob per distinct file content and a constexpr
+EmbeddedAsset table sorted by (path hash, path), so the device can look files up
+straight from flash without building an index at boot.
+"""
+
+from __future__ import annotations
+
+import argparse
+import gzip
+import io
+import pathlib
+import re
+
+# Must match kMimeTable in src/EspHttpServer.cpp (the list position is the MIME id).
+MIME_EXTENSIONS = (
+    ".avif",
+    ".css",
+    ".csv",
+    ".gif",
+    ".htm",
+    ".html",
+    ".ico",
+    ".jpeg",
+    ".jpg",
+    ".js",
+    ".json",
+    ".mjs",
+    ".mp3",
+    ".mp4",
+    ".png",
+    ".svg",
+    ".txt",
+    ".wasm",
+    ".webp",
+    ".xml",
+    ".zip",
+)
+MIME_UNKNOWN = 0xFF
+
+# Extensions worth compressing when --gzip is given.
+COMPRESSIBLE = {".css", ".csv", ".htm", ".html", ".js", ".json", ".mjs", ".svg", ".txt", ".wasm", ".xml"}
+
+FNV_OFFSET = 0x811C9DC5
+FNV_PRIME = 0x01000193
+
+
+def parse_args() -> argparse.Namespace:
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("input", type=pathlib.Path, help="Directory to embed.")
+    parser.add_argument("output", type=pathlib.Path, help="Header file to write.")
+    parser.add_argument(
+        "--name",
+        default="web",
+        help="Symbol prefix for the generated arrays (default: web).",
+    )
+    parser.add_argument(
+        "--gzip",
+        action="store_true",
+        help="Add a .gz sibling for compressible files when it is smaller.",
+    )
+    parser.add_argument(
+        "--drop-plain",
+        action="store_true",
+        help="With --gzip, keep only the .gz entry for compressed files.",
+    )
+    return parser.parse_args()
+
+
+def fnv1a(data: bytes) -> int:
+    value = FNV_OFFSET
+    for byte in data:
+        value ^= byte
+        value = (value * FNV_PRIME) & 0xFFFFFFFF
+    return value
+
+
+def mime_id(path: str) -> int:
+    lower = path.lower()
+    if lower.endswith(".gz"):
+        lower = lower[:-3]
+    for index, extension in enumerate(MIME_EXTENSIONS):
+        if lower.endswith(extension):
+            return index
+    return MIME_UNKNOWN
+
+
+def deterministic_gzip(data: bytes) -> bytes:
+    buffer = io.BytesIO()
+    with gzip.GzipFile(filename="", mode="wb", fileobj=buffer, compresslevel=9, mtime=0) as stream:
+        stream.write(data)
+    return buffer.getvalue()
+
+
+def collect_files(root: pathlib.Path) -> list[tuple[str, bytes]]:
+    files: list[tuple[str, bytes]] = []
+    for path in sorted(root.rglob("*")):
+        rel = path.relative_to(root)
+        if not path.is_file() or any(part.startswith(".") for part in rel.parts):
+            continue
+        files.append(("/" + rel.as_posix(), path.read_bytes()))
+    return files
+
+
+def build_entries(files: list[tuple[str, bytes]], use_gzip: bool, drop_plain: bool) -> list[dict]:
+    existing = {path for path, _ in files}
+    entries: list[dict] = []
+    for path, data in files:
+        encoding = 1 if path.endswith(".gz") else 0
+        compressed = None
+        extension = pathlib.PurePosixPath(path).suffix.lower()
+        if use_gzip and not encoding and extension in COMPRESSIBLE and path + ".gz" not in existing:
+            candidate = deterministic_gzip(data)
+            if len(candidate) < len(data):
+                compressed = candidate
+        if compressed is None or not drop_plain:
+            entries.append({"path": path, "data": data, "encoding": encoding})
+        if compressed is not None:
+            entries.append({"path": path + ".gz", "data": compressed, "encoding": 1})
+    for entry in entries:
+        entry["path_hash"] = fnv1a(entry["path"].encode("utf-8"))
+        entry["content_hash"] = fnv1a(entry["data"])
+        entry["mime_id"] = mime_id(entry["path"])
+    entries.sort(key=lambda entry: (entry["path_hash"], entry["path"].encode("utf-8")))
+    positions = {entry["path"]: index for index, entry in enumerate(entries)}
+    for entry in entries:
+        entry["gz_sibling"] = -1 if entry["encoding"] else positions.get(entry["path"] + ".gz", -1)
+    if len(entries) > 0x7FFF:
+        raise ValueError("too many assets for int16_t gz sibling links")
+    return entries
+
+
+def c_string(text: str) -> str:
+    escaped = text.replace("\\", "\\\\").replace('"', '\\"')
+    return f'"{escaped}"'
+
+
+def format_blob(symbol: str, data: bytes) -> list[str]:
+    lines = [f"alignas(4) const uint8_t {symbol}[] PROGMEM = {{"]
+    for offset in range(0, len(data), 16):
+        chunk = ", ".join(f"0x{byte:02x}" for byte in data[offset:offset + 16])
+        lines.append(f"    {chunk},")
+    if not data:
+        lines.append("    0x00,")
+    lines.append("};")
+    return lines
+
+
+def render_header(prefix: str, entries: list[dict]) -> str:
+    blobs: dict[bytes, str] = {}
+    out: list[str] = [
+        "/* Auto-generated by tools/embed_assets.py - do not edit manually */",
+        "#pragma once",
+        "",
+        "#include <EspHttpServer.h>",
+        "",
+    ]
+    for entry in entries:
+        data = entry["data"]
+        if data in blobs:
+            continue
+        symbol = f"{prefix}_blob_{len(blobs)}"
+        blobs[data] = symbol
+        out.extend(format_blob(symbol, data))
+        out.append("")
+
+    out.append(f"constexpr EspHttpServer::EmbeddedAsset {prefix}_assets[] = {{")
+    for entry in entries:
+        etag = c_string(f'"{entry["content_hash"]:08x}"')
+        out.append(
+            "    {"
+            f"0x{entry['path_hash']:08x}u, {c_string(entry['path'])}, {blobs[entry['data']]}, "
+            f"{len(entry['data'])}u, {entry['mime_id']}, {entry['encoding']}, {entry['gz_sibling']}, "
+            f"0x{entry['content_hash']:08x}u, {etag}"
+            "},"
+        )
+    out.append("};")
+    out.append("")
+    out.append(
+        f"constexpr EspHttpServer::EmbeddedAssetIndex {prefix}_index = "
+        f"{{{prefix}_assets, sizeof({prefix}_assets) / sizeof({prefix}_assets[0])}};"
+    )
+    out.append("")
+    return "\n".join(out)
+
+
+def main() -> None:
+    args = parse_args()
+    if not re.match(r"^[A-Za-z_][A-Za-z0-9_]*$", args.name):
+        raise SystemExit(f"invalid symbol prefix: {args.name}")
+    if not args.input.is_dir():
+        raise SystemExit(f"input directory not found: {args.input}")
+    files = collect_files(args.input)
+    if not files:
+        raise SystemExit(f"no files found under {args.input}")
+    entries = build_entries(files, args.gzip, args.drop_plain)
+    header = render_header(args.name, entries)
+    args.output.parent.mkdir(parents=True, exist_ok=True)
+    args.output.write_text(header, encoding="utf-8")
+    unique = len({entry["data"] for entry in entries})
+    total = sum(len(data) for data in {entry["data"] for entry in entries})
+    print(f"{args.output}: {len(entries)} assets, {unique} blobs, {total} bytes")
+
+
+if __name__ == "__main__":
+    main()